@@ -38,6 +38,7 @@
 #include "hw/audiodev.h"
 #include "kvm.h"
 #include "migration.h"
+#include "balloon.h"
 #include "net.h"
 #include "gdbstub.h"
 #include "hw/smbios.h"
@@ -299,6 +300,7 @@ int ram_save_live(QEMUFile *f, int stage, void *opaque)
     int ret;
 
     if (stage < 0) {
+        qemu_balloon_free_page_done();
         memory_global_dirty_log_stop();
         return 0;
     }
@@ -324,6 +326,9 @@ int ram_save_live(QEMUFile *f, int stage, void *opaque)
 
         memory_global_dirty_log_start();
 
+        /* Pages the guest reports as free from now on need not be sent */
+        qemu_balloon_free_page_start();
+
         qemu_put_be64(f, ram_bytes_total() | RAM_SAVE_FLAG_MEM_SIZE);
 
         QLIST_FOREACH(block, &ram_list.blocks, next) {
@@ -363,6 +368,8 @@ int ram_save_live(QEMUFile *f, int stage, void *opaque)
     if (stage == 3) {
         int bytes_sent;
 
+        qemu_balloon_free_page_done();
+
         /* flush all remaining blocks regardless of rate limiting */
         while ((bytes_sent = ram_save_block(f)) != 0) {
             bytes_transferred += bytes_sent;
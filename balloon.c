@@ -34,6 +34,8 @@
 static QEMUBalloonEvent *balloon_event_fn;
 static QEMUBalloonStatus *balloon_stat_fn;
 static void *balloon_opaque;
+static QEMUBalloonFreePageHint *balloon_hint_fn;
+static void *balloon_hint_opaque;
 
 int qemu_add_balloon_handler(QEMUBalloonEvent *event_func,
                              QEMUBalloonStatus *stat_func, void *opaque)
@@ -59,6 +61,36 @@ void qemu_remove_balloon_handler(void *opaque)
     balloon_event_fn = NULL;
     balloon_stat_fn = NULL;
     balloon_opaque = NULL;
+    if (balloon_hint_opaque == opaque) {
+        balloon_hint_fn = NULL;
+        balloon_hint_opaque = NULL;
+    }
+}
+
+int qemu_add_balloon_free_page_handler(QEMUBalloonFreePageHint *hint_func,
+                                       void *opaque)
+{
+    if (balloon_hint_fn) {
+        error_report("Another free page hinting device already registered");
+        return -1;
+    }
+    balloon_hint_fn = hint_func;
+    balloon_hint_opaque = opaque;
+    return 0;
+}
+
+void qemu_balloon_free_page_start(void)
+{
+    if (balloon_hint_fn) {
+        balloon_hint_fn(balloon_hint_opaque, true);
+    }
+}
+
+void qemu_balloon_free_page_done(void)
+{
+    if (balloon_hint_fn) {
+        balloon_hint_fn(balloon_hint_opaque, false);
+    }
 }
 
 static int qemu_balloon(ram_addr_t target)
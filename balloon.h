@@ -19,9 +19,18 @@
 
 typedef void (QEMUBalloonEvent)(void *opaque, ram_addr_t target);
 typedef void (QEMUBalloonStatus)(void *opaque, BalloonInfo *info);
+typedef void (QEMUBalloonFreePageHint)(void *opaque, bool start);
 
 int qemu_add_balloon_handler(QEMUBalloonEvent *event_func,
 			     QEMUBalloonStatus *stat_func, void *opaque);
 void qemu_remove_balloon_handler(void *opaque);
 
+/* Free page hinting: between start and done, the balloon may clear the
+ * migration dirty bits of pages that the guest reports as free.
+ */
+int qemu_add_balloon_free_page_handler(QEMUBalloonFreePageHint *hint_func,
+                                       void *opaque);
+void qemu_balloon_free_page_start(void);
+void qemu_balloon_free_page_done(void);
+
 #endif
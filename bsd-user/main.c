@@ -37,6 +37,8 @@
 #define DEBUG_LOGFILE "/tmp/qemu.log"
 
 int singlestep;
+unsigned int tb_hot_threshold;
+const char *tb_cache_path;
 #if defined(CONFIG_USE_GUEST_BASE)
 unsigned long mmap_min_addr;
 unsigned long guest_base;
@@ -695,6 +697,7 @@ static void usage(void)
            "-D logfile   override default logfile location\n"
            "-p pagesize  set the host page size to 'pagesize'\n"
            "-singlestep  always run in singlestep mode\n"
+           "-tb-cache file  reuse translated code saved in file by earlier runs\n"
            "-strace      log system calls\n"
            "\n"
            "Environment variables:\n"
@@ -852,6 +855,8 @@ int main(int argc, char **argv)
             optind++;
         } else if (!strcmp(r, "singlestep")) {
             singlestep = 1;
+        } else if (!strcmp(r, "tb-cache")) {
+            tb_cache_path = argv[optind++];
         } else if (!strcmp(r, "strace")) {
             do_strace = 1;
         } else
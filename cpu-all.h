@@ -497,6 +497,8 @@ typedef struct RAMBlock {
 #if defined(__linux__) && !defined(TARGET_S390X)
     int fd;
 #endif
+    /* One per guest NUMA node, for RAM placed with qemu_ram_alloc_numa */
+    struct RAMNodeSlice *node_slices;
 } RAMBlock;
 
 typedef struct RAMList {
@@ -220,6 +220,8 @@ typedef struct CPUWatchpoint {
     CPU_COMMON_THREAD                                                   \
     struct QemuCond *halt_cond;                                         \
     int thread_kicked;                                                  \
+    int64_t halt_poll_ns; /* current halt polling window */            \
+    uint64_t halt_poll_hits, halt_poll_misses;                          \
     struct qemu_work_item *queued_work_first, *queued_work_last;        \
     const char *cpu_model_str;                                          \
     struct KVMState *kvm_state;                                         \
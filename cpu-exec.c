@@ -80,6 +80,24 @@ static void cpu_exec_nocache(CPUArchState *env, int max_cycles,
     tb_free(tb);
 }
 
+/* Replace a hot TB by a superblock starting at the same pc.  The
+   frontend keeps translating through direct jumps, so the optimizer
+   sees the whole path instead of one basic block at a time.  */
+static void cpu_exec_superblock(CPUArchState *env, TranslationBlock *orig_tb)
+{
+    target_ulong pc, cs_base;
+    uint64_t flags;
+
+    pc = orig_tb->pc;
+    cs_base = orig_tb->cs_base;
+    flags = orig_tb->flags;
+
+    spin_lock(&tb_lock);
+    tb_phys_invalidate(orig_tb, -1);
+    tb_gen_code(env, pc, cs_base, flags, CF_SUPERBLOCK);
+    spin_unlock(&tb_lock);
+}
+
 static TranslationBlock *tb_find_slow(CPUArchState *env,
                                       target_ulong pc,
                                       target_ulong cs_base,
@@ -154,6 +172,31 @@ static inline TranslationBlock *tb_find_fast(CPUArchState *env)
     return tb;
 }
 
+/* Called by generated code after an indirect branch.  Return the host
+   code of the TB matching the current CPU state if it is in the jump
+   cache, so that the caller can jump to it without going through the
+   main loop.  NULL means the main loop must run, either because of a
+   cache miss or because an interrupt or exit request is pending.  */
+void *helper_lookup_tb_ptr(CPUArchState *env)
+{
+    TranslationBlock *tb;
+    target_ulong cs_base, pc;
+    int flags;
+
+    if (unlikely(env->interrupt_request || env->exit_request)) {
+        return NULL;
+    }
+    cpu_get_tb_cpu_state(env, &pc, &cs_base, &flags);
+    tb = env->tb_jmp_cache[tb_jmp_cache_hash_func(pc)];
+    if (unlikely(!tb || tb->pc != pc || tb->cs_base != cs_base ||
+                 tb->flags != flags)) {
+        return NULL;
+    }
+    /* keep cpu_unlink_tb() able to break loops through this TB */
+    env->current_tb = tb;
+    return tb->tc_ptr;
+}
+
 static CPUDebugExcpHandler *debug_excp_handler;
 
 CPUDebugExcpHandler *cpu_set_debug_excp_handler(CPUDebugExcpHandler *handler)
@@ -589,6 +632,13 @@ int cpu_exec(CPUArchState *env)
                             next_tb = 0;
                             cpu_loop_exit(env);
                         }
+                    } else if ((next_tb & 3) == 3) {
+                        /* Hot block counter expired.  */
+                        tb = (TranslationBlock *)(next_tb & ~3);
+                        /* Restore PC.  */
+                        cpu_pc_from_tb(env, tb);
+                        cpu_exec_superblock(env, tb);
+                        next_tb = 0;
                     }
                 }
                 env->current_tb = NULL;
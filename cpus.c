@@ -33,6 +33,7 @@
 #include "qmp-commands.h"
 
 #include "qemu-thread.h"
+#include "qemu-barrier.h"
 #include "cpus.h"
 #include "qtest.h"
 #include "main-loop.h"
@@ -695,15 +696,79 @@ static void qemu_wait_io_event_common(CPUArchState *env)
     env->thread_kicked = false;
 }
 
+/* Smallest useful halt polling window; shorter ones are rounded to 0 */
+#define HALT_POLL_NS_MIN 10000
+
+/*
+ * Spin for up to env->halt_poll_ns, with the global mutex released, until
+ * @is_idle(env) turns false.  Returns true if it did, in which case the
+ * caller need not sleep.
+ */
+static bool qemu_halt_poll(CPUArchState *env, bool (*is_idle)(CPUArchState *))
+{
+    int64_t start, now;
+    bool idle;
+
+    if (!env->halt_poll_ns || !runstate_is_running()) {
+        return false;
+    }
+
+    start = get_clock();
+    qemu_mutex_unlock(&qemu_global_mutex);
+    do {
+        /* Racy, but an interrupt seen late only costs a sleep */
+        barrier();
+        idle = is_idle(env);
+        now = get_clock();
+    } while (idle && now - start < env->halt_poll_ns);
+    qemu_mutex_lock(&qemu_global_mutex);
+
+    if (is_idle(env)) {
+        env->halt_poll_misses++;
+        return false;
+    }
+    env->halt_poll_hits++;
+    return true;
+}
+
+/* Adapt the polling window to a halt that lasted @block_ns in total. */
+static void qemu_halt_poll_update(CPUArchState *env, int64_t block_ns)
+{
+    if (block_ns > halt_poll_max_ns) {
+        /* Polling could not have helped */
+        env->halt_poll_ns /= 2;
+        if (env->halt_poll_ns < HALT_POLL_NS_MIN) {
+            env->halt_poll_ns = 0;
+        }
+    } else if (block_ns > env->halt_poll_ns) {
+        /* A longer window would have caught the wakeup */
+        env->halt_poll_ns = MAX(env->halt_poll_ns * 2, HALT_POLL_NS_MIN);
+        env->halt_poll_ns = MIN(env->halt_poll_ns, halt_poll_max_ns);
+    }
+}
+
+static bool tcg_cpus_idle(CPUArchState *env)
+{
+    return all_cpu_threads_idle();
+}
+
 static void qemu_tcg_wait_io_event(void)
 {
     CPUArchState *env;
 
-    while (all_cpu_threads_idle()) {
-       /* Start accounting real time to the virtual clock if the CPUs
-          are idle.  */
-        qemu_clock_warp(vm_clock);
-        qemu_cond_wait(tcg_halt_cond, &qemu_global_mutex);
+    /* All CPUs are run by this thread and share first_cpu's window */
+    if (all_cpu_threads_idle()) {
+        int64_t start = get_clock();
+
+        if (!qemu_halt_poll(first_cpu, tcg_cpus_idle)) {
+            while (all_cpu_threads_idle()) {
+                /* Start accounting real time to the virtual clock if the CPUs
+                   are idle.  */
+                qemu_clock_warp(vm_clock);
+                qemu_cond_wait(tcg_halt_cond, &qemu_global_mutex);
+            }
+            qemu_halt_poll_update(first_cpu, get_clock() - start);
+        }
     }
 
     while (iothread_requesting_mutex) {
@@ -717,8 +782,16 @@ static void qemu_tcg_wait_io_event(void)
 
 static void qemu_kvm_wait_io_event(CPUArchState *env)
 {
-    while (cpu_thread_is_idle(env)) {
-        qemu_cond_wait(env->halt_cond, &qemu_global_mutex);
+    /* Only reached with a userspace irqchip; otherwise KVM waits for us */
+    if (cpu_thread_is_idle(env)) {
+        int64_t start = get_clock();
+
+        if (!qemu_halt_poll(env, cpu_thread_is_idle)) {
+            while (cpu_thread_is_idle(env)) {
+                qemu_cond_wait(env->halt_cond, &qemu_global_mutex);
+            }
+            qemu_halt_poll_update(env, get_clock() - start);
+        }
     }
 
     qemu_kvm_eat_signals(env);
@@ -1199,6 +1272,16 @@ CpuInfoList *qmp_query_cpus(Error **errp)
         info->value->current = (env == first_cpu);
         info->value->halted = env->halted;
         info->value->thread_id = env->thread_id;
+        if (tcg_enabled() || (kvm_enabled() && !kvm_irqchip_in_kernel())) {
+            CPUArchState *poll_env = tcg_enabled() ? first_cpu : env;
+
+            info->value->has_halt_poll_ns = true;
+            info->value->halt_poll_ns = poll_env->halt_poll_ns;
+            info->value->has_halt_poll_hits = true;
+            info->value->halt_poll_hits = poll_env->halt_poll_hits;
+            info->value->has_halt_poll_misses = true;
+            info->value->halt_poll_misses = poll_env->halt_poll_misses;
+        }
 #if defined(TARGET_I386)
         info->value->has_pc = true;
         info->value->pc = env->eip + env->segs[R_CS].base;
@@ -14,6 +14,7 @@ void cpu_synchronize_all_post_init(void);
 void qtest_clock_warp(int64_t dest);
 
 /* vl.c */
+extern int64_t halt_poll_max_ns;
 extern int smp_cores;
 extern int smp_threads;
 void set_numa_modes(void);
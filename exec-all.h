@@ -144,9 +144,10 @@ struct TranslationBlock {
     uint64_t flags; /* flags defining in which context the code was generated */
     uint16_t size;      /* size of target code for this block (1 <=
                            size <= TARGET_PAGE_SIZE) */
-    uint16_t cflags;    /* compile flags */
+    uint32_t cflags;    /* compile flags */
 #define CF_COUNT_MASK  0x7fff
 #define CF_LAST_IO     0x8000 /* Last insn may be an IO access.  */
+#define CF_SUPERBLOCK  0x10000 /* Translation follows direct jumps.  */
 
     uint8_t *tc_ptr;    /* pointer to the translated code */
     /* next matching tb for physical address. */
@@ -171,6 +172,8 @@ struct TranslationBlock {
     struct TranslationBlock *jmp_next[2];
     struct TranslationBlock *jmp_first;
     uint32_t icount;
+    /* executions left before the block is retranslated as a superblock */
+    uint32_t hot_count;
 };
 
 static inline unsigned int tb_jmp_cache_hash_page(target_ulong pc)
@@ -361,9 +364,23 @@ CPUDebugExcpHandler *cpu_set_debug_excp_handler(CPUDebugExcpHandler *handler);
 
 /* vl.c */
 extern int singlestep;
+/* Number of executions after which a TB is retranslated as a
+   superblock.  Zero disables hot block detection.  */
+extern unsigned int tb_hot_threshold;
+/* File of the persistent TB cache, NULL if disabled.  */
+extern const char *tb_cache_path;
+
+/* tb-cache.c */
+int tb_cache_fetch(CPUArchState *env, TranslationBlock *tb,
+                   tb_page_addr_t phys_pc, int *gen_code_size_ptr);
+void tb_cache_store(CPUArchState *env, TranslationBlock *tb,
+                    tb_page_addr_t phys_pc, int gen_code_size);
+void tb_cache_save(void);
+void tb_cache_dump_info(FILE *f, fprintf_function cpu_fprintf);
 
 /* cpu-exec.c */
 extern volatile sig_atomic_t exit_request;
+void *helper_lookup_tb_ptr(CPUArchState *env);
 
 /* Deterministic execution requires that IO only be performed on the last
    instruction of a TB so that interrupts take effect immediately.  */
@@ -28,6 +28,7 @@
 ram_addr_t qemu_ram_alloc_from_ptr(ram_addr_t size, void *host,
                                    MemoryRegion *mr);
 ram_addr_t qemu_ram_alloc(ram_addr_t size, MemoryRegion *mr);
+ram_addr_t qemu_ram_alloc_numa(ram_addr_t size, MemoryRegion *mr);
 void qemu_ram_free(ram_addr_t addr);
 void qemu_ram_free_from_ptr(ram_addr_t addr);
 
@@ -118,6 +119,9 @@ static inline void cpu_physical_memory_mask_dirty_range(ram_addr_t start,
 
 void cpu_physical_memory_reset_dirty(ram_addr_t start, ram_addr_t end,
                                      int dirty_flags);
+void cpu_physical_memory_set_dirty_lebitmap(ram_addr_t start,
+                                            const unsigned long *bitmap,
+                                            uint64_t first, uint64_t nr);
 
 extern const IORangeOps memory_region_iorange_ops;
 
@@ -55,6 +55,9 @@
 #else /* !CONFIG_USER_ONLY */
 #include "xen-mapcache.h"
 #include "trace.h"
+#include "sysemu.h"
+#include "qemu-thread.h"
+#include "qmp-commands.h"
 #endif
 
 #include "cputlb.h"
@@ -101,7 +104,7 @@ spinlock_t tb_lock = SPIN_LOCK_UNLOCKED;
     __attribute__((aligned (32)))
 #endif
 
-uint8_t code_gen_prologue[1024] code_gen_section;
+uint8_t code_gen_prologue[CODE_GEN_PROLOGUE_SIZE] code_gen_section;
 static uint8_t *code_gen_buffer;
 static unsigned long code_gen_buffer_size;
 /* threshold to flush the translated code buffer */
@@ -1061,7 +1064,13 @@ TranslationBlock *tb_gen_code(CPUArchState *env,
     tb->cs_base = cs_base;
     tb->flags = flags;
     tb->cflags = cflags;
-    cpu_gen_code(env, tb, &code_gen_size);
+    tb->hot_count = tb_hot_threshold;
+    if (!tb_cache_path || !tb_cache_fetch(env, tb, phys_pc, &code_gen_size)) {
+        cpu_gen_code(env, tb, &code_gen_size);
+        if (tb_cache_path) {
+            tb_cache_store(env, tb, phys_pc, code_gen_size);
+        }
+    }
     code_gen_ptr = (void *)(((uintptr_t)code_gen_ptr + code_gen_size +
                              CODE_GEN_ALIGN - 1) & ~(CODE_GEN_ALIGN - 1));
 
@@ -1969,6 +1978,48 @@ void cpu_physical_memory_reset_dirty(ram_addr_t start, ram_addr_t end,
     cpu_tlb_reset_dirty_all(start1, length);
 }
 
+/* Mark dirty the pages starting at @start whose bits are set in a little
+ * endian bitmap, from bit @first on, for @nr bits.  The bitmap is walked
+ * a word at a time, so that clean and fully dirty words are cheap.
+ */
+void cpu_physical_memory_set_dirty_lebitmap(ram_addr_t start,
+                                            const unsigned long *bitmap,
+                                            uint64_t first, uint64_t nr)
+{
+    uint8_t *p = ram_list.phys_dirty + (start >> TARGET_PAGE_BITS);
+    uint64_t end = first + nr;
+    uint64_t i, base;
+    unsigned long c, mask;
+    int j;
+
+    for (i = first / HOST_LONG_BITS; i * HOST_LONG_BITS < end; i++) {
+        c = leul_to_cpu(bitmap[i]);
+        if (c == 0) {
+            continue;
+        }
+
+        base = i * HOST_LONG_BITS;
+        mask = ~0UL;
+        if (base < first) {
+            mask &= ~0UL << (first - base);
+        }
+        if (end - base < HOST_LONG_BITS) {
+            mask &= ~0UL >> (HOST_LONG_BITS - (end - base));
+        }
+        c &= mask;
+
+        if (c == ~0UL) {
+            memset(p + base - first, 0xff, HOST_LONG_BITS);
+            continue;
+        }
+        while (c != 0) {
+            j = ffsl(c) - 1;
+            c &= ~(1UL << j);
+            p[base + j - first] = 0xff;
+        }
+    }
+}
+
 int cpu_physical_memory_set_dirty_tracking(int enable)
 {
     int ret = 0;
@@ -2446,9 +2497,103 @@ void qemu_flush_coalesced_mmio_buffer(void)
         kvm_flush_coalesced_mmio_buffer();
 }
 
+/* -mem-prealloc: fault guest RAM in up front, so that neither startup
+ * nor the running guest pay for it one page at a time.  Most of the time
+ * goes into the kernel zeroing the pages, so the work is cut into chunks
+ * that are handed out to one thread per host CPU.
+ */
+#define RAM_PREALLOC_CHUNK       (64 * 1024 * 1024)
+#define RAM_PREALLOC_MAX_THREADS 64
+
+typedef struct RAMPrealloc {
+    uint8_t *host;
+    ram_addr_t length;
+    ram_addr_t chunk;
+    long page_size;
+    ram_addr_t next;
+    ram_addr_t done;
+} RAMPrealloc;
+
+static void *ram_prealloc_thread(void *opaque)
+{
+    RAMPrealloc *p = opaque;
+    ram_addr_t start, end, offset;
+
+    for (;;) {
+        start = __sync_fetch_and_add(&p->next, p->chunk);
+        if (start >= p->length) {
+            break;
+        }
+        end = MIN(start + p->chunk, p->length);
+
+        /* The RAM is fresh, so writing zeroes does not change it but
+         * makes the kernel allocate the pages.
+         */
+        for (offset = start; offset < end; offset += p->page_size) {
+            *(volatile uint8_t *)(p->host + offset) = 0;
+        }
+        __sync_fetch_and_add(&p->done, end - start);
+    }
+    return NULL;
+}
+
+static int ram_prealloc_max_threads(void)
+{
+#ifdef _WIN32
+    SYSTEM_INFO info;
+
+    GetSystemInfo(&info);
+    return info.dwNumberOfProcessors;
+#else
+    return sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+}
+
+static void ram_prealloc(uint8_t *host, ram_addr_t length, long page_size)
+{
+    RAMPrealloc p = {
+        .host = host,
+        .length = length,
+        .chunk = QEMU_ALIGN_UP(RAM_PREALLOC_CHUNK, page_size),
+        .page_size = page_size,
+    };
+    QemuThread threads[RAM_PREALLOC_MAX_THREADS];
+    int64_t last_print = get_clock();
+    int nr_threads, i;
+
+    nr_threads = MIN(ram_prealloc_max_threads(), RAM_PREALLOC_MAX_THREADS);
+    nr_threads = MIN(nr_threads, DIV_ROUND_UP(length, p.chunk));
+    if (nr_threads <= 1) {
+        ram_prealloc_thread(&p);
+        return;
+    }
+
+    for (i = 0; i < nr_threads; i++) {
+        qemu_thread_create(&threads[i], ram_prealloc_thread, &p,
+                           QEMU_THREAD_JOINABLE);
+    }
+
+    /* Large guests take a while, so tell the user what is going on */
+    while (*(volatile ram_addr_t *)&p.done < length) {
+        g_usleep(100 * 1000);
+        if (get_clock() - last_print >= 2 * get_ticks_per_sec()) {
+            fprintf(stderr, "preallocating guest RAM: %" PRIu64 "%% of %"
+                    PRIu64 " MB\n", (uint64_t)p.done * 100 / length,
+                    (uint64_t)length >> 20);
+            last_print = get_clock();
+        }
+    }
+
+    for (i = 0; i < nr_threads; i++) {
+        qemu_thread_join(&threads[i]);
+    }
+}
+
 #if defined(__linux__) && !defined(TARGET_S390X)
 
 #include <sys/vfs.h>
+#include <sys/syscall.h>
+#include <linux/mempolicy.h>
 
 #define HUGETLBFS_MAGIC       0x958458f6
 
@@ -2472,47 +2617,30 @@ static long gethugepagesize(const char *path)
     return fs.f_bsize;
 }
 
-static void *file_ram_alloc(RAMBlock *block,
-                            ram_addr_t memory,
-                            const char *path)
+/* Create an unlinked file of @memory bytes in @path to back guest RAM. */
+static int file_ram_open(const char *path, ram_addr_t memory)
 {
     char *filename;
-    void *area;
     int fd;
-#ifdef MAP_POPULATE
-    int flags;
-#endif
-    unsigned long hpagesize;
-
-    hpagesize = gethugepagesize(path);
-    if (!hpagesize) {
-        return NULL;
-    }
-
-    if (memory < hpagesize) {
-        return NULL;
-    }
 
     if (kvm_enabled() && !kvm_has_sync_mmu()) {
         fprintf(stderr, "host lacks kvm mmu notifiers, -mem-path unsupported\n");
-        return NULL;
+        return -1;
     }
 
     if (asprintf(&filename, "%s/qemu_back_mem.XXXXXX", path) == -1) {
-        return NULL;
+        return -1;
     }
 
     fd = mkstemp(filename);
     if (fd < 0) {
         perror("unable to create backing store for hugepages");
         free(filename);
-        return NULL;
+        return -1;
     }
     unlink(filename);
     free(filename);
 
-    memory = (memory+hpagesize-1) & ~(hpagesize-1);
-
     /*
      * ftruncate is not supported by hugetlbfs in older
      * hosts, so don't bother bailing out on errors.
@@ -2522,24 +2650,340 @@ static void *file_ram_alloc(RAMBlock *block,
     if (ftruncate(fd, memory))
         perror("ftruncate");
 
-#ifdef MAP_POPULATE
-    /* NB: MAP_POPULATE won't exhaustively alloc all phys pages in the case
-     * MAP_PRIVATE is requested.  For mem_prealloc we mmap as MAP_SHARED
-     * to sidestep this quirk.
+    return fd;
+}
+
+static void *file_ram_alloc(RAMBlock *block,
+                            ram_addr_t memory,
+                            const char *path)
+{
+    void *area;
+    int fd;
+    unsigned long hpagesize;
+
+    hpagesize = gethugepagesize(path);
+    if (!hpagesize) {
+        return NULL;
+    }
+
+    if (memory < hpagesize) {
+        return NULL;
+    }
+
+    memory = (memory+hpagesize-1) & ~(hpagesize-1);
+
+    fd = file_ram_open(path, memory);
+    if (fd < 0) {
+        return NULL;
+    }
+
+    /* For mem_prealloc we mmap as MAP_SHARED, so that the pages are
+     * allocated in the file and not just copied on write to anonymous
+     * memory.
      */
-    flags = mem_prealloc ? MAP_POPULATE | MAP_SHARED : MAP_PRIVATE;
-    area = mmap(0, memory, PROT_READ | PROT_WRITE, flags, fd, 0);
-#else
-    area = mmap(0, memory, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
-#endif
+    area = mmap(0, memory, PROT_READ | PROT_WRITE,
+                mem_prealloc ? MAP_SHARED : MAP_PRIVATE, fd, 0);
     if (area == MAP_FAILED) {
         perror("file_ram_alloc: can't mmap RAM pages");
         close(fd);
         return (NULL);
     }
+    if (mem_prealloc) {
+        ram_prealloc(area, memory, hpagesize);
+    }
     block->fd = fd;
     return area;
 }
+
+/* Guest RAM allocated with qemu_ram_alloc_numa is made of one slice per
+ * guest node, laid out in node order like the guest sees it.  Each slice
+ * is a separate mapping (anonymous, or a file in the node's -mem-path)
+ * with its own host memory policy.
+ */
+typedef struct RAMNodeSlice {
+    uint8_t *host;
+    ram_addr_t offset;
+    ram_addr_t length;
+    ram_addr_t map_length;
+    long page_size;
+    const char *path;
+    int fd;
+    int node;
+} RAMNodeSlice;
+
+/* Large enough for transparent huge pages */
+#define NUMA_RAM_ALIGN (2 * 1024 * 1024)
+
+static void numa_ram_bind(RAMNodeSlice *slice)
+{
+    static const int modes[NUMA_MEM_POLICY_MAX] = {
+        [NUMA_MEM_POLICY_DEFAULT] = MPOL_DEFAULT,
+        [NUMA_MEM_POLICY_PREFERRED] = MPOL_PREFERRED,
+        [NUMA_MEM_POLICY_BIND] = MPOL_BIND,
+        [NUMA_MEM_POLICY_INTERLEAVE] = MPOL_INTERLEAVE,
+    };
+    const int bits_per_long = sizeof(unsigned long) * 8;
+    unsigned long mask[64 / (sizeof(unsigned long) * 8)];
+    int node = slice->node;
+    int i;
+
+    if (node_mem_policy[node] == NUMA_MEM_POLICY_DEFAULT) {
+        return;
+    }
+
+    memset(mask, 0, sizeof(mask));
+    for (i = 0; i < 64; i++) {
+        if (node_host_nodes[node] & (1ULL << i)) {
+            mask[i / bits_per_long] |= 1UL << (i % bits_per_long);
+        }
+    }
+
+    /* The kernel wants the number of bits plus one */
+    if (syscall(SYS_mbind, slice->host, slice->map_length,
+                modes[node_mem_policy[node]], mask, 64 + 1,
+                MPOL_MF_STRICT | MPOL_MF_MOVE)) {
+        fprintf(stderr, "numa node %d: can't bind RAM to host nodes: %s\n",
+                node, strerror(errno));
+        exit(1);
+    }
+}
+
+static void *numa_ram_map(RAMNodeSlice *slice, ram_addr_t offset,
+                          ram_addr_t length)
+{
+    void *area;
+
+    if (slice->fd >= 0) {
+        /* See file_ram_alloc about MAP_SHARED */
+        area = mmap(slice->host + offset, length, PROT_READ | PROT_WRITE,
+                    MAP_FIXED | (mem_prealloc ? MAP_SHARED : MAP_PRIVATE),
+                    slice->fd, offset);
+    } else {
+        area = mmap(slice->host + offset, length, PROT_READ | PROT_WRITE,
+                    MAP_FIXED | MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    }
+    if (area == MAP_FAILED) {
+        return NULL;
+    }
+    if (slice->fd < 0) {
+        qemu_madvise(area, length, QEMU_MADV_MERGEABLE);
+    }
+    return area;
+}
+
+static void *numa_ram_alloc(RAMBlock *block, ram_addr_t size)
+{
+    RAMNodeSlice *slices = g_new0(RAMNodeSlice, nb_numa_nodes);
+    ram_addr_t offset = 0, total = 0;
+    long align = NUMA_RAM_ALIGN;
+    uint8_t *reserved, *area;
+    int i;
+
+    for (i = 0; i < nb_numa_nodes; i++) {
+        RAMNodeSlice *slice = &slices[i];
+        const char *path = node_mem_path[i] ? node_mem_path[i] : mem_path;
+
+        slice->node = i;
+        slice->fd = -1;
+        slice->offset = offset;
+        slice->length = i == nb_numa_nodes - 1 ? size - offset
+                                                : MIN(node_mem[i], size - offset);
+        slice->page_size = getpagesize();
+        slice->map_length = slice->length;
+        offset += slice->length;
+
+        if (!path || !slice->length) {
+            continue;
+        }
+        slice->page_size = gethugepagesize(path);
+        if (!slice->page_size) {
+            slice->page_size = getpagesize();
+            continue;
+        }
+        if ((slice->offset & (slice->page_size - 1)) ||
+            (i < nb_numa_nodes - 1 &&
+             (slice->length & (slice->page_size - 1)))) {
+            fprintf(stderr, "numa node %d: RAM is not aligned to the %ld "
+                    "bytes pages of %s, not using it\n",
+                    i, slice->page_size, path);
+            slice->page_size = getpagesize();
+            continue;
+        }
+        slice->map_length = QEMU_ALIGN_UP(slice->length, slice->page_size);
+        slice->fd = file_ram_open(path, slice->map_length);
+        if (slice->fd < 0) {
+            slice->page_size = getpagesize();
+            slice->map_length = slice->length;
+            continue;
+        }
+        slice->path = path;
+        align = MAX(align, slice->page_size);
+    }
+    total = slices[nb_numa_nodes - 1].offset +
+            slices[nb_numa_nodes - 1].map_length;
+
+    /* Reserve the whole range first, so that the slices end up next to
+     * each other and suitably aligned for the largest page size.
+     */
+    reserved = mmap(0, total + align, PROT_NONE,
+                    MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (reserved == MAP_FAILED) {
+        perror("numa_ram_alloc: can't reserve address space");
+        exit(1);
+    }
+    area = (uint8_t *)QEMU_ALIGN_UP((uintptr_t)reserved, align);
+    if (area > reserved) {
+        munmap(reserved, area - reserved);
+    }
+    munmap(area + total, reserved + align - area);
+
+    for (i = 0; i < nb_numa_nodes; i++) {
+        RAMNodeSlice *slice = &slices[i];
+
+        slice->host = area + slice->offset;
+        if (!slice->map_length) {
+            continue;
+        }
+        if (!numa_ram_map(slice, 0, slice->map_length)) {
+            perror("numa_ram_alloc: can't mmap RAM pages");
+            exit(1);
+        }
+        numa_ram_bind(slice);
+    }
+
+    /* Only now that the slices are bound, so that the pages are
+     * allocated on the right nodes
+     */
+    if (mem_prealloc) {
+        for (i = 0; i < nb_numa_nodes; i++) {
+            if (slices[i].length) {
+                ram_prealloc(slices[i].host, slices[i].length,
+                             slices[i].page_size);
+            }
+        }
+    }
+
+    block->node_slices = slices;
+    return area;
+}
+
+static void numa_ram_free(RAMBlock *block)
+{
+    int i;
+
+    for (i = 0; i < nb_numa_nodes; i++) {
+        RAMNodeSlice *slice = &block->node_slices[i];
+
+        if (slice->map_length) {
+            munmap(slice->host, slice->map_length);
+        }
+        if (slice->fd >= 0) {
+            close(slice->fd);
+        }
+    }
+    g_free(block->node_slices);
+}
+
+static RAMNodeSlice *numa_ram_find_slice(RAMBlock *block, ram_addr_t offset)
+{
+    int i;
+
+    for (i = 0; i < nb_numa_nodes - 1; i++) {
+        if (offset - block->node_slices[i].offset <
+            block->node_slices[i].length) {
+            break;
+        }
+    }
+    return &block->node_slices[i];
+}
+
+static void *numa_ram_remap(RAMBlock *block, ram_addr_t offset,
+                            ram_addr_t length)
+{
+    RAMNodeSlice *slice = numa_ram_find_slice(block, offset);
+    uint8_t *area;
+
+    area = numa_ram_map(slice, offset - slice->offset, length);
+    if (area) {
+        RAMNodeSlice part = *slice;
+
+        part.host = area;
+        part.map_length = length;
+        numa_ram_bind(&part);
+    }
+    return area;
+}
+
+/* Estimate where the touched pages of @slice live by asking the kernel
+ * about a sample of them.
+ */
+#define NUMA_RAM_USAGE_SAMPLES 1024
+
+static NumaHostNodeUsageList *numa_ram_usage(RAMNodeSlice *slice)
+{
+    NumaHostNodeUsageList *head = NULL, **tail = &head;
+    void *pages[NUMA_RAM_USAGE_SAMPLES];
+    int status[NUMA_RAM_USAGE_SAMPLES];
+    uint64_t *bytes;
+    ram_addr_t stride, offset;
+    int i, n = 0, max_node = -1;
+
+    if (!slice->length) {
+        return NULL;
+    }
+    stride = QEMU_ALIGN_UP(slice->length / NUMA_RAM_USAGE_SAMPLES + 1,
+                           slice->page_size);
+    for (offset = 0; offset < slice->length; offset += stride) {
+        pages[n++] = slice->host + offset;
+    }
+    if (syscall(SYS_move_pages, 0, (unsigned long)n, pages, NULL, status, 0)) {
+        return NULL;
+    }
+
+    for (i = 0; i < n; i++) {
+        max_node = MAX(max_node, status[i]);
+    }
+    bytes = g_new0(uint64_t, max_node + 1);
+    for (i = 0; i < n; i++) {
+        if (status[i] >= 0) {
+            bytes[status[i]] += MIN(stride, slice->length - i * stride);
+        }
+    }
+    for (i = 0; i <= max_node; i++) {
+        NumaHostNodeUsageList *entry;
+
+        if (!bytes[i]) {
+            continue;
+        }
+        entry = g_malloc0(sizeof(*entry));
+        entry->value = g_malloc0(sizeof(*entry->value));
+        entry->value->host_node = i;
+        entry->value->bytes = bytes[i];
+        *tail = entry;
+        tail = &entry->next;
+    }
+    g_free(bytes);
+    return head;
+}
+#else
+static void *numa_ram_alloc(RAMBlock *block, ram_addr_t size)
+{
+    void *host;
+    int i;
+
+    for (i = 0; i < nb_numa_nodes; i++) {
+        if (node_host_nodes[i] || node_mem_path[i]) {
+            fprintf(stderr, "-numa host placement unsupported\n");
+            exit(1);
+        }
+    }
+    host = qemu_vmalloc(size);
+    qemu_madvise(host, size, QEMU_MADV_MERGEABLE);
+    if (mem_prealloc) {
+        ram_prealloc(host, size, getpagesize());
+    }
+    return host;
+}
 #endif
 
 static ram_addr_t find_ram_offset(ram_addr_t size)
@@ -2618,8 +3062,8 @@ void qemu_ram_set_idstr(ram_addr_t addr, const char *name, DeviceState *dev)
     }
 }
 
-ram_addr_t qemu_ram_alloc_from_ptr(ram_addr_t size, void *host,
-                                   MemoryRegion *mr)
+static ram_addr_t ram_block_add(ram_addr_t size, void *host,
+                                MemoryRegion *mr, bool numa)
 {
     RAMBlock *new_block;
 
@@ -2631,6 +3075,8 @@ ram_addr_t qemu_ram_alloc_from_ptr(ram_addr_t size, void *host,
     if (host) {
         new_block->host = host;
         new_block->flags |= RAM_PREALLOC_MASK;
+    } else if (numa && nb_numa_nodes > 0 && !xen_enabled()) {
+        new_block->host = numa_ram_alloc(new_block, size);
     } else {
         if (mem_path) {
 #if defined (__linux__) && !defined(TARGET_S390X)
@@ -2638,6 +3084,9 @@ ram_addr_t qemu_ram_alloc_from_ptr(ram_addr_t size, void *host,
             if (!new_block->host) {
                 new_block->host = qemu_vmalloc(size);
                 qemu_madvise(new_block->host, size, QEMU_MADV_MERGEABLE);
+                if (mem_prealloc) {
+                    ram_prealloc(new_block->host, size, getpagesize());
+                }
             }
 #else
             fprintf(stderr, "-mem-path option unsupported\n");
@@ -2665,6 +3114,9 @@ ram_addr_t qemu_ram_alloc_from_ptr(ram_addr_t size, void *host,
             }
 #endif
             qemu_madvise(new_block->host, size, QEMU_MADV_MERGEABLE);
+            if (mem_prealloc && new_block->host) {
+                ram_prealloc(new_block->host, size, getpagesize());
+            }
         }
     }
     new_block->length = size;
@@ -2682,9 +3134,24 @@ ram_addr_t qemu_ram_alloc_from_ptr(ram_addr_t size, void *host,
     return new_block->offset;
 }
 
+ram_addr_t qemu_ram_alloc_from_ptr(ram_addr_t size, void *host,
+                                   MemoryRegion *mr)
+{
+    return ram_block_add(size, host, mr, false);
+}
+
 ram_addr_t qemu_ram_alloc(ram_addr_t size, MemoryRegion *mr)
 {
-    return qemu_ram_alloc_from_ptr(size, NULL, mr);
+    return ram_block_add(size, NULL, mr, false);
+}
+
+/* Allocate guest RAM that is split between the guest NUMA nodes in the
+ * order and sizes given by node_mem, and placed on the host as requested
+ * with -numa.
+ */
+ram_addr_t qemu_ram_alloc_numa(ram_addr_t size, MemoryRegion *mr)
+{
+    return ram_block_add(size, NULL, mr, true);
 }
 
 void qemu_ram_free_from_ptr(ram_addr_t addr)
@@ -2709,6 +3176,10 @@ void qemu_ram_free(ram_addr_t addr)
             QLIST_REMOVE(block, next);
             if (block->flags & RAM_PREALLOC_MASK) {
                 ;
+#if defined(__linux__) && !defined(TARGET_S390X)
+            } else if (block->node_slices) {
+                numa_ram_free(block);
+#endif
             } else if (mem_path) {
 #if defined (__linux__) && !defined(TARGET_S390X)
                 if (block->fd) {
@@ -2744,26 +3215,39 @@ void qemu_ram_remap(ram_addr_t addr, ram_addr_t length)
     RAMBlock *block;
     ram_addr_t offset;
     int flags;
+    long page_size;
     void *area, *vaddr;
 
     QLIST_FOREACH(block, &ram_list.blocks, next) {
         offset = addr - block->offset;
         if (offset < block->length) {
             vaddr = block->host + offset;
+            page_size = getpagesize();
             if (block->flags & RAM_PREALLOC_MASK) {
                 ;
+#if defined(__linux__) && !defined(TARGET_S390X)
+            } else if (block->node_slices) {
+                munmap(vaddr, length);
+                if (numa_ram_remap(block, offset, length) != vaddr) {
+                    fprintf(stderr, "Could not remap addr: "
+                            RAM_ADDR_FMT "@" RAM_ADDR_FMT "\n",
+                            length, addr);
+                    exit(1);
+                }
+                if (mem_prealloc) {
+                    page_size = numa_ram_find_slice(block, offset)->page_size;
+                    ram_prealloc(vaddr, length, page_size);
+                }
+#endif
             } else {
                 flags = MAP_FIXED;
                 munmap(vaddr, length);
                 if (mem_path) {
 #if defined(__linux__) && !defined(TARGET_S390X)
                     if (block->fd) {
-#ifdef MAP_POPULATE
-                        flags |= mem_prealloc ? MAP_POPULATE | MAP_SHARED :
-                            MAP_PRIVATE;
-#else
-                        flags |= MAP_PRIVATE;
-#endif
+                        /* as in file_ram_alloc */
+                        flags |= mem_prealloc ? MAP_SHARED : MAP_PRIVATE;
+                        page_size = gethugepagesize(mem_path);
                         area = mmap(vaddr, length, PROT_READ | PROT_WRITE,
                                     flags, block->fd, offset);
                     } else {
@@ -2792,6 +3276,9 @@ void qemu_ram_remap(ram_addr_t addr, ram_addr_t length)
                     exit(1);
                 }
                 qemu_madvise(vaddr, length, QEMU_MADV_MERGEABLE);
+                if (mem_prealloc) {
+                    ram_prealloc(vaddr, length, page_size);
+                }
             }
             return;
         }
@@ -2799,6 +3286,53 @@ void qemu_ram_remap(ram_addr_t addr, ram_addr_t length)
 }
 #endif /* !_WIN32 */
 
+NumaNodeInfoList *qmp_query_numa(Error **errp)
+{
+    NumaNodeInfoList *head = NULL, **tail = &head;
+    RAMBlock *block, *numa_block = NULL;
+    int i;
+
+    QLIST_FOREACH(block, &ram_list.blocks, next) {
+        if (block->node_slices) {
+            numa_block = block;
+            break;
+        }
+    }
+
+    for (i = 0; i < nb_numa_nodes; i++) {
+        NumaNodeInfoList *entry = g_malloc0(sizeof(*entry));
+        NumaNodeInfo *info = g_malloc0(sizeof(*info));
+
+        info->node = i;
+        info->size = node_mem[i];
+        info->policy = node_mem_policy[i];
+        if (node_host_nodes[i]) {
+            info->has_host_nodes = true;
+            info->host_nodes = node_host_nodes[i];
+        }
+        info->page_size = getpagesize();
+#if defined(__linux__) && !defined(TARGET_S390X)
+        if (numa_block) {
+            RAMNodeSlice *slice = &numa_block->node_slices[i];
+
+            info->size = slice->length;
+            info->page_size = slice->page_size;
+            if (slice->path) {
+                info->has_mem_path = true;
+                info->mem_path = g_strdup(slice->path);
+            }
+            info->usage = numa_ram_usage(slice);
+        }
+#endif
+
+        entry->value = info;
+        *tail = entry;
+        tail = &entry->next;
+    }
+
+    return head;
+}
+
 /* Return a host pointer to ram allocated with qemu_ram_alloc.
    With the exception of the softmmu code in this file, this should
    only be used for local memory (e.g. video ram) that the device owns,
@@ -2938,6 +3472,53 @@ ram_addr_t qemu_ram_addr_from_host_nofail(void *ptr)
     return ram_addr;
 }
 
+/* Find the file that backs the guest RAM at @ptr, for sharing it with
+ * another process.  On success returns the file descriptor and stores
+ * where @ptr is in the file and how many bytes after it are backed by
+ * the same file contiguously.  Only RAM mapped MAP_SHARED, that is with
+ * -mem-path and -mem-prealloc, can be shared.
+ */
+int qemu_ram_get_fd(void *ptr, ram_addr_t *offset, ram_addr_t *length)
+{
+#if defined(__linux__) && !defined(TARGET_S390X)
+    RAMBlock *block;
+    uint8_t *host = ptr;
+    int i;
+
+    if (xen_enabled() || !mem_prealloc) {
+        return -1;
+    }
+
+    QLIST_FOREACH(block, &ram_list.blocks, next) {
+        if (block->host == NULL || host - block->host >= block->length) {
+            continue;
+        }
+        if (block->node_slices) {
+            for (i = 0; i < nb_numa_nodes; i++) {
+                RAMNodeSlice *slice = &block->node_slices[i];
+
+                if (host - slice->host < slice->length) {
+                    if (slice->fd < 0) {
+                        return -1;
+                    }
+                    *offset = host - slice->host;
+                    *length = slice->length - *offset;
+                    return slice->fd;
+                }
+            }
+            return -1;
+        }
+        if (!block->fd) {
+            return -1;
+        }
+        *offset = host - block->host;
+        *length = block->length - *offset;
+        return block->fd;
+    }
+#endif
+    return -1;
+}
+
 static uint64_t unassigned_mem_read(void *opaque, target_phys_addr_t addr,
                                     unsigned size)
 {
@@ -4272,12 +4853,13 @@ void cpu_io_recompile(CPUArchState *env, uintptr_t retaddr)
 void dump_exec_info(FILE *f, fprintf_function cpu_fprintf)
 {
     int i, target_code_size, max_target_code_size;
-    int direct_jmp_count, direct_jmp2_count, cross_page;
+    int direct_jmp_count, direct_jmp2_count, cross_page, superblocks;
     TranslationBlock *tb;
 
     target_code_size = 0;
     max_target_code_size = 0;
     cross_page = 0;
+    superblocks = 0;
     direct_jmp_count = 0;
     direct_jmp2_count = 0;
     for(i = 0; i < nb_tbs; i++) {
@@ -4287,6 +4869,9 @@ void dump_exec_info(FILE *f, fprintf_function cpu_fprintf)
             max_target_code_size = tb->size;
         if (tb->page_addr[1] != -1)
             cross_page++;
+        if (tb->cflags & CF_SUPERBLOCK) {
+            superblocks++;
+        }
         if (tb->tb_next_offset[0] != 0xffff) {
             direct_jmp_count++;
             if (tb->tb_next_offset[1] != 0xffff) {
@@ -4314,10 +4899,14 @@ void dump_exec_info(FILE *f, fprintf_function cpu_fprintf)
                 nb_tbs ? (direct_jmp_count * 100) / nb_tbs : 0,
                 direct_jmp2_count,
                 nb_tbs ? (direct_jmp2_count * 100) / nb_tbs : 0);
+    cpu_fprintf(f, "superblock count    %d (%d%%)\n",
+                superblocks,
+                nb_tbs ? (superblocks * 100) / nb_tbs : 0);
     cpu_fprintf(f, "\nStatistics:\n");
     cpu_fprintf(f, "TB flush count      %d\n", tb_flush_count);
     cpu_fprintf(f, "TB invalidate count %d\n", tb_phys_invalidate_count);
     cpu_fprintf(f, "TLB flush count     %d\n", tlb_flush_count);
+    tb_cache_dump_info(f, cpu_fprintf);
     tcg_dump_info(f, cpu_fprintf);
 }
 
@@ -40,6 +40,10 @@ these four paragraphs for those parts of this code that are retained.
  */
 #include "config.h"
 
+#include <float.h>
+#include <fenv.h>
+#include <math.h>
+
 #include "softfloat.h"
 
 /*----------------------------------------------------------------------------
@@ -1843,6 +1847,159 @@ static float32 subFloat32Sigs( float32 a, float32 b, flag zSign STATUS_PARAM)
 
 }
 
+/*----------------------------------------------------------------------------
+| Host FPU fast path for the basic single- and double-precision operations.
+| It is only taken when the rounding mode is round-to-nearest-even, every
+| operand is a normal finite number and the host result is a normal number
+| at least twice the smallest normal, so that neither overflow, underflow
+| (with tininess detected before or after rounding) nor NaN handling can
+| come into play.  The only exception left is inexact, which is read back
+| from the host's floating-point environment; once the guest has the
+| sticky inexact flag set already, the host environment is not touched at
+| all.  Anything else returns 0 and the caller falls back to the software
+| implementation.  Hosts that evaluate in extended precision (x87) never
+| use the fast path, since double rounding would change the results.
+*----------------------------------------------------------------------------*/
+#if defined(FLT_EVAL_METHOD) && FLT_EVAL_METHOD == 0 && defined(FE_INEXACT)
+#define USE_HOST_FPU 1
+#else
+#define USE_HOST_FPU 0
+#endif
+
+enum {
+    host_fpu_add,
+    host_fpu_sub,
+    host_fpu_mul,
+    host_fpu_div,
+    host_fpu_sqrt,
+};
+
+typedef union {
+    uint32_t i;
+    float f;
+} host_float32;
+
+typedef union {
+    uint64_t i;
+    double f;
+} host_float64;
+
+static inline int float32_host_op(int op, float32 a, float32 b, float32 *z
+                                  STATUS_PARAM)
+{
+#if USE_HOST_FPU
+    volatile host_float32 ua, ub, uz;
+    int_fast16_t aExp, bExp, zExp;
+    int inexact;
+
+    if (STATUS(float_rounding_mode) != float_round_nearest_even) {
+        return 0;
+    }
+    aExp = extractFloat32Exp(a);
+    bExp = extractFloat32Exp(b);
+    if (aExp == 0 || aExp == 0xFF || bExp == 0 || bExp == 0xFF) {
+        return 0;
+    }
+    if (op == host_fpu_sqrt && extractFloat32Sign(a)) {
+        return 0;
+    }
+
+    inexact = STATUS(float_exception_flags) & float_flag_inexact;
+    ua.i = float32_val(a);
+    ub.i = float32_val(b);
+    if (!inexact) {
+        feclearexcept(FE_INEXACT);
+    }
+    switch (op) {
+    case host_fpu_add:
+        uz.f = ua.f + ub.f;
+        break;
+    case host_fpu_sub:
+        uz.f = ua.f - ub.f;
+        break;
+    case host_fpu_mul:
+        uz.f = ua.f * ub.f;
+        break;
+    case host_fpu_div:
+        uz.f = ua.f / ub.f;
+        break;
+    default:
+        uz.f = sqrtf(ua.f);
+        break;
+    }
+
+    zExp = (uz.i >> 23) & 0xFF;
+    if (zExp <= 1 || zExp == 0xFF) {
+        return 0;
+    }
+    if (!inexact && fetestexcept(FE_INEXACT)) {
+        float_raise(float_flag_inexact STATUS_VAR);
+    }
+    *z = make_float32(uz.i);
+    return 1;
+#else
+    return 0;
+#endif
+}
+
+static inline int float64_host_op(int op, float64 a, float64 b, float64 *z
+                                  STATUS_PARAM)
+{
+#if USE_HOST_FPU
+    volatile host_float64 ua, ub, uz;
+    int_fast16_t aExp, bExp, zExp;
+    int inexact;
+
+    if (STATUS(float_rounding_mode) != float_round_nearest_even) {
+        return 0;
+    }
+    aExp = extractFloat64Exp(a);
+    bExp = extractFloat64Exp(b);
+    if (aExp == 0 || aExp == 0x7FF || bExp == 0 || bExp == 0x7FF) {
+        return 0;
+    }
+    if (op == host_fpu_sqrt && extractFloat64Sign(a)) {
+        return 0;
+    }
+
+    inexact = STATUS(float_exception_flags) & float_flag_inexact;
+    ua.i = float64_val(a);
+    ub.i = float64_val(b);
+    if (!inexact) {
+        feclearexcept(FE_INEXACT);
+    }
+    switch (op) {
+    case host_fpu_add:
+        uz.f = ua.f + ub.f;
+        break;
+    case host_fpu_sub:
+        uz.f = ua.f - ub.f;
+        break;
+    case host_fpu_mul:
+        uz.f = ua.f * ub.f;
+        break;
+    case host_fpu_div:
+        uz.f = ua.f / ub.f;
+        break;
+    default:
+        uz.f = sqrt(ua.f);
+        break;
+    }
+
+    zExp = (uz.i >> 52) & 0x7FF;
+    if (zExp <= 1 || zExp == 0x7FF) {
+        return 0;
+    }
+    if (!inexact && fetestexcept(FE_INEXACT)) {
+        float_raise(float_flag_inexact STATUS_VAR);
+    }
+    *z = make_float64(uz.i);
+    return 1;
+#else
+    return 0;
+#endif
+}
+
 /*----------------------------------------------------------------------------
 | Returns the result of adding the single-precision floating-point values `a'
 | and `b'.  The operation is performed according to the IEC/IEEE Standard for
@@ -1851,7 +2008,11 @@ static float32 subFloat32Sigs( float32 a, float32 b, flag zSign STATUS_PARAM)
 
 float32 float32_add( float32 a, float32 b STATUS_PARAM )
 {
+    float32 z;
     flag aSign, bSign;
+    if (float32_host_op(host_fpu_add, a, b, &z STATUS_VAR)) {
+        return z;
+    }
     a = float32_squash_input_denormal(a STATUS_VAR);
     b = float32_squash_input_denormal(b STATUS_VAR);
 
@@ -1874,7 +2035,11 @@ float32 float32_add( float32 a, float32 b STATUS_PARAM )
 
 float32 float32_sub( float32 a, float32 b STATUS_PARAM )
 {
+    float32 z;
     flag aSign, bSign;
+    if (float32_host_op(host_fpu_sub, a, b, &z STATUS_VAR)) {
+        return z;
+    }
     a = float32_squash_input_denormal(a STATUS_VAR);
     b = float32_squash_input_denormal(b STATUS_VAR);
 
@@ -1897,12 +2062,16 @@ float32 float32_sub( float32 a, float32 b STATUS_PARAM )
 
 float32 float32_mul( float32 a, float32 b STATUS_PARAM )
 {
+    float32 z;
     flag aSign, bSign, zSign;
     int_fast16_t aExp, bExp, zExp;
     uint32_t aSig, bSig;
     uint64_t zSig64;
     uint32_t zSig;
 
+    if (float32_host_op(host_fpu_mul, a, b, &z STATUS_VAR)) {
+        return z;
+    }
     a = float32_squash_input_denormal(a STATUS_VAR);
     b = float32_squash_input_denormal(b STATUS_VAR);
 
@@ -1960,9 +2129,13 @@ float32 float32_mul( float32 a, float32 b STATUS_PARAM )
 
 float32 float32_div( float32 a, float32 b STATUS_PARAM )
 {
+    float32 z;
     flag aSign, bSign, zSign;
     int_fast16_t aExp, bExp, zExp;
     uint32_t aSig, bSig, zSig;
+    if (float32_host_op(host_fpu_div, a, b, &z STATUS_VAR)) {
+        return z;
+    }
     a = float32_squash_input_denormal(a STATUS_VAR);
     b = float32_squash_input_denormal(b STATUS_VAR);
 
@@ -2332,10 +2505,14 @@ float32 float32_muladd(float32 a, float32 b, float32 c, int flags STATUS_PARAM)
 
 float32 float32_sqrt( float32 a STATUS_PARAM )
 {
+    float32 z;
     flag aSign;
     int_fast16_t aExp, zExp;
     uint32_t aSig, zSig;
     uint64_t rem, term;
+    if (float32_host_op(host_fpu_sqrt, a, a, &z STATUS_VAR)) {
+        return z;
+    }
     a = float32_squash_input_denormal(a STATUS_VAR);
 
     aSig = extractFloat32Frac( a );
@@ -3414,7 +3591,11 @@ static float64 subFloat64Sigs( float64 a, float64 b, flag zSign STATUS_PARAM )
 
 float64 float64_add( float64 a, float64 b STATUS_PARAM )
 {
+    float64 z;
     flag aSign, bSign;
+    if (float64_host_op(host_fpu_add, a, b, &z STATUS_VAR)) {
+        return z;
+    }
     a = float64_squash_input_denormal(a STATUS_VAR);
     b = float64_squash_input_denormal(b STATUS_VAR);
 
@@ -3437,7 +3618,11 @@ float64 float64_add( float64 a, float64 b STATUS_PARAM )
 
 float64 float64_sub( float64 a, float64 b STATUS_PARAM )
 {
+    float64 z;
     flag aSign, bSign;
+    if (float64_host_op(host_fpu_sub, a, b, &z STATUS_VAR)) {
+        return z;
+    }
     a = float64_squash_input_denormal(a STATUS_VAR);
     b = float64_squash_input_denormal(b STATUS_VAR);
 
@@ -3460,10 +3645,14 @@ float64 float64_sub( float64 a, float64 b STATUS_PARAM )
 
 float64 float64_mul( float64 a, float64 b STATUS_PARAM )
 {
+    float64 z;
     flag aSign, bSign, zSign;
     int_fast16_t aExp, bExp, zExp;
     uint64_t aSig, bSig, zSig0, zSig1;
 
+    if (float64_host_op(host_fpu_mul, a, b, &z STATUS_VAR)) {
+        return z;
+    }
     a = float64_squash_input_denormal(a STATUS_VAR);
     b = float64_squash_input_denormal(b STATUS_VAR);
 
@@ -3521,11 +3710,15 @@ float64 float64_mul( float64 a, float64 b STATUS_PARAM )
 
 float64 float64_div( float64 a, float64 b STATUS_PARAM )
 {
+    float64 z;
     flag aSign, bSign, zSign;
     int_fast16_t aExp, bExp, zExp;
     uint64_t aSig, bSig, zSig;
     uint64_t rem0, rem1;
     uint64_t term0, term1;
+    if (float64_host_op(host_fpu_div, a, b, &z STATUS_VAR)) {
+        return z;
+    }
     a = float64_squash_input_denormal(a STATUS_VAR);
     b = float64_squash_input_denormal(b STATUS_VAR);
 
@@ -3899,10 +4092,14 @@ float64 float64_muladd(float64 a, float64 b, float64 c, int flags STATUS_PARAM)
 
 float64 float64_sqrt( float64 a STATUS_PARAM )
 {
+    float64 z;
     flag aSign;
     int_fast16_t aExp, zExp;
     uint64_t aSig, zSig, doubleZSig;
     uint64_t rem0, rem1, term0, term1;
+    if (float64_host_op(host_fpu_sqrt, a, a, &z STATUS_VAR)) {
+        return z;
+    }
     a = float64_squash_input_denormal(a STATUS_VAR);
 
     aSig = extractFloat64Frac( a );
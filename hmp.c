@@ -189,7 +189,17 @@ void hmp_info_cpus(Monitor *mon)
             monitor_printf(mon, " (halted)");
         }
 
-        monitor_printf(mon, " thread_id=%" PRId64 "\n", cpu->value->thread_id);
+        monitor_printf(mon, " thread_id=%" PRId64, cpu->value->thread_id);
+
+        if (cpu->value->has_halt_poll_ns) {
+            monitor_printf(mon, " halt_poll_ns=%" PRId64
+                           " halt_poll=%" PRId64 "/%" PRId64,
+                           cpu->value->halt_poll_ns,
+                           cpu->value->halt_poll_hits,
+                           cpu->value->halt_poll_hits +
+                           cpu->value->halt_poll_misses);
+        }
+        monitor_printf(mon, "\n");
     }
 
     qapi_free_CpuInfoList(cpu_list);
@@ -351,12 +351,40 @@ static void acpi_pm_tmr_timer(void *opaque)
     ar->tmr.update_sci(ar);
 }
 
+static uint64_t acpi_pm_tmr_read(void *opaque, target_phys_addr_t addr,
+                                 unsigned width)
+{
+    return acpi_pm_tmr_get(opaque);
+}
+
+static void acpi_pm_tmr_write(void *opaque, target_phys_addr_t addr,
+                              uint64_t val, unsigned width)
+{
+    /* nothing */
+}
+
+static const MemoryRegionOps acpi_pm_tmr_ops = {
+    .read = acpi_pm_tmr_read,
+    .write = acpi_pm_tmr_write,
+    .endianness = DEVICE_LITTLE_ENDIAN,
+};
+
 void acpi_pm_tmr_init(ACPIREGS *ar, acpi_update_sci_fn update_sci)
 {
     ar->tmr.update_sci = update_sci;
     ar->tmr.timer = qemu_new_timer_ns(vm_clock, acpi_pm_tmr_timer, ar);
 }
 
+/* Map PM_TMR at offset 8 of the PM register block @parent.  Guests poll
+ * this register in tight loops; since reading it only looks at vm_clock,
+ * vcpus can do so without taking the global mutex. */
+void acpi_pm_tmr_map(ACPIREGS *ar, MemoryRegion *parent)
+{
+    memory_region_init_io(&ar->tmr.io, &acpi_pm_tmr_ops, ar, "acpi-tmr", 4);
+    memory_region_set_lockless(&ar->tmr.io, true);
+    memory_region_add_subregion(parent, 8, &ar->tmr.io);
+}
+
 void acpi_pm_tmr_reset(ACPIREGS *ar)
 {
     ar->tmr.overflow_time = 0;
@@ -66,6 +66,7 @@
 
 #define MAX_APICS 255
 
+#define MSI_ADDR_BASE                   0xfee00000
 #define MSI_SPACE_SIZE                  0x100000
 
 typedef struct APICCommonState APICCommonState;
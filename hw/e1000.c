@@ -69,6 +69,12 @@ static int debugflags = DBGBIT(TXERR) | DBGBIT(GENERAL);
  */
 enum { E1000_DEVID = E1000_DEV_ID_82540EM };
 
+/* Descriptors fetched from a ring with a single DMA read */
+#define E1000_DESC_BATCH  32
+
+#define E1000_FLAG_MIT_BIT  0
+#define E1000_FLAG_MIT      (1 << E1000_FLAG_MIT_BIT)
+
 /*
  * May need to specify additional MAC-to-PHY entries --
  * Intel's Windows driver refuses to initialize unless they match
@@ -127,6 +133,25 @@ typedef struct E1000State_st {
     } eecd_state;
 
     QEMUTimer *autoneg_timer;
+
+    /* Interrupt moderation */
+    QEMUTimer *mit_timer;
+    struct e1000_delay {
+        uint32_t cause;     // held back until one of the deadlines passes
+        int64_t rel;        // restarted by every event (RDTR, TIDV)
+        int64_t abs;        // counted from the first event (RADV, TADV)
+    } rx_delay, tx_delay;
+    int64_t itr_next;       // the line may not be raised again before this
+    uint32_t irq_level;
+    QEMUBH *tx_bh;          // batches TDT writes, see set_tctl
+
+    /* RX descriptors fetched ahead of RDH */
+    struct e1000_rx_desc rx_desc[E1000_DESC_BATCH];
+    uint32_t rx_desc_head;  // ring index of rx_desc[rx_desc_next]
+    uint32_t rx_desc_next;
+    uint32_t rx_desc_count; // left from rx_desc_next on
+
+    uint32_t compat_flags;
 } E1000State;
 
 #define	defreg(x)	x = (E1000_##x>>2)
@@ -141,7 +166,8 @@ enum {
     defreg(TORH),	defreg(TORL),	defreg(TOTH),	defreg(TOTL),
     defreg(TPR),	defreg(TPT),	defreg(TXDCTL),	defreg(WUFC),
     defreg(RA),		defreg(MTA),	defreg(CRCERRS),defreg(VFTA),
-    defreg(VET),
+    defreg(VET),	defreg(ITR),	defreg(RDTR),	defreg(RADV),
+    defreg(TIDV),	defreg(TADV),
 };
 
 static void
@@ -220,6 +246,60 @@ static const uint32_t mac_reg_init[] = {
                 E1000_MANC_RMCP_EN,
 };
 
+/*
+ * Interrupt moderation.  ITR is the minimum interval between two rising
+ * edges of the interrupt line, in units of 256 ns; causes that come in
+ * earlier are latched in ICR but the line is raised only once it expires.
+ * RXT0 is held back until RDTR (restarted by every packet) or RADV
+ * (counted from the first one) expires, TXDW likewise by TIDV and TADV for
+ * descriptors with IDE set; these count in units of 1.024 us.  A zero RDTR
+ * or TIDV delivers the cause at once.  All deadlines share one timer.
+ */
+static bool
+e1000_mit_enabled(E1000State *s)
+{
+    return s->compat_flags & E1000_FLAG_MIT;
+}
+
+static void
+e1000_mit_arm(E1000State *s)
+{
+    int64_t next = INT64_MAX;
+
+    if (s->rx_delay.cause) {
+        next = MIN(next, MIN(s->rx_delay.rel, s->rx_delay.abs));
+    }
+    if (s->tx_delay.cause) {
+        next = MIN(next, MIN(s->tx_delay.rel, s->tx_delay.abs));
+    }
+    if (!s->irq_level && (s->mac_reg[IMS] & s->mac_reg[ICR])) {
+        next = MIN(next, s->itr_next);
+    }
+    if (next == INT64_MAX) {
+        qemu_del_timer(s->mit_timer);
+    } else {
+        qemu_mod_timer(s->mit_timer, next);
+    }
+}
+
+static void
+e1000_update_irq(E1000State *s)
+{
+    uint32_t level = (s->mac_reg[IMS] & s->mac_reg[ICR]) != 0;
+    int64_t now;
+
+    if (level && !s->irq_level && e1000_mit_enabled(s) && s->mac_reg[ITR]) {
+        now = qemu_get_clock_ns(vm_clock);
+        if (now < s->itr_next) {
+            e1000_mit_arm(s);
+            return;
+        }
+        s->itr_next = now + s->mac_reg[ITR] * 256;
+    }
+    s->irq_level = level;
+    qemu_set_irq(s->dev.irq[0], level);
+}
+
 static void
 set_interrupt_cause(E1000State *s, int index, uint32_t val)
 {
@@ -229,7 +309,7 @@ set_interrupt_cause(E1000State *s, int index, uint32_t val)
     }
     s->mac_reg[ICR] = val;
     s->mac_reg[ICS] = val;
-    qemu_set_irq(s->dev.irq[0], (s->mac_reg[IMS] & s->mac_reg[ICR]) != 0);
+    e1000_update_irq(s);
 }
 
 static void
@@ -240,6 +320,56 @@ set_ics(E1000State *s, int index, uint32_t val)
     set_interrupt_cause(s, 0, val | s->mac_reg[ICR]);
 }
 
+/* Remove and return the held back causes of @d */
+static uint32_t
+e1000_delay_flush(struct e1000_delay *d)
+{
+    uint32_t cause = d->cause;
+
+    d->cause = 0;
+    return cause;
+}
+
+/* Hold back @cause for @rel and at most @abs units of 1.024 us */
+static void
+e1000_delay_cause(E1000State *s, struct e1000_delay *d, uint32_t cause,
+                  uint32_t rel, uint32_t abs)
+{
+    int64_t now;
+
+    if (!e1000_mit_enabled(s) || !rel) {
+        set_ics(s, 0, cause | e1000_delay_flush(d));
+        return;
+    }
+    now = qemu_get_clock_ns(vm_clock);
+    if (!d->cause) {
+        d->abs = abs ? now + abs * 1024 : INT64_MAX;
+    }
+    d->cause |= cause;
+    d->rel = now + rel * 1024;
+    e1000_mit_arm(s);
+}
+
+static void
+e1000_mit_timer(void *opaque)
+{
+    E1000State *s = opaque;
+    int64_t now = qemu_get_clock_ns(vm_clock);
+    uint32_t cause = 0;
+
+    if (s->rx_delay.cause &&
+        (now >= s->rx_delay.rel || now >= s->rx_delay.abs)) {
+        cause |= e1000_delay_flush(&s->rx_delay);
+    }
+    if (s->tx_delay.cause &&
+        (now >= s->tx_delay.rel || now >= s->tx_delay.abs)) {
+        cause |= e1000_delay_flush(&s->tx_delay);
+    }
+    /* Also raises the line if it was only waiting for ITR */
+    set_ics(s, 0, cause);
+    e1000_mit_arm(s);
+}
+
 static int
 rxbufsize(uint32_t v)
 {
@@ -268,6 +398,13 @@ static void e1000_reset(void *opaque)
     E1000State *d = opaque;
 
     qemu_del_timer(d->autoneg_timer);
+    qemu_del_timer(d->mit_timer);
+    qemu_bh_cancel(d->tx_bh);
+    memset(&d->rx_delay, 0, sizeof d->rx_delay);
+    memset(&d->tx_delay, 0, sizeof d->tx_delay);
+    d->itr_next = 0;
+    d->irq_level = 0;
+    d->rx_desc_count = 0;
     memset(d->phy_reg, 0, sizeof d->phy_reg);
     memmove(d->phy_reg, phy_reg_init, sizeof phy_reg_init);
     memset(d->mac_reg, 0, sizeof d->mac_reg);
@@ -291,6 +428,7 @@ static void
 set_rx_control(E1000State *s, int index, uint32_t val)
 {
     s->mac_reg[RCTL] = val;
+    s->rx_desc_count = 0;
     s->rxbuf_size = rxbufsize(val);
     s->rxbuf_min_shift = ((val / E1000_RCTL_RDMTS_QUAT) & 3) + 1;
     DBGOUT(RX, "RCTL: %d, mac_reg[RCTL] = 0x%x\n", s->mac_reg[RDT],
@@ -603,8 +741,9 @@ process_tx_desc(E1000State *s, struct e1000_tx_desc *dp)
     tp->cptse = 0;
 }
 
+/* Update the status of @dp; the caller writes it back to the ring */
 static uint32_t
-txdesc_writeback(E1000State *s, dma_addr_t base, struct e1000_tx_desc *dp)
+txdesc_writeback(struct e1000_tx_desc *dp)
 {
     uint32_t txd_upper, txd_lower = le32_to_cpu(dp->lower.data);
 
@@ -613,8 +752,6 @@ txdesc_writeback(E1000State *s, dma_addr_t base, struct e1000_tx_desc *dp)
     txd_upper = (le32_to_cpu(dp->upper.data) | E1000_TXD_STAT_DD) &
                 ~(E1000_TXD_STAT_EC | E1000_TXD_STAT_LC | E1000_TXD_STAT_TU);
     dp->upper.data = cpu_to_le32(txd_upper);
-    pci_dma_write(&s->dev, base + ((char *)&dp->upper - (char *)dp),
-                  &dp->upper, sizeof(dp->upper));
     return E1000_ICR_TXDW;
 }
 
@@ -626,12 +763,31 @@ static uint64_t tx_desc_base(E1000State *s)
     return (bah << 32) + bal;
 }
 
+/*
+ * Number of descriptors that can be fetched at once from index @head on,
+ * without going past @tail or the end of a ring of @len bytes.
+ */
+static unsigned int
+desc_batch(uint32_t head, uint32_t tail, uint32_t len, size_t desc_size)
+{
+    uint32_t ring = len / desc_size;
+    uint32_t n;
+
+    if (head >= ring) {
+        return 1;
+    }
+    n = (tail > head && tail <= ring ? tail : ring) - head;
+    return MIN(n, E1000_DESC_BATCH);
+}
+
 static void
 start_xmit(E1000State *s)
 {
     dma_addr_t base;
-    struct e1000_tx_desc desc;
+    struct e1000_tx_desc desc[E1000_DESC_BATCH];
     uint32_t tdh_start = s->mac_reg[TDH], cause = E1000_ICS_TXQE;
+    uint32_t delayed = 0, txdw;
+    unsigned int i, n, wb_first, wb_last;
 
     if (!(s->mac_reg[TCTL] & E1000_TCTL_EN)) {
         DBGOUT(TX, "tx disabled\n");
@@ -639,30 +795,63 @@ start_xmit(E1000State *s)
     }
 
     while (s->mac_reg[TDH] != s->mac_reg[TDT]) {
+        n = desc_batch(s->mac_reg[TDH], s->mac_reg[TDT], s->mac_reg[TDLEN],
+                       sizeof(desc[0]));
         base = tx_desc_base(s) +
                sizeof(struct e1000_tx_desc) * s->mac_reg[TDH];
-        pci_dma_read(&s->dev, base, &desc, sizeof(desc));
-
-        DBGOUT(TX, "index %d: %p : %x %x\n", s->mac_reg[TDH],
-               (void *)(intptr_t)desc.buffer_addr, desc.lower.data,
-               desc.upper.data);
-
-        process_tx_desc(s, &desc);
-        cause |= txdesc_writeback(s, base, &desc);
-
-        if (++s->mac_reg[TDH] * sizeof(desc) >= s->mac_reg[TDLEN])
-            s->mac_reg[TDH] = 0;
-        /*
-         * the following could happen only if guest sw assigns
-         * bogus values to TDT/TDLEN.
-         * there's nothing too intelligent we could do about this.
-         */
-        if (s->mac_reg[TDH] == tdh_start) {
-            DBGOUT(TXERR, "TDH wraparound @%x, TDT %x, TDLEN %x\n",
-                   tdh_start, s->mac_reg[TDT], s->mac_reg[TDLEN]);
+        pci_dma_read(&s->dev, base, desc, n * sizeof(desc[0]));
+
+        wb_first = n;
+        wb_last = 0;
+        for (i = 0; i < n; i++) {
+            DBGOUT(TX, "index %d: %p : %x %x\n", s->mac_reg[TDH],
+                   (void *)(intptr_t)desc[i].buffer_addr, desc[i].lower.data,
+                   desc[i].upper.data);
+
+            process_tx_desc(s, &desc[i]);
+            txdw = txdesc_writeback(&desc[i]);
+            if (txdw) {
+                wb_first = MIN(wb_first, i);
+                wb_last = i;
+                if (le32_to_cpu(desc[i].lower.data) & E1000_TXD_CMD_IDE) {
+                    delayed |= txdw;
+                } else {
+                    cause |= txdw;
+                }
+            }
+
+            if (++s->mac_reg[TDH] * sizeof(desc[0]) >= s->mac_reg[TDLEN])
+                s->mac_reg[TDH] = 0;
+            /*
+             * the following could happen only if guest sw assigns
+             * bogus values to TDT/TDLEN.
+             * there's nothing too intelligent we could do about this.
+             */
+            if (s->mac_reg[TDH] == tdh_start) {
+                DBGOUT(TXERR, "TDH wraparound @%x, TDT %x, TDLEN %x\n",
+                       tdh_start, s->mac_reg[TDT], s->mac_reg[TDLEN]);
+                break;
+            }
+        }
+
+        /* Descriptors in between are written back unchanged */
+        if (wb_first <= wb_last) {
+            pci_dma_write(&s->dev, base + wb_first * sizeof(desc[0]),
+                          &desc[wb_first],
+                          (wb_last - wb_first + 1) * sizeof(desc[0]));
+        }
+        if (i < n) {
             break;
         }
     }
+
+    /* Write-backs without IDE also deliver the delayed ones */
+    if (cause & E1000_ICR_TXDW) {
+        cause |= e1000_delay_flush(&s->tx_delay);
+    } else if (delayed) {
+        e1000_delay_cause(s, &s->tx_delay, delayed, s->mac_reg[TIDV],
+                          s->mac_reg[TADV]);
+    }
     set_ics(s, 0, cause);
 }
 
@@ -735,7 +924,7 @@ e1000_set_link_status(VLANClientState *nc)
         set_ics(s, 0, E1000_ICR_LSC);
 }
 
-static bool e1000_has_rxbufs(E1000State *s, size_t total_size)
+static bool e1000_rxbufs_fit(E1000State *s, size_t total_size)
 {
     int bufs;
     /* Fast-path short packets */
@@ -753,6 +942,16 @@ static bool e1000_has_rxbufs(E1000State *s, size_t total_size)
     return total_size <= bufs * s->rxbuf_size;
 }
 
+static bool e1000_has_rxbufs(E1000State *s, size_t total_size)
+{
+    if (e1000_rxbufs_fit(s, total_size)) {
+        return true;
+    }
+    /* RDT is coalesced; the guest may have refilled the ring already */
+    memory_region_flush_coalesced(&s->mmio);
+    return e1000_rxbufs_fit(s, total_size);
+}
+
 static int
 e1000_can_receive(VLANClientState *nc)
 {
@@ -769,6 +968,28 @@ static uint64_t rx_desc_base(E1000State *s)
     return (bah << 32) + bal;
 }
 
+/*
+ * Descriptors between RDH and RDT belong to the device, so they can be
+ * fetched ahead and used in order until the ring is moved or reset.
+ */
+static void
+e1000_rx_desc_get(E1000State *s, struct e1000_rx_desc *desc)
+{
+    uint32_t rdh = s->mac_reg[RDH];
+
+    if (!s->rx_desc_count || s->rx_desc_head != rdh) {
+        s->rx_desc_count = desc_batch(rdh, s->mac_reg[RDT], s->mac_reg[RDLEN],
+                                      sizeof(*desc));
+        pci_dma_read(&s->dev, rx_desc_base(s) + sizeof(*desc) * rdh,
+                     s->rx_desc, s->rx_desc_count * sizeof(*desc));
+        s->rx_desc_head = rdh;
+        s->rx_desc_next = 0;
+    }
+    *desc = s->rx_desc[s->rx_desc_next++];
+    s->rx_desc_head++;
+    s->rx_desc_count--;
+}
+
 static ssize_t
 e1000_receive(VLANClientState *nc, const uint8_t *buf, size_t size)
 {
@@ -810,7 +1031,7 @@ e1000_receive(VLANClientState *nc, const uint8_t *buf, size_t size)
     desc_offset = 0;
     total_size = size + fcs_len(s);
     if (!e1000_has_rxbufs(s, total_size)) {
-            set_ics(s, 0, E1000_ICS_RXO);
+            set_ics(s, 0, E1000_ICS_RXO | e1000_delay_flush(&s->rx_delay));
             return -1;
     }
     do {
@@ -819,7 +1040,7 @@ e1000_receive(VLANClientState *nc, const uint8_t *buf, size_t size)
             desc_size = s->rxbuf_size;
         }
         base = rx_desc_base(s) + sizeof(desc) * s->mac_reg[RDH];
-        pci_dma_read(&s->dev, base, &desc, sizeof(desc));
+        e1000_rx_desc_get(s, &desc);
         desc.special = vlan_special;
         desc.status |= (vlan_status | E1000_RXD_STAT_DD);
         if (desc.buffer_addr) {
@@ -852,7 +1073,7 @@ e1000_receive(VLANClientState *nc, const uint8_t *buf, size_t size)
         if (s->mac_reg[RDH] == rdh_start) {
             DBGOUT(RXERR, "RDH wraparound @%x, RDT %x, RDLEN %x\n",
                    rdh_start, s->mac_reg[RDT], s->mac_reg[RDLEN]);
-            set_ics(s, 0, E1000_ICS_RXO);
+            set_ics(s, 0, E1000_ICS_RXO | e1000_delay_flush(&s->rx_delay));
             return -1;
         }
     } while (desc_offset < total_size);
@@ -868,14 +1089,17 @@ e1000_receive(VLANClientState *nc, const uint8_t *buf, size_t size)
         s->mac_reg[TORH]++;
     s->mac_reg[TORL] = n;
 
-    n = E1000_ICS_RXT0;
     if ((rdt = s->mac_reg[RDT]) < s->mac_reg[RDH])
         rdt += s->mac_reg[RDLEN] / sizeof(desc);
     if (((rdt - s->mac_reg[RDH]) * sizeof(desc)) <= s->mac_reg[RDLEN] >>
-        s->rxbuf_min_shift)
-        n |= E1000_ICS_RXDMT0;
-
-    set_ics(s, 0, n);
+        s->rxbuf_min_shift) {
+        /* Running out of buffers is reported at once, with what is held */
+        set_ics(s, 0, E1000_ICS_RXT0 | E1000_ICS_RXDMT0 |
+                      e1000_delay_flush(&s->rx_delay));
+    } else {
+        e1000_delay_cause(s, &s->rx_delay, E1000_ICS_RXT0,
+                          s->mac_reg[RDTR], s->mac_reg[RADV]);
+    }
 
     return size;
 }
@@ -940,12 +1164,49 @@ set_dlen(E1000State *s, int index, uint32_t val)
     s->mac_reg[index] = val & 0xfff80;
 }
 
+static void
+set_rx_ring(E1000State *s, int index, uint32_t val)
+{
+    /* Whatever was fetched ahead is stale now */
+    s->rx_desc_count = 0;
+    if (index == RDLEN) {
+        set_dlen(s, index, val);
+    } else if (index == RDH) {
+        set_16bit(s, index, val);
+    } else {
+        mac_writereg(s, index, val);
+    }
+}
+
+static void
+set_rdtr(E1000State *s, int index, uint32_t val)
+{
+    s->mac_reg[index] = val & E1000_RDT_DELAY;
+    if (val & E1000_RDT_FPDB) {
+        set_ics(s, 0, e1000_delay_flush(&s->rx_delay));
+    }
+}
+
+static void
+e1000_tx_bh(void *opaque)
+{
+    start_xmit(opaque);
+}
+
+/* With moderation, drivers bump TDT once per packet and expect the
+ * completions together; transmitting from a bottom half lets all the
+ * bumps up to the next main loop iteration go out in one start_xmit.
+ */
 static void
 set_tctl(E1000State *s, int index, uint32_t val)
 {
     s->mac_reg[index] = val;
     s->mac_reg[TDT] &= 0xffff;
-    start_xmit(s);
+    if (e1000_mit_enabled(s)) {
+        qemu_bh_schedule(s->tx_bh);
+    } else {
+        start_xmit(s);
+    }
 }
 
 static void
@@ -977,7 +1238,8 @@ static uint32_t (*macreg_readops[])(E1000State *, int) = {
     getreg(TORL),	getreg(TOTL),	getreg(IMS),	getreg(TCTL),
     getreg(RDH),	getreg(RDT),	getreg(VET),	getreg(ICS),
     getreg(TDBAL),	getreg(TDBAH),	getreg(RDBAH),	getreg(RDBAL),
-    getreg(TDLEN),	getreg(RDLEN),
+    getreg(TDLEN),	getreg(RDLEN),	getreg(ITR),	getreg(RDTR),
+    getreg(RADV),	getreg(TIDV),	getreg(TADV),
 
     [TOTH] = mac_read_clr8,	[TORH] = mac_read_clr8,	[GPRC] = mac_read_clr4,
     [GPTC] = mac_read_clr4,	[TPR] = mac_read_clr4,	[TPT] = mac_read_clr4,
@@ -992,11 +1254,14 @@ enum { NREADOPS = ARRAY_SIZE(macreg_readops) };
 #define putreg(x)	[x] = mac_writereg
 static void (*macreg_writeops[])(E1000State *, int, uint32_t) = {
     putreg(PBA),	putreg(EERD),	putreg(SWSM),	putreg(WUFC),
-    putreg(TDBAL),	putreg(TDBAH),	putreg(TXDCTL),	putreg(RDBAH),
-    putreg(RDBAL),	putreg(LEDCTL), putreg(VET),
-    [TDLEN] = set_dlen,	[RDLEN] = set_dlen,	[TCTL] = set_tctl,
+    putreg(TDBAL),	putreg(TDBAH),	putreg(TXDCTL),	putreg(LEDCTL),
+    putreg(VET),
+    [TDLEN] = set_dlen,	[RDLEN] = set_rx_ring,	[TCTL] = set_tctl,
     [TDT] = set_tctl,	[MDIC] = set_mdic,	[ICS] = set_ics,
-    [TDH] = set_16bit,	[RDH] = set_16bit,	[RDT] = set_rdt,
+    [TDH] = set_16bit,	[RDH] = set_rx_ring,	[RDT] = set_rdt,
+    [RDBAH] = set_rx_ring, [RDBAL] = set_rx_ring, [RDTR] = set_rdtr,
+    [ITR] = set_16bit,	[RADV] = set_16bit,	[TIDV] = set_16bit,
+    [TADV] = set_16bit,
     [IMC] = set_imc,	[IMS] = set_ims,	[ICR] = set_icr,
     [EECD] = set_eecd,	[RCTL] = set_rx_control, [CTRL] = set_ctrl,
     [RA ... RA+31] = &mac_writereg,
@@ -1075,11 +1340,57 @@ static bool is_version_1(void *opaque, int version_id)
     return version_id == 1;
 }
 
+static int e1000_post_load(void *opaque, int version_id)
+{
+    E1000State *s = opaque;
+
+    s->rx_desc_count = 0;
+    if (e1000_mit_enabled(s)) {
+        e1000_mit_arm(s);
+        /* The source may not have got to the last TDT writes yet */
+        if (s->mac_reg[TDH] != s->mac_reg[TDT]) {
+            qemu_bh_schedule(s->tx_bh);
+        }
+    }
+    return 0;
+}
+
+static bool e1000_mit_state_needed(void *opaque)
+{
+    E1000State *s = opaque;
+
+    return e1000_mit_enabled(s);
+}
+
+static const VMStateDescription vmstate_e1000_mit_state = {
+    .name = "e1000/mit_state",
+    .version_id = 1,
+    .minimum_version_id = 1,
+    .minimum_version_id_old = 1,
+    .fields = (VMStateField[]) {
+        VMSTATE_UINT32(mac_reg[RDTR], E1000State),
+        VMSTATE_UINT32(mac_reg[RADV], E1000State),
+        VMSTATE_UINT32(mac_reg[TADV], E1000State),
+        VMSTATE_UINT32(mac_reg[TIDV], E1000State),
+        VMSTATE_UINT32(mac_reg[ITR], E1000State),
+        VMSTATE_UINT32(rx_delay.cause, E1000State),
+        VMSTATE_INT64(rx_delay.rel, E1000State),
+        VMSTATE_INT64(rx_delay.abs, E1000State),
+        VMSTATE_UINT32(tx_delay.cause, E1000State),
+        VMSTATE_INT64(tx_delay.rel, E1000State),
+        VMSTATE_INT64(tx_delay.abs, E1000State),
+        VMSTATE_INT64(itr_next, E1000State),
+        VMSTATE_UINT32(irq_level, E1000State),
+        VMSTATE_END_OF_LIST()
+    }
+};
+
 static const VMStateDescription vmstate_e1000 = {
     .name = "e1000",
     .version_id = 2,
     .minimum_version_id = 1,
     .minimum_version_id_old = 1,
+    .post_load = e1000_post_load,
     .fields      = (VMStateField []) {
         VMSTATE_PCI_DEVICE(dev, E1000State),
         VMSTATE_UNUSED_TEST(is_version_1, 4), /* was instance id */
@@ -1150,6 +1461,14 @@ static const VMStateDescription vmstate_e1000 = {
         VMSTATE_UINT32_SUB_ARRAY(mac_reg, E1000State, MTA, 128),
         VMSTATE_UINT32_SUB_ARRAY(mac_reg, E1000State, VFTA, 128),
         VMSTATE_END_OF_LIST()
+    },
+    .subsections = (VMStateSubsection[]) {
+        {
+            .vmsd = &vmstate_e1000_mit_state,
+            .needed = e1000_mit_state_needed,
+        }, {
+            /* empty */
+        }
     }
 };
 
@@ -1172,7 +1491,7 @@ e1000_mmio_setup(E1000State *d)
     int i;
     const uint32_t excluded_regs[] = {
         E1000_MDIC, E1000_ICR, E1000_ICS, E1000_IMS,
-        E1000_IMC, E1000_TCTL, E1000_TDT, PNPMMIO_SIZE
+        E1000_IMC, E1000_TCTL, E1000_RDTR, E1000_TDT, PNPMMIO_SIZE
     };
 
     memory_region_init_io(&d->mmio, &e1000_mmio_ops, d, "e1000-mmio",
@@ -1199,6 +1518,9 @@ pci_e1000_uninit(PCIDevice *dev)
 
     qemu_del_timer(d->autoneg_timer);
     qemu_free_timer(d->autoneg_timer);
+    qemu_del_timer(d->mit_timer);
+    qemu_free_timer(d->mit_timer);
+    qemu_bh_delete(d->tx_bh);
     memory_region_destroy(&d->mmio);
     memory_region_destroy(&d->io);
     qemu_del_vlan_client(&d->nic->nc);
@@ -1254,6 +1576,8 @@ static int pci_e1000_init(PCIDevice *pci_dev)
     add_boot_device_path(d->conf.bootindex, &pci_dev->qdev, "/ethernet-phy@0");
 
     d->autoneg_timer = qemu_new_timer_ms(vm_clock, e1000_autoneg_timer, d);
+    d->mit_timer = qemu_new_timer_ns(vm_clock, e1000_mit_timer, d);
+    d->tx_bh = qemu_bh_new(e1000_tx_bh, d);
 
     return 0;
 }
@@ -1266,6 +1590,8 @@ static void qdev_e1000_reset(DeviceState *dev)
 
 static Property e1000_properties[] = {
     DEFINE_NIC_PROPERTIES(E1000State, conf),
+    DEFINE_PROP_BIT("mitigation", E1000State, compat_flags,
+                    E1000_FLAG_MIT_BIT, true),
     DEFINE_PROP_END_OF_LIST(),
 };
 
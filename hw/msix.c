@@ -19,6 +19,7 @@
 #include "msix.h"
 #include "pci.h"
 #include "range.h"
+#include "qemu-error.h"
 
 #define MSIX_CAP_LENGTH 12
 
@@ -130,6 +131,43 @@ static bool msix_is_masked(PCIDevice *dev, int vector)
     return msix_vector_masked(dev, vector, dev->msix_function_masked);
 }
 
+MSIMessage msix_get_message(PCIDevice *dev, unsigned vector)
+{
+    uint8_t *table_entry = dev->msix_table_page + vector * PCI_MSIX_ENTRY_SIZE;
+    MSIMessage msg;
+
+    msg.address = pci_get_quad(table_entry + PCI_MSIX_ENTRY_LOWER_ADDR);
+    msg.data = pci_get_long(table_entry + PCI_MSIX_ENTRY_DATA);
+    return msg;
+}
+
+/* Tell the vector notifiers that a vector was unmasked or masked.  Devices
+ * use this to bind the vector to a direct injection path (e.g. a KVM irqfd)
+ * while the guest has it unmasked, and to fall back to msix_notify, which
+ * honours the mask and sets the pending bit, while it is masked. */
+static void msix_fire_vector_notifier(PCIDevice *dev,
+                                      unsigned vector, bool is_masked)
+{
+    int ret;
+
+    if (!dev->msix_vector_use_notifier) {
+        return;
+    }
+    if (is_masked) {
+        dev->msix_vector_release_notifier(dev, vector);
+    } else {
+        ret = dev->msix_vector_use_notifier(dev, vector,
+                                            msix_get_message(dev, vector));
+        if (ret < 0) {
+            /* E.g. KVM ran out of GSI routes; the guest can cause that,
+             * so keep going with the vector delivered by msix_notify. */
+            error_report("msix: cannot bind vector %u for direct injection: "
+                         "%s; falling back to userspace", vector,
+                         strerror(-ret));
+        }
+    }
+}
+
 static void msix_handle_mask_update(PCIDevice *dev, int vector, bool was_masked)
 {
     bool is_masked = msix_is_masked(dev, vector);
@@ -137,6 +175,8 @@ static void msix_handle_mask_update(PCIDevice *dev, int vector, bool was_masked)
         return;
     }
 
+    msix_fire_vector_notifier(dev, vector, is_masked);
+
     if (!is_masked && msix_is_pending(dev, vector)) {
         msix_clr_pending(dev, vector);
         msix_notify(dev, vector);
@@ -164,12 +204,12 @@ void msix_write_config(PCIDevice *dev, uint32_t addr,
     was_masked = dev->msix_function_masked;
     msix_update_function_masked(dev);
 
-    if (!msix_enabled(dev)) {
-        return;
+    if (msix_enabled(dev)) {
+        pci_device_deassert_intx(dev);
     }
 
-    pci_device_deassert_intx(dev);
-
+    /* Disabling MSI-X masks every vector, which matters to the vector
+     * notifiers even though nothing can be delivered any more. */
     if (dev->msix_function_masked == was_masked) {
         return;
     }
@@ -313,19 +353,43 @@ void msix_save(PCIDevice *dev, QEMUFile *f)
     qemu_put_buffer(f, dev->msix_table_page + MSIX_PAGE_PENDING, (n + 7) / 8);
 }
 
+/* Release the vector notifiers of all unmasked vectors, before the vector
+ * table or the function mask change behind msix_handle_mask_update's back. */
+static void msix_release_vector_notifiers(PCIDevice *dev)
+{
+    int vector;
+
+    if (!dev->msix_vector_release_notifier) {
+        return;
+    }
+    for (vector = 0; vector < dev->msix_entries_nr; ++vector) {
+        if (!msix_is_masked(dev, vector)) {
+            dev->msix_vector_release_notifier(dev, vector);
+        }
+    }
+}
+
 /* Should be called after restoring the config space. */
 void msix_load(PCIDevice *dev, QEMUFile *f)
 {
     unsigned n = dev->msix_entries_nr;
+    int vector;
 
     if (!(dev->cap_present & QEMU_PCI_CAP_MSIX)) {
         return;
     }
 
+    msix_release_vector_notifiers(dev);
     msix_free_irq_entries(dev);
     qemu_get_buffer(f, dev->msix_table_page, n * PCI_MSIX_ENTRY_SIZE);
     qemu_get_buffer(f, dev->msix_table_page + MSIX_PAGE_PENDING, (n + 7) / 8);
     msix_update_function_masked(dev);
+
+    for (vector = 0; vector < n; ++vector) {
+        if (!msix_is_masked(dev, vector)) {
+            msix_fire_vector_notifier(dev, vector, false);
+        }
+    }
 }
 
 /* Does device support MSI-X? */
@@ -352,9 +416,7 @@ uint32_t msix_bar_size(PCIDevice *dev)
 /* Send an MSI-X message */
 void msix_notify(PCIDevice *dev, unsigned vector)
 {
-    uint8_t *table_entry = dev->msix_table_page + vector * PCI_MSIX_ENTRY_SIZE;
-    uint64_t address;
-    uint32_t data;
+    MSIMessage msg;
 
     if (vector >= dev->msix_entries_nr || !dev->msix_entry_used[vector])
         return;
@@ -363,20 +425,21 @@ void msix_notify(PCIDevice *dev, unsigned vector)
         return;
     }
 
-    address = pci_get_quad(table_entry + PCI_MSIX_ENTRY_LOWER_ADDR);
-    data = pci_get_long(table_entry + PCI_MSIX_ENTRY_DATA);
-    stl_le_phys(address, data);
+    msg = msix_get_message(dev, vector);
+    stl_le_phys(msg.address, msg.data);
 }
 
 void msix_reset(PCIDevice *dev)
 {
     if (!(dev->cap_present & QEMU_PCI_CAP_MSIX))
         return;
+    msix_release_vector_notifiers(dev);
     msix_free_irq_entries(dev);
     dev->config[dev->msix_cap + MSIX_CONTROL_OFFSET] &=
 	    ~dev->wmask[dev->msix_cap + MSIX_CONTROL_OFFSET];
     memset(dev->msix_table_page, 0, MSIX_PAGE_SIZE);
     msix_mask_all(dev, dev->msix_entries_nr);
+    msix_update_function_masked(dev);
 }
 
 /* PCI spec suggests that devices make it possible for software to configure
@@ -408,9 +471,58 @@ void msix_vector_unuse(PCIDevice *dev, unsigned vector)
     msix_clr_pending(dev, vector);
 }
 
+unsigned int msix_nr_vectors_allocated(const PCIDevice *dev)
+{
+    return dev->msix_entries_nr;
+}
+
 void msix_unuse_all_vectors(PCIDevice *dev)
 {
     if (!(dev->cap_present & QEMU_PCI_CAP_MSIX))
         return;
     msix_free_irq_entries(dev);
 }
+
+/* Register callbacks that are invoked whenever a vector goes from masked to
+ * unmasked (use) or back (release).  The use notifier is called right away
+ * for every vector that is unmasked at registration time; if it fails, the
+ * vectors set up so far are released again and the error is returned. */
+int msix_set_vector_notifiers(PCIDevice *dev,
+                              MSIVectorUseNotifier use_notifier,
+                              MSIVectorReleaseNotifier release_notifier)
+{
+    int vector, ret;
+
+    assert(use_notifier && release_notifier);
+
+    for (vector = 0; vector < dev->msix_entries_nr; ++vector) {
+        if (msix_is_masked(dev, vector)) {
+            continue;
+        }
+        ret = use_notifier(dev, vector, msix_get_message(dev, vector));
+        if (ret < 0) {
+            goto undo;
+        }
+    }
+    dev->msix_vector_use_notifier = use_notifier;
+    dev->msix_vector_release_notifier = release_notifier;
+    return 0;
+
+undo:
+    while (--vector >= 0) {
+        if (!msix_is_masked(dev, vector)) {
+            release_notifier(dev, vector);
+        }
+    }
+    return ret;
+}
+
+void msix_unset_vector_notifiers(PCIDevice *dev)
+{
+    assert(dev->msix_vector_use_notifier &&
+           dev->msix_vector_release_notifier);
+
+    msix_release_vector_notifiers(dev);
+    dev->msix_vector_use_notifier = NULL;
+    dev->msix_vector_release_notifier = NULL;
+}
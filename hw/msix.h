@@ -24,9 +24,16 @@ uint32_t msix_bar_size(PCIDevice *dev);
 int msix_vector_use(PCIDevice *dev, unsigned vector);
 void msix_vector_unuse(PCIDevice *dev, unsigned vector);
 void msix_unuse_all_vectors(PCIDevice *dev);
+unsigned int msix_nr_vectors_allocated(const PCIDevice *dev);
 
+MSIMessage msix_get_message(PCIDevice *dev, unsigned vector);
 void msix_notify(PCIDevice *dev, unsigned vector);
 
 void msix_reset(PCIDevice *dev);
 
+int msix_set_vector_notifiers(PCIDevice *dev,
+                              MSIVectorUseNotifier use_notifier,
+                              MSIVectorReleaseNotifier release_notifier);
+void msix_unset_vector_notifiers(PCIDevice *dev);
+
 #endif
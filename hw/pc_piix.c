@@ -381,6 +381,18 @@ static QEMUMachine pc_machine_v1_1 = {
             .driver   = "USB",\
             .property = "full-path",\
             .value    = "no",\
+        },{\
+            .driver   = "e1000",\
+            .property = "mitigation",\
+            .value    = "off",\
+        },{\
+            .driver   = "virtio-balloon-pci",\
+            .property = "free-page-hint",\
+            .value    = "off",\
+        },{\
+            .driver   = "virtio-balloon-pci",\
+            .property = "auto-balloon-interval",\
+            .value    = stringify(0),\
         }
 
 static QEMUMachine pc_machine_v1_0 = {
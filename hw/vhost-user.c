@@ -0,0 +1,274 @@
+/*
+ * vhost-user: vhost with the virtqueues run by another process
+ *
+ * Copyright (c) 2012 agent <agent@local>
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ *
+ */
+
+#include <sys/socket.h>
+#include <poll.h>
+#include "vhost.h"
+#include "vhost-user.h"
+#include "hw/hw.h"
+#include "qemu-error.h"
+
+static int vhost_user_write(int fd, VhostUserMsg *msg, int *fds, int fd_num)
+{
+    char control[CMSG_SPACE(VHOST_USER_MEMORY_MAX_NREGIONS * sizeof(int))];
+    struct iovec iov = {
+        .iov_base = msg,
+        .iov_len = VHOST_USER_HDR_SIZE + msg->size,
+    };
+    struct msghdr msgh = {
+        .msg_iov = &iov,
+        .msg_iovlen = 1,
+    };
+    struct cmsghdr *cmsg;
+    ssize_t r;
+
+    if (fd_num) {
+        msgh.msg_control = control;
+        msgh.msg_controllen = CMSG_SPACE(fd_num * sizeof(int));
+        cmsg = CMSG_FIRSTHDR(&msgh);
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_RIGHTS;
+        cmsg->cmsg_len = CMSG_LEN(fd_num * sizeof(int));
+        memcpy(CMSG_DATA(cmsg), fds, fd_num * sizeof(int));
+    }
+
+    do {
+        r = sendmsg(fd, &msgh, MSG_NOSIGNAL);
+    } while (r < 0 && errno == EINTR);
+    if (r >= 0 && r != iov.iov_len) {
+        errno = EIO;
+        r = -1;
+    }
+    return r < 0 ? -1 : 0;
+}
+
+/* Replies are read with the iothread lock held; a backend that hangs must
+ * not freeze the VM with it.
+ */
+#define VHOST_USER_TIMEOUT_MS 5000
+
+static int vhost_user_read_all(int fd, void *buf, size_t size)
+{
+    struct pollfd pfd = { .fd = fd, .events = POLLIN };
+    ssize_t r;
+
+    while (size) {
+        r = poll(&pfd, 1, VHOST_USER_TIMEOUT_MS);
+        if (r < 0 && errno == EINTR) {
+            continue;
+        }
+        if (r <= 0) {
+            if (r == 0) {
+                error_report("vhost-user: no reply from the backend");
+                errno = ETIMEDOUT;
+            }
+            return -1;
+        }
+        r = read(fd, buf, size);
+        if (r < 0 && errno == EINTR) {
+            continue;
+        }
+        if (r <= 0) {
+            if (r == 0) {
+                errno = ECONNRESET;
+            }
+            return -1;
+        }
+        buf += r;
+        size -= r;
+    }
+    return 0;
+}
+
+static int vhost_user_read(int fd, VhostUserMsg *msg, uint32_t request)
+{
+    if (vhost_user_read_all(fd, msg, VHOST_USER_HDR_SIZE) < 0) {
+        return -1;
+    }
+    if (msg->request != request ||
+        msg->flags != (VHOST_USER_REPLY | VHOST_USER_VERSION) ||
+        msg->size > sizeof(msg->payload)) {
+        error_report("vhost-user: bad reply to request %u", request);
+        errno = EPROTO;
+        return -1;
+    }
+    return vhost_user_read_all(fd, &msg->payload, msg->size);
+}
+
+/* The regions of the vhost memory table, split where the file that backs
+ * guest RAM changes, and one descriptor for each.  RAM that is not in a
+ * shared file, like small ROMs that did not fit a huge page, is left out:
+ * the guest does not put buffers there.  Returns the number of
+ * descriptors or -1 if nothing can be shared.
+ */
+static int vhost_user_mem_table(struct vhost_memory *mem,
+                                VhostUserMemory *table, int *fds)
+{
+    int i, n = 0;
+
+    for (i = 0; i < mem->nregions; i++) {
+        struct vhost_memory_region *reg = &mem->regions[i];
+        uint64_t done = 0;
+        ram_addr_t offset, length;
+        int fd;
+
+        while (done < reg->memory_size) {
+            fd = qemu_ram_get_fd((void *)(uintptr_t)
+                                 (reg->userspace_addr + done),
+                                 &offset, &length);
+            if (fd < 0) {
+                break;
+            }
+            if (n == VHOST_USER_MEMORY_MAX_NREGIONS) {
+                error_report("vhost-user: more than %d memory regions",
+                             VHOST_USER_MEMORY_MAX_NREGIONS);
+                return -1;
+            }
+            length = MIN(length, reg->memory_size - done);
+            table->regions[n].guest_phys_addr = reg->guest_phys_addr + done;
+            table->regions[n].memory_size = length;
+            table->regions[n].userspace_addr = reg->userspace_addr + done;
+            table->regions[n].mmap_offset = offset;
+            fds[n++] = fd;
+            done += length;
+        }
+    }
+    if (!n) {
+        error_report("vhost-user: guest RAM cannot be shared, "
+                     "use -mem-path with -mem-prealloc");
+        return -1;
+    }
+    table->nregions = n;
+    return n;
+}
+
+static VhostUserRequest vhost_user_request(unsigned long request)
+{
+    switch (request) {
+    case VHOST_GET_FEATURES:
+        return VHOST_USER_GET_FEATURES;
+    case VHOST_SET_FEATURES:
+        return VHOST_USER_SET_FEATURES;
+    case VHOST_SET_OWNER:
+        return VHOST_USER_SET_OWNER;
+    case VHOST_RESET_OWNER:
+        return VHOST_USER_RESET_OWNER;
+    case VHOST_SET_MEM_TABLE:
+        return VHOST_USER_SET_MEM_TABLE;
+    case VHOST_SET_VRING_NUM:
+        return VHOST_USER_SET_VRING_NUM;
+    case VHOST_SET_VRING_ADDR:
+        return VHOST_USER_SET_VRING_ADDR;
+    case VHOST_SET_VRING_BASE:
+        return VHOST_USER_SET_VRING_BASE;
+    case VHOST_GET_VRING_BASE:
+        return VHOST_USER_GET_VRING_BASE;
+    case VHOST_SET_VRING_KICK:
+        return VHOST_USER_SET_VRING_KICK;
+    case VHOST_SET_VRING_CALL:
+        return VHOST_USER_SET_VRING_CALL;
+    case VHOST_NET_SET_BACKEND:
+        return VHOST_USER_NET_SET_BACKEND;
+    default:
+        /* Dirty logging is not supported, migration is blocked instead */
+        return VHOST_USER_NONE;
+    }
+}
+
+int vhost_user_call(struct vhost_dev *dev, unsigned long request, void *arg)
+{
+    VhostUserMsg msg = {
+        .request = vhost_user_request(request),
+        .flags = VHOST_USER_VERSION,
+    };
+    struct vhost_vring_file *file;
+    VhostUserMemory memory;
+    int fds[VHOST_USER_MEMORY_MAX_NREGIONS];
+    int fd_num = 0;
+
+    switch (msg.request) {
+    case VHOST_USER_NONE:
+        errno = ENOSYS;
+        return -1;
+    case VHOST_USER_GET_FEATURES:
+    case VHOST_USER_SET_OWNER:
+    case VHOST_USER_RESET_OWNER:
+        break;
+    case VHOST_USER_SET_FEATURES:
+        msg.payload.u64 = *(uint64_t *)arg;
+        msg.size = sizeof(msg.payload.u64);
+        break;
+    case VHOST_USER_SET_MEM_TABLE:
+        fd_num = vhost_user_mem_table(arg, &memory, fds);
+        if (fd_num < 0) {
+            errno = EINVAL;
+            return -1;
+        }
+        msg.payload.memory = memory;
+        msg.size = offsetof(VhostUserMemory, regions) +
+                   fd_num * sizeof(VhostUserMemoryRegion);
+        break;
+    case VHOST_USER_SET_VRING_NUM:
+    case VHOST_USER_SET_VRING_BASE:
+    case VHOST_USER_GET_VRING_BASE:
+        msg.payload.state = *(struct vhost_vring_state *)arg;
+        msg.size = sizeof(msg.payload.state);
+        break;
+    case VHOST_USER_SET_VRING_ADDR:
+        msg.payload.addr = *(struct vhost_vring_addr *)arg;
+        msg.size = sizeof(msg.payload.addr);
+        break;
+    case VHOST_USER_SET_VRING_KICK:
+    case VHOST_USER_SET_VRING_CALL:
+    case VHOST_USER_NET_SET_BACKEND:
+        file = arg;
+        msg.payload.u64 = file->index & VHOST_USER_VRING_IDX_MASK;
+        if (file->fd < 0) {
+            msg.payload.u64 |= VHOST_USER_VRING_NOFD;
+        } else if (msg.request != VHOST_USER_NET_SET_BACKEND) {
+            /* The backend of the net device is the other process itself */
+            fds[fd_num++] = file->fd;
+        }
+        msg.size = sizeof(msg.payload.u64);
+        break;
+    default:
+        abort();
+    }
+
+    if (vhost_user_write(dev->control, &msg, fds, fd_num) < 0) {
+        return -1;
+    }
+
+    switch (msg.request) {
+    case VHOST_USER_GET_FEATURES:
+        if (vhost_user_read(dev->control, &msg, msg.request) < 0) {
+            return -1;
+        }
+        if (msg.size != sizeof(msg.payload.u64)) {
+            break;
+        }
+        *(uint64_t *)arg = msg.payload.u64;
+        return 0;
+    case VHOST_USER_GET_VRING_BASE:
+        if (vhost_user_read(dev->control, &msg, msg.request) < 0) {
+            return -1;
+        }
+        if (msg.size != sizeof(msg.payload.state)) {
+            break;
+        }
+        *(struct vhost_vring_state *)arg = msg.payload.state;
+        return 0;
+    default:
+        return 0;
+    }
+    error_report("vhost-user: bad reply size %u", msg.size);
+    errno = EPROTO;
+    return -1;
+}
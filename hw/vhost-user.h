@@ -0,0 +1,91 @@
+/*
+ * vhost-user protocol
+ *
+ * Copyright (c) 2012 agent <agent@local>
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ *
+ */
+
+#ifndef VHOST_USER_H
+#define VHOST_USER_H
+
+/*
+ * The vhost ioctls, sent as messages over a Unix socket to a process that
+ * runs the virtqueues instead of the kernel.  Every message starts with
+ * the header below, followed by @size bytes of payload.  Only the
+ * requests that return something get a reply, with the same request and
+ * VHOST_USER_REPLY set in the flags.
+ *
+ * File descriptors travel as SCM_RIGHTS ancillary data of the header:
+ *
+ *   SET_MEM_TABLE      one per region, to be mapped with MAP_SHARED; the
+ *                      region starts @mmap_offset bytes into the file
+ *   SET_VRING_KICK     eventfd written by the guest notifier, unless
+ *   SET_VRING_CALL     eventfd to write to interrupt the guest, unless
+ *                      VHOST_USER_VRING_NOFD is set in @u64
+ *
+ * Ring addresses in SET_VRING_ADDR are addresses in QEMU, and have to be
+ * translated with @userspace_addr of the memory regions; addresses in the
+ * descriptors are guest physical addresses.  The rings of a queue are
+ * only processed between NET_SET_BACKEND with the index and
+ * NET_SET_BACKEND with VHOST_USER_VRING_NOFD set.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <linux/vhost.h>
+
+#define VHOST_USER_MEMORY_MAX_NREGIONS 8
+
+typedef enum VhostUserRequest {
+    VHOST_USER_NONE = 0,
+    VHOST_USER_GET_FEATURES = 1,
+    VHOST_USER_SET_FEATURES = 2,
+    VHOST_USER_SET_OWNER = 3,
+    VHOST_USER_RESET_OWNER = 4,
+    VHOST_USER_SET_MEM_TABLE = 5,
+    VHOST_USER_SET_VRING_NUM = 6,
+    VHOST_USER_SET_VRING_ADDR = 7,
+    VHOST_USER_SET_VRING_BASE = 8,
+    VHOST_USER_GET_VRING_BASE = 9,
+    VHOST_USER_SET_VRING_KICK = 10,
+    VHOST_USER_SET_VRING_CALL = 11,
+    VHOST_USER_NET_SET_BACKEND = 12,
+    VHOST_USER_MAX
+} VhostUserRequest;
+
+typedef struct VhostUserMemoryRegion {
+    uint64_t guest_phys_addr;
+    uint64_t memory_size;
+    uint64_t userspace_addr;
+    uint64_t mmap_offset;
+} VhostUserMemoryRegion;
+
+typedef struct VhostUserMemory {
+    uint32_t nregions;
+    uint32_t padding;
+    VhostUserMemoryRegion regions[VHOST_USER_MEMORY_MAX_NREGIONS];
+} VhostUserMemory;
+
+typedef struct VhostUserMsg {
+    uint32_t request;
+#define VHOST_USER_VERSION      0x1
+#define VHOST_USER_VERSION_MASK 0x3
+#define VHOST_USER_REPLY        (1 << 2)
+    uint32_t flags;
+    uint32_t size;
+    union {
+#define VHOST_USER_VRING_IDX_MASK 0xff
+#define VHOST_USER_VRING_NOFD     (1 << 8)
+        uint64_t u64;
+        struct vhost_vring_state state;
+        struct vhost_vring_addr addr;
+        VhostUserMemory memory;
+    } payload;
+} __attribute__((packed)) VhostUserMsg;
+
+#define VHOST_USER_HDR_SIZE offsetof(VhostUserMsg, payload)
+
+#endif
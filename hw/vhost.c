@@ -17,9 +17,18 @@
 #include "vhost.h"
 #include "hw/hw.h"
 #include "range.h"
+#include "qemu-error.h"
 #include <linux/vhost.h>
 #include "exec-memory.h"
 
+int vhost_call(struct vhost_dev *dev, unsigned long request, void *arg)
+{
+    if (dev->backend_type == VHOST_BACKEND_TYPE_USER) {
+        return vhost_user_call(dev, request, arg);
+    }
+    return ioctl(dev->control, request, arg);
+}
+
 static void vhost_dev_sync_region(struct vhost_dev *dev,
                                   MemoryRegionSection *section,
                                   uint64_t mfirst, uint64_t mlast,
@@ -275,7 +284,7 @@ static inline void vhost_dev_log_resize(struct vhost_dev* dev, uint64_t size)
         log = NULL;
     }
     log_base = (uint64_t)(unsigned long)log;
-    r = ioctl(dev->control, VHOST_SET_LOG_BASE, &log_base);
+    r = vhost_call(dev, VHOST_SET_LOG_BASE, &log_base);
     assert(r >= 0);
     for (i = 0; i < dev->n_mem_sections; ++i) {
         /* Sync only the range covered by the old log */
@@ -356,6 +365,27 @@ static bool vhost_dev_cmp_memory(struct vhost_dev *dev,
     return uaddr != reg->userspace_addr + start_addr - reg->guest_phys_addr;
 }
 
+static void vhost_error_bh(void *opaque)
+{
+    struct vhost_dev *dev = opaque;
+
+    if (dev->started && dev->backend_error) {
+        dev->backend_error(dev);
+    }
+}
+
+/* A backend can fail requests at any time, e.g. a vhost-user process that
+ * exited, or one that cannot map as many regions as the new memory table
+ * has.  The caller may be in the middle of a memory transaction, so vhost
+ * is stopped later, from a bottom half.
+ */
+static void vhost_backend_failed(struct vhost_dev *dev, const char *what)
+{
+    error_report("vhost: %s failed: %s; stopping vhost", what,
+                 strerror(errno));
+    qemu_bh_schedule(dev->error_bh);
+}
+
 static void vhost_set_memory(MemoryListener *listener,
                              MemoryRegionSection *section,
                              bool add)
@@ -412,8 +442,10 @@ static void vhost_set_memory(MemoryListener *listener,
     }
 
     if (!dev->log_enabled) {
-        r = ioctl(dev->control, VHOST_SET_MEM_TABLE, dev->mem);
-        assert(r >= 0);
+        r = vhost_call(dev, VHOST_SET_MEM_TABLE, dev->mem);
+        if (r < 0) {
+            vhost_backend_failed(dev, "setting the memory table");
+        }
         return;
     }
     log_size = vhost_get_log_size(dev);
@@ -424,8 +456,11 @@ static void vhost_set_memory(MemoryListener *listener,
     if (dev->log_size < log_size) {
         vhost_dev_log_resize(dev, log_size + VHOST_LOG_BUFFER);
     }
-    r = ioctl(dev->control, VHOST_SET_MEM_TABLE, dev->mem);
-    assert(r >= 0);
+    r = vhost_call(dev, VHOST_SET_MEM_TABLE, dev->mem);
+    if (r < 0) {
+        vhost_backend_failed(dev, "setting the memory table");
+        return;
+    }
     /* To log less, can only decrease log size after table update. */
     if (dev->log_size > log_size + VHOST_LOG_BUFFER) {
         vhost_dev_log_resize(dev, log_size);
@@ -503,7 +538,7 @@ static int vhost_virtqueue_set_addr(struct vhost_dev *dev,
         .log_guest_addr = vq->used_phys,
         .flags = enable_log ? (1 << VHOST_VRING_F_LOG) : 0,
     };
-    int r = ioctl(dev->control, VHOST_SET_VRING_ADDR, &addr);
+    int r = vhost_call(dev, VHOST_SET_VRING_ADDR, &addr);
     if (r < 0) {
         return -errno;
     }
@@ -517,7 +552,7 @@ static int vhost_dev_set_features(struct vhost_dev *dev, bool enable_log)
     if (enable_log) {
         features |= 0x1 << VHOST_F_LOG_ALL;
     }
-    r = ioctl(dev->control, VHOST_SET_FEATURES, &features);
+    r = vhost_call(dev, VHOST_SET_FEATURES, &features);
     return r < 0 ? -errno : 0;
 }
 
@@ -629,13 +664,13 @@ static int vhost_virtqueue_init(struct vhost_dev *dev,
     struct VirtQueue *vvq = virtio_get_queue(vdev, idx);
 
     vq->num = state.num = virtio_queue_get_num(vdev, idx);
-    r = ioctl(dev->control, VHOST_SET_VRING_NUM, &state);
+    r = vhost_call(dev, VHOST_SET_VRING_NUM, &state);
     if (r) {
         return -errno;
     }
 
     state.num = virtio_queue_get_last_avail_idx(vdev, idx);
-    r = ioctl(dev->control, VHOST_SET_VRING_BASE, &state);
+    r = vhost_call(dev, VHOST_SET_VRING_BASE, &state);
     if (r) {
         return -errno;
     }
@@ -676,14 +711,14 @@ static int vhost_virtqueue_init(struct vhost_dev *dev,
         goto fail_alloc;
     }
     file.fd = event_notifier_get_fd(virtio_queue_get_host_notifier(vvq));
-    r = ioctl(dev->control, VHOST_SET_VRING_KICK, &file);
+    r = vhost_call(dev, VHOST_SET_VRING_KICK, &file);
     if (r) {
         r = -errno;
         goto fail_kick;
     }
 
     file.fd = event_notifier_get_fd(virtio_queue_get_guest_notifier(vvq));
-    r = ioctl(dev->control, VHOST_SET_VRING_CALL, &file);
+    r = vhost_call(dev, VHOST_SET_VRING_CALL, &file);
     if (r) {
         r = -errno;
         goto fail_call;
@@ -718,13 +753,15 @@ static void vhost_virtqueue_cleanup(struct vhost_dev *dev,
         .index = idx,
     };
     int r;
-    r = ioctl(dev->control, VHOST_GET_VRING_BASE, &state);
+    r = vhost_call(dev, VHOST_GET_VRING_BASE, &state);
     if (r < 0) {
         fprintf(stderr, "vhost VQ %d ring restore failed: %d\n", idx, r);
         fflush(stderr);
+    } else {
+        virtio_queue_set_last_avail_idx(vdev, idx, state.num);
     }
-    virtio_queue_set_last_avail_idx(vdev, idx, state.num);
-    assert (r >= 0);
+    /* Unlike the kernel, a vhost-user process can go away under us */
+    assert(r >= 0 || dev->backend_type == VHOST_BACKEND_TYPE_USER);
     cpu_physical_memory_unmap(vq->ring, virtio_queue_get_ring_size(vdev, idx),
                               0, virtio_queue_get_ring_size(vdev, idx));
     cpu_physical_memory_unmap(vq->used, virtio_queue_get_used_size(vdev, idx),
@@ -747,10 +784,12 @@ static void vhost_eventfd_del(MemoryListener *listener,
 {
 }
 
-int vhost_dev_init(struct vhost_dev *hdev, int devfd, bool force)
+int vhost_dev_init(struct vhost_dev *hdev, int devfd,
+                   VhostBackendType backend_type, bool force)
 {
     uint64_t features;
     int r;
+    hdev->backend_type = backend_type;
     if (devfd >= 0) {
         hdev->control = devfd;
     } else {
@@ -759,12 +798,12 @@ int vhost_dev_init(struct vhost_dev *hdev, int devfd, bool force)
             return -errno;
         }
     }
-    r = ioctl(hdev->control, VHOST_SET_OWNER, NULL);
+    r = vhost_call(hdev, VHOST_SET_OWNER, NULL);
     if (r < 0) {
         goto fail;
     }
 
-    r = ioctl(hdev->control, VHOST_GET_FEATURES, &features);
+    r = vhost_call(hdev, VHOST_GET_FEATURES, &features);
     if (r < 0) {
         goto fail;
     }
@@ -792,6 +831,8 @@ int vhost_dev_init(struct vhost_dev *hdev, int devfd, bool force)
     hdev->log_size = 0;
     hdev->log_enabled = false;
     hdev->started = false;
+    hdev->backend_error = NULL;
+    hdev->error_bh = qemu_bh_new(vhost_error_bh, hdev);
     memory_listener_register(&hdev->memory_listener, NULL);
     hdev->force = force;
     return 0;
@@ -804,6 +845,7 @@ fail:
 void vhost_dev_cleanup(struct vhost_dev *hdev)
 {
     memory_listener_unregister(&hdev->memory_listener);
+    qemu_bh_delete(hdev->error_bh);
     g_free(hdev->mem);
     g_free(hdev->mem_sections);
     close(hdev->control);
@@ -889,7 +931,7 @@ int vhost_dev_start(struct vhost_dev *hdev, VirtIODevice *vdev)
     if (r < 0) {
         goto fail_features;
     }
-    r = ioctl(hdev->control, VHOST_SET_MEM_TABLE, hdev->mem);
+    r = vhost_call(hdev, VHOST_SET_MEM_TABLE, hdev->mem);
     if (r < 0) {
         r = -errno;
         goto fail_mem;
@@ -905,11 +947,13 @@ int vhost_dev_start(struct vhost_dev *hdev, VirtIODevice *vdev)
     }
 
     if (hdev->log_enabled) {
+        uint64_t log_base;
+
         hdev->log_size = vhost_get_log_size(hdev);
         hdev->log = hdev->log_size ?
             g_malloc0(hdev->log_size * sizeof *hdev->log) : NULL;
-        r = ioctl(hdev->control, VHOST_SET_LOG_BASE,
-                  (uint64_t)(unsigned long)hdev->log);
+        log_base = (uint64_t)(unsigned long)hdev->log;
+        r = vhost_call(hdev, VHOST_SET_LOG_BASE, &log_base);
         if (r < 0) {
             r = -errno;
             goto fail_log;
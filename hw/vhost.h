@@ -25,9 +25,19 @@ typedef unsigned long vhost_log_chunk_t;
 #define VHOST_LOG_BITS (8 * sizeof(vhost_log_chunk_t))
 #define VHOST_LOG_CHUNK (VHOST_LOG_PAGE * VHOST_LOG_BITS)
 
+/* Who runs the virtqueues: the kernel, driven with ioctls on @control, or
+ * another process, driven with vhost-user messages (see vhost-user.h) on
+ * the Unix socket @control.
+ */
+typedef enum VhostBackendType {
+    VHOST_BACKEND_TYPE_KERNEL,
+    VHOST_BACKEND_TYPE_USER,
+} VhostBackendType;
+
 struct vhost_memory;
 struct vhost_dev {
     MemoryListener memory_listener;
+    VhostBackendType backend_type;
     int control;
     struct vhost_memory *mem;
     int n_mem_sections;
@@ -42,9 +52,14 @@ struct vhost_dev {
     vhost_log_chunk_t *log;
     unsigned long long log_size;
     bool force;
+    /* Called from a bottom half when the backend fails while started, e.g.
+     * rejects a new memory table; the owner is expected to stop vhost.  */
+    void (*backend_error)(struct vhost_dev *hdev);
+    QEMUBH *error_bh;
 };
 
-int vhost_dev_init(struct vhost_dev *hdev, int devfd, bool force);
+int vhost_dev_init(struct vhost_dev *hdev, int devfd,
+                   VhostBackendType backend_type, bool force);
 void vhost_dev_cleanup(struct vhost_dev *hdev);
 bool vhost_dev_query(struct vhost_dev *hdev, VirtIODevice *vdev);
 int vhost_dev_start(struct vhost_dev *hdev, VirtIODevice *vdev);
@@ -52,4 +67,9 @@ void vhost_dev_stop(struct vhost_dev *hdev, VirtIODevice *vdev);
 int vhost_dev_enable_notifiers(struct vhost_dev *hdev, VirtIODevice *vdev);
 void vhost_dev_disable_notifiers(struct vhost_dev *hdev, VirtIODevice *vdev);
 
+/* Issue a vhost ioctl @request to the backend; returns -1 and sets errno
+ * on failure, like ioctl.  */
+int vhost_call(struct vhost_dev *dev, unsigned long request, void *arg);
+int vhost_user_call(struct vhost_dev *dev, unsigned long request, void *arg);
+
 #endif
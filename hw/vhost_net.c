@@ -80,40 +80,95 @@ void vhost_net_ack_features(struct vhost_net *net, unsigned features)
     }
 }
 
-static int vhost_net_get_fd(VLANClientState *backend)
+/* For vhost-user, @devfd is the socket to the process that does the
+ * work of both vhost and the backend.  */
+static int vhost_net_get_fd(VLANClientState *backend, int devfd)
 {
     switch (backend->info->type) {
     case NET_CLIENT_TYPE_TAP:
         return tap_get_fd(backend);
+    case NET_CLIENT_TYPE_VHOST_USER:
+        return devfd;
     default:
-        fprintf(stderr, "vhost-net requires tap backend\n");
+        fprintf(stderr, "vhost-net requires tap or vhost-user backend\n");
         return -EBADFD;
     }
 }
 
+static bool vhost_net_is_tap(struct vhost_net *net)
+{
+    return net->vc->info->type == NET_CLIENT_TYPE_TAP;
+}
+
+static void vhost_net_set_vnet_hdr_len(struct vhost_net *net, int len)
+{
+    if (vhost_net_is_tap(net)) {
+        tap_set_vnet_hdr_len(net->vc, len);
+    }
+}
+
+/* Stop or restart reading from the backend in QEMU */
+static void vhost_net_backend_poll(struct vhost_net *net, bool enable)
+{
+    if (!vhost_net_is_tap(net)) {
+        return;
+    }
+    net->vc->info->poll(net->vc, enable);
+    if (!enable) {
+        qemu_set_fd_handler(net->backend, NULL, NULL, NULL);
+    }
+}
+
+/* Take the link of the backend down; virtio-net stops vhost for a peer
+ * whose link is down, and drops what the guest sends.
+ */
+static void vhost_net_backend_error(struct vhost_dev *hdev)
+{
+    struct vhost_net *net = container_of(hdev, struct vhost_net, dev);
+    VLANClientState *vc = net->vc;
+
+    vc->link_down = 1;
+    if (vc->info->link_status_changed) {
+        vc->info->link_status_changed(vc);
+    }
+    if (vc->peer && vc->peer->info->link_status_changed) {
+        vc->peer->info->link_status_changed(vc->peer);
+    }
+}
+
 struct vhost_net *vhost_net_init(VLANClientState *backend, int devfd,
                                  bool force)
 {
+    VhostBackendType backend_type = VHOST_BACKEND_TYPE_KERNEL;
     int r;
     struct vhost_net *net = g_malloc(sizeof *net);
     if (!backend) {
         fprintf(stderr, "vhost-net requires backend to be setup\n");
         goto fail;
     }
-    r = vhost_net_get_fd(backend);
+    r = vhost_net_get_fd(backend, devfd);
     if (r < 0) {
         goto fail;
     }
     net->vc = backend;
-    net->dev.backend_features = tap_has_vnet_hdr(backend) ? 0 :
-        (1 << VHOST_NET_F_VIRTIO_NET_HDR);
     net->backend = r;
+    if (vhost_net_is_tap(net)) {
+        net->dev.backend_features = tap_has_vnet_hdr(backend) ? 0 :
+            (1 << VHOST_NET_F_VIRTIO_NET_HDR);
+    } else {
+        /* The other process sees the virtio-net header as the guest
+         * wrote it */
+        backend_type = VHOST_BACKEND_TYPE_USER;
+        net->dev.backend_features = 0;
+    }
 
-    r = vhost_dev_init(&net->dev, devfd, force);
+    r = vhost_dev_init(&net->dev, devfd, backend_type, force);
     if (r < 0) {
         goto fail;
     }
-    if (!tap_has_vnet_hdr_len(backend,
+    net->dev.backend_error = vhost_net_backend_error;
+    if (vhost_net_is_tap(net) &&
+        !tap_has_vnet_hdr_len(backend,
                               sizeof(struct virtio_net_hdr_mrg_rxbuf))) {
         net->dev.features &= ~(1 << VIRTIO_NET_F_MRG_RXBUF);
     }
@@ -151,8 +206,8 @@ int vhost_net_start(struct vhost_net *net,
         goto fail_notifiers;
     }
     if (net->dev.acked_features & (1 << VIRTIO_NET_F_MRG_RXBUF)) {
-        tap_set_vnet_hdr_len(net->vc,
-                             sizeof(struct virtio_net_hdr_mrg_rxbuf));
+        vhost_net_set_vnet_hdr_len(net,
+                                   sizeof(struct virtio_net_hdr_mrg_rxbuf));
     }
 
     r = vhost_dev_start(&net->dev, dev);
@@ -160,11 +215,10 @@ int vhost_net_start(struct vhost_net *net,
         goto fail_start;
     }
 
-    net->vc->info->poll(net->vc, false);
-    qemu_set_fd_handler(net->backend, NULL, NULL, NULL);
+    vhost_net_backend_poll(net, false);
     file.fd = net->backend;
     for (file.index = 0; file.index < net->dev.nvqs; ++file.index) {
-        r = ioctl(net->dev.control, VHOST_NET_SET_BACKEND, &file);
+        r = vhost_call(&net->dev, VHOST_NET_SET_BACKEND, &file);
         if (r < 0) {
             r = -errno;
             goto fail;
@@ -174,13 +228,14 @@ int vhost_net_start(struct vhost_net *net,
 fail:
     file.fd = -1;
     while (file.index-- > 0) {
-        int r = ioctl(net->dev.control, VHOST_NET_SET_BACKEND, &file);
-        assert(r >= 0);
+        int r = vhost_call(&net->dev, VHOST_NET_SET_BACKEND, &file);
+        /* A vhost-user process may be gone already */
+        assert(r >= 0 || !vhost_net_is_tap(net));
     }
-    net->vc->info->poll(net->vc, true);
+    vhost_net_backend_poll(net, true);
     vhost_dev_stop(&net->dev, dev);
     if (net->dev.acked_features & (1 << VIRTIO_NET_F_MRG_RXBUF)) {
-        tap_set_vnet_hdr_len(net->vc, sizeof(struct virtio_net_hdr));
+        vhost_net_set_vnet_hdr_len(net, sizeof(struct virtio_net_hdr));
     }
 fail_start:
     vhost_dev_disable_notifiers(&net->dev, dev);
@@ -194,13 +249,14 @@ void vhost_net_stop(struct vhost_net *net,
     struct vhost_vring_file file = { .fd = -1 };
 
     for (file.index = 0; file.index < net->dev.nvqs; ++file.index) {
-        int r = ioctl(net->dev.control, VHOST_NET_SET_BACKEND, &file);
-        assert(r >= 0);
+        int r = vhost_call(&net->dev, VHOST_NET_SET_BACKEND, &file);
+        /* A vhost-user process may be gone already */
+        assert(r >= 0 || !vhost_net_is_tap(net));
     }
-    net->vc->info->poll(net->vc, true);
+    vhost_net_backend_poll(net, true);
     vhost_dev_stop(&net->dev, dev);
     if (net->dev.acked_features & (1 << VIRTIO_NET_F_MRG_RXBUF)) {
-        tap_set_vnet_hdr_len(net->vc, sizeof(struct virtio_net_hdr));
+        vhost_net_set_vnet_hdr_len(net, sizeof(struct virtio_net_hdr));
     }
     vhost_dev_disable_notifiers(&net->dev, dev);
 }
@@ -209,7 +265,7 @@ void vhost_net_cleanup(struct vhost_net *net)
 {
     vhost_dev_cleanup(&net->dev);
     if (net->dev.acked_features & (1 << VIRTIO_NET_F_MRG_RXBUF)) {
-        tap_set_vnet_hdr_len(net->vc, sizeof(struct virtio_net_hdr));
+        vhost_net_set_vnet_hdr_len(net, sizeof(struct virtio_net_hdr));
     }
     g_free(net);
 }
@@ -22,20 +22,36 @@
 #include "virtio-balloon.h"
 #include "kvm.h"
 #include "exec-memory.h"
+#include "qemu-timer.h"
 
 #if defined(__linux__)
 #include <sys/mman.h>
 #endif
 
+enum {
+    FREE_PAGE_HINT_DONE,        /* no hinting, the guest may reuse pages */
+    FREE_PAGE_HINT_REQUESTED,   /* cmd id sent, waiting for the guest */
+    FREE_PAGE_HINT_RUNNING,     /* the guest is sending hints */
+    FREE_PAGE_HINT_STOPPED,     /* the guest is through, pages still held */
+};
+
 typedef struct VirtIOBalloon
 {
     VirtIODevice vdev;
-    VirtQueue *ivq, *dvq, *svq;
+    VirtQueue *ivq, *dvq, *svq, *fvq;
     uint32_t num_pages;
     uint32_t actual;
     uint64_t stats[VIRTIO_BALLOON_S_NR];
     VirtQueueElement stats_vq_elem;
     size_t stats_vq_offset;
+    bool stats_vq_elem_held;
+    bool stats_valid;
+    VirtIOBalloonConf conf;
+    QEMUTimer *auto_timer;
+    uint64_t target;
+    uint64_t last_swap_in;
+    uint32_t free_page_cmd_id;
+    int free_page_hint;
     DeviceState *qdev;
 } VirtIOBalloon;
 
@@ -44,15 +60,54 @@ static VirtIOBalloon *to_virtio_balloon(VirtIODevice *vdev)
     return (VirtIOBalloon *)vdev;
 }
 
-static void balloon_page(void *addr, int deflate)
+static void balloon_page(void *addr, size_t len, int deflate)
 {
 #if defined(__linux__)
     if (!kvm_enabled() || kvm_has_sync_mmu())
-        qemu_madvise(addr, TARGET_PAGE_SIZE,
+        qemu_madvise(addr, len,
                 deflate ? QEMU_MADV_WILLNEED : QEMU_MADV_DONTNEED);
 #endif
 }
 
+/* Guests usually hand over pages that are adjacent in host memory, in
+ * either order.  Collect them into runs so that the host sees one madvise
+ * per run instead of one per page.
+ */
+typedef struct BalloonRun {
+    uint8_t *start;
+    size_t len;
+    int deflate;
+} BalloonRun;
+
+static void balloon_run_flush(BalloonRun *run)
+{
+    if (run->len) {
+        balloon_page(run->start, run->len, run->deflate);
+        run->len = 0;
+    }
+}
+
+static void balloon_run_add(BalloonRun *run, uint8_t *addr)
+{
+    if (run->len) {
+        if (addr == run->start + run->len) {
+            run->len += TARGET_PAGE_SIZE;
+            return;
+        }
+        if (addr + TARGET_PAGE_SIZE == run->start) {
+            run->start = addr;
+            run->len += TARGET_PAGE_SIZE;
+            return;
+        }
+        if (addr >= run->start && addr < run->start + run->len) {
+            return;
+        }
+    }
+    balloon_run_flush(run);
+    run->start = addr;
+    run->len = TARGET_PAGE_SIZE;
+}
+
 /*
  * reset_stats - Mark all items in the stats array as unset
  *
@@ -72,6 +127,8 @@ static void virtio_balloon_handle_output(VirtIODevice *vdev, VirtQueue *vq)
     VirtIOBalloon *s = to_virtio_balloon(vdev);
     VirtQueueElement elem;
     MemoryRegionSection section;
+    BalloonRun run = { .len = 0, .deflate = !!(vq == s->dvq) };
+    bool pushed = false;
 
     while (virtqueue_pop(vq, &elem)) {
         size_t offset = 0;
@@ -92,15 +149,158 @@ static void virtio_balloon_handle_output(VirtIODevice *vdev, VirtQueue *vq)
             /* Using memory_region_get_ram_ptr is bending the rules a bit, but
                should be OK because we only want a single page.  */
             addr = section.offset_within_region;
-            balloon_page(memory_region_get_ram_ptr(section.mr) + addr,
-                         !!(vq == s->dvq));
+            balloon_run_add(&run,
+                            memory_region_get_ram_ptr(section.mr) + addr);
         }
 
         virtqueue_push(vq, &elem, offset);
+        pushed = true;
+    }
+
+    /* The guest does not touch ballooned pages before they are deflated
+     * again, and deflating goes through this function too, so the last run
+     * can be discarded after the buffers have been returned.
+     */
+    balloon_run_flush(&run);
+    if (pushed) {
+        virtio_notify(vdev, vq);
+    }
+}
+
+/* Clear the migration dirty bits of a range of guest memory that the guest
+ * reported as free; it will not be sent unless it is written to again.
+ */
+static void balloon_free_page_hint(target_phys_addr_t pa, uint64_t len)
+{
+    MemoryRegionSection section;
+
+    while (len) {
+        section = memory_region_find(get_system_memory(), pa, len);
+        if (!section.size) {
+            return;
+        }
+        if (memory_region_is_ram(section.mr)) {
+            memory_region_reset_dirty(section.mr,
+                                      section.offset_within_region,
+                                      section.size, DIRTY_MEMORY_MIGRATION);
+        }
+        len -= MIN(len, section.offset_within_address_space + section.size
+                        - pa);
+        pa = section.offset_within_address_space + section.size;
+    }
+}
+
+static void virtio_balloon_handle_free_page(VirtIODevice *vdev, VirtQueue *vq)
+{
+    VirtIOBalloon *s = to_virtio_balloon(vdev);
+    VirtQueueElement elem;
+    bool pushed = false;
+
+    while (virtqueue_pop(vq, &elem)) {
+        uint32_t id;
+        int i;
+
+        if (iov_to_buf(elem.out_sg, elem.out_num, &id, 0, 4) == 4) {
+            id = le32_to_cpu(id);
+            if (id == s->free_page_cmd_id &&
+                s->free_page_hint == FREE_PAGE_HINT_REQUESTED) {
+                s->free_page_hint = FREE_PAGE_HINT_RUNNING;
+            } else if (id == VIRTIO_BALLOON_CMD_ID_STOP &&
+                       s->free_page_hint == FREE_PAGE_HINT_RUNNING) {
+                s->free_page_hint = FREE_PAGE_HINT_STOPPED;
+            }
+        }
+
+        /* Hints for an old command may come from before the dirty log was
+         * started; only trust those sent while our command is running.
+         */
+        if (s->free_page_hint == FREE_PAGE_HINT_RUNNING) {
+            for (i = 0; i < elem.in_num; i++) {
+                balloon_free_page_hint(elem.in_addr[i], elem.in_sg[i].iov_len);
+            }
+        }
+
+        virtqueue_push(vq, &elem, 0);
+        pushed = true;
+    }
+
+    if (pushed) {
         virtio_notify(vdev, vq);
     }
 }
 
+static void virtio_balloon_free_page_hint(void *opaque, bool start)
+{
+    VirtIOBalloon *s = opaque;
+
+    if (!(s->vdev.guest_features & (1 << VIRTIO_BALLOON_F_FREE_PAGE_HINT))) {
+        return;
+    }
+
+    if (start) {
+        if (++s->free_page_cmd_id < VIRTIO_BALLOON_CMD_ID_MIN) {
+            s->free_page_cmd_id = VIRTIO_BALLOON_CMD_ID_MIN;
+        }
+        s->free_page_hint = FREE_PAGE_HINT_REQUESTED;
+    } else {
+        s->free_page_hint = FREE_PAGE_HINT_DONE;
+    }
+    virtio_notify_config(&s->vdev);
+}
+
+static ram_addr_t virtio_balloon_guest_size(VirtIOBalloon *s)
+{
+    return ram_size - ((uint64_t)s->actual << VIRTIO_BALLOON_PFN_SHIFT);
+}
+
+static void virtio_balloon_set_size(VirtIOBalloon *s, ram_addr_t size)
+{
+    uint32_t num_pages = (ram_size - size) >> VIRTIO_BALLOON_PFN_SHIFT;
+
+    if (num_pages != s->num_pages) {
+        s->num_pages = num_pages;
+        virtio_notify_config(&s->vdev);
+    }
+}
+
+/*
+ * virtio_balloon_auto - Resize the guest from its memory statistics
+ *
+ * Aim for conf.auto_free percent of the guest's memory to be free.  Give
+ * memory back at once when the guest runs short or starts swapping in, but
+ * take it away only half of the excess at a time, so that a short-lived
+ * drop in usage does not make the guest swap right afterwards.  The size
+ * stays between conf.auto_min and the last target set with the balloon
+ * command.
+ */
+static void virtio_balloon_auto(VirtIOBalloon *s)
+{
+    uint64_t free = s->stats[VIRTIO_BALLOON_S_MEMFREE];
+    uint64_t total = s->stats[VIRTIO_BALLOON_S_MEMTOT];
+    uint64_t swap_in = s->stats[VIRTIO_BALLOON_S_SWAP_IN];
+    uint64_t size = virtio_balloon_guest_size(s);
+    uint64_t want, min;
+
+    if (free == -1 || total == -1 || !total) {
+        return;
+    }
+
+    want = total * s->conf.auto_free / 100;
+    if (swap_in != -1 && s->last_swap_in != -1 && swap_in > s->last_swap_in) {
+        size += want;
+    } else if (free < want) {
+        size += want - free;
+    } else if (free > want + want / 4) {
+        size -= MIN(size, (free - want) / 2);
+    }
+    s->last_swap_in = swap_in;
+
+    min = MIN(s->conf.auto_min, s->target);
+    size = MAX(size, min);
+    size = MIN(size, s->target);
+    virtio_balloon_set_size(s, size & TARGET_PAGE_MASK);
+}
+
 static void virtio_balloon_receive_stats(VirtIODevice *vdev, VirtQueue *vq)
 {
     VirtIOBalloon *s = DO_UPCAST(VirtIOBalloon, vdev, vdev);
@@ -128,17 +328,68 @@ static void virtio_balloon_receive_stats(VirtIODevice *vdev, VirtQueue *vq)
             s->stats[tag] = val;
     }
     s->stats_vq_offset = offset;
+    s->stats_vq_elem_held = true;
+    s->stats_valid = true;
+
+    if (s->conf.auto_interval) {
+        virtio_balloon_auto(s);
+    }
+}
+
+/* Give the stats buffer back to the guest, which refills it and queues it
+ * again with fresh values.
+ */
+static void virtio_balloon_request_stats(VirtIOBalloon *s)
+{
+    if (!s->stats_vq_elem_held) {
+        /* After migration the buffer is back in the queue (see
+         * virtio_balloon_load); take it and ask for fresh stats at once.
+         */
+        virtio_balloon_receive_stats(&s->vdev, s->svq);
+        if (!s->stats_vq_elem_held) {
+            return;
+        }
+    }
+    s->stats_vq_elem_held = false;
+    virtqueue_push(s->svq, &s->stats_vq_elem, s->stats_vq_offset);
+    virtio_notify(&s->vdev, s->svq);
+}
+
+static void virtio_balloon_auto_timer(void *opaque)
+{
+    VirtIOBalloon *s = opaque;
+
+    if (s->vdev.guest_features & (1 << VIRTIO_BALLOON_F_STATS_VQ)) {
+        virtio_balloon_request_stats(s);
+    }
+    qemu_mod_timer(s->auto_timer, qemu_get_clock_ms(vm_clock) +
+                   s->conf.auto_interval * 1000LL);
 }
 
 static void virtio_balloon_get_config(VirtIODevice *vdev, uint8_t *config_data)
 {
     VirtIOBalloon *dev = to_virtio_balloon(vdev);
     struct virtio_balloon_config config;
+    uint32_t cmd_id;
 
     config.num_pages = cpu_to_le32(dev->num_pages);
     config.actual = cpu_to_le32(dev->actual);
 
-    memcpy(config_data, &config, 8);
+    switch (dev->free_page_hint) {
+    case FREE_PAGE_HINT_REQUESTED:
+        cmd_id = dev->free_page_cmd_id;
+        break;
+    case FREE_PAGE_HINT_DONE:
+        cmd_id = VIRTIO_BALLOON_CMD_ID_DONE;
+        break;
+    default:
+        cmd_id = VIRTIO_BALLOON_CMD_ID_STOP;
+        break;
+    }
+    config.free_page_hint_cmd_id = cpu_to_le32(cmd_id);
+    config.poison_val = 0;
+
+    memcpy(config_data, &config, dev->vdev.config_len);
 }
 
 static void virtio_balloon_set_config(VirtIODevice *vdev,
@@ -152,37 +403,65 @@ static void virtio_balloon_set_config(VirtIODevice *vdev,
 
 static uint32_t virtio_balloon_get_features(VirtIODevice *vdev, uint32_t f)
 {
+    VirtIOBalloon *dev = to_virtio_balloon(vdev);
+
     f |= (1 << VIRTIO_BALLOON_F_STATS_VQ);
+    if (dev->fvq) {
+        f |= (1 << VIRTIO_BALLOON_F_FREE_PAGE_HINT);
+    }
     return f;
 }
 
 static void virtio_balloon_stat(void *opaque, BalloonInfo *info)
 {
     VirtIOBalloon *dev = opaque;
+    uint64_t *stats = dev->stats;
 
-#if 0
-    /* Disable guest-provided stats for now. For more details please check:
-     * https://bugzilla.redhat.com/show_bug.cgi?id=623903
-     *
-     * If you do enable it (which is probably not going to happen as we
-     * need a new command for it), remember that you also need to fill the
-     * appropriate members of the BalloonInfo structure so that the stats
-     * are returned to the client.
+    info->actual = virtio_balloon_guest_size(dev);
+
+    /* Guest statistics are only polled by automatic ballooning, and never
+     * synchronously (see https://bugzilla.redhat.com/show_bug.cgi?id=623903);
+     * report the last ones the guest sent.
      */
-    if (dev->vdev.guest_features & (1 << VIRTIO_BALLOON_F_STATS_VQ)) {
-        virtqueue_push(dev->svq, &dev->stats_vq_elem, dev->stats_vq_offset);
-        virtio_notify(&dev->vdev, dev->svq);
+    if (!dev->stats_valid ||
+        !(dev->vdev.guest_features & (1 << VIRTIO_BALLOON_F_STATS_VQ))) {
         return;
     }
-#endif
+    if (stats[VIRTIO_BALLOON_S_SWAP_IN] != -1) {
+        info->has_mem_swapped_in = true;
+        info->mem_swapped_in = stats[VIRTIO_BALLOON_S_SWAP_IN];
+    }
+    if (stats[VIRTIO_BALLOON_S_SWAP_OUT] != -1) {
+        info->has_mem_swapped_out = true;
+        info->mem_swapped_out = stats[VIRTIO_BALLOON_S_SWAP_OUT];
+    }
+    if (stats[VIRTIO_BALLOON_S_MAJFLT] != -1) {
+        info->has_major_page_faults = true;
+        info->major_page_faults = stats[VIRTIO_BALLOON_S_MAJFLT];
+    }
+    if (stats[VIRTIO_BALLOON_S_MINFLT] != -1) {
+        info->has_minor_page_faults = true;
+        info->minor_page_faults = stats[VIRTIO_BALLOON_S_MINFLT];
+    }
+    if (stats[VIRTIO_BALLOON_S_MEMFREE] != -1) {
+        info->has_free_mem = true;
+        info->free_mem = stats[VIRTIO_BALLOON_S_MEMFREE];
+    }
+    if (stats[VIRTIO_BALLOON_S_MEMTOT] != -1) {
+        info->has_total_mem = true;
+        info->total_mem = stats[VIRTIO_BALLOON_S_MEMTOT];
+    }
+}
 
-    /* Stats are not supported.  Clear out any stale values that might
-     * have been set by a more featureful guest kernel.
-     */
-    reset_stats(dev);
+static void virtio_balloon_reset(VirtIODevice *vdev)
+{
+    VirtIOBalloon *s = to_virtio_balloon(vdev);
 
-    info->actual = ram_size - ((uint64_t) dev->actual <<
-                               VIRTIO_BALLOON_PFN_SHIFT);
+    s->stats_vq_elem_held = false;
+    s->stats_valid = false;
+    s->last_swap_in = -1;
+    s->free_page_hint = FREE_PAGE_HINT_DONE;
+    reset_stats(s);
 }
 
 static void virtio_balloon_to_target(void *opaque, ram_addr_t target)
@@ -193,11 +472,76 @@ static void virtio_balloon_to_target(void *opaque, ram_addr_t target)
         target = ram_size;
     }
     if (target) {
+        /* With automatic ballooning this is the most the guest gets */
+        dev->target = target;
         dev->num_pages = (ram_size - target) >> VIRTIO_BALLOON_PFN_SHIFT;
         virtio_notify_config(&dev->vdev);
     }
 }
 
+static bool virtio_balloon_free_page_hint_needed(void *opaque)
+{
+    VirtIOBalloon *s = opaque;
+
+    return s->fvq != NULL;
+}
+
+static const VMStateDescription vmstate_virtio_balloon_free_page_hint = {
+    .name = "virtio-balloon/free-page-hint",
+    .version_id = 1,
+    .minimum_version_id = 1,
+    .minimum_version_id_old = 1,
+    .fields = (VMStateField[]) {
+        VMSTATE_UINT32(free_page_cmd_id, VirtIOBalloon),
+        VMSTATE_INT32(free_page_hint, VirtIOBalloon),
+        VMSTATE_END_OF_LIST()
+    }
+};
+
+static bool virtio_balloon_auto_needed(void *opaque)
+{
+    VirtIOBalloon *s = opaque;
+
+    return s->conf.auto_interval != 0;
+}
+
+static const VMStateDescription vmstate_virtio_balloon_auto = {
+    .name = "virtio-balloon/auto",
+    .version_id = 1,
+    .minimum_version_id = 1,
+    .minimum_version_id_old = 1,
+    .fields = (VMStateField[]) {
+        VMSTATE_UINT64(target, VirtIOBalloon),
+        VMSTATE_UINT64(last_swap_in, VirtIOBalloon),
+        VMSTATE_END_OF_LIST()
+    }
+};
+
+/* Follows the version 1 state, which is not described by a VMState; only
+ * the subsections of the features that are enabled go in the stream, so
+ * older QEMUs can still load it when they are off.
+ */
+static const VMStateDescription vmstate_virtio_balloon = {
+    .name = "virtio-balloon",
+    .version_id = 1,
+    .minimum_version_id = 1,
+    .minimum_version_id_old = 1,
+    .fields = (VMStateField[]) {
+        VMSTATE_END_OF_LIST()
+    },
+    .subsections = (VMStateSubsection[]) {
+        {
+            .vmsd = &vmstate_virtio_balloon_free_page_hint,
+            .needed = virtio_balloon_free_page_hint_needed,
+        }, {
+            .vmsd = &vmstate_virtio_balloon_auto,
+            .needed = virtio_balloon_auto_needed,
+        }, {
+            /* empty */
+        }
+    }
+};
+
 static void virtio_balloon_save(QEMUFile *f, void *opaque)
 {
     VirtIOBalloon *s = opaque;
@@ -206,6 +550,7 @@ static void virtio_balloon_save(QEMUFile *f, void *opaque)
 
     qemu_put_be32(f, s->num_pages);
     qemu_put_be32(f, s->actual);
+    vmstate_save_state(f, &vmstate_virtio_balloon, s);
 }
 
 static int virtio_balloon_load(QEMUFile *f, void *opaque, int version_id)
@@ -223,21 +568,39 @@ static int virtio_balloon_load(QEMUFile *f, void *opaque, int version_id)
 
     s->num_pages = qemu_get_be32(f);
     s->actual = qemu_get_be32(f);
+
+    ret = vmstate_load_state(f, &vmstate_virtio_balloon, s,
+                             vmstate_virtio_balloon.version_id);
+    if (ret) {
+        return ret;
+    }
+
+    /* The stats buffer the source was holding is not in the stream, and
+     * the guest does not queue another until it gets it back.  Whether
+     * there is one can be told from the ring, whatever the source was;
+     * put it back in the queue so that the next stats request uses it.
+     */
+    s->stats_vq_elem_held = false;
+    if (s->vdev.guest_features & (1 << VIRTIO_BALLOON_F_STATS_VQ)) {
+        virtio_queue_rewind_inflight(&s->vdev, 2);
+    }
     return 0;
 }
 
-VirtIODevice *virtio_balloon_init(DeviceState *dev)
+VirtIODevice *virtio_balloon_init(DeviceState *dev, VirtIOBalloonConf *conf)
 {
     VirtIOBalloon *s;
     int ret;
 
     s = (VirtIOBalloon *)virtio_common_init("virtio-balloon",
                                             VIRTIO_ID_BALLOON,
-                                            8, sizeof(VirtIOBalloon));
+                                            conf->free_page_hint ? 16 : 8,
+                                            sizeof(VirtIOBalloon));
 
     s->vdev.get_config = virtio_balloon_get_config;
     s->vdev.set_config = virtio_balloon_set_config;
     s->vdev.get_features = virtio_balloon_get_features;
+    s->vdev.reset = virtio_balloon_reset;
 
     ret = qemu_add_balloon_handler(virtio_balloon_to_target,
                                    virtio_balloon_stat, s);
@@ -246,12 +609,38 @@ VirtIODevice *virtio_balloon_init(DeviceState *dev)
         return NULL;
     }
 
+    if (conf->free_page_hint) {
+        ret = qemu_add_balloon_free_page_handler(virtio_balloon_free_page_hint,
+                                                 s);
+        if (ret < 0) {
+            qemu_remove_balloon_handler(s);
+            virtio_cleanup(&s->vdev);
+            return NULL;
+        }
+    }
+
     s->ivq = virtio_add_queue(&s->vdev, 128, virtio_balloon_handle_output);
     s->dvq = virtio_add_queue(&s->vdev, 128, virtio_balloon_handle_output);
     s->svq = virtio_add_queue(&s->vdev, 128, virtio_balloon_receive_stats);
+    if (conf->free_page_hint) {
+        s->fvq = virtio_add_queue(&s->vdev, 128,
+                                  virtio_balloon_handle_free_page);
+    }
 
     reset_stats(s);
 
+    s->conf = *conf;
+    s->target = ram_size;
+    s->last_swap_in = -1;
+    s->free_page_cmd_id = VIRTIO_BALLOON_CMD_ID_MIN - 1;
+    s->free_page_hint = FREE_PAGE_HINT_DONE;
+    if (s->conf.auto_interval) {
+        s->auto_timer = qemu_new_timer_ms(vm_clock,
+                                          virtio_balloon_auto_timer, s);
+        qemu_mod_timer(s->auto_timer, qemu_get_clock_ms(vm_clock) +
+                       s->conf.auto_interval * 1000LL);
+    }
+
     s->qdev = dev;
     register_savevm(dev, "virtio-balloon", -1, 1,
                     virtio_balloon_save, virtio_balloon_load, s);
@@ -263,6 +652,10 @@ void virtio_balloon_exit(VirtIODevice *vdev)
 {
     VirtIOBalloon *s = DO_UPCAST(VirtIOBalloon, vdev, vdev);
 
+    if (s->auto_timer) {
+        qemu_del_timer(s->auto_timer);
+        qemu_free_timer(s->auto_timer);
+    }
     qemu_remove_balloon_handler(s);
     unregister_savevm(s->qdev, "virtio-balloon", s);
     virtio_cleanup(vdev);
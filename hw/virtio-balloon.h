@@ -26,6 +26,7 @@
 /* The feature bitmap for virtio balloon */
 #define VIRTIO_BALLOON_F_MUST_TELL_HOST 0 /* Tell before reclaiming pages */
 #define VIRTIO_BALLOON_F_STATS_VQ 1       /* Memory stats virtqueue */
+#define VIRTIO_BALLOON_F_FREE_PAGE_HINT 3 /* Free page hinting virtqueue */
 
 /* Size of a PFN in the balloon interface. */
 #define VIRTIO_BALLOON_PFN_SHIFT 12
@@ -36,8 +37,21 @@ struct virtio_balloon_config
     uint32_t num_pages;
     /* Number of pages we've actually got in balloon. */
     uint32_t actual;
+    /* Free page hinting command, only with VIRTIO_BALLOON_F_FREE_PAGE_HINT */
+    uint32_t free_page_hint_cmd_id;
+    uint32_t poison_val;
 };
 
+/* Free page hinting command ids.  Ids from VIRTIO_BALLOON_CMD_ID_MIN on ask
+ * the guest to start reporting free pages; the guest sends the id back on
+ * the free page virtqueue before the first hint, and VIRTIO_BALLOON_CMD_ID_STOP
+ * once it has reported everything.  The guest keeps hinted pages to itself
+ * until the host writes VIRTIO_BALLOON_CMD_ID_DONE.
+ */
+#define VIRTIO_BALLOON_CMD_ID_STOP 0
+#define VIRTIO_BALLOON_CMD_ID_DONE 1
+#define VIRTIO_BALLOON_CMD_ID_MIN  0x80000000
+
 /* Memory Statistics */
 #define VIRTIO_BALLOON_S_SWAP_IN  0   /* Amount of memory swapped in */
 #define VIRTIO_BALLOON_S_SWAP_OUT 1   /* Amount of memory swapped out */
@@ -52,4 +66,26 @@ typedef struct VirtIOBalloonStat {
     uint64_t val;
 } QEMU_PACKED VirtIOBalloonStat;
 
+struct VirtIOBalloonConf {
+    /* Automatic ballooning: poll guest statistics every auto_interval
+     * seconds (0 disables it) and resize the balloon so that about
+     * auto_free percent of the guest memory stays free, never shrinking
+     * the guest below auto_min bytes.
+     */
+    uint32_t auto_interval;
+    uint32_t auto_free;
+    uint64_t auto_min;
+    uint32_t free_page_hint;
+};
+
+#define DEFINE_VIRTIO_BALLOON_PROPERTIES(_state, _conf_field) \
+    DEFINE_PROP_UINT32("auto-balloon-interval", _state, \
+                       _conf_field.auto_interval, 0), \
+    DEFINE_PROP_UINT32("auto-balloon-free", _state, \
+                       _conf_field.auto_free, 20), \
+    DEFINE_PROP_UINT64("auto-balloon-min", _state, \
+                       _conf_field.auto_min, 256 << 20), \
+    DEFINE_PROP_BIT("free-page-hint", _state, \
+                    _conf_field.free_page_hint, 0, false)
+
 #endif
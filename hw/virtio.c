@@ -628,6 +628,23 @@ target_phys_addr_t virtio_queue_get_addr(VirtIODevice *vdev, int n)
     return vdev->vq[n].pa;
 }
 
+/* Make the buffers that were popped but not yet pushed back available
+ * again, e.g. after migration, where the device state that held them is
+ * lost.  Returns how many there were.
+ */
+unsigned int virtio_queue_rewind_inflight(VirtIODevice *vdev, int n)
+{
+    VirtQueue *vq = &vdev->vq[n];
+    uint16_t num;
+
+    if (!vq->vring.avail) {
+        return 0;
+    }
+    num = vq->last_avail_idx - vring_used_idx(vq);
+    vq->last_avail_idx -= num;
+    return num;
+}
+
 int virtio_queue_get_num(VirtIODevice *vdev, int n)
 {
     return vdev->vq[n].vring.num;
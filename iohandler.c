@@ -32,6 +32,15 @@
 #include <sys/wait.h>
 #endif
 
+#ifdef CONFIG_EPOLL
+#include <sys/epoll.h>
+
+/* Maximum number of ready handlers dispatched per main loop iteration.
+ * Handlers that do not fit stay ready (epoll is level-triggered) and are
+ * picked up on the next iteration. */
+#define IOHANDLER_MAX_EVENTS 128
+#endif
+
 typedef struct IOHandlerRecord {
     IOCanReadHandler *fd_read_poll;
     IOHandler *fd_read;
@@ -39,12 +48,154 @@ typedef struct IOHandlerRecord {
     void *opaque;
     QLIST_ENTRY(IOHandlerRecord) next;
     int fd;
+    int pollfds_idx;
+    /* Events the fd is currently registered for in the epoll set */
+    uint32_t events;
+    /* The fd cannot be used with epoll (e.g. regular files) */
+    bool no_epoll;
     bool deleted;
 } IOHandlerRecord;
 
+/* Handlers that must be looked at on every iteration: those whose fd is
+ * not in the epoll set, and those with an fd_read_poll callback whose
+ * result decides whether the fd is polled for reading. */
 static QLIST_HEAD(, IOHandlerRecord) io_handlers =
     QLIST_HEAD_INITIALIZER(io_handlers);
 
+/* Handlers with a persistent epoll registration.  They cost nothing until
+ * their fd becomes ready. */
+static QLIST_HEAD(, IOHandlerRecord) io_handlers_epoll =
+    QLIST_HEAD_INITIALIZER(io_handlers_epoll);
+
+/* Deleted handlers.  They are freed at the end of qemu_iohandler_poll, so
+ * that handlers can remove each other while the pollfds are dispatched. */
+static QLIST_HEAD(, IOHandlerRecord) io_handlers_deleted =
+    QLIST_HEAD_INITIALIZER(io_handlers_deleted);
+
+/* fd -> IOHandlerRecord */
+static GHashTable *io_handler_table;
+
+#ifdef CONFIG_EPOLL
+static int io_epoll_fd = -1;
+static int io_epoll_pollfds_idx = -1;
+
+static void iohandler_epoll_init(void)
+{
+    static bool initialized;
+
+    if (initialized) {
+        return;
+    }
+    initialized = true;
+
+#ifdef CONFIG_EPOLL_CREATE1
+    io_epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+#else
+    io_epoll_fd = epoll_create(IOHANDLER_MAX_EVENTS);
+    if (io_epoll_fd >= 0) {
+        qemu_set_cloexec(io_epoll_fd);
+    }
+#endif
+    /* On failure every handler simply goes through poll() */
+}
+
+static uint32_t iohandler_epoll_events(IOHandlerRecord *ioh)
+{
+    uint32_t events = 0;
+
+    if (ioh->fd_read &&
+        (!ioh->fd_read_poll ||
+         ioh->fd_read_poll(ioh->opaque) != 0)) {
+        events |= EPOLLIN;
+    }
+    if (ioh->fd_write) {
+        events |= EPOLLOUT;
+    }
+    return events;
+}
+
+/* Bring the epoll registration of @ioh in line with @events.  An fd that
+ * waits for nothing is removed from the set altogether, because epoll
+ * always reports hangups and errors.  Returns false if the fd has to be
+ * polled by hand instead. */
+static bool iohandler_epoll_update(IOHandlerRecord *ioh, uint32_t events)
+{
+    struct epoll_event ev;
+    int op;
+
+    if (ioh->no_epoll || io_epoll_fd < 0) {
+        return false;
+    }
+    if (events == ioh->events) {
+        return true;
+    }
+
+    if (!events) {
+        op = EPOLL_CTL_DEL;
+    } else if (!ioh->events) {
+        op = EPOLL_CTL_ADD;
+    } else {
+        op = EPOLL_CTL_MOD;
+    }
+    ev.events = events;
+    ev.data.fd = ioh->fd;
+    if (epoll_ctl(io_epoll_fd, op, ioh->fd, &ev) < 0 && op != EPOLL_CTL_DEL) {
+        ioh->no_epoll = true;
+        return false;
+    }
+    ioh->events = events;
+    return true;
+}
+
+static void iohandler_epoll_dispatch(void)
+{
+    struct epoll_event events[IOHANDLER_MAX_EVENTS];
+    IOHandlerRecord *ioh;
+    int i, n;
+
+    do {
+        n = epoll_wait(io_epoll_fd, events, IOHANDLER_MAX_EVENTS, 0);
+    } while (n < 0 && errno == EINTR);
+
+    for (i = 0; i < n; i++) {
+        uint32_t revents = events[i].events;
+
+        /* Look the handler up again rather than trusting a pointer in the
+         * kernel: an earlier handler may have removed it, and an fd that
+         * was closed while still registered can keep reporting events. */
+        ioh = g_hash_table_lookup(io_handler_table,
+                                  GINT_TO_POINTER(events[i].data.fd));
+        if (!ioh) {
+            continue;
+        }
+        /* A hangup or error wakes both directions, like select() does */
+        if (revents & (EPOLLHUP | EPOLLERR)) {
+            revents |= EPOLLIN | EPOLLOUT;
+        }
+        if (ioh->fd_read && (ioh->events & EPOLLIN) && (revents & EPOLLIN)) {
+            ioh->fd_read(ioh->opaque);
+        }
+        if (!ioh->deleted && ioh->fd_write && (ioh->events & EPOLLOUT) &&
+            (revents & EPOLLOUT)) {
+            ioh->fd_write(ioh->opaque);
+        }
+    }
+}
+#endif
+
+/* Put @ioh on the list that matches how it is going to be polled. */
+static void iohandler_update(IOHandlerRecord *ioh)
+{
+    QLIST_REMOVE(ioh, next);
+#ifdef CONFIG_EPOLL
+    if (!ioh->fd_read_poll &&
+        iohandler_epoll_update(ioh, iohandler_epoll_events(ioh))) {
+        QLIST_INSERT_HEAD(&io_handlers_epoll, ioh, next);
+        return;
+    }
+#endif
+    QLIST_INSERT_HEAD(&io_handlers, ioh, next);
+}
 
 /* XXX: fd_read_poll should be suppressed, but an API change is
    necessary in the character devices to suppress fd_can_read(). */
@@ -56,27 +207,37 @@ int qemu_set_fd_handler2(int fd,
 {
     IOHandlerRecord *ioh;
 
+    if (!io_handler_table) {
+        io_handler_table = g_hash_table_new(NULL, NULL);
+#ifdef CONFIG_EPOLL
+        iohandler_epoll_init();
+#endif
+    }
+    ioh = g_hash_table_lookup(io_handler_table, GINT_TO_POINTER(fd));
+
     if (!fd_read && !fd_write) {
-        QLIST_FOREACH(ioh, &io_handlers, next) {
-            if (ioh->fd == fd) {
-                ioh->deleted = 1;
-                break;
-            }
+        if (ioh) {
+#ifdef CONFIG_EPOLL
+            iohandler_epoll_update(ioh, 0);
+#endif
+            g_hash_table_remove(io_handler_table, GINT_TO_POINTER(fd));
+            QLIST_REMOVE(ioh, next);
+            QLIST_INSERT_HEAD(&io_handlers_deleted, ioh, next);
+            ioh->deleted = 1;
         }
     } else {
-        QLIST_FOREACH(ioh, &io_handlers, next) {
-            if (ioh->fd == fd)
-                goto found;
+        if (!ioh) {
+            ioh = g_malloc0(sizeof(IOHandlerRecord));
+            ioh->fd = fd;
+            ioh->pollfds_idx = -1;
+            QLIST_INSERT_HEAD(&io_handlers, ioh, next);
+            g_hash_table_insert(io_handler_table, GINT_TO_POINTER(fd), ioh);
         }
-        ioh = g_malloc0(sizeof(IOHandlerRecord));
-        QLIST_INSERT_HEAD(&io_handlers, ioh, next);
-    found:
-        ioh->fd = fd;
         ioh->fd_read_poll = fd_read_poll;
         ioh->fd_read = fd_read;
         ioh->fd_write = fd_write;
         ioh->opaque = opaque;
-        ioh->deleted = 0;
+        iohandler_update(ioh);
     }
     return 0;
 }
@@ -89,13 +250,27 @@ int qemu_set_fd_handler(int fd,
     return qemu_set_fd_handler2(fd, NULL, fd_read, fd_write, opaque);
 }
 
+static void iohandler_free_deleted(void)
+{
+    IOHandlerRecord *ioh;
+
+    while ((ioh = QLIST_FIRST(&io_handlers_deleted)) != NULL) {
+        QLIST_REMOVE(ioh, next);
+        g_free(ioh);
+    }
+}
+
+/* Handlers that may be dispatched by qemu_iohandler_poll, in order.  A
+ * callback can delete any handler, which moves it off io_handlers, so
+ * the lists are not walked while dispatching. */
+static GPtrArray *io_handlers_polled;
+
+#ifdef _WIN32
 void qemu_iohandler_fill(int *pnfds, fd_set *readfds, fd_set *writefds, fd_set *xfds)
 {
     IOHandlerRecord *ioh;
 
     QLIST_FOREACH(ioh, &io_handlers, next) {
-        if (ioh->deleted)
-            continue;
         if (ioh->fd_read &&
             (!ioh->fd_read_poll ||
              ioh->fd_read_poll(ioh->opaque) != 0)) {
@@ -114,24 +289,117 @@ void qemu_iohandler_fill(int *pnfds, fd_set *readfds, fd_set *writefds, fd_set *
 void qemu_iohandler_poll(fd_set *readfds, fd_set *writefds, fd_set *xfds, int ret)
 {
     if (ret > 0) {
-        IOHandlerRecord *pioh, *ioh;
+        IOHandlerRecord *ioh;
+        int i;
 
-        QLIST_FOREACH_SAFE(ioh, &io_handlers, next, pioh) {
+        if (!io_handlers_polled) {
+            io_handlers_polled = g_ptr_array_new();
+        }
+        g_ptr_array_set_size(io_handlers_polled, 0);
+        QLIST_FOREACH(ioh, &io_handlers, next) {
+            if (FD_ISSET(ioh->fd, readfds) || FD_ISSET(ioh->fd, writefds)) {
+                g_ptr_array_add(io_handlers_polled, ioh);
+            }
+        }
+
+        for (i = 0; i < io_handlers_polled->len; i++) {
+            ioh = g_ptr_array_index(io_handlers_polled, i);
             if (!ioh->deleted && ioh->fd_read && FD_ISSET(ioh->fd, readfds)) {
                 ioh->fd_read(ioh->opaque);
             }
             if (!ioh->deleted && ioh->fd_write && FD_ISSET(ioh->fd, writefds)) {
                 ioh->fd_write(ioh->opaque);
             }
+        }
+    }
+    iohandler_free_deleted();
+}
+#else
+void qemu_iohandler_fill(GArray *pollfds)
+{
+    IOHandlerRecord *ioh;
 
-            /* Do this last in case read/write handlers marked it for deletion */
-            if (ioh->deleted) {
-                QLIST_REMOVE(ioh, next);
-                g_free(ioh);
+    if (!io_handlers_polled) {
+        io_handlers_polled = g_ptr_array_new();
+    }
+    g_ptr_array_set_size(io_handlers_polled, 0);
+
+    QLIST_FOREACH(ioh, &io_handlers, next) {
+        int events = 0;
+
+        ioh->pollfds_idx = -1;
+#ifdef CONFIG_EPOLL
+        if (iohandler_epoll_update(ioh, iohandler_epoll_events(ioh))) {
+            continue;
+        }
+#endif
+        if (ioh->fd_read &&
+            (!ioh->fd_read_poll ||
+             ioh->fd_read_poll(ioh->opaque) != 0)) {
+            events |= G_IO_IN | G_IO_HUP | G_IO_ERR;
+        }
+        if (ioh->fd_write) {
+            events |= G_IO_OUT | G_IO_ERR;
+        }
+        if (events) {
+            GPollFD pfd = {
+                .fd = ioh->fd,
+                .events = events,
+            };
+            ioh->pollfds_idx = pollfds->len;
+            g_array_append_val(pollfds, pfd);
+            g_ptr_array_add(io_handlers_polled, ioh);
+        }
+    }
+
+#ifdef CONFIG_EPOLL
+    io_epoll_pollfds_idx = -1;
+    if (io_epoll_fd >= 0) {
+        GPollFD pfd = {
+            .fd = io_epoll_fd,
+            .events = G_IO_IN,
+        };
+        io_epoll_pollfds_idx = pollfds->len;
+        g_array_append_val(pollfds, pfd);
+    }
+#endif
+}
+
+void qemu_iohandler_poll(GArray *pollfds, int ret)
+{
+    if (ret > 0) {
+        IOHandlerRecord *ioh;
+        int i;
+
+        for (i = 0; i < io_handlers_polled->len; i++) {
+            GPollFD *pfd;
+
+            ioh = g_ptr_array_index(io_handlers_polled, i);
+            if (ioh->deleted || ioh->pollfds_idx < 0) {
+                continue;
+            }
+            pfd = &g_array_index(pollfds, GPollFD, ioh->pollfds_idx);
+            if (!ioh->deleted && ioh->fd_read && (pfd->events & G_IO_IN) &&
+                (pfd->revents & (G_IO_IN | G_IO_HUP | G_IO_ERR))) {
+                ioh->fd_read(ioh->opaque);
             }
+            if (!ioh->deleted && ioh->fd_write && (pfd->events & G_IO_OUT) &&
+                (pfd->revents & (G_IO_OUT | G_IO_ERR))) {
+                ioh->fd_write(ioh->opaque);
+            }
+        }
+
+#ifdef CONFIG_EPOLL
+        if (io_epoll_pollfds_idx >= 0 &&
+            (g_array_index(pollfds, GPollFD,
+                           io_epoll_pollfds_idx).revents & G_IO_IN)) {
+            iohandler_epoll_dispatch();
         }
+#endif
     }
+    iohandler_free_deleted();
 }
+#endif
 
 /* reaping of zombies.  right now we're not passing the status to
    anyone, but it would be possible to add a callback.  */
@@ -22,6 +22,7 @@
 
 #include "qemu-common.h"
 #include "qemu-barrier.h"
+#include "qemu-thread.h"
 #include "sysemu.h"
 #include "hw/hw.h"
 #include "gdbstub.h"
@@ -29,6 +30,7 @@
 #include "bswap.h"
 #include "memory.h"
 #include "exec-memory.h"
+#include "hw/msi.h"
 
 /* This check must be after config-host.h is included */
 #ifdef CONFIG_EVENTFD
@@ -55,16 +57,47 @@ typedef struct KVMSlot
     void *ram;
     int slot;
     int flags;
+    /* Written by KVM_GET_DIRTY_LOG, which overwrites all of it */
+    unsigned long *dirty_bmap;
+    /* Fetched but not yet published; see kvm_dirty_log_harvest */
+    unsigned long *dirty_pending;
+    bool harvested;
 } KVMSlot;
 
 typedef struct kvm_dirty_log KVMDirtyLog;
 
+#define KVM_DIRTY_MAX_THREADS   16
+
+/* Worker threads that fetch dirty logs, see kvm_dirty_log_harvest */
+typedef struct KVMDirtyPool {
+    QemuMutex lock;
+    QemuCond work_cond;
+    QemuCond done_cond;
+    int nr_threads;
+    KVMSlot *jobs[32];
+    int nr_jobs;
+    int next_job;
+    int nr_done;
+    bool running;
+} KVMDirtyPool;
+
+#define KVM_MSI_HASHTAB_SIZE    256
+
+/* Route used to inject an MSI message that has no dedicated route */
+typedef struct KVMMSIRoute {
+    MSIMessage msg;
+    int virq;
+    QTAILQ_ENTRY(KVMMSIRoute) entry;
+} KVMMSIRoute;
+
 struct KVMState
 {
     KVMSlot slots[32];
+    KVMDirtyPool dirty_pool;
     int fd;
     int vmfd;
     int coalesced_mmio;
+    int coalesced_pio;
     struct kvm_coalesced_mmio_ring *coalesced_mmio_ring;
     bool coalesced_flush_in_progress;
     int broken_set_mem_region;
@@ -87,11 +120,14 @@ struct KVMState
     int nr_allocated_irq_routes;
     uint32_t *used_gsi_bitmap;
     unsigned int max_gsi;
+    QTAILQ_HEAD(msi_hashtab, KVMMSIRoute) msi_hashtab[KVM_MSI_HASHTAB_SIZE];
 #endif
+    bool direct_msi;
 };
 
 KVMState *kvm_state;
 bool kvm_kernel_irqchip;
+bool kvm_msi_via_irqfd_allowed;
 
 static const KVMCapabilityInfo kvm_required_capabilites[] = {
     KVM_CAP_INFO(USER_MEMORY),
@@ -248,6 +284,179 @@ err:
  * dirty pages logging control
  */
 
+#define ALIGN(x, y)  (((x)+(y)-1) & ~((y)-1))
+
+/* XXX bad kernel interface alert
+ * For dirty bitmap, kernel allocates array of size aligned to
+ * bits-per-long.  But for case when the kernel is 64bits and
+ * the userspace is 32bits, userspace can't align to the same
+ * bits-per-long, since sizeof(long) is different between kernel
+ * and user space.  This way, userspace will provide buffer which
+ * may be 4 bytes less than the kernel will use, resulting in
+ * userspace memory corruption (which is not detectable by valgrind
+ * too, in most cases).
+ * So for now, let's align to 64 instead of HOST_LONG_BITS here, in
+ * a hope that sizeof(long) wont become >8 any time soon.
+ */
+static unsigned long kvm_dirty_bitmap_size(KVMSlot *mem)
+{
+    return ALIGN(((mem->memory_size) >> TARGET_PAGE_BITS),
+                 /*HOST_LONG_BITS*/ 64) / 8;
+}
+
+static void kvm_dirty_bitmap_alloc(KVMSlot *mem)
+{
+    if (!mem->dirty_bmap) {
+        mem->dirty_bmap = g_malloc0(kvm_dirty_bitmap_size(mem));
+        mem->dirty_pending = g_malloc0(kvm_dirty_bitmap_size(mem));
+    }
+}
+
+static void kvm_dirty_bitmap_free(KVMSlot *mem)
+{
+    g_free(mem->dirty_bmap);
+    g_free(mem->dirty_pending);
+    mem->dirty_bmap = NULL;
+    mem->dirty_pending = NULL;
+    mem->harvested = false;
+}
+
+/* Fetch a slot's dirty log from KVM and add it to the pages that are still
+ * to be published.  Does not touch QEMU's dirty bitmap, so it does not need
+ * the iothread lock; the slot must not change while this runs.
+ */
+static int kvm_dirty_log_fetch(KVMState *s, KVMSlot *mem)
+{
+    KVMDirtyLog d;
+    unsigned long i, n;
+
+    /* The kernel writes the whole bitmap, so it need not be cleared */
+    d.dirty_bitmap = mem->dirty_bmap;
+    d.slot = mem->slot;
+    if (kvm_vm_ioctl(s, KVM_GET_DIRTY_LOG, &d) == -1) {
+        DPRINTF("ioctl failed %d\n", errno);
+        return -1;
+    }
+
+    /* Both are little endian, which does not matter for an OR */
+    n = kvm_dirty_bitmap_size(mem) / sizeof(unsigned long);
+    for (i = 0; i < n; i++) {
+        mem->dirty_pending[i] |= mem->dirty_bmap[i];
+    }
+    return 0;
+}
+
+static void *kvm_dirty_pool_thread(void *opaque)
+{
+    KVMState *s = opaque;
+    KVMDirtyPool *pool = &s->dirty_pool;
+    KVMSlot *mem;
+
+    qemu_mutex_lock(&pool->lock);
+    for (;;) {
+        while (pool->next_job >= pool->nr_jobs) {
+            qemu_cond_wait(&pool->work_cond, &pool->lock);
+        }
+        mem = pool->jobs[pool->next_job++];
+        qemu_mutex_unlock(&pool->lock);
+
+        /* On failure the slot stays unharvested and the next log_sync
+         * fetches it again and reports the error.
+         */
+        if (kvm_dirty_log_fetch(s, mem) == 0) {
+            mem->harvested = true;
+        }
+
+        qemu_mutex_lock(&pool->lock);
+        if (++pool->nr_done == pool->nr_jobs) {
+            qemu_cond_signal(&pool->done_cond);
+        }
+    }
+    return NULL;
+}
+
+/* Slots must not change while the pool works on them.  Callers hold the
+ * iothread lock, which the pool does not need, so this cannot deadlock.
+ */
+static void kvm_dirty_pool_wait(KVMState *s)
+{
+    KVMDirtyPool *pool = &s->dirty_pool;
+
+    if (!pool->nr_threads) {
+        return;
+    }
+    qemu_mutex_lock(&pool->lock);
+    while (pool->running) {
+        qemu_cond_wait(&pool->done_cond, &pool->lock);
+    }
+    qemu_mutex_unlock(&pool->lock);
+}
+
+static void kvm_dirty_pool_init(KVMState *s)
+{
+    KVMDirtyPool *pool = &s->dirty_pool;
+    QemuThread thread;
+    int i, n;
+
+    n = MIN(sysconf(_SC_NPROCESSORS_ONLN), KVM_DIRTY_MAX_THREADS);
+    n = MAX(n, 1);
+
+    qemu_mutex_init(&pool->lock);
+    qemu_cond_init(&pool->work_cond);
+    qemu_cond_init(&pool->done_cond);
+    for (i = 0; i < n; i++) {
+        qemu_thread_create(&thread, kvm_dirty_pool_thread, s,
+                           QEMU_THREAD_DETACHED);
+    }
+    pool->nr_threads = n;
+}
+
+void kvm_dirty_log_harvest(void)
+{
+    KVMState *s = kvm_state;
+    KVMDirtyPool *pool = &s->dirty_pool;
+    KVMSlot *mem;
+    int i, n = 0;
+
+    for (i = 0; i < ARRAY_SIZE(s->slots); i++) {
+        mem = &s->slots[i];
+        if (!mem->memory_size ||
+            !((mem->flags & KVM_MEM_LOG_DIRTY_PAGES) || s->migration_log)) {
+            continue;
+        }
+        kvm_dirty_bitmap_alloc(mem);
+        pool->jobs[n++] = mem;
+    }
+    if (n == 0) {
+        return;
+    }
+    if (!pool->nr_threads) {
+        kvm_dirty_pool_init(s);
+    }
+
+    qemu_mutex_lock(&pool->lock);
+    pool->nr_jobs = n;
+    pool->next_job = 0;
+    pool->nr_done = 0;
+    pool->running = true;
+    qemu_cond_broadcast(&pool->work_cond);
+    qemu_mutex_unlock(&pool->lock);
+
+    qemu_mutex_unlock_iothread();
+
+    qemu_mutex_lock(&pool->lock);
+    while (pool->nr_done < pool->nr_jobs) {
+        qemu_cond_wait(&pool->done_cond, &pool->lock);
+    }
+    pool->nr_jobs = 0;
+    pool->next_job = 0;
+    pool->running = false;
+    qemu_cond_broadcast(&pool->done_cond);
+    qemu_mutex_unlock(&pool->lock);
+
+    qemu_mutex_lock_iothread();
+}
+
 static int kvm_mem_flags(KVMState *s, bool log_dirty)
 {
     return log_dirty ? KVM_MEM_LOG_DIRTY_PAGES : 0;
@@ -259,6 +468,7 @@ static int kvm_slot_dirty_pages_log_change(KVMSlot *mem, bool log_dirty)
     int flags, mask = KVM_MEM_LOG_DIRTY_PAGES;
     int old_flags;
 
+    kvm_dirty_pool_wait(s);
     old_flags = mem->flags;
 
     flags = (mem->flags & ~mask) | kvm_mem_flags(s, log_dirty);
@@ -321,6 +531,7 @@ static int kvm_set_migration_log(int enable)
     KVMSlot *mem;
     int i, err;
 
+    kvm_dirty_pool_wait(s);
     s->migration_log = enable;
 
     for (i = 0; i < ARRAY_SIZE(s->slots); i++) {
@@ -341,37 +552,50 @@ static int kvm_set_migration_log(int enable)
 }
 
 /* get kvm's dirty pages bitmap and update qemu's */
-static int kvm_get_dirty_pages_log_range(MemoryRegionSection *section,
-                                         unsigned long *bitmap)
+/* Fallback for hosts whose pages are larger than the target's, where one
+ * bit of KVM's bitmap stands for several target pages.
+ */
+static void kvm_get_dirty_pages_log_range(MemoryRegionSection *section,
+                                          target_phys_addr_t addr,
+                                          unsigned long *bitmap,
+                                          uint64_t first, uint64_t nr)
 {
-    unsigned int i, j;
-    unsigned long page_number, c;
-    target_phys_addr_t addr, addr1;
-    unsigned int len = ((section->size / TARGET_PAGE_SIZE) + HOST_LONG_BITS - 1) / HOST_LONG_BITS;
     unsigned long hpratio = getpagesize() / TARGET_PAGE_SIZE;
-
-    /*
-     * bitmap-traveling is faster than memory-traveling (for addr...)
-     * especially when most of the memory is not dirty.
-     */
-    for (i = 0; i < len; i++) {
-        if (bitmap[i] != 0) {
-            c = leul_to_cpu(bitmap[i]);
-            do {
-                j = ffsl(c) - 1;
-                c &= ~(1ul << j);
-                page_number = (i * HOST_LONG_BITS + j) * hpratio;
-                addr1 = page_number * TARGET_PAGE_SIZE;
-                addr = section->offset_within_region + addr1;
-                memory_region_set_dirty(section->mr, addr,
-                                        TARGET_PAGE_SIZE * hpratio);
-            } while (c != 0);
+    uint64_t i;
+
+    for (i = first; i < first + nr; i++) {
+        if (leul_to_cpu(bitmap[i / HOST_LONG_BITS]) &
+            (1UL << (i % HOST_LONG_BITS))) {
+            memory_region_set_dirty(section->mr,
+                                    addr + (i - first) * TARGET_PAGE_SIZE * hpratio,
+                                    TARGET_PAGE_SIZE * hpratio);
         }
     }
-    return 0;
 }
 
-#define ALIGN(x, y)  (((x)+(y)-1) & ~((y)-1))
+/* Clear bits @first to @first + @nr of a little endian bitmap.  Swapping
+ * to and from little endian is the same operation, so leul_to_cpu works
+ * for the mask too.
+ */
+static void kvm_dirty_bitmap_clear(unsigned long *bitmap,
+                                   uint64_t first, uint64_t nr)
+{
+    uint64_t end = first + nr;
+    uint64_t i, base;
+    unsigned long mask;
+
+    for (i = first / HOST_LONG_BITS; i * HOST_LONG_BITS < end; i++) {
+        base = i * HOST_LONG_BITS;
+        mask = ~0UL;
+        if (base < first) {
+            mask &= ~0UL << (first - base);
+        }
+        if (end - base < HOST_LONG_BITS) {
+            mask &= ~0UL >> (HOST_LONG_BITS - (end - base));
+        }
+        bitmap[i] &= ~leul_to_cpu(mask);
+    }
+}
 
 /**
  * kvm_physical_sync_dirty_bitmap - Grab dirty bitmap from kernel space
@@ -379,60 +603,68 @@ static int kvm_get_dirty_pages_log_range(MemoryRegionSection *section,
  * memory_region_set_dirty().  This means all bits are set
  * to dirty.
  *
- * @start_add: start of logged region.
- * @end_addr: end of logged region.
+ * Slots that kvm_dirty_log_harvest already fetched are only published
+ * here; the others, or all of them if @fresh, are fetched first.
+ *
+ * @section: the logged section.
+ * @fresh: fetch the log even if the slot was harvested.
  */
-static int kvm_physical_sync_dirty_bitmap(MemoryRegionSection *section)
+static int kvm_physical_sync_dirty_bitmap(MemoryRegionSection *section,
+                                          bool fresh)
 {
     KVMState *s = kvm_state;
-    unsigned long size, allocated_size = 0;
-    KVMDirtyLog d;
     KVMSlot *mem;
     int ret = 0;
     target_phys_addr_t start_addr = section->offset_within_address_space;
     target_phys_addr_t end_addr = start_addr + section->size;
+    target_phys_addr_t first, last;
+    unsigned long hpratio = getpagesize() / TARGET_PAGE_SIZE;
+
+    kvm_dirty_pool_wait(s);
 
-    d.dirty_bitmap = NULL;
     while (start_addr < end_addr) {
         mem = kvm_lookup_overlapping_slot(s, start_addr, end_addr);
         if (mem == NULL) {
             break;
         }
 
-        /* XXX bad kernel interface alert
-         * For dirty bitmap, kernel allocates array of size aligned to
-         * bits-per-long.  But for case when the kernel is 64bits and
-         * the userspace is 32bits, userspace can't align to the same
-         * bits-per-long, since sizeof(long) is different between kernel
-         * and user space.  This way, userspace will provide buffer which
-         * may be 4 bytes less than the kernel will use, resulting in
-         * userspace memory corruption (which is not detectable by valgrind
-         * too, in most cases).
-         * So for now, let's align to 64 instead of HOST_LONG_BITS here, in
-         * a hope that sizeof(long) wont become >8 any time soon.
-         */
-        size = ALIGN(((mem->memory_size) >> TARGET_PAGE_BITS),
-                     /*HOST_LONG_BITS*/ 64) / 8;
-        if (!d.dirty_bitmap) {
-            d.dirty_bitmap = g_malloc(size);
-        } else if (size > allocated_size) {
-            d.dirty_bitmap = g_realloc(d.dirty_bitmap, size);
+        kvm_dirty_bitmap_alloc(mem);
+        if (!mem->harvested || fresh) {
+            if (kvm_dirty_log_fetch(s, mem) < 0) {
+                ret = -1;
+                break;
+            }
         }
-        allocated_size = size;
-        memset(d.dirty_bitmap, 0, allocated_size);
-
-        d.slot = mem->slot;
+        mem->harvested = false;
 
-        if (kvm_vm_ioctl(s, KVM_GET_DIRTY_LOG, &d) == -1) {
-            DPRINTF("ioctl failed %d\n", errno);
-            ret = -1;
-            break;
+        /* Only take the part of the slot that is inside the section;
+         * the rest stays pending until its own section is synced.
+         */
+        first = MAX(mem->start_addr, start_addr);
+        last = MIN(mem->start_addr + mem->memory_size, end_addr);
+        if (hpratio == 1) {
+            memory_region_set_dirty_lebitmap(section->mr,
+                section->offset_within_region +
+                    (first - section->offset_within_address_space),
+                mem->dirty_pending,
+                (first - mem->start_addr) >> TARGET_PAGE_BITS,
+                (last - first) >> TARGET_PAGE_BITS);
+            kvm_dirty_bitmap_clear(mem->dirty_pending,
+                                   (first - mem->start_addr) >> TARGET_PAGE_BITS,
+                                   (last - first) >> TARGET_PAGE_BITS);
+        } else {
+            kvm_get_dirty_pages_log_range(section,
+                section->offset_within_region +
+                    (first - section->offset_within_address_space),
+                mem->dirty_pending,
+                (first - mem->start_addr) / getpagesize(),
+                (last - first) / getpagesize());
+            kvm_dirty_bitmap_clear(mem->dirty_pending,
+                                   (first - mem->start_addr) / getpagesize(),
+                                   (last - first) / getpagesize());
         }
-
-        kvm_get_dirty_pages_log_range(section, d.dirty_bitmap);
         start_addr = mem->start_addr + mem->memory_size;
     }
-    g_free(d.dirty_bitmap);
 
     return ret;
 }
@@ -473,6 +705,42 @@ int kvm_uncoalesce_mmio_region(target_phys_addr_t start, ram_addr_t size)
     return ret;
 }
 
+int kvm_coalesce_pio_region(pio_addr_t start, ram_addr_t size)
+{
+    int ret = -ENOSYS;
+    KVMState *s = kvm_state;
+
+    if (s->coalesced_pio) {
+        struct kvm_coalesced_mmio_zone zone;
+
+        zone.addr = start;
+        zone.size = size;
+        zone.pio = 1;
+
+        ret = kvm_vm_ioctl(s, KVM_REGISTER_COALESCED_MMIO, &zone);
+    }
+
+    return ret;
+}
+
+int kvm_uncoalesce_pio_region(pio_addr_t start, ram_addr_t size)
+{
+    int ret = -ENOSYS;
+    KVMState *s = kvm_state;
+
+    if (s->coalesced_pio) {
+        struct kvm_coalesced_mmio_zone zone;
+
+        zone.addr = start;
+        zone.size = size;
+        zone.pio = 1;
+
+        ret = kvm_vm_ioctl(s, KVM_UNREGISTER_COALESCED_MMIO, &zone);
+    }
+
+    return ret;
+}
+
 int kvm_check_extension(KVMState *s, unsigned int extension)
 {
     int ret;
@@ -563,6 +831,7 @@ static void kvm_set_phys_mem(MemoryRegionSection *section, bool add)
         return;
     }
 
+    kvm_dirty_pool_wait(s);
     ram = memory_region_get_ram_ptr(mr) + section->offset_within_region + delta;
 
     while (1) {
@@ -583,11 +852,12 @@ static void kvm_set_phys_mem(MemoryRegionSection *section, bool add)
         old = *mem;
 
         if (mem->flags & KVM_MEM_LOG_DIRTY_PAGES) {
-            kvm_physical_sync_dirty_bitmap(section);
+            kvm_physical_sync_dirty_bitmap(section, true);
         }
 
         /* unregister the overlapping slot */
         mem->memory_size = 0;
+        kvm_dirty_bitmap_free(mem);
         err = kvm_set_user_memory_region(s, mem);
         if (err) {
             fprintf(stderr, "%s: error unregistering overlapping slot: %s\n",
@@ -716,7 +986,7 @@ static void kvm_log_sync(MemoryListener *listener,
 {
     int r;
 
-    r = kvm_physical_sync_dirty_bitmap(section);
+    r = kvm_physical_sync_dirty_bitmap(section, false);
     if (r < 0) {
         abort();
     }
@@ -864,9 +1134,16 @@ static void set_gsi(KVMState *s, unsigned int gsi)
     s->used_gsi_bitmap[gsi / 32] |= 1U << (gsi % 32);
 }
 
+static void clear_gsi(KVMState *s, unsigned int gsi)
+{
+    assert(gsi < s->max_gsi);
+
+    s->used_gsi_bitmap[gsi / 32] &= ~(1U << (gsi % 32));
+}
+
 static void kvm_init_irq_routing(KVMState *s)
 {
-    int gsi_count;
+    int gsi_count, i;
 
     gsi_count = kvm_check_extension(s, KVM_CAP_IRQ_ROUTING);
     if (gsi_count > 0) {
@@ -886,6 +1163,10 @@ static void kvm_init_irq_routing(KVMState *s)
     s->irq_routes = g_malloc0(sizeof(*s->irq_routes));
     s->nr_allocated_irq_routes = 0;
 
+    for (i = 0; i < KVM_MSI_HASHTAB_SIZE; i++) {
+        QTAILQ_INIT(&s->msi_hashtab[i]);
+    }
+
     kvm_arch_init_irq_routing(s);
 }
 
@@ -934,11 +1215,212 @@ int kvm_irqchip_commit_routes(KVMState *s)
     return kvm_vm_ioctl(s, KVM_SET_GSI_ROUTING, s->irq_routes);
 }
 
+static void kvm_remove_routes(KVMState *s, int virq)
+{
+    struct kvm_irq_routing_entry *e;
+    int i;
+
+    for (i = 0; i < s->irq_routes->nr; i++) {
+        e = &s->irq_routes->entries[i];
+        if (e->gsi == virq) {
+            s->irq_routes->nr--;
+            *e = s->irq_routes->entries[s->irq_routes->nr];
+            i--;
+        }
+    }
+    clear_gsi(s, virq);
+}
+
+static void kvm_flush_dynamic_msi_routes(KVMState *s)
+{
+    KVMMSIRoute *route, *next;
+    unsigned int hash;
+
+    for (hash = 0; hash < KVM_MSI_HASHTAB_SIZE; hash++) {
+        QTAILQ_FOREACH_SAFE(route, &s->msi_hashtab[hash], entry, next) {
+            kvm_remove_routes(s, route->virq);
+            QTAILQ_REMOVE(&s->msi_hashtab[hash], route, entry);
+            g_free(route);
+        }
+    }
+}
+
+static int kvm_irqchip_get_virq(KVMState *s)
+{
+    unsigned int i;
+    int bit;
+    bool retry = true;
+
+again:
+    /* Return the lowest unused GSI in the bitmap */
+    for (i = 0; i < s->max_gsi / 32; i++) {
+        bit = ffs(~s->used_gsi_bitmap[i]);
+        if (bit) {
+            return bit - 1 + i * 32;
+        }
+    }
+    /* The routes of MSI messages without a dedicated vector route can
+       be recreated on demand, so drop them once we run out of GSIs. */
+    if (retry) {
+        retry = false;
+        kvm_flush_dynamic_msi_routes(s);
+        goto again;
+    }
+    return -ENOSPC;
+}
+
+int kvm_irqchip_add_msi_route(MSIMessage msg)
+{
+    KVMState *s = kvm_state;
+    struct kvm_irq_routing_entry kroute;
+    int virq, ret;
+
+    if (!kvm_irqchip_in_kernel() || !kvm_has_gsi_routing()) {
+        return -ENOSYS;
+    }
+
+    virq = kvm_irqchip_get_virq(s);
+    if (virq < 0) {
+        return virq;
+    }
+
+    kroute.gsi = virq;
+    kroute.type = KVM_IRQ_ROUTING_MSI;
+    kroute.flags = 0;
+    kroute.u.msi.address_lo = (uint32_t)msg.address;
+    kroute.u.msi.address_hi = msg.address >> 32;
+    kroute.u.msi.data = msg.data;
+    kvm_add_routing_entry(s, &kroute);
+
+    ret = kvm_irqchip_commit_routes(s);
+    if (ret < 0) {
+        kvm_remove_routes(s, virq);
+        return ret;
+    }
+    return virq;
+}
+
+void kvm_irqchip_release_virq(int virq)
+{
+    KVMState *s = kvm_state;
+
+    kvm_remove_routes(s, virq);
+    kvm_irqchip_commit_routes(s);
+}
+
+static unsigned int kvm_hash_msi(uint32_t data)
+{
+    /* This is optimized for IA32 MSI layout. However, no other arch
+       shall repeat the mistake of not providing a direct MSI injection
+       API. */
+    return data & 0xff;
+}
+
+static KVMMSIRoute *kvm_lookup_msi_route(KVMState *s, MSIMessage msg)
+{
+    unsigned int hash = kvm_hash_msi(msg.data);
+    KVMMSIRoute *route;
+
+    QTAILQ_FOREACH(route, &s->msi_hashtab[hash], entry) {
+        if (route->msg.address == msg.address &&
+            route->msg.data == msg.data) {
+            return route;
+        }
+    }
+    return NULL;
+}
+
+int kvm_irqchip_send_msi(MSIMessage msg)
+{
+    KVMState *s = kvm_state;
+    KVMMSIRoute *route;
+    int virq;
+
+#ifdef KVM_CAP_SIGNAL_MSI
+    if (s->direct_msi) {
+        struct kvm_msi msi;
+
+        msi.address_lo = (uint32_t)msg.address;
+        msi.address_hi = msg.address >> 32;
+        msi.data = msg.data;
+        msi.flags = 0;
+        memset(msi.pad, 0, sizeof(msi.pad));
+
+        return kvm_vm_ioctl(s, KVM_SIGNAL_MSI, &msi);
+    }
+#endif
+
+    route = kvm_lookup_msi_route(s, msg);
+    if (!route) {
+        virq = kvm_irqchip_add_msi_route(msg);
+        if (virq < 0) {
+            return virq;
+        }
+        route = g_malloc(sizeof(KVMMSIRoute));
+        route->msg = msg;
+        route->virq = virq;
+        QTAILQ_INSERT_TAIL(&s->msi_hashtab[kvm_hash_msi(msg.data)], route,
+                           entry);
+    }
+
+    assert(route->virq < s->max_gsi);
+    return kvm_irqchip_set_irq(s, route->virq, 1);
+}
+
+static int kvm_irqchip_assign_irqfd(KVMState *s, int fd, int virq,
+                                    bool assign)
+{
+    struct kvm_irqfd irqfd = {
+        .fd = fd,
+        .gsi = virq,
+        .flags = assign ? 0 : KVM_IRQFD_FLAG_DEASSIGN,
+    };
+
+    if (!kvm_msi_via_irqfd_enabled()) {
+        return -ENOSYS;
+    }
+    return kvm_vm_ioctl(s, KVM_IRQFD, &irqfd);
+}
+
+int kvm_irqchip_add_irqfd(int fd, int virq)
+{
+    return kvm_irqchip_assign_irqfd(kvm_state, fd, virq, true);
+}
+
+int kvm_irqchip_remove_irqfd(int fd, int virq)
+{
+    return kvm_irqchip_assign_irqfd(kvm_state, fd, virq, false);
+}
+
 #else /* !KVM_CAP_IRQ_ROUTING */
 
 static void kvm_init_irq_routing(KVMState *s)
 {
 }
+
+int kvm_irqchip_send_msi(MSIMessage msg)
+{
+    return -ENOSYS;
+}
+
+int kvm_irqchip_add_msi_route(MSIMessage msg)
+{
+    return -ENOSYS;
+}
+
+void kvm_irqchip_release_virq(int virq)
+{
+}
+
+int kvm_irqchip_add_irqfd(int fd, int virq)
+{
+    return -ENOSYS;
+}
+
+int kvm_irqchip_remove_irqfd(int fd, int virq)
+{
+    return -ENOSYS;
+}
 #endif /* !KVM_CAP_IRQ_ROUTING */
 
 static int kvm_irqchip_create(KVMState *s)
@@ -967,6 +1449,15 @@ static int kvm_irqchip_create(KVMState *s)
 
     kvm_init_irq_routing(s);
 
+#ifdef KVM_CAP_IRQ_ROUTING
+    kvm_msi_via_irqfd_allowed =
+        kvm_check_extension(s, KVM_CAP_IRQ_ROUTING) > 0 &&
+        kvm_check_extension(s, KVM_CAP_IRQFD) > 0;
+#endif
+#ifdef KVM_CAP_SIGNAL_MSI
+    s->direct_msi = kvm_check_extension(s, KVM_CAP_SIGNAL_MSI) > 0;
+#endif
+
     return 0;
 }
 
@@ -1042,6 +1533,10 @@ int kvm_init(void)
     }
 
     s->coalesced_mmio = kvm_check_extension(s, KVM_CAP_COALESCED_MMIO);
+    /* PIO entries share the ring with MMIO ones */
+    if (s->coalesced_mmio) {
+        s->coalesced_pio = kvm_check_extension(s, KVM_CAP_COALESCED_PIO);
+    }
 
     s->broken_set_mem_region = 1;
     ret = kvm_check_extension(s, KVM_CAP_JOIN_MEMORY_REGIONS_WORKS);
@@ -1142,6 +1637,94 @@ static void kvm_handle_io(uint16_t port, void *data, int direction, int size,
     }
 }
 
+static uint64_t kvm_lockless_ld(uint8_t *ptr, int size)
+{
+    switch (size) {
+    case 1:
+        return ldub_p(ptr);
+    case 2:
+        return lduw_p(ptr);
+    default:
+        return ldl_p(ptr);
+    }
+}
+
+static void kvm_lockless_st(uint8_t *ptr, int size, uint64_t data)
+{
+    switch (size) {
+    case 1:
+        stb_p(ptr, data);
+        break;
+    case 2:
+        stw_p(ptr, data);
+        break;
+    default:
+        stl_p(ptr, data);
+        break;
+    }
+}
+
+/*
+ * Try to complete an IO or MMIO exit without taking the global mutex, by
+ * dispatching it to a region marked with memory_region_set_lockless().
+ * Returns true if the exit was handled and the vcpu can reenter the guest.
+ */
+static bool kvm_handle_lockless_exit(CPUArchState *env, struct kvm_run *run)
+{
+    uint64_t data = 0;
+    uint8_t *ptr;
+    bool is_write;
+    int size;
+
+    /* Interrupt injection and everything else done by kvm_arch_pre_run
+     * and kvm_arch_post_run needs the global mutex. */
+    if (!kvm_irqchip_in_kernel() || env->exit_request ||
+        env->interrupt_request) {
+        return false;
+    }
+
+    switch (run->exit_reason) {
+    case KVM_EXIT_IO:
+        size = run->io.size;
+        is_write = run->io.direction == KVM_EXIT_IO_OUT;
+        ptr = (uint8_t *)run + run->io.data_offset;
+        if (run->io.count != 1) {
+            return false;
+        }
+        if (is_write) {
+            data = kvm_lockless_ld(ptr, size);
+        }
+        if (!memory_region_dispatch_lockless(get_system_io(), run->io.port,
+                                             &data, size, is_write)) {
+            return false;
+        }
+        break;
+    case KVM_EXIT_MMIO:
+        size = run->mmio.len;
+        is_write = run->mmio.is_write;
+        ptr = run->mmio.data;
+        if (size != 1 && size != 2 && size != 4) {
+            return false;
+        }
+        if (is_write) {
+            data = kvm_lockless_ld(ptr, size);
+        }
+        if (!memory_region_dispatch_lockless(get_system_memory(),
+                                             run->mmio.phys_addr,
+                                             &data, size, is_write)) {
+            return false;
+        }
+        break;
+    default:
+        return false;
+    }
+
+    if (!is_write) {
+        kvm_lockless_st(ptr, size, data);
+    }
+    return true;
+}
+
 static int kvm_handle_internal_error(CPUArchState *env, struct kvm_run *run)
 {
     fprintf(stderr, "KVM internal error.");
@@ -1186,7 +1769,12 @@ void kvm_flush_coalesced_mmio_buffer(void)
 
             ent = &ring->coalesced_mmio[ring->first];
 
-            cpu_physical_memory_write(ent->phys_addr, ent->data, ent->len);
+            if (ent->pio) {
+                kvm_handle_io(ent->phys_addr, ent->data, KVM_EXIT_IO_OUT,
+                              ent->len, 1);
+            } else {
+                cpu_physical_memory_write(ent->phys_addr, ent->data, ent->len);
+            }
             smp_wmb();
             ring->first = (ring->first + 1) % KVM_COALESCED_MMIO_MAX;
         }
@@ -1254,12 +1842,18 @@ int kvm_cpu_exec(CPUArchState *env)
         }
         qemu_mutex_unlock_iothread();
 
-        run_ret = kvm_vcpu_ioctl(env, KVM_RUN, 0);
+        do {
+            run_ret = kvm_vcpu_ioctl(env, KVM_RUN, 0);
+        } while (run_ret == 0 && kvm_handle_lockless_exit(env, run));
 
         qemu_mutex_lock_iothread();
         kvm_arch_post_run(env, run);
 
-        kvm_flush_coalesced_mmio_buffer();
+        /*
+         * The coalesced ring is not drained on exits.  A non-coalesced
+         * access to a region with coalesced ranges drains it (see
+         * memory_region_flush_coalesced), and so does leaving this loop.
+         */
 
         if (run_ret < 0) {
             if (run_ret == -EINTR || run_ret == -EAGAIN) {
@@ -1319,6 +1913,8 @@ int kvm_cpu_exec(CPUArchState *env)
         vm_stop(RUN_STATE_INTERNAL_ERROR);
     }
 
+    kvm_flush_coalesced_mmio_buffer();
+
     env->exit_request = 0;
     return ret;
 }
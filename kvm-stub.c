@@ -15,6 +15,9 @@
 #include "cpu.h"
 #include "gdbstub.h"
 #include "kvm.h"
+#include "hw/msi.h"
+
+bool kvm_msi_via_irqfd_allowed;
 
 int kvm_init_vcpu(CPUArchState *env)
 {
@@ -31,6 +34,16 @@ int kvm_uncoalesce_mmio_region(target_phys_addr_t start, ram_addr_t size)
     return -ENOSYS;
 }
 
+int kvm_coalesce_pio_region(pio_addr_t start, ram_addr_t size)
+{
+    return -ENOSYS;
+}
+
+int kvm_uncoalesce_pio_region(pio_addr_t start, ram_addr_t size)
+{
+    return -ENOSYS;
+}
+
 int kvm_init(void)
 {
     return -ENOSYS;
@@ -40,6 +53,10 @@ void kvm_flush_coalesced_mmio_buffer(void)
 {
 }
 
+void kvm_dirty_log_harvest(void)
+{
+}
+
 void kvm_cpu_synchronize_state(CPUArchState *env)
 {
 }
@@ -119,6 +136,30 @@ int kvm_set_ioeventfd_mmio(int fd, uint32_t adr, uint32_t val, bool assign, uint
     return -ENOSYS;
 }
 
+int kvm_irqchip_send_msi(MSIMessage msg)
+{
+    return -ENOSYS;
+}
+
+int kvm_irqchip_add_msi_route(MSIMessage msg)
+{
+    return -ENOSYS;
+}
+
+void kvm_irqchip_release_virq(int virq)
+{
+}
+
+int kvm_irqchip_add_irqfd(int fd, int virq)
+{
+    return -ENOSYS;
+}
+
+int kvm_irqchip_remove_irqfd(int fd, int virq)
+{
+    return -ENOSYS;
+}
+
 int kvm_on_sigbus_vcpu(CPUArchState *env, int code, void *addr)
 {
     return 1;
@@ -17,6 +17,7 @@
 #include <errno.h>
 #include "config-host.h"
 #include "qemu-queue.h"
+#include "ioport.h"
 
 #ifdef CONFIG_KVM
 #include <linux/kvm.h>
@@ -24,13 +25,16 @@
 
 extern int kvm_allowed;
 extern bool kvm_kernel_irqchip;
+extern bool kvm_msi_via_irqfd_allowed;
 
 #if defined CONFIG_KVM || !defined NEED_CPU_H
 #define kvm_enabled()           (kvm_allowed)
 #define kvm_irqchip_in_kernel() (kvm_kernel_irqchip)
+#define kvm_msi_via_irqfd_enabled() (kvm_msi_via_irqfd_allowed)
 #else
 #define kvm_enabled()           (0)
 #define kvm_irqchip_in_kernel() (false)
+#define kvm_msi_via_irqfd_enabled() (false)
 #endif
 
 struct kvm_run;
@@ -70,7 +74,10 @@ void kvm_setup_guest_memory(void *start, size_t size);
 
 int kvm_coalesce_mmio_region(target_phys_addr_t start, ram_addr_t size);
 int kvm_uncoalesce_mmio_region(target_phys_addr_t start, ram_addr_t size);
+int kvm_coalesce_pio_region(pio_addr_t start, ram_addr_t size);
+int kvm_uncoalesce_pio_region(pio_addr_t start, ram_addr_t size);
 void kvm_flush_coalesced_mmio_buffer(void);
+void kvm_dirty_log_harvest(void);
 #endif
 
 int kvm_insert_breakpoint(CPUArchState *current_env, target_ulong addr,
@@ -212,4 +219,10 @@ int kvm_set_ioeventfd_mmio(int fd, uint32_t adr, uint32_t val, bool assign,
                            uint32_t size);
 
 int kvm_set_ioeventfd_pio_word(int fd, uint16_t adr, uint16_t val, bool assign);
+
+int kvm_irqchip_send_msi(MSIMessage msg);
+int kvm_irqchip_add_msi_route(MSIMessage msg);
+void kvm_irqchip_release_virq(int virq);
+int kvm_irqchip_add_irqfd(int fd, int virq);
+int kvm_irqchip_remove_irqfd(int fd, int virq);
 #endif
@@ -40,6 +40,8 @@
 char *exec_path;
 
 int singlestep;
+unsigned int tb_hot_threshold;
+const char *tb_cache_path;
 const char *filename;
 const char *argv0;
 int gdbstub_port;
@@ -3112,6 +3114,16 @@ static void handle_arg_singlestep(const char *arg)
     singlestep = 1;
 }
 
+static void handle_arg_tb_hot_threshold(const char *arg)
+{
+    tb_hot_threshold = strtoul(arg, NULL, 0);
+}
+
+static void handle_arg_tb_cache(const char *arg)
+{
+    tb_cache_path = arg;
+}
+
 static void handle_arg_strace(const char *arg)
 {
     do_strace = 1;
@@ -3166,6 +3178,10 @@ struct qemu_argument arg_table[] = {
      "pagesize",   "set the host page size to 'pagesize'"},
     {"singlestep", "QEMU_SINGLESTEP",  false, handle_arg_singlestep,
      "",           "run in singlestep mode"},
+    {"tb-hot-threshold", "QEMU_TB_HOT_THRESHOLD", true, handle_arg_tb_hot_threshold,
+     "count",      "retranslate blocks executed 'count' times as superblocks"},
+    {"tb-cache",   "QEMU_TB_CACHE",    true,  handle_arg_tb_cache,
+     "file",       "reuse translated code saved in 'file' by earlier runs"},
     {"strace",     "QEMU_STRACE",      false, handle_arg_strace,
      "",           "log system calls"},
     {"version",    "QEMU_VERSION",     false, handle_arg_version,
@@ -199,6 +199,12 @@ static int qemu_signal_init(void)
 }
 #endif
 
+#ifndef _WIN32
+/* All fds the POSIX main loop waits on: slirp's sockets, the iohandlers
+ * (just the epoll fd on hosts that have it) and glib's sources. */
+static GArray *gpollfds;
+#endif
+
 int main_loop_init(void)
 {
     int ret;
@@ -215,103 +221,130 @@ int main_loop_init(void)
         return ret;
     }
 
+#ifndef _WIN32
+    gpollfds = g_array_new(FALSE, FALSE, sizeof(GPollFD));
+#endif
     return 0;
 }
 
 static fd_set rfds, wfds, xfds;
 static int nfds;
-static GPollFD poll_fds[1024 * 2]; /* this is probably overkill */
-static int n_poll_fds;
 static int max_priority;
 
 #ifndef _WIN32
-static void glib_select_fill(int *max_fd, fd_set *rfds, fd_set *wfds,
-                             fd_set *xfds, uint32_t *cur_timeout)
+static int slirp_pollfds_idx;
+static int slirp_n_poll_fds;
+static int glib_pollfds_idx;
+static int glib_n_poll_fds;
+
+/* slirp still works on fd_sets; translate them to and from pollfds. */
+static void select_pollfds_fill(GArray *pollfds, int nfds, fd_set *rfds,
+                                fd_set *wfds, fd_set *xfds)
 {
-    GMainContext *context = g_main_context_default();
-    int i;
-    int timeout = 0;
-
-    g_main_context_prepare(context, &max_priority);
-
-    n_poll_fds = g_main_context_query(context, max_priority, &timeout,
-                                      poll_fds, ARRAY_SIZE(poll_fds));
-    g_assert(n_poll_fds <= ARRAY_SIZE(poll_fds));
+    int fd;
 
-    for (i = 0; i < n_poll_fds; i++) {
-        GPollFD *p = &poll_fds[i];
+    slirp_pollfds_idx = pollfds->len;
+    for (fd = 0; fd <= nfds; fd++) {
+        int events = 0;
 
-        if ((p->events & G_IO_IN)) {
-            FD_SET(p->fd, rfds);
-            *max_fd = MAX(*max_fd, p->fd);
+        if (FD_ISSET(fd, rfds)) {
+            events |= G_IO_IN | G_IO_HUP | G_IO_ERR;
+        }
+        if (FD_ISSET(fd, wfds)) {
+            events |= G_IO_OUT | G_IO_ERR;
         }
-        if ((p->events & G_IO_OUT)) {
-            FD_SET(p->fd, wfds);
-            *max_fd = MAX(*max_fd, p->fd);
+        if (FD_ISSET(fd, xfds)) {
+            events |= G_IO_PRI;
         }
-        if ((p->events & G_IO_ERR)) {
-            FD_SET(p->fd, xfds);
-            *max_fd = MAX(*max_fd, p->fd);
+        if (events) {
+            GPollFD pfd = {
+                .fd = fd,
+                .events = events,
+            };
+            g_array_append_val(pollfds, pfd);
         }
     }
+    slirp_n_poll_fds = pollfds->len - slirp_pollfds_idx;
+}
 
-    if (timeout >= 0 && timeout < *cur_timeout) {
-        *cur_timeout = timeout;
+static void select_pollfds_poll(GArray *pollfds, fd_set *rfds, fd_set *wfds,
+                                fd_set *xfds)
+{
+    int i, end = slirp_pollfds_idx + slirp_n_poll_fds;
+
+    FD_ZERO(rfds);
+    FD_ZERO(wfds);
+    FD_ZERO(xfds);
+
+    for (i = slirp_pollfds_idx; i < end; i++) {
+        GPollFD *pfd = &g_array_index(pollfds, GPollFD, i);
+        int fd = pfd->fd;
+        int revents = pfd->revents;
+
+        if (revents & (G_IO_IN | G_IO_HUP | G_IO_ERR)) {
+            FD_SET(fd, rfds);
+        }
+        if (revents & (G_IO_OUT | G_IO_ERR)) {
+            FD_SET(fd, wfds);
+        }
+        if (revents & G_IO_PRI) {
+            FD_SET(fd, xfds);
+        }
     }
 }
 
-static void glib_select_poll(fd_set *rfds, fd_set *wfds, fd_set *xfds,
-                             bool err)
+static void glib_pollfds_fill(uint32_t *cur_timeout)
 {
     GMainContext *context = g_main_context_default();
+    int timeout = 0;
+    int n;
 
-    if (!err) {
-        int i;
+    g_main_context_prepare(context, &max_priority);
 
-        for (i = 0; i < n_poll_fds; i++) {
-            GPollFD *p = &poll_fds[i];
+    glib_pollfds_idx = gpollfds->len;
+    n = glib_n_poll_fds;
+    do {
+        GPollFD *pfds;
+        glib_n_poll_fds = n;
+        g_array_set_size(gpollfds, glib_pollfds_idx + glib_n_poll_fds);
+        pfds = &g_array_index(gpollfds, GPollFD, glib_pollfds_idx);
+        n = g_main_context_query(context, max_priority, &timeout, pfds,
+                                 glib_n_poll_fds);
+    } while (n != glib_n_poll_fds);
 
-            if ((p->events & G_IO_IN) && FD_ISSET(p->fd, rfds)) {
-                p->revents |= G_IO_IN;
-            }
-            if ((p->events & G_IO_OUT) && FD_ISSET(p->fd, wfds)) {
-                p->revents |= G_IO_OUT;
-            }
-            if ((p->events & G_IO_ERR) && FD_ISSET(p->fd, xfds)) {
-                p->revents |= G_IO_ERR;
-            }
-        }
+    if (timeout >= 0 && timeout < *cur_timeout) {
+        *cur_timeout = timeout;
     }
+}
 
-    if (g_main_context_check(context, max_priority, poll_fds, n_poll_fds)) {
+static void glib_pollfds_poll(void)
+{
+    GMainContext *context = g_main_context_default();
+    GPollFD *pfds = &g_array_index(gpollfds, GPollFD, glib_pollfds_idx);
+
+    if (g_main_context_check(context, max_priority, pfds, glib_n_poll_fds)) {
         g_main_context_dispatch(context);
     }
 }
 
 static int os_host_main_loop_wait(uint32_t timeout)
 {
-    struct timeval tv, *tvarg = NULL;
     int ret;
 
-    glib_select_fill(&nfds, &rfds, &wfds, &xfds, &timeout);
-
-    if (timeout < UINT32_MAX) {
-        tvarg = &tv;
-        tv.tv_sec = timeout / 1000;
-        tv.tv_usec = (timeout % 1000) * 1000;
-    }
+    glib_pollfds_fill(&timeout);
 
     if (timeout > 0) {
         qemu_mutex_unlock_iothread();
     }
 
-    ret = select(nfds + 1, &rfds, &wfds, &xfds, tvarg);
+    ret = g_poll((GPollFD *)gpollfds->data, gpollfds->len,
+                 timeout == UINT32_MAX ? -1 : MIN(timeout, INT_MAX));
 
     if (timeout > 0) {
         qemu_mutex_lock_iothread();
     }
 
-    glib_select_poll(&rfds, &wfds, &xfds, (ret < 0));
+    glib_pollfds_poll();
     return ret;
 }
 #else
@@ -404,6 +437,9 @@ void qemu_fd_register(int fd)
                    FD_CONNECT | FD_WRITE | FD_OOB);
 }
 
+static GPollFD poll_fds[1024 * 2]; /* this is probably overkill */
+static int n_poll_fds;
+
 static int os_host_main_loop_wait(uint32_t timeout)
 {
     GMainContext *context = g_main_context_default();
@@ -492,9 +528,18 @@ int main_loop_wait(int nonblocking)
     slirp_update_timeout(&timeout);
     slirp_select_fill(&nfds, &rfds, &wfds, &xfds);
 #endif
+#ifdef _WIN32
     qemu_iohandler_fill(&nfds, &rfds, &wfds, &xfds);
     ret = os_host_main_loop_wait(timeout);
     qemu_iohandler_poll(&rfds, &wfds, &xfds, ret);
+#else
+    g_array_set_size(gpollfds, 0);
+    select_pollfds_fill(gpollfds, nfds, &rfds, &wfds, &xfds);
+    qemu_iohandler_fill(gpollfds);
+    ret = os_host_main_loop_wait(timeout);
+    select_pollfds_poll(gpollfds, &rfds, &wfds, &xfds);
+    qemu_iohandler_poll(gpollfds, ret);
+#endif
 #ifdef CONFIG_SLIRP
     slirp_select_poll(&rfds, &wfds, &xfds, (ret < 0));
 #endif
@@ -18,13 +18,13 @@
 #include "ioport.h"
 #include "bitops.h"
 #include "kvm.h"
+#include "qemu-thread.h"
 #include <assert.h>
 
 #define WANT_EXEC_OBSOLETE
 #include "exec-obsolete.h"
 
 unsigned memory_region_transaction_depth = 0;
-static bool memory_region_update_pending = false;
 static bool global_dirty_log = false;
 
 static QTAILQ_HEAD(memory_listeners, MemoryListener) memory_listeners
@@ -218,17 +218,45 @@ struct FlatView {
     unsigned nr_allocated;
 };
 
+typedef struct LocklessRange LocklessRange;
+
+/* A part of an address space that is backed by a lockless region. */
+struct LocklessRange {
+    MemoryRegion *mr;
+    target_phys_addr_t addr;
+    target_phys_addr_t size;
+    target_phys_addr_t offset_in_region;
+};
+
 typedef struct AddressSpace AddressSpace;
 typedef struct AddressSpaceOps AddressSpaceOps;
 
+/* Past this many dirty ranges, an update renders the whole address space */
+#define ADDRESS_SPACE_MAX_DIRTY 16
+
 /* A system address space - I/O, memory, etc. */
 struct AddressSpace {
     MemoryRegion *root;
     FlatView current_map;
     int ioeventfd_nb;
     MemoryRegionIoeventfd *ioeventfds;
+    /* Sorted copy of the lockless part of current_map, protected by
+     * lockless_lock so that it can be searched without the global mutex.
+     */
+    LocklessRange *lockless_ranges;
+    unsigned lockless_nr;
+    /* Parts of current_map that must be rendered again on the next update */
+    AddrRange dirty[ADDRESS_SPACE_MAX_DIRTY];
+    unsigned dirty_nr;
+    bool dirty_all;
+    /* Index of the range returned by the last address_space_lookup() */
+    unsigned lookup_hint;
 };
 
+/* Leaf lock: only held to look up a LocklessRange and grab a reference to
+ * its region, or to replace the tables. */
+static QemuMutex lockless_lock;
+
 #define FOR_EACH_FLAT_RANGE(var, view)          \
     for (var = (view)->ranges; var < (view)->ranges + (view)->nr; ++var)
 
@@ -377,6 +405,17 @@ static const MemoryRegionPortio *find_portio(MemoryRegion *mr, uint64_t offset,
     return NULL;
 }
 
+/* Accesses to coalesced ranges are queued by KVM and never dispatched
+ * here, so any access that does reach a region with coalesced ranges has
+ * to observe the queued ones first.
+ */
+void memory_region_flush_coalesced(MemoryRegion *mr)
+{
+    if (!QTAILQ_EMPTY(&mr->coalesced)) {
+        qemu_flush_coalesced_mmio_buffer();
+    }
+}
+
 static void memory_region_iorange_read(IORange *iorange,
                                        uint64_t offset,
                                        unsigned width,
@@ -386,6 +425,7 @@ static void memory_region_iorange_read(IORange *iorange,
         = container_of(iorange, MemoryRegionIORange, iorange);
     MemoryRegion *mr = mrio->mr;
 
+    memory_region_flush_coalesced(mr);
     offset += mrio->offset;
     if (mr->ops->old_portio) {
         const MemoryRegionPortio *mrp = find_portio(mr, offset - mrio->offset,
@@ -418,6 +458,7 @@ static void memory_region_iorange_write(IORange *iorange,
         = container_of(iorange, MemoryRegionIORange, iorange);
     MemoryRegion *mr = mrio->mr;
 
+    memory_region_flush_coalesced(mr);
     offset += mrio->offset;
     if (mr->ops->old_portio) {
         const MemoryRegionPortio *mrp = find_portio(mr, offset - mrio->offset,
@@ -538,12 +579,14 @@ static void render_memory_region(FlatView *view,
             offset_in_region += int128_get64(now);
             int128_subfrom(&remain, now);
         }
-        if (int128_eq(base, view->ranges[i].addr.start)) {
-            now = int128_min(remain, view->ranges[i].addr.size);
-            int128_addto(&base, now);
-            offset_in_region += int128_get64(now);
-            int128_subfrom(&remain, now);
-        }
+        /* Skip over the part obscured by this range; @base may start
+         * in the middle of it. */
+        now = int128_sub(int128_min(int128_add(base, remain),
+                                    addrrange_end(view->ranges[i].addr)),
+                         base);
+        int128_addto(&base, now);
+        offset_in_region += int128_get64(now);
+        int128_subfrom(&remain, now);
     }
     if (int128_nz(remain)) {
         fr.mr = mr;
@@ -570,6 +613,168 @@ static FlatView generate_memory_topology(MemoryRegion *mr)
     return view;
 }
 
+static void address_space_invalidate_all(AddressSpace *as)
+{
+    as->dirty_all = true;
+    as->dirty_nr = 0;
+}
+
+/* Note that @range of @as must be rendered again. */
+static void address_space_invalidate(AddressSpace *as, AddrRange range)
+{
+    if (as->dirty_all) {
+        return;
+    }
+    if (as->dirty_nr == ADDRESS_SPACE_MAX_DIRTY) {
+        address_space_invalidate_all(as);
+        return;
+    }
+    as->dirty[as->dirty_nr++] = range;
+}
+
+static bool address_space_is_dirty(AddressSpace *as)
+{
+    return as->root && (as->dirty_all || as->dirty_nr);
+}
+
+/* Longest chain of parents and aliases followed by memory_region_invalidate */
+#define MEMORY_REGION_MAX_DEPTH 64
+
+/* Find where @range (relative to @mr) shows up in the address spaces, by
+ * walking up through parents and through the aliases that point to each
+ * region on the way, and mark those places dirty.
+ */
+static void memory_region_invalidate_range(MemoryRegion *mr, AddrRange range,
+                                           unsigned depth)
+{
+    MemoryRegion *alias;
+
+    if (depth > MEMORY_REGION_MAX_DEPTH) {
+        address_space_invalidate_all(&address_space_memory);
+        address_space_invalidate_all(&address_space_io);
+        return;
+    }
+
+    if (!mr->enabled) {
+        return;
+    }
+    range = addrrange_intersection(range,
+                                   addrrange_make(int128_zero(), mr->size));
+    if (!int128_nonneg(range.size) || !int128_nz(range.size)) {
+        return;
+    }
+
+    QTAILQ_FOREACH(alias, &mr->aliases, aliases_link) {
+        memory_region_invalidate_range(alias,
+            addrrange_shift(range, int128_neg(int128_make64(alias->alias_offset))),
+            depth + 1);
+    }
+
+    range = addrrange_shift(range, int128_make64(mr->addr));
+    if (mr->parent) {
+        memory_region_invalidate_range(mr->parent, range, depth + 1);
+    } else if (mr == address_space_memory.root) {
+        address_space_invalidate(&address_space_memory, range);
+    } else if (mr == address_space_io.root) {
+        address_space_invalidate(&address_space_io, range);
+    }
+}
+
+static void memory_region_invalidate(MemoryRegion *mr)
+{
+    memory_region_invalidate_range(mr, addrrange_make(int128_zero(), mr->size),
+                                   0);
+}
+
+static int cmp_addrrange_start(const void *a_, const void *b_)
+{
+    const AddrRange *a = a_, *b = b_;
+
+    if (int128_lt(a->start, b->start)) {
+        return -1;
+    } else if (int128_eq(a->start, b->start)) {
+        return 0;
+    }
+    return 1;
+}
+
+/* Append @fr to @view, which must stay sorted. */
+static void flatview_append(FlatView *view, FlatRange *fr)
+{
+    flatview_insert(view, view->nr, fr);
+}
+
+/* Build a new view for @as by rendering only its dirty ranges again, and
+ * taking everything else from the current view.
+ */
+static FlatView address_space_render_dirty(AddressSpace *as)
+{
+    AddrRange *dirty = as->dirty;
+    FlatView patch, view;
+    FlatRange *fr, piece;
+    Int128 start, end, dirty_end;
+    unsigned i, j, k, n;
+
+    /* Sort and coalesce the dirty ranges */
+    qsort(dirty, as->dirty_nr, sizeof(*dirty), cmp_addrrange_start);
+    n = 0;
+    for (i = 0; i < as->dirty_nr; ++i) {
+        if (n && int128_ge(addrrange_end(dirty[n - 1]), dirty[i].start)) {
+            dirty_end = int128_max(addrrange_end(dirty[n - 1]),
+                                   addrrange_end(dirty[i]));
+            dirty[n - 1].size = int128_sub(dirty_end, dirty[n - 1].start);
+        } else {
+            dirty[n++] = dirty[i];
+        }
+    }
+
+    flatview_init(&patch);
+    for (i = 0; i < n; ++i) {
+        render_memory_region(&patch, as->root, int128_zero(), dirty[i], false);
+    }
+
+    /* Merge the parts of the old view outside the dirty ranges with the
+     * freshly rendered ones. */
+    flatview_init(&view);
+    j = k = 0;
+    FOR_EACH_FLAT_RANGE(fr, &as->current_map) {
+        start = fr->addr.start;
+        end = addrrange_end(fr->addr);
+        while (k < n && int128_le(addrrange_end(dirty[k]), start)) {
+            ++k;
+        }
+        for (i = k; int128_lt(start, end); ++i) {
+            dirty_end = end;
+            if (i < n && int128_lt(dirty[i].start, end)) {
+                dirty_end = dirty[i].start;
+            }
+            if (int128_lt(start, dirty_end)) {
+                while (j < patch.nr
+                       && int128_lt(patch.ranges[j].addr.start, start)) {
+                    flatview_append(&view, &patch.ranges[j++]);
+                }
+                piece = *fr;
+                piece.offset_in_region +=
+                    int128_get64(int128_sub(start, fr->addr.start));
+                piece.addr = addrrange_make(start,
+                                            int128_sub(dirty_end, start));
+                flatview_append(&view, &piece);
+            }
+            if (i >= n || int128_ge(dirty[i].start, end)) {
+                break;
+            }
+            start = addrrange_end(dirty[i]);
+        }
+    }
+    while (j < patch.nr) {
+        flatview_append(&view, &patch.ranges[j++]);
+    }
+    flatview_destroy(&patch);
+    flatview_simplify(&view);
+
+    return view;
+}
+
 static void address_space_add_del_ioeventfds(AddressSpace *as,
                                              MemoryRegionIoeventfd *fds_new,
                                              unsigned fds_new_nb,
@@ -650,6 +855,53 @@ static void address_space_update_ioeventfds(AddressSpace *as)
     as->ioeventfd_nb = ioeventfd_nb;
 }
 
+static void address_space_coalesce(AddressSpace *as, AddrRange range,
+                                   bool add)
+{
+    target_phys_addr_t start = int128_get64(range.start);
+    uint64_t size = int128_get64(range.size);
+
+    if (as == &address_space_io) {
+        if (!kvm_enabled()) {
+            return;
+        }
+        if (add) {
+            kvm_coalesce_pio_region(start, size);
+        } else {
+            kvm_uncoalesce_pio_region(start, size);
+        }
+    } else if (add) {
+        qemu_register_coalesced_mmio(start, size);
+    } else {
+        qemu_unregister_coalesced_mmio(start, size);
+    }
+}
+
+static void flat_range_coalesced_io_del(FlatRange *fr, AddressSpace *as)
+{
+    if (QTAILQ_EMPTY(&fr->mr->coalesced)) {
+        return;
+    }
+    address_space_coalesce(as, fr->addr, false);
+}
+
+static void flat_range_coalesced_io_add(FlatRange *fr, AddressSpace *as)
+{
+    CoalescedMemoryRange *cmr;
+    AddrRange tmp;
+
+    QTAILQ_FOREACH(cmr, &fr->mr->coalesced, link) {
+        tmp = addrrange_shift(cmr->addr,
+                              int128_sub(fr->addr.start,
+                                         int128_make64(fr->offset_in_region)));
+        if (!addrrange_intersects(tmp, fr->addr)) {
+            continue;
+        }
+        tmp = addrrange_intersection(tmp, fr->addr);
+        address_space_coalesce(as, tmp, true);
+    }
+}
+
 static void address_space_update_topology_pass(AddressSpace *as,
                                                FlatView old_view,
                                                FlatView new_view,
@@ -682,6 +934,7 @@ static void address_space_update_topology_pass(AddressSpace *as,
             /* In old, but (not in new, or in new but attributes changed). */
 
             if (!adding) {
+                flat_range_coalesced_io_del(frold, as);
                 MEMORY_LISTENER_UPDATE_REGION(frold, as, Reverse, region_del);
             }
 
@@ -705,6 +958,7 @@ static void address_space_update_topology_pass(AddressSpace *as,
 
             if (adding) {
                 MEMORY_LISTENER_UPDATE_REGION(frnew, as, Forward, region_add);
+                flat_range_coalesced_io_add(frnew, as);
             }
 
             ++inew;
@@ -713,10 +967,48 @@ static void address_space_update_topology_pass(AddressSpace *as,
 }
 
 
+static void address_space_update_lockless(AddressSpace *as)
+{
+    LocklessRange *ranges = NULL, *old_ranges;
+    unsigned nr = 0;
+    FlatRange *fr;
+
+    FOR_EACH_FLAT_RANGE(fr, &as->current_map) {
+        if (!fr->mr->lockless) {
+            continue;
+        }
+        ranges = g_renew(LocklessRange, ranges, nr + 1);
+        ranges[nr].mr = fr->mr;
+        ranges[nr].addr = int128_get64(fr->addr.start);
+        ranges[nr].size = int128_get64(fr->addr.size);
+        ranges[nr].offset_in_region = fr->offset_in_region;
+        ++nr;
+    }
+
+    if (!nr && !as->lockless_nr) {
+        return;
+    }
+
+    qemu_mutex_lock(&lockless_lock);
+    old_ranges = as->lockless_ranges;
+    as->lockless_ranges = ranges;
+    as->lockless_nr = nr;
+    qemu_mutex_unlock(&lockless_lock);
+    g_free(old_ranges);
+}
+
 static void address_space_update_topology(AddressSpace *as)
 {
     FlatView old_view = as->current_map;
-    FlatView new_view = generate_memory_topology(as->root);
+    FlatView new_view;
+
+    if (as->dirty_all) {
+        new_view = generate_memory_topology(as->root);
+    } else {
+        new_view = address_space_render_dirty(as);
+    }
+    as->dirty_all = false;
+    as->dirty_nr = 0;
 
     address_space_update_topology_pass(as, old_view, new_view, false);
     address_space_update_topology_pass(as, old_view, new_view, true);
@@ -724,31 +1016,45 @@ static void address_space_update_topology(AddressSpace *as)
     as->current_map = new_view;
     flatview_destroy(&old_view);
     address_space_update_ioeventfds(as);
+    address_space_update_lockless(as);
 }
 
-static void memory_region_update_topology(MemoryRegion *mr)
+/* Apply the pending invalidations, unless a transaction is open. */
+static void memory_region_commit_topology(void)
 {
     if (memory_region_transaction_depth) {
-        memory_region_update_pending |= !mr || mr->enabled;
         return;
     }
 
-    if (mr && !mr->enabled) {
+    if (!address_space_is_dirty(&address_space_memory)
+        && !address_space_is_dirty(&address_space_io)) {
         return;
     }
 
     MEMORY_LISTENER_CALL_GLOBAL(begin, Forward);
 
-    if (address_space_memory.root) {
+    if (address_space_is_dirty(&address_space_memory)) {
         address_space_update_topology(&address_space_memory);
     }
-    if (address_space_io.root) {
+    if (address_space_is_dirty(&address_space_io)) {
         address_space_update_topology(&address_space_io);
     }
 
     MEMORY_LISTENER_CALL_GLOBAL(commit, Forward);
+}
 
-    memory_region_update_pending = false;
+/* Update the address spaces after a change to @mr, which is still in
+ * place, or to everything if @mr is NULL.
+ */
+static void memory_region_update_topology(MemoryRegion *mr)
+{
+    if (mr) {
+        memory_region_invalidate(mr);
+    } else {
+        address_space_invalidate_all(&address_space_memory);
+        address_space_invalidate_all(&address_space_io);
+    }
+    memory_region_commit_topology();
 }
 
 void memory_region_transaction_begin(void)
@@ -760,9 +1066,7 @@ void memory_region_transaction_commit(void)
 {
     assert(memory_region_transaction_depth);
     --memory_region_transaction_depth;
-    if (!memory_region_transaction_depth && memory_region_update_pending) {
-        memory_region_update_topology(NULL);
-    }
+    memory_region_commit_topology();
 }
 
 static void memory_region_destructor_none(MemoryRegion *mr)
@@ -821,11 +1125,14 @@ void memory_region_init(MemoryRegion *mr,
     mr->alias = NULL;
     QTAILQ_INIT(&mr->subregions);
     memset(&mr->subregions_link, 0, sizeof mr->subregions_link);
+    QTAILQ_INIT(&mr->aliases);
     QTAILQ_INIT(&mr->coalesced);
     mr->name = g_strdup(name);
     mr->dirty_log_mask = 0;
     mr->ioeventfd_nb = 0;
     mr->ioeventfds = NULL;
+    mr->lockless = false;
+    mr->lockless_refs = 0;
 }
 
 static bool memory_region_access_valid(MemoryRegion *mr,
@@ -901,6 +1208,7 @@ static uint64_t memory_region_dispatch_read(MemoryRegion *mr,
 {
     uint64_t ret;
 
+    memory_region_flush_coalesced(mr);
     ret = memory_region_dispatch_read1(mr, addr, size);
     adjust_endianness(mr, &ret, size);
     return ret;
@@ -915,6 +1223,7 @@ static void memory_region_dispatch_write(MemoryRegion *mr,
         return; /* FIXME: better signalling */
     }
 
+    memory_region_flush_coalesced(mr);
     adjust_endianness(mr, &data, size);
 
     if (!mr->ops->write) {
@@ -954,6 +1263,17 @@ void memory_region_init_ram(MemoryRegion *mr,
     mr->ram_addr = qemu_ram_alloc(size, mr);
 }
 
+void memory_region_init_ram_numa(MemoryRegion *mr,
+                                 const char *name,
+                                 uint64_t size)
+{
+    memory_region_init(mr, name, size);
+    mr->ram = true;
+    mr->terminates = true;
+    mr->destructor = memory_region_destructor_ram;
+    mr->ram_addr = qemu_ram_alloc_numa(size, mr);
+}
+
 void memory_region_init_ram_ptr(MemoryRegion *mr,
                                 const char *name,
                                 uint64_t size,
@@ -975,6 +1295,7 @@ void memory_region_init_alias(MemoryRegion *mr,
     memory_region_init(mr, name, size);
     mr->alias = orig;
     mr->alias_offset = offset;
+    QTAILQ_INSERT_TAIL(&orig->aliases, mr, aliases_link);
 }
 
 void memory_region_init_rom_device(MemoryRegion *mr,
@@ -1028,9 +1349,38 @@ void memory_region_init_reservation(MemoryRegion *mr,
     memory_region_init_io(mr, &reservation_ops, mr, name, size);
 }
 
+static void memory_region_drain_lockless(MemoryRegion *mr)
+{
+    AddressSpace *spaces[] = { &address_space_memory, &address_space_io };
+    unsigned i, j;
+
+    /* Unpublish the region, so that no new access can find it... */
+    qemu_mutex_lock(&lockless_lock);
+    for (i = 0; i < ARRAY_SIZE(spaces); ++i) {
+        for (j = 0; j < spaces[i]->lockless_nr; ++j) {
+            if (spaces[i]->lockless_ranges[j].mr == mr) {
+                spaces[i]->lockless_ranges[j].mr = NULL;
+            }
+        }
+    }
+    qemu_mutex_unlock(&lockless_lock);
+
+    /* ...and wait for those that already did. */
+    while (__sync_fetch_and_add(&mr->lockless_refs, 0)) {
+        g_usleep(10);
+    }
+}
+
 void memory_region_destroy(MemoryRegion *mr)
 {
     assert(QTAILQ_EMPTY(&mr->subregions));
+    assert(QTAILQ_EMPTY(&mr->aliases));
+    if (mr->alias) {
+        QTAILQ_REMOVE(&mr->alias->aliases, mr, aliases_link);
+    }
+    if (mr->lockless) {
+        memory_region_drain_lockless(mr);
+    }
     mr->destructor(mr);
     memory_region_clear_coalescing(mr);
     g_free((char *)mr->name);
@@ -1088,6 +1438,15 @@ void memory_region_set_dirty(MemoryRegion *mr, target_phys_addr_t addr,
     return cpu_physical_memory_set_dirty_range(mr->ram_addr + addr, size, -1);
 }
 
+void memory_region_set_dirty_lebitmap(MemoryRegion *mr, target_phys_addr_t addr,
+                                      const unsigned long *bitmap,
+                                      uint64_t first, uint64_t nr)
+{
+    assert(mr->terminates);
+    cpu_physical_memory_set_dirty_lebitmap(mr->ram_addr + addr, bitmap,
+                                           first, nr);
+}
+
 void memory_region_sync_dirty_bitmap(MemoryRegion *mr)
 {
     FlatRange *fr;
@@ -1136,31 +1495,34 @@ void *memory_region_get_ram_ptr(MemoryRegion *mr)
     return qemu_get_ram_ptr(mr->ram_addr & TARGET_PAGE_MASK);
 }
 
-static void memory_region_update_coalesced_range(MemoryRegion *mr)
+static void memory_region_update_coalesced_range_as(MemoryRegion *mr,
+                                                    AddressSpace *as)
 {
     FlatRange *fr;
-    CoalescedMemoryRange *cmr;
-    AddrRange tmp;
 
-    FOR_EACH_FLAT_RANGE(fr, &address_space_memory.current_map) {
+    FOR_EACH_FLAT_RANGE(fr, &as->current_map) {
         if (fr->mr == mr) {
-            qemu_unregister_coalesced_mmio(int128_get64(fr->addr.start),
-                                           int128_get64(fr->addr.size));
-            QTAILQ_FOREACH(cmr, &mr->coalesced, link) {
-                tmp = addrrange_shift(cmr->addr,
-                                      int128_sub(fr->addr.start,
-                                                 int128_make64(fr->offset_in_region)));
-                if (!addrrange_intersects(tmp, fr->addr)) {
-                    continue;
-                }
-                tmp = addrrange_intersection(tmp, fr->addr);
-                qemu_register_coalesced_mmio(int128_get64(tmp.start),
-                                             int128_get64(tmp.size));
-            }
+            address_space_coalesce(as, fr->addr, false);
+            flat_range_coalesced_io_add(fr, as);
         }
     }
 }
 
+static void memory_region_update_coalesced_range(MemoryRegion *mr)
+{
+    memory_region_update_coalesced_range_as(mr, &address_space_memory);
+    memory_region_update_coalesced_range_as(mr, &address_space_io);
+}
+
+void memory_region_set_lockless(MemoryRegion *mr, bool lockless)
+{
+    assert(!lockless || (mr->ops && mr->ops->read && mr->ops->write));
+    if (mr->lockless != lockless) {
+        mr->lockless = lockless;
+        memory_region_update_topology(mr);
+    }
+}
+
 void memory_region_set_coalescing(MemoryRegion *mr)
 {
     memory_region_clear_coalescing(mr);
@@ -1288,7 +1650,7 @@ static void memory_region_add_subregion_common(MemoryRegion *mr,
     }
     QTAILQ_INSERT_TAIL(&mr->subregions, subregion, subregions_link);
 done:
-    memory_region_update_topology(mr);
+    memory_region_update_topology(subregion);
 }
 
 
@@ -1315,9 +1677,10 @@ void memory_region_del_subregion(MemoryRegion *mr,
                                  MemoryRegion *subregion)
 {
     assert(subregion->parent == mr);
+    memory_region_invalidate(subregion);
     subregion->parent = NULL;
     QTAILQ_REMOVE(&mr->subregions, subregion, subregions_link);
-    memory_region_update_topology(mr);
+    memory_region_commit_topology();
 }
 
 void memory_region_set_enabled(MemoryRegion *mr, bool enabled)
@@ -1325,8 +1688,11 @@ void memory_region_set_enabled(MemoryRegion *mr, bool enabled)
     if (enabled == mr->enabled) {
         return;
     }
+    /* Invalidate while the region is visible, i.e. before disabling it
+     * or after enabling it */
+    memory_region_invalidate(mr);
     mr->enabled = enabled;
-    memory_region_update_topology(NULL);
+    memory_region_update_topology(mr);
 }
 
 void memory_region_set_address(MemoryRegion *mr, target_phys_addr_t addr)
@@ -1357,7 +1723,7 @@ void memory_region_set_alias_offset(MemoryRegion *mr, target_phys_addr_t offset)
     assert(mr->alias);
     mr->alias_offset = offset;
 
-    if (offset == old_offset || !mr->parent) {
+    if (offset == old_offset) {
         return;
     }
 
@@ -1369,23 +1735,36 @@ ram_addr_t memory_region_get_ram_addr(MemoryRegion *mr)
     return mr->ram_addr;
 }
 
-static int cmp_flatrange_addr(const void *addr_, const void *fr_)
+/* Return the lowest range of @as that intersects @addr, or NULL. */
+static FlatRange *address_space_lookup(AddressSpace *as, AddrRange addr)
 {
-    const AddrRange *addr = addr_;
-    const FlatRange *fr = fr_;
+    FlatView *view = &as->current_map;
+    unsigned lo, hi, mid;
 
-    if (int128_le(addrrange_end(*addr), fr->addr.start)) {
-        return -1;
-    } else if (int128_ge(addr->start, addrrange_end(fr->addr))) {
-        return 1;
+    /* Lookups tend to hit the same range over and over */
+    if (as->lookup_hint < view->nr
+        && addrrange_contains(view->ranges[as->lookup_hint].addr,
+                              addr.start)) {
+        return &view->ranges[as->lookup_hint];
     }
-    return 0;
-}
 
-static FlatRange *address_space_lookup(AddressSpace *as, AddrRange addr)
-{
-    return bsearch(&addr, as->current_map.ranges, as->current_map.nr,
-                   sizeof(FlatRange), cmp_flatrange_addr);
+    /* Find the first range that ends after the start of @addr */
+    lo = 0;
+    hi = view->nr;
+    while (lo < hi) {
+        mid = lo + (hi - lo) / 2;
+        if (int128_le(addrrange_end(view->ranges[mid].addr), addr.start)) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+
+    if (lo == view->nr || !addrrange_intersects(view->ranges[lo].addr, addr)) {
+        return NULL;
+    }
+    as->lookup_hint = lo;
+    return &view->ranges[lo];
 }
 
 MemoryRegionSection memory_region_find(MemoryRegion *address_space,
@@ -1401,11 +1780,6 @@ MemoryRegionSection memory_region_find(MemoryRegion *address_space,
         return ret;
     }
 
-    while (fr > as->current_map.ranges
-           && addrrange_intersects(fr[-1].addr, range)) {
-        --fr;
-    }
-
     ret.mr = fr->mr;
     range = addrrange_intersection(range, fr->addr);
     ret.offset_within_region = fr->offset_in_region;
@@ -1417,11 +1791,80 @@ MemoryRegionSection memory_region_find(MemoryRegion *address_space,
     return ret;
 }
 
+static int cmp_lockless_range(const void *addr_, const void *lr_)
+{
+    target_phys_addr_t addr = *(const target_phys_addr_t *)addr_;
+    const LocklessRange *lr = lr_;
+
+    if (addr < lr->addr) {
+        return -1;
+    } else if (addr - lr->addr >= lr->size) {
+        return 1;
+    }
+    return 0;
+}
+
+bool memory_region_dispatch_lockless(MemoryRegion *address_space,
+                                     target_phys_addr_t addr, uint64_t *data,
+                                     unsigned size, bool is_write)
+{
+    AddressSpace *as = memory_region_to_address_space(address_space);
+    MemoryRegion *mr = NULL;
+    target_phys_addr_t offset = 0;
+    LocklessRange *lr;
+
+    /* Racy, but the common case is that there are no lockless regions at
+     * all; a region that was just added will be found on the next exit. */
+    if (!as->lockless_nr) {
+        return false;
+    }
+
+    /* Regions with coalesced ranges must see the ring flushed first,
+     * which needs the global mutex. */
+    qemu_mutex_lock(&lockless_lock);
+    lr = bsearch(&addr, as->lockless_ranges, as->lockless_nr,
+                 sizeof(LocklessRange), cmp_lockless_range);
+    if (lr && lr->mr && addr - lr->addr + size <= lr->size
+        && QTAILQ_EMPTY(&lr->mr->coalesced)) {
+        mr = lr->mr;
+        offset = addr - lr->addr + lr->offset_in_region;
+        __sync_fetch_and_add(&mr->lockless_refs, 1);
+    }
+    qemu_mutex_unlock(&lockless_lock);
+
+    if (!mr) {
+        return false;
+    }
+
+    if (as == &address_space_io) {
+        /* Same conventions as memory_region_iorange_read/write */
+        if (!is_write) {
+            *data = 0;
+        }
+        access_with_adjusted_size(offset, data, size,
+                                  mr->ops->impl.min_access_size,
+                                  mr->ops->impl.max_access_size,
+                                  is_write ? memory_region_write_accessor
+                                           : memory_region_read_accessor,
+                                  mr);
+    } else if (is_write) {
+        memory_region_dispatch_write(mr, offset, *data, size);
+    } else {
+        *data = memory_region_dispatch_read(mr, offset, size);
+    }
+
+    __sync_fetch_and_sub(&mr->lockless_refs, 1);
+    return true;
+}
+
 void memory_global_sync_dirty_bitmap(MemoryRegion *address_space)
 {
     AddressSpace *as = memory_region_to_address_space(address_space);
     FlatRange *fr;
 
+    if (kvm_enabled()) {
+        kvm_dirty_log_harvest();
+    }
     FOR_EACH_FLAT_RANGE(fr, &as->current_map) {
         MEMORY_LISTENER_UPDATE_REGION(fr, as, Forward, log_sync);
     }
@@ -1491,14 +1934,26 @@ void memory_listener_unregister(MemoryListener *listener)
     QTAILQ_REMOVE(&memory_listeners, listener, link);
 }
 
+static void memory_lockless_init(void)
+{
+    static bool initialized;
+
+    if (!initialized) {
+        qemu_mutex_init(&lockless_lock);
+        initialized = true;
+    }
+}
+
 void set_system_memory_map(MemoryRegion *mr)
 {
+    memory_lockless_init();
     address_space_memory.root = mr;
     memory_region_update_topology(NULL);
 }
 
 void set_system_io_map(MemoryRegion *mr)
 {
+    memory_lockless_init();
     address_space_io.root = mr;
     memory_region_update_topology(NULL);
 }
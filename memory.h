@@ -139,11 +139,15 @@ struct MemoryRegion {
     bool may_overlap;
     QTAILQ_HEAD(subregions, MemoryRegion) subregions;
     QTAILQ_ENTRY(MemoryRegion) subregions_link;
+    QTAILQ_HEAD(aliases, MemoryRegion) aliases; /* Aliases of this region */
+    QTAILQ_ENTRY(MemoryRegion) aliases_link;
     QTAILQ_HEAD(coalesced_ranges, CoalescedMemoryRange) coalesced;
     const char *name;
     uint8_t dirty_log_mask;
     unsigned ioeventfd_nb;
     MemoryRegionIoeventfd *ioeventfds;
+    bool lockless;
+    unsigned lockless_refs; /* Accesses in flight outside the global mutex */
 };
 
 struct MemoryRegionPortio {
@@ -251,6 +255,22 @@ void memory_region_init_ram(MemoryRegion *mr,
                             const char *name,
                             uint64_t size);
 
+/**
+ * memory_region_init_ram_numa:  Initialize the main RAM of a machine.  Like
+ *                               memory_region_init_ram(), but the host memory
+ *                               is split between the guest NUMA nodes, in
+ *                               order and with the sizes given by -numa, and
+ *                               each part is placed on the host as requested
+ *                               there.
+ *
+ * @mr: the #MemoryRegion to be initialized.
+ * @name: the name of the region.
+ * @size: size of the region.
+ */
+void memory_region_init_ram_numa(MemoryRegion *mr,
+                                 const char *name,
+                                 uint64_t size);
+
 /**
  * memory_region_init_ram:  Initialize RAM memory region from a user-provided.
  *                          pointer.  Accesses into the region will modify
@@ -432,6 +452,24 @@ bool memory_region_get_dirty(MemoryRegion *mr, target_phys_addr_t addr,
 void memory_region_set_dirty(MemoryRegion *mr, target_phys_addr_t addr,
                              target_phys_addr_t size);
 
+/**
+ * memory_region_set_dirty_lebitmap: Mark pages dirty from a bitmap.
+ *
+ * Marks as dirty the pages starting at @addr whose bits are set in
+ * @bitmap, a little endian array of longs like KVM produces, from bit
+ * @first on.  Must be called with the iothread lock held.
+ *
+ * @mr: the memory region being dirtied.
+ * @addr: the page-aligned address (relative to the start of the region)
+ *        of the page for bit @first.
+ * @bitmap: the dirty bitmap, with one bit per target page.
+ * @first: the first bit of @bitmap to use.
+ * @nr: the number of bits to use.
+ */
+void memory_region_set_dirty_lebitmap(MemoryRegion *mr, target_phys_addr_t addr,
+                                      const unsigned long *bitmap,
+                                      uint64_t first, uint64_t nr);
+
 /**
  * memory_region_sync_dirty_bitmap: Synchronize a region's dirty bitmap with
  *                                  any external TLBs (e.g. kvm)
@@ -483,12 +521,31 @@ void memory_region_set_readonly(MemoryRegion *mr, bool readonly);
  */
 void memory_region_rom_device_set_readable(MemoryRegion *mr, bool readable);
 
+/**
+ * memory_region_set_lockless: Allow accesses to the region to be dispatched
+ *                             without holding the global mutex.
+ *
+ * Accesses that vcpu threads make to a lockless region are dispatched
+ * straight from the thread that took the exit (see
+ * memory_region_dispatch_lockless()).  The callbacks may then run
+ * concurrently with each other and with the rest of QEMU: they must do
+ * their own locking and must not take the global mutex.
+ * memory_region_destroy() waits for accesses that are still in flight.
+ * Only useful for IO regions with MemoryRegionOps read and write callbacks.
+ *
+ * @mr: the memory region being updated.
+ * @lockless: whether accesses may bypass the global mutex.
+ */
+void memory_region_set_lockless(MemoryRegion *mr, bool lockless);
+
 /**
  * memory_region_set_coalescing: Enable memory coalescing for the region.
  *
  * Enabled writes to a region to be queued for later processing. MMIO ->write
- * callbacks may be delayed until a non-coalesced MMIO is issued.
- * Only useful for IO regions.  Roughly similar to write-combining hardware.
+ * callbacks may be delayed until a non-coalesced access to the same region
+ * is issued, or the vcpu stops running.  Works for regions in the system I/O
+ * space as well, if KVM supports coalesced PIO.  Only useful for IO regions.
+ * Roughly similar to write-combining hardware.
  *
  * @mr: the memory region to be write coalesced
  */
@@ -520,6 +577,17 @@ void memory_region_add_coalescing(MemoryRegion *mr,
  */
 void memory_region_clear_coalescing(MemoryRegion *mr);
 
+/**
+ * memory_region_flush_coalesced: Process writes queued for a region.
+ *
+ * Devices that look at state the guest writes through coalesced ranges
+ * from outside a guest access, e.g. on packet reception, must call this
+ * first.  Does nothing if @mr has no coalesced ranges.
+ *
+ * @mr: the memory region whose queued writes must be visible.
+ */
+void memory_region_flush_coalesced(MemoryRegion *mr);
+
 /**
  * memory_region_add_eventfd: Request an eventfd to be triggered when a word
  *                            is written to a location.
@@ -696,10 +764,31 @@ memory_region_section_addr(MemoryRegionSection *section,
     return addr;
 }
 
+/**
+ * memory_region_dispatch_lockless: try to dispatch an access without holding
+ *                                  the global mutex
+ *
+ * Looks up @addr in @address_space and, if it falls into a region marked
+ * with memory_region_set_lockless(), performs the access.  May be called
+ * without the global mutex.  Returns %false, without side effects, if the
+ * access must instead be dispatched normally with the global mutex held.
+ *
+ * @address_space: the system memory or I/O root region.
+ * @addr: absolute address of the access.
+ * @data: value to write, or where to store the value read.
+ * @size: access size in bytes.
+ * @is_write: whether the access is a write.
+ */
+bool memory_region_dispatch_lockless(MemoryRegion *address_space,
+                                     target_phys_addr_t addr, uint64_t *data,
+                                     unsigned size, bool is_write);
+
 /**
  * memory_global_sync_dirty_bitmap: synchronize the dirty log for all memory
  *
- * Synchronizes the dirty page log for an entire address space.
+ * Synchronizes the dirty page log for an entire address space.  With KVM
+ * the iothread lock is dropped while the logs are fetched from the kernel.
+ *
  * @address_space: a top-level (i.e. parentless) region that contains the
  *       memory being synchronized
  */
@@ -1971,6 +1971,11 @@ static void do_info_numa(Monitor *mon)
 {
     int i;
     CPUArchState *env;
+    NumaNodeInfoList *info_list, *info;
+    NumaHostNodeUsageList *usage;
+
+    info_list = qmp_query_numa(NULL);
+    info = info_list;
 
     monitor_printf(mon, "%d nodes\n", nb_numa_nodes);
     for (i = 0; i < nb_numa_nodes; i++) {
@@ -1983,7 +1988,30 @@ static void do_info_numa(Monitor *mon)
         monitor_printf(mon, "\n");
         monitor_printf(mon, "node %d size: %" PRId64 " MB\n", i,
             node_mem[i] >> 20);
+        if (!info) {
+            continue;
+        }
+        monitor_printf(mon, "node %d host: policy %s", i,
+                       NumaMemPolicy_lookup[info->value->policy]);
+        if (info->value->has_host_nodes) {
+            monitor_printf(mon, " nodes 0x%" PRIx64,
+                           info->value->host_nodes);
+        }
+        monitor_printf(mon, " pages %" PRId64 " kB",
+                       info->value->page_size >> 10);
+        if (info->value->has_mem_path) {
+            monitor_printf(mon, " path %s", info->value->mem_path);
+        }
+        for (usage = info->value->usage; usage; usage = usage->next) {
+            monitor_printf(mon, " [%" PRId64 ": %" PRId64 " MB]",
+                           usage->value->host_node,
+                           usage->value->bytes >> 20);
+        }
+        monitor_printf(mon, "\n");
+        info = info->next;
     }
+
+    qapi_free_NumaNodeInfoList(info_list);
 }
 
 #ifdef CONFIG_PROFILER
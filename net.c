@@ -30,6 +30,7 @@
 #include "net/dump.h"
 #include "net/slirp.h"
 #include "net/vde.h"
+#include "net/vhost-user.h"
 #include "net/util.h"
 #include "monitor.h"
 #include "qemu-common.h"
@@ -221,12 +222,13 @@ VLANClientState *qemu_new_net_client(NetClientInfo *info,
             peer->peer = vc;
         }
         QTAILQ_INSERT_TAIL(&non_vlan_clients, vc, next);
-
-        vc->send_queue = qemu_new_net_queue(qemu_deliver_packet,
-                                            qemu_deliver_packet_iov,
-                                            vc);
     }
 
+    /* VLAN clients need their own queue too, see qemu_net_peer() */
+    vc->send_queue = qemu_new_net_queue(qemu_deliver_packet,
+                                        qemu_deliver_packet_iov,
+                                        vc);
+
     return vc;
 }
 
@@ -266,13 +268,11 @@ static void qemu_cleanup_vlan_client(VLANClientState *vc)
 
 static void qemu_free_vlan_client(VLANClientState *vc)
 {
-    if (!vc->vlan) {
-        if (vc->send_queue) {
-            qemu_del_net_queue(vc->send_queue);
-        }
-        if (vc->peer) {
-            vc->peer->peer = NULL;
-        }
+    if (vc->send_queue) {
+        qemu_del_net_queue(vc->send_queue);
+    }
+    if (!vc->vlan && vc->peer) {
+        vc->peer->peer = NULL;
     }
     g_free(vc->name);
     g_free(vc->model);
@@ -355,16 +355,87 @@ void qemu_foreach_nic(qemu_nic_foreach func, void *opaque)
     }
 }
 
+int qemu_has_ufo(VLANClientState *vc)
+{
+    if (!vc || !vc->info->has_ufo) {
+        return 0;
+    }
+
+    return vc->info->has_ufo(vc);
+}
+
+int qemu_has_vnet_hdr(VLANClientState *vc)
+{
+    if (!vc || !vc->info->has_vnet_hdr) {
+        return 0;
+    }
+
+    return vc->info->has_vnet_hdr(vc);
+}
+
+void qemu_using_vnet_hdr(VLANClientState *vc, int enable)
+{
+    if (!vc || !vc->info->using_vnet_hdr) {
+        return;
+    }
+
+    vc->info->using_vnet_hdr(vc, enable);
+}
+
+void qemu_set_offload(VLANClientState *vc, int csum, int tso4, int tso6,
+                      int ecn, int ufo)
+{
+    if (!vc || !vc->info->set_offload) {
+        return;
+    }
+
+    vc->info->set_offload(vc, csum, tso4, tso6, ecn, ufo);
+}
+
+struct vhost_net *qemu_get_vhost_net(VLANClientState *vc)
+{
+    if (!vc || !vc->info->get_vhost_net) {
+        return NULL;
+    }
+
+    return vc->info->get_vhost_net(vc);
+}
+
+/*
+ * qemu_net_peer - Where packets from @sender go, if only one place
+ *
+ * A VLAN is a hub that broadcasts every packet to all of its clients.  The
+ * usual VLAN has just a NIC and a backend on it, though, and then the hub
+ * has nothing to do: treat the two as peers, like -netdev does, and send
+ * straight into the receiver's own queue.  Only VLANs with three or more
+ * clients go through the hub.
+ */
+static VLANClientState *qemu_net_peer(VLANClientState *sender)
+{
+    VLANClientState *first, *second;
+
+    if (!sender->vlan) {
+        return sender->peer;
+    }
+
+    first = QTAILQ_FIRST(&sender->vlan->clients);
+    second = QTAILQ_NEXT(first, next);
+    if (!second || QTAILQ_NEXT(second, next)) {
+        return NULL;
+    }
+    return first == sender ? second : first;
+}
+
 int qemu_can_send_packet(VLANClientState *sender)
 {
     VLANState *vlan = sender->vlan;
-    VLANClientState *vc;
+    VLANClientState *vc, *peer = qemu_net_peer(sender);
 
-    if (sender->peer) {
-        if (sender->peer->receive_disabled) {
+    if (peer) {
+        if (peer->receive_disabled) {
             return 0;
-        } else if (sender->peer->info->can_receive &&
-                   !sender->peer->info->can_receive(sender->peer)) {
+        } else if (peer->info->can_receive &&
+                   !peer->info->can_receive(peer)) {
             return 0;
         } else {
             return 1;
@@ -464,34 +535,42 @@ static ssize_t qemu_vlan_deliver_packet(VLANClientState *sender,
 
 void qemu_purge_queued_packets(VLANClientState *vc)
 {
-    NetQueue *queue;
+    VLANClientState *other;
 
-    if (!vc->peer && !vc->vlan) {
+    if (vc->peer) {
+        qemu_net_queue_purge(vc->peer->send_queue, vc);
+    }
+    if (!vc->vlan) {
         return;
     }
 
-    if (vc->peer) {
-        queue = vc->peer->send_queue;
-    } else {
-        queue = vc->vlan->send_queue;
+    /* Clients come and go, so the VLAN may have been a pair earlier */
+    qemu_net_queue_purge(vc->vlan->send_queue, vc);
+    QTAILQ_FOREACH(other, &vc->vlan->clients, next) {
+        if (other != vc) {
+            qemu_net_queue_purge(other->send_queue, vc);
+        }
     }
-
-    qemu_net_queue_purge(queue, vc);
 }
 
 void qemu_flush_queued_packets(VLANClientState *vc)
 {
-    NetQueue *queue;
-
     vc->receive_disabled = 0;
 
+    qemu_net_queue_flush(vc->send_queue);
     if (vc->vlan) {
-        queue = vc->vlan->send_queue;
-    } else {
-        queue = vc->send_queue;
+        qemu_net_queue_flush(vc->vlan->send_queue);
     }
+}
+
+static NetQueue *qemu_net_send_queue(VLANClientState *sender)
+{
+    VLANClientState *peer = qemu_net_peer(sender);
 
-    qemu_net_queue_flush(queue);
+    if (peer) {
+        return peer->send_queue;
+    }
+    return sender->vlan ? sender->vlan->send_queue : NULL;
 }
 
 static ssize_t qemu_send_packet_async_with_flags(VLANClientState *sender,
@@ -506,16 +585,11 @@ static ssize_t qemu_send_packet_async_with_flags(VLANClientState *sender,
     hex_dump(stdout, buf, size);
 #endif
 
-    if (sender->link_down || (!sender->peer && !sender->vlan)) {
+    queue = qemu_net_send_queue(sender);
+    if (sender->link_down || !queue) {
         return size;
     }
 
-    if (sender->peer) {
-        queue = sender->peer->send_queue;
-    } else {
-        queue = sender->vlan->send_queue;
-    }
-
     return qemu_net_queue_send(queue, sender, flags, buf, size, sent_cb);
 }
 
@@ -610,16 +684,11 @@ ssize_t qemu_sendv_packet_async(VLANClientState *sender,
 {
     NetQueue *queue;
 
-    if (sender->link_down || (!sender->peer && !sender->vlan)) {
+    queue = qemu_net_send_queue(sender);
+    if (sender->link_down || !queue) {
         return iov_size(iov, iovcnt);
     }
 
-    if (sender->peer) {
-        queue = sender->peer->send_queue;
-    } else {
-        queue = sender->vlan->send_queue;
-    }
-
     return qemu_net_queue_send_iov(queue, sender,
                                    QEMU_NET_PACKET_FLAG_NONE,
                                    iov, iovcnt, sent_cb);
@@ -928,6 +997,10 @@ static const struct {
                 .name = "guestfwd",
                 .type = QEMU_OPT_STRING,
                 .help = "IP address and port to forward guest TCP connections",
+            }, {
+                .name = "vnet_hdr",
+                .type = QEMU_OPT_BOOL,
+                .help = "offer checksum and TCP segmentation offload to virtio-net",
             },
             { /* end of list */ }
         },
@@ -1016,6 +1089,35 @@ static const struct {
                 .name = "udp",
                 .type = QEMU_OPT_STRING,
                 .help = "UDP unicast address and port number",
+            }, {
+                .name = "l2tpv3",
+                .type = QEMU_OPT_BOOL,
+                .help = "encapsulate udp packets in L2TPv3",
+            }, {
+                .name = "txsession",
+                .type = QEMU_OPT_NUMBER,
+                .help = "L2TPv3 session id of sent packets",
+            }, {
+                .name = "rxsession",
+                .type = QEMU_OPT_NUMBER,
+                .help = "L2TPv3 session id of received packets"
+                        " (default txsession)",
+            }, {
+                .name = "txcookie",
+                .type = QEMU_OPT_NUMBER,
+                .help = "L2TPv3 cookie of sent packets",
+            }, {
+                .name = "rxcookie",
+                .type = QEMU_OPT_NUMBER,
+                .help = "L2TPv3 cookie of received packets",
+            }, {
+                .name = "cookie64",
+                .type = QEMU_OPT_BOOL,
+                .help = "use 64-bit L2TPv3 cookies instead of 32-bit",
+            }, {
+                .name = "counter",
+                .type = QEMU_OPT_BOOL,
+                .help = "L2TPv3 sequence numbers, on both ends",
             },
             { /* end of list */ }
         },
@@ -1060,6 +1162,22 @@ static const struct {
                 .name = "file",
                 .type = QEMU_OPT_STRING,
                 .help = "dump file path (default is qemu-vlan0.pcap)",
+            }, {
+                .name = "filter",
+                .type = QEMU_OPT_STRING,
+                .help = "only dump packets matching this filter expression",
+            }, {
+                .name = "bufsize",
+                .type = QEMU_OPT_SIZE,
+                .help = "size of the in-memory packet buffer (4M default)",
+            }, {
+                .name = "filesize",
+                .type = QEMU_OPT_SIZE,
+                .help = "start a new file when this size is reached",
+            }, {
+                .name = "files",
+                .type = QEMU_OPT_NUMBER,
+                .help = "number of files to rotate through (no limit default)",
             },
             { /* end of list */ }
         },
@@ -1083,6 +1201,21 @@ static const struct {
         },
     },
 #endif /* CONFIG_NET_BRIDGE */
+#ifdef CONFIG_LINUX
+    [NET_CLIENT_TYPE_VHOST_USER] = {
+        .type = "vhost-user",
+        .init = net_init_vhost_user,
+        .desc = {
+            NET_COMMON_PARAMS_DESC,
+            {
+                .name = "path",
+                .type = QEMU_OPT_STRING,
+                .help = "socket of the process that runs the virtqueues",
+            },
+            { /* end of list */ }
+        },
+    },
+#endif /* CONFIG_LINUX */
 };
 
 int net_client_init(Monitor *mon, QemuOpts *opts, int is_netdev)
@@ -1107,6 +1240,9 @@ int net_client_init(Monitor *mon, QemuOpts *opts, int is_netdev)
 #endif
 #ifdef CONFIG_VDE
             strcmp(type, "vde") != 0 &&
+#endif
+#ifdef CONFIG_LINUX
+            strcmp(type, "vhost-user") != 0 &&
 #endif
             strcmp(type, "socket") != 0) {
             qerror_report(QERR_INVALID_PARAMETER_VALUE, "type",
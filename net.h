@@ -38,6 +38,7 @@ typedef enum {
     NET_CLIENT_TYPE_VDE,
     NET_CLIENT_TYPE_DUMP,
     NET_CLIENT_TYPE_BRIDGE,
+    NET_CLIENT_TYPE_VHOST_USER,
 
     NET_CLIENT_TYPE_MAX
 } net_client_type;
@@ -48,6 +49,11 @@ typedef ssize_t (NetReceive)(VLANClientState *, const uint8_t *, size_t);
 typedef ssize_t (NetReceiveIOV)(VLANClientState *, const struct iovec *, int);
 typedef void (NetCleanup) (VLANClientState *);
 typedef void (LinkStatusChanged)(VLANClientState *);
+typedef int (NetHasUfo)(VLANClientState *);
+typedef int (NetHasVnetHdr)(VLANClientState *);
+typedef void (NetUsingVnetHdr)(VLANClientState *, int);
+typedef void (NetSetOffload)(VLANClientState *, int, int, int, int, int);
+typedef struct vhost_net *(NetGetVhostNet)(VLANClientState *);
 
 typedef struct NetClientInfo {
     net_client_type type;
@@ -59,6 +65,14 @@ typedef struct NetClientInfo {
     NetCleanup *cleanup;
     LinkStatusChanged *link_status_changed;
     NetPoll *poll;
+    /* Backends that can exchange frames behind a struct virtio_net_hdr,
+     * and so take part in checksum and segmentation offloads.  */
+    NetHasUfo *has_ufo;
+    NetHasVnetHdr *has_vnet_hdr;
+    NetUsingVnetHdr *using_vnet_hdr;
+    NetSetOffload *set_offload;
+    /* Backends whose frames can be moved by vhost instead of QEMU */
+    NetGetVhostNet *get_vhost_net;
 } NetClientInfo;
 
 struct VLANClientState {
@@ -116,6 +130,12 @@ ssize_t qemu_send_packet_async(VLANClientState *vc, const uint8_t *buf,
                                int size, NetPacketSent *sent_cb);
 void qemu_purge_queued_packets(VLANClientState *vc);
 void qemu_flush_queued_packets(VLANClientState *vc);
+int qemu_has_ufo(VLANClientState *vc);
+int qemu_has_vnet_hdr(VLANClientState *vc);
+void qemu_using_vnet_hdr(VLANClientState *vc, int enable);
+void qemu_set_offload(VLANClientState *vc, int csum, int tso4, int tso6,
+                      int ecn, int ufo);
+struct vhost_net *qemu_get_vhost_net(VLANClientState *vc);
 void qemu_format_nic_info_str(VLANClientState *vc, uint8_t macaddr[6]);
 void qemu_macaddr_default_if_unset(MACAddr *macaddr);
 int qemu_show_nic_models(const char *arg, const char *const *models);
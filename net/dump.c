@@ -25,18 +25,57 @@
 #include "dump.h"
 #include "qemu-common.h"
 #include "qemu-error.h"
-#include "qemu-log.h"
 #include "qemu-timer.h"
+#include "qemu-thread.h"
+#include "qemu-barrier.h"
+#include "iov.h"
+#include "net/filter.h"
+#include "net/ring.h"
 
+/*
+ * Packets are copied into a ring, already in file format, by the receive
+ * callback; a thread writes them out in large chunks.  The two sides
+ * share no lock: the receive side only moves tail, the writer only head.
+ * If the ring is full, packets are dropped rather than stalling the VLAN.
+ *
+ * Errors of the writer stop the dump.  The writer cannot report them
+ * itself, since error_report is not thread-safe; it leaves a message that
+ * the receive side reports.
+ */
 typedef struct DumpState {
     VLANClientState nc;
     int64_t start_ts;
     int fd;
     int pcap_caplen;
+    NetFilter *filter;
+
+    uint8_t *buf;
+    unsigned int buf_size;      /* power of two */
+    unsigned int head;          /* written out up to here */
+    unsigned int tail;          /* filled up to here */
+    unsigned int dropped;
+    int failed;                 /* see dump_fail and dump_failed */
+    char *error;                /* written before failed is set */
+
+    /* Rotation: ring offsets at which a new file starts */
+    NetRing *rotations;
+    uint64_t file_size;         /* 0 for no rotation */
+    uint64_t file_bytes;        /* size of the file being filled */
+    int files;                  /* names to cycle through, 0 for no limit */
+    int file_index;             /* of the file being written */
+    char *filename;
+
+    QemuThread thread;
+    QemuMutex lock;
+    QemuCond cond;
+    bool writer_waiting;
+    bool stop;
 } DumpState;
 
 #define PCAP_MAGIC 0xa1b2c3d4
 
+#define DUMP_ROTATIONS 64
+
 struct pcap_file_hdr {
     uint32_t magic;
     uint16_t version_major;
@@ -56,32 +95,289 @@ struct pcap_sf_pkthdr {
     uint32_t len;
 };
 
-static ssize_t dump_receive(VLANClientState *nc, const uint8_t *buf, size_t size)
+/* The filter looks at this much of each frame, see qemu-options.hx */
+#define DUMP_FILTER_HDR 128
+
+/* Create the @index'th file of a rotating dump and write its header.  On
+ * failure, returns -1 and sets *@errmsg; this also runs on the writer
+ * thread, so it must not report errors itself.
+ */
+static int dump_open(const char *base, int index, int caplen, char **errmsg)
+{
+    struct pcap_file_hdr hdr;
+    char *filename;
+    int fd;
+
+    if (index) {
+        filename = g_strdup_printf("%s.%d", base, index);
+    } else {
+        filename = g_strdup(base);
+    }
+    fd = open(filename, O_CREAT | O_TRUNC | O_WRONLY | O_BINARY, 0644);
+    if (fd < 0) {
+        *errmsg = g_strdup_printf("-net dump: can't open %s: %s", filename,
+                                  strerror(errno));
+        g_free(filename);
+        return -1;
+    }
+    g_free(filename);
+
+    hdr.magic = PCAP_MAGIC;
+    hdr.version_major = 2;
+    hdr.version_minor = 4;
+    hdr.thiszone = 0;
+    hdr.sigfigs = 0;
+    hdr.snaplen = caplen;
+    hdr.linktype = 1;
+
+    if (write(fd, &hdr, sizeof(hdr)) < sizeof(hdr)) {
+        *errmsg = g_strdup_printf("-net dump write error: %s",
+                                  strerror(errno));
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+/* Either side: whether the dump has stopped; if so, s->error is valid */
+static bool dump_failed(DumpState *s)
+{
+    int failed = *(volatile int *)&s->failed;
+
+    smp_rmb();
+    return failed;
+}
+
+/* Receive side: report the error the writer left, once */
+static void dump_report_error(DumpState *s)
+{
+    if (s->error) {
+        error_report("%s", s->error);
+        g_free(s->error);
+        s->error = NULL;
+    }
+}
+
+/* Writer thread side */
+
+/* Stop the dump; only the writer sets failed, so nobody else touches
+ * s->error before it is published here.
+ */
+static void dump_fail(DumpState *s, char *errmsg)
+{
+    s->error = errmsg;
+    smp_wmb();
+    *(volatile int *)&s->failed = 1;
+}
+
+static void dump_rotate(DumpState *s)
+{
+    int index = s->file_index + 1;
+    char *errmsg;
+
+    if (s->files && index >= s->files) {
+        index = 0;
+    }
+    close(s->fd);
+    s->fd = dump_open(s->filename, index, s->pcap_caplen, &errmsg);
+    s->file_index = index;
+    if (s->fd < 0) {
+        dump_fail(s, errmsg);
+    }
+}
+
+static void dump_write(DumpState *s, const uint8_t *buf, size_t len)
+{
+    ssize_t ret;
+
+    while (len && !s->failed) {
+        ret = write(s->fd, buf, len);
+        if (ret < 0 && errno == EINTR) {
+            continue;
+        }
+        if (ret <= 0) {
+            dump_fail(s, g_strdup_printf("-net dump write error: %s - "
+                                         "stop dump",
+                                         ret ? strerror(errno) : "no space"));
+            break;
+        }
+        buf += ret;
+        len -= ret;
+    }
+}
+
+/* Returns false if there is nothing to write and the dump is stopping */
+static bool dump_wait(DumpState *s)
+{
+    bool stop;
+
+    qemu_mutex_lock(&s->lock);
+    s->writer_waiting = true;
+    smp_mb();
+    while (!(stop = s->stop) &&
+           *(volatile unsigned int *)&s->tail == s->head) {
+        qemu_cond_wait(&s->cond, &s->lock);
+    }
+    s->writer_waiting = false;
+    qemu_mutex_unlock(&s->lock);
+    smp_rmb();
+    return !stop || *(volatile unsigned int *)&s->tail != s->head;
+}
+
+static void *dump_writer(void *opaque)
+{
+    DumpState *s = opaque;
+    unsigned int head, tail, start, len, rotation;
+
+    while (dump_wait(s)) {
+        head = s->head;
+        tail = *(volatile unsigned int *)&s->tail;
+        smp_rmb();
+
+        /* Offsets may be 0 after wrapping, so do not use net_ring_peek */
+        if (net_ring_count(s->rotations)) {
+            rotation = (uintptr_t)net_ring_entry(s->rotations, 0);
+            if (rotation == head) {
+                if (!s->failed) {
+                    dump_rotate(s);
+                }
+                net_ring_pop(s->rotations);
+                continue;
+            }
+            if (rotation - head < tail - head) {
+                tail = rotation;
+            }
+        }
+
+        start = head & (s->buf_size - 1);
+        len = MIN(tail - head, s->buf_size - start);
+        dump_write(s, s->buf + start, len);
+
+        /* The data must have been read before the space is reused */
+        smp_mb();
+        *(volatile unsigned int *)&s->head = head + len;
+    }
+    return NULL;
+}
+
+/* Receive side */
+
+static void dump_copy(DumpState *s, unsigned int pos, const void *data,
+                      size_t len)
+{
+    unsigned int start = pos & (s->buf_size - 1);
+    size_t n = MIN(len, s->buf_size - start);
+
+    memcpy(s->buf + start, data, n);
+    memcpy(s->buf, (const uint8_t *)data + n, len - n);
+}
+
+/* Reserve room for a record of @caplen bytes and fill in its header;
+ * returns the ring position of the packet data or false if it is dropped */
+static bool dump_reserve(DumpState *s, size_t size, size_t caplen,
+                         unsigned int *pos)
 {
-    DumpState *s = DO_UPCAST(DumpState, nc, nc);
     struct pcap_sf_pkthdr hdr;
+    unsigned int tail = s->tail;
+    size_t len = sizeof(hdr) + caplen;
     int64_t ts;
-    int caplen;
 
-    /* Early return in case of previous error. */
-    if (s->fd < 0) {
-        return size;
+    if (len > s->buf_size - (tail - *(volatile unsigned int *)&s->head)) {
+        s->dropped++;
+        return false;
+    }
+    if (s->file_size &&
+        s->file_bytes + len > s->file_size &&
+        s->file_bytes > sizeof(struct pcap_file_hdr)) {
+        if (!net_ring_push(s->rotations, (void *)(uintptr_t)tail)) {
+            s->dropped++;
+            return false;
+        }
+        s->file_bytes = sizeof(struct pcap_file_hdr);
     }
+    s->file_bytes += len;
 
     ts = muldiv64(qemu_get_clock_ns(vm_clock), 1000000, get_ticks_per_sec());
-    caplen = size > s->pcap_caplen ? s->pcap_caplen : size;
 
     hdr.ts.tv_sec = ts / 1000000 + s->start_ts;
     hdr.ts.tv_usec = ts % 1000000;
     hdr.caplen = caplen;
     hdr.len = size;
-    if (write(s->fd, &hdr, sizeof(hdr)) != sizeof(hdr) ||
-        write(s->fd, buf, caplen) != caplen) {
-        qemu_log("-net dump write error - stop dump\n");
-        close(s->fd);
-        s->fd = -1;
+    dump_copy(s, tail, &hdr, sizeof(hdr));
+    *pos = tail + sizeof(hdr);
+    return true;
+}
+
+static void dump_commit(DumpState *s, unsigned int end)
+{
+    smp_wmb();
+    *(volatile unsigned int *)&s->tail = end;
+
+    /* Pairs with the barrier in dump_wait: either the writer sees the new
+     * tail, or we see that it is going to sleep. */
+    smp_mb();
+    if (s->writer_waiting) {
+        qemu_mutex_lock(&s->lock);
+        qemu_cond_signal(&s->cond);
+        qemu_mutex_unlock(&s->lock);
     }
+}
 
+static ssize_t dump_receive(VLANClientState *nc, const uint8_t *buf, size_t size)
+{
+    DumpState *s = DO_UPCAST(DumpState, nc, nc);
+    size_t caplen;
+    unsigned int pos;
+
+    /* Early return in case of previous error. */
+    if (dump_failed(s)) {
+        dump_report_error(s);
+        return size;
+    }
+    if (s->filter &&
+        !net_filter_match(s->filter, buf, MIN(size, DUMP_FILTER_HDR), size)) {
+        return size;
+    }
+
+    caplen = MIN(size, s->pcap_caplen);
+    if (dump_reserve(s, size, caplen, &pos)) {
+        dump_copy(s, pos, buf, caplen);
+        dump_commit(s, pos + caplen);
+    }
+    return size;
+}
+
+static ssize_t dump_receive_iov(VLANClientState *nc, const struct iovec *iov,
+                                int iovcnt)
+{
+    DumpState *s = DO_UPCAST(DumpState, nc, nc);
+    uint8_t hdr[DUMP_FILTER_HDR];
+    size_t size = iov_size(iov, iovcnt);
+    size_t caplen, len;
+    unsigned int pos;
+    int i;
+
+    if (dump_failed(s)) {
+        dump_report_error(s);
+        return size;
+    }
+    if (s->filter) {
+        len = iov_to_buf(iov, iovcnt, hdr, 0, sizeof(hdr));
+        if (!net_filter_match(s->filter, hdr, len, size)) {
+            return size;
+        }
+    }
+
+    caplen = MIN(size, s->pcap_caplen);
+    if (dump_reserve(s, size, caplen, &pos)) {
+        for (i = 0; i < iovcnt && caplen; i++) {
+            len = MIN(iov[i].iov_len, caplen);
+            dump_copy(s, pos, iov[i].iov_base, len);
+            pos += len;
+            caplen -= len;
+        }
+        dump_commit(s, pos);
+    }
     return size;
 }
 
@@ -89,42 +385,61 @@ static void dump_cleanup(VLANClientState *nc)
 {
     DumpState *s = DO_UPCAST(DumpState, nc, nc);
 
-    close(s->fd);
+    qemu_mutex_lock(&s->lock);
+    s->stop = true;
+    qemu_cond_signal(&s->cond);
+    qemu_mutex_unlock(&s->lock);
+    qemu_thread_join(&s->thread);
+
+    dump_report_error(s);
+    if (s->dropped) {
+        error_report("-net dump: %u packets dropped", s->dropped);
+    }
+    if (s->fd >= 0) {
+        close(s->fd);
+    }
+    net_filter_free(s->filter);
+    net_ring_free(s->rotations);
+    qemu_cond_destroy(&s->cond);
+    qemu_mutex_destroy(&s->lock);
+    g_free(s->buf);
+    g_free(s->filename);
 }
 
 static NetClientInfo net_dump_info = {
     .type = NET_CLIENT_TYPE_DUMP,
     .size = sizeof(DumpState),
     .receive = dump_receive,
+    .receive_iov = dump_receive_iov,
     .cleanup = dump_cleanup,
 };
 
 static int net_dump_init(VLANState *vlan, const char *device,
-                         const char *name, const char *filename, int len)
+                         const char *name, const char *filename, int len,
+                         const char *filter, uint64_t bufsize,
+                         uint64_t file_size, int files)
 {
-    struct pcap_file_hdr hdr;
     VLANClientState *nc;
+    NetFilter *f = NULL;
     DumpState *s;
     struct tm tm;
+    const char *err;
+    char *errmsg;
     int fd;
 
-    fd = open(filename, O_CREAT | O_TRUNC | O_WRONLY | O_BINARY, 0644);
-    if (fd < 0) {
-        error_report("-net dump: can't open %s", filename);
-        return -1;
+    if (filter) {
+        f = net_filter_new(filter, &err);
+        if (!f) {
+            error_report("-net dump: filter syntax error at '%s'", err);
+            return -1;
+        }
     }
 
-    hdr.magic = PCAP_MAGIC;
-    hdr.version_major = 2;
-    hdr.version_minor = 4;
-    hdr.thiszone = 0;
-    hdr.sigfigs = 0;
-    hdr.snaplen = len;
-    hdr.linktype = 1;
-
-    if (write(fd, &hdr, sizeof(hdr)) < sizeof(hdr)) {
-        error_report("-net dump write error: %s", strerror(errno));
-        close(fd);
+    fd = dump_open(filename, 0, len, &errmsg);
+    if (fd < 0) {
+        error_report("%s", errmsg);
+        g_free(errmsg);
+        net_filter_free(f);
         return -1;
     }
 
@@ -137,16 +452,33 @@ static int net_dump_init(VLANState *vlan, const char *device,
 
     s->fd = fd;
     s->pcap_caplen = len;
+    s->filename = g_strdup(filename);
+    s->filter = f;
+    s->file_size = file_size;
+    s->file_bytes = sizeof(struct pcap_file_hdr);
+    s->files = files;
+
+    s->buf_size = 1;
+    while (s->buf_size < bufsize && s->buf_size < (1U << 31)) {
+        s->buf_size <<= 1;
+    }
+    s->buf = g_malloc(s->buf_size);
+    s->rotations = net_ring_new(DUMP_ROTATIONS);
 
     qemu_get_timedate(&tm, 0);
     s->start_ts = mktime(&tm);
 
+    qemu_mutex_init(&s->lock);
+    qemu_cond_init(&s->cond);
+    qemu_thread_create(&s->thread, dump_writer, s, QEMU_THREAD_JOINABLE);
+
     return 0;
 }
 
 int net_init_dump(QemuOpts *opts, Monitor *mon, const char *name, VLANState *vlan)
 {
-    int len;
+    int len, files;
+    uint64_t bufsize, file_size;
     const char *file;
     char def_file[128];
 
@@ -159,6 +491,15 @@ int net_init_dump(QemuOpts *opts, Monitor *mon, const char *name, VLANState *vla
     }
 
     len = qemu_opt_get_size(opts, "len", 65536);
+    bufsize = qemu_opt_get_size(opts, "bufsize", 4 * 1024 * 1024);
+    if (bufsize < len + sizeof(struct pcap_sf_pkthdr)) {
+        error_report("-net dump: bufsize must hold at least one packet");
+        return -1;
+    }
+    file_size = qemu_opt_get_size(opts, "filesize", 0);
+    files = qemu_opt_get_number(opts, "files", 0);
 
-    return net_dump_init(vlan, "dump", name, file, len);
+    return net_dump_init(vlan, "dump", name, file, len,
+                         qemu_opt_get(opts, "filter"), bufsize, file_size,
+                         files);
 }
@@ -0,0 +1,415 @@
+/*
+ * Packet filter expressions
+ *
+ * Copyright (c) 2012 agent <agent@local>
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ *
+ */
+
+#include "net/filter.h"
+
+#define ETH_P_IP    0x0800
+#define ETH_P_ARP   0x0806
+#define ETH_P_8021Q 0x8100
+#define ETH_P_IPV6  0x86dd
+
+#define PROTO_ICMP  1
+#define PROTO_TCP   6
+#define PROTO_UDP  17
+
+enum {
+    FILTER_AND,
+    FILTER_OR,
+    FILTER_NOT,
+    FILTER_ARP,
+    FILTER_IP,
+    FILTER_IP6,
+    FILTER_TCP,
+    FILTER_UDP,
+    FILTER_ICMP,
+    FILTER_VLAN,
+    FILTER_BROADCAST,
+    FILTER_MULTICAST,
+    FILTER_HOST,
+    FILTER_PORT,
+    FILTER_LESS,
+    FILTER_GREATER,
+};
+
+enum {
+    FILTER_DIR_ANY,
+    FILTER_DIR_SRC,
+    FILTER_DIR_DST,
+};
+
+struct NetFilter {
+    int op;
+    int dir;
+    uint32_t val;
+    NetFilter *left, *right;
+};
+
+static const struct {
+    const char *name;
+    int op;
+} filter_keywords[] = {
+    { "arp", FILTER_ARP },
+    { "ip", FILTER_IP },
+    { "ip6", FILTER_IP6 },
+    { "tcp", FILTER_TCP },
+    { "udp", FILTER_UDP },
+    { "icmp", FILTER_ICMP },
+    { "vlan", FILTER_VLAN },
+    { "broadcast", FILTER_BROADCAST },
+    { "multicast", FILTER_MULTICAST },
+};
+
+typedef struct FilterParser {
+    const char *pos;        /* after the current token */
+    const char *tok;        /* current token, len bytes; len 0 at the end */
+    size_t len;
+    const char *err;
+} FilterParser;
+
+static void filter_next(FilterParser *p)
+{
+    const char *s = p->pos;
+    size_t len = 0;
+
+    while (qemu_isspace(*s)) {
+        s++;
+    }
+    if (*s == '(' || *s == ')' || *s == '!') {
+        len = 1;
+    } else if ((s[0] == '&' && s[1] == '&') || (s[0] == '|' && s[1] == '|')) {
+        len = 2;
+    } else {
+        while (qemu_isalnum(s[len]) || s[len] == '.') {
+            len++;
+        }
+        if (!len && *s) {
+            len = 1;
+        }
+    }
+    p->tok = s;
+    p->len = len;
+    p->pos = s + len;
+}
+
+static bool filter_accept(FilterParser *p, const char *word)
+{
+    if (p->len != strlen(word) || memcmp(p->tok, word, p->len)) {
+        return false;
+    }
+    filter_next(p);
+    return true;
+}
+
+static NetFilter *filter_error(FilterParser *p)
+{
+    if (!p->err) {
+        p->err = p->tok;
+    }
+    return NULL;
+}
+
+static NetFilter *filter_node(int op, NetFilter *left, NetFilter *right)
+{
+    NetFilter *f = g_malloc0(sizeof(*f));
+
+    f->op = op;
+    f->left = left;
+    f->right = right;
+    return f;
+}
+
+/* The current token as a number no bigger than @max */
+static bool filter_number(FilterParser *p, uint32_t max, uint32_t *val)
+{
+    char buf[16], *end;
+    unsigned long v;
+
+    if (!p->len || p->len >= sizeof(buf)) {
+        return false;
+    }
+    memcpy(buf, p->tok, p->len);
+    buf[p->len] = 0;
+    v = strtoul(buf, &end, 0);
+    if (*end || !qemu_isdigit(buf[0]) || v > max) {
+        return false;
+    }
+    *val = v;
+    filter_next(p);
+    return true;
+}
+
+static bool filter_ipv4(FilterParser *p, uint32_t *addr)
+{
+    unsigned int a[4];
+    char buf[16], c;
+    int i;
+
+    if (!p->len || p->len >= sizeof(buf)) {
+        return false;
+    }
+    memcpy(buf, p->tok, p->len);
+    buf[p->len] = 0;
+    if (sscanf(buf, "%u.%u.%u.%u%c", &a[0], &a[1], &a[2], &a[3], &c) != 4) {
+        return false;
+    }
+    *addr = 0;
+    for (i = 0; i < 4; i++) {
+        if (a[i] > 255) {
+            return false;
+        }
+        *addr = *addr << 8 | a[i];
+    }
+    filter_next(p);
+    return true;
+}
+
+static NetFilter *filter_or(FilterParser *p);
+
+static NetFilter *filter_primitive(FilterParser *p)
+{
+    NetFilter *f;
+    uint32_t val;
+    int i, dir = FILTER_DIR_ANY;
+
+    if (filter_accept(p, "src")) {
+        dir = FILTER_DIR_SRC;
+    } else if (filter_accept(p, "dst")) {
+        dir = FILTER_DIR_DST;
+    }
+
+    if (filter_accept(p, "host")) {
+        if (!filter_ipv4(p, &val)) {
+            return filter_error(p);
+        }
+        f = filter_node(FILTER_HOST, NULL, NULL);
+    } else if (filter_accept(p, "port")) {
+        if (!filter_number(p, 65535, &val)) {
+            return filter_error(p);
+        }
+        f = filter_node(FILTER_PORT, NULL, NULL);
+    } else if (dir != FILTER_DIR_ANY) {
+        return filter_error(p);
+    } else if (filter_accept(p, "less")) {
+        if (!filter_number(p, UINT32_MAX, &val)) {
+            return filter_error(p);
+        }
+        f = filter_node(FILTER_LESS, NULL, NULL);
+    } else if (filter_accept(p, "greater")) {
+        if (!filter_number(p, UINT32_MAX, &val)) {
+            return filter_error(p);
+        }
+        f = filter_node(FILTER_GREATER, NULL, NULL);
+    } else {
+        for (i = 0; i < ARRAY_SIZE(filter_keywords); i++) {
+            if (filter_accept(p, filter_keywords[i].name)) {
+                return filter_node(filter_keywords[i].op, NULL, NULL);
+            }
+        }
+        return filter_error(p);
+    }
+    f->dir = dir;
+    f->val = val;
+    return f;
+}
+
+static NetFilter *filter_not(FilterParser *p)
+{
+    NetFilter *f;
+
+    if (filter_accept(p, "not") || filter_accept(p, "!")) {
+        f = filter_not(p);
+        return f ? filter_node(FILTER_NOT, f, NULL) : NULL;
+    }
+    if (filter_accept(p, "(")) {
+        f = filter_or(p);
+        if (f && !filter_accept(p, ")")) {
+            net_filter_free(f);
+            return filter_error(p);
+        }
+        return f;
+    }
+    return filter_primitive(p);
+}
+
+static NetFilter *filter_and(FilterParser *p)
+{
+    NetFilter *f, *right;
+
+    f = filter_not(p);
+    while (f && (filter_accept(p, "and") || filter_accept(p, "&&"))) {
+        right = filter_not(p);
+        if (!right) {
+            net_filter_free(f);
+            return NULL;
+        }
+        f = filter_node(FILTER_AND, f, right);
+    }
+    return f;
+}
+
+static NetFilter *filter_or(FilterParser *p)
+{
+    NetFilter *f, *right;
+
+    f = filter_and(p);
+    while (f && (filter_accept(p, "or") || filter_accept(p, "||"))) {
+        right = filter_and(p);
+        if (!right) {
+            net_filter_free(f);
+            return NULL;
+        }
+        f = filter_node(FILTER_OR, f, right);
+    }
+    return f;
+}
+
+NetFilter *net_filter_new(const char *expr, const char **err)
+{
+    FilterParser p = { .pos = expr };
+    NetFilter *f;
+
+    filter_next(&p);
+    f = filter_or(&p);
+    if (f && p.len) {
+        net_filter_free(f);
+        f = filter_error(&p);
+    }
+    if (!f) {
+        *err = p.err;
+    }
+    return f;
+}
+
+void net_filter_free(NetFilter *f)
+{
+    if (f) {
+        net_filter_free(f->left);
+        net_filter_free(f->right);
+        g_free(f);
+    }
+}
+
+/* The headers, parsed once per frame */
+typedef struct FilterPacket {
+    size_t len;
+    uint16_t proto;         /* ethertype, behind the VLAN tag if any */
+    bool vlan;
+    bool broadcast;
+    bool multicast;
+    int l4;                 /* IP protocol or -1 */
+    bool has_addr;
+    uint32_t src, dst;
+    bool has_ports;
+    uint16_t sport, dport;
+} FilterPacket;
+
+static void filter_parse_packet(FilterPacket *pkt, const uint8_t *buf,
+                                size_t caplen, size_t len)
+{
+    static const uint8_t bcast[6] = { 0xff, 0xff, 0xff, 0xff, 0xff, 0xff };
+    const uint8_t *ip, *l4 = NULL;
+    size_t off = 14, hlen;
+
+    memset(pkt, 0, sizeof(*pkt));
+    pkt->len = len;
+    pkt->l4 = -1;
+    if (caplen < off) {
+        return;
+    }
+    pkt->broadcast = !memcmp(buf, bcast, sizeof(bcast));
+    pkt->multicast = (buf[0] & 1) && !pkt->broadcast;
+    pkt->proto = buf[12] << 8 | buf[13];
+    if (pkt->proto == ETH_P_8021Q && caplen >= off + 4) {
+        pkt->vlan = true;
+        pkt->proto = buf[16] << 8 | buf[17];
+        off += 4;
+    }
+    ip = buf + off;
+
+    if (pkt->proto == ETH_P_IP && caplen >= off + 20) {
+        hlen = (ip[0] & 0xf) * 4;
+        pkt->l4 = ip[9];
+        pkt->has_addr = true;
+        pkt->src = ip[12] << 24 | ip[13] << 16 | ip[14] << 8 | ip[15];
+        pkt->dst = ip[16] << 24 | ip[17] << 16 | ip[18] << 8 | ip[19];
+        /* Only the first fragment carries the ports */
+        if (hlen >= 20 && !((ip[6] << 8 | ip[7]) & 0x1fff)) {
+            l4 = ip + hlen;
+        }
+    } else if (pkt->proto == ETH_P_IPV6 && caplen >= off + 40) {
+        pkt->l4 = ip[6];
+        l4 = ip + 40;
+    }
+
+    if (l4 && (pkt->l4 == PROTO_TCP || pkt->l4 == PROTO_UDP) &&
+        l4 + 4 <= buf + caplen) {
+        pkt->has_ports = true;
+        pkt->sport = l4[0] << 8 | l4[1];
+        pkt->dport = l4[2] << 8 | l4[3];
+    }
+}
+
+static bool filter_dir_match(int dir, uint32_t src, uint32_t dst,
+                             uint32_t val)
+{
+    return (dir != FILTER_DIR_DST && src == val) ||
+           (dir != FILTER_DIR_SRC && dst == val);
+}
+
+static bool filter_eval(const NetFilter *f, const FilterPacket *pkt)
+{
+    switch (f->op) {
+    case FILTER_AND:
+        return filter_eval(f->left, pkt) && filter_eval(f->right, pkt);
+    case FILTER_OR:
+        return filter_eval(f->left, pkt) || filter_eval(f->right, pkt);
+    case FILTER_NOT:
+        return !filter_eval(f->left, pkt);
+    case FILTER_ARP:
+        return pkt->proto == ETH_P_ARP;
+    case FILTER_IP:
+        return pkt->proto == ETH_P_IP;
+    case FILTER_IP6:
+        return pkt->proto == ETH_P_IPV6;
+    case FILTER_TCP:
+        return pkt->l4 == PROTO_TCP;
+    case FILTER_UDP:
+        return pkt->l4 == PROTO_UDP;
+    case FILTER_ICMP:
+        return pkt->proto == ETH_P_IP && pkt->l4 == PROTO_ICMP;
+    case FILTER_VLAN:
+        return pkt->vlan;
+    case FILTER_BROADCAST:
+        return pkt->broadcast;
+    case FILTER_MULTICAST:
+        return pkt->multicast;
+    case FILTER_HOST:
+        return pkt->has_addr &&
+               filter_dir_match(f->dir, pkt->src, pkt->dst, f->val);
+    case FILTER_PORT:
+        return pkt->has_ports &&
+               filter_dir_match(f->dir, pkt->sport, pkt->dport, f->val);
+    case FILTER_LESS:
+        return pkt->len <= f->val;
+    case FILTER_GREATER:
+        return pkt->len >= f->val;
+    default:
+        abort();
+    }
+}
+
+bool net_filter_match(const NetFilter *f, const uint8_t *buf, size_t caplen,
+                      size_t len)
+{
+    FilterPacket pkt;
+
+    filter_parse_packet(&pkt, buf, caplen, len);
+    return filter_eval(f, &pkt);
+}
@@ -0,0 +1,39 @@
+/*
+ * Packet filter expressions
+ *
+ * Copyright (c) 2012 agent <agent@local>
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ *
+ */
+
+#ifndef QEMU_NET_FILTER_H
+#define QEMU_NET_FILTER_H
+
+#include "qemu-common.h"
+
+/*
+ * A subset of the pcap filter language:
+ *
+ *   arp, ip, ip6, tcp, udp, icmp, vlan, broadcast, multicast
+ *   [src|dst] host A.B.C.D
+ *   [src|dst] port N
+ *   less N, greater N
+ *
+ * combined with "not"/"!", "and"/"&&", "or"/"||" and parentheses.  The
+ * protocol primitives see through a single VLAN tag; host matches IPv4
+ * addresses only.
+ */
+typedef struct NetFilter NetFilter;
+
+/* On a syntax error, returns NULL and points @err to the offending part
+ * of @expr.  */
+NetFilter *net_filter_new(const char *expr, const char **err);
+void net_filter_free(NetFilter *f);
+
+/* @buf holds the first @caplen bytes of a frame of @len bytes */
+bool net_filter_match(const NetFilter *f, const uint8_t *buf, size_t caplen,
+                      size_t len);
+
+#endif /* QEMU_NET_FILTER_H */
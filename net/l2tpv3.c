@@ -0,0 +1,82 @@
+/*
+ * L2TPv3 over UDP encapsulation
+ *
+ * Copyright (c) 2012 agent <agent@local>
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ *
+ */
+
+#include "net/l2tpv3.h"
+
+#define L2TPV3_T_BIT    0x80000000
+#define L2TPV3_VER_MASK 0x000f0000
+#define L2TPV3_VER      0x00030000
+#define L2TPV3_S_BIT    0x40000000
+#define L2TPV3_SEQ_MASK 0x00ffffff
+
+static void l2tpv3_put32(uint8_t *p, uint32_t v)
+{
+    p[0] = v >> 24;
+    p[1] = v >> 16;
+    p[2] = v >> 8;
+    p[3] = v;
+}
+
+static uint32_t l2tpv3_get32(const uint8_t *p)
+{
+    return (uint32_t)p[0] << 24 | p[1] << 16 | p[2] << 8 | p[3];
+}
+
+size_t l2tpv3_header_size(const L2TPv3 *l)
+{
+    return 4 + 4 + l->cookie_size + (l->counter ? 4 : 0);
+}
+
+/* The cookie is the low @cookie_size bytes of the value, big endian */
+static void l2tpv3_put_cookie(uint8_t *p, uint64_t cookie, int size)
+{
+    if (size == 8) {
+        l2tpv3_put32(p, cookie >> 32);
+        l2tpv3_put32(p + 4, cookie);
+    } else if (size == 4) {
+        l2tpv3_put32(p, cookie);
+    }
+}
+
+void l2tpv3_write_header(L2TPv3 *l, uint8_t *buf)
+{
+    l2tpv3_put32(buf, L2TPV3_VER);
+    l2tpv3_put32(buf + 4, l->tx_session);
+    l2tpv3_put_cookie(buf + 8, l->tx_cookie, l->cookie_size);
+    if (l->counter) {
+        l2tpv3_put32(buf + 8 + l->cookie_size,
+                     L2TPV3_S_BIT | (l->tx_seq++ & L2TPV3_SEQ_MASK));
+    }
+}
+
+int l2tpv3_check_header(const L2TPv3 *l, const uint8_t *buf, size_t size)
+{
+    uint8_t cookie[8];
+    size_t hlen = l2tpv3_header_size(l);
+    uint32_t flags;
+
+    if (size < hlen) {
+        return -1;
+    }
+    flags = l2tpv3_get32(buf);
+    if ((flags & L2TPV3_T_BIT) || (flags & L2TPV3_VER_MASK) != L2TPV3_VER) {
+        return -1;
+    }
+    if (l2tpv3_get32(buf + 4) != l->rx_session) {
+        return -1;
+    }
+    l2tpv3_put_cookie(cookie, l->rx_cookie, l->cookie_size);
+    if (memcmp(buf + 8, cookie, l->cookie_size)) {
+        return -1;
+    }
+    /* Sequence numbers are not checked: frames are delivered as they
+     * come, like Ethernet does.  */
+    return hlen;
+}
@@ -0,0 +1,49 @@
+/*
+ * L2TPv3 over UDP encapsulation
+ *
+ * Copyright (c) 2012 agent <agent@local>
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ *
+ */
+
+#ifndef QEMU_NET_L2TPV3_H
+#define QEMU_NET_L2TPV3_H
+
+#include "qemu-common.h"
+
+/*
+ * The data message header of RFC 3931 for UDP transport, in front of the
+ * Ethernet frame:
+ *
+ *   flags and version (T = 0, Ver = 3), 16 bits reserved   4 bytes
+ *   session id                                             4 bytes
+ *   cookie                                                 0, 4 or 8 bytes
+ *   default L2-specific sublayer (S bit, sequence number)  0 or 4 bytes
+ *
+ * A tunnel has one session in each direction; frames of other sessions or
+ * with the wrong cookie are not for us.
+ */
+#define L2TPV3_HEADER_MAX (4 + 4 + 8 + 4)
+
+typedef struct L2TPv3 {
+    uint32_t tx_session;
+    uint32_t rx_session;
+    uint64_t tx_cookie;
+    uint64_t rx_cookie;
+    int cookie_size;
+    bool counter;
+    uint32_t tx_seq;
+} L2TPv3;
+
+size_t l2tpv3_header_size(const L2TPv3 *l);
+
+/* Write the header of the next frame, l2tpv3_header_size bytes */
+void l2tpv3_write_header(L2TPv3 *l, uint8_t *buf);
+
+/* The size of the header at @buf, or -1 if the @size bytes there are not
+ * a data message of our session.  */
+int l2tpv3_check_header(const L2TPv3 *l, const uint8_t *buf, size_t size);
+
+#endif /* QEMU_NET_L2TPV3_H */
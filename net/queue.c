@@ -22,7 +22,8 @@
  */
 
 #include "net/queue.h"
-#include "qemu-queue.h"
+#include "net/ring.h"
+#include "iov.h"
 
 /* The delivery handler may only return zero if it will call
  * qemu_net_queue_flush() when it determines that it is once again able
@@ -32,27 +33,56 @@
  * If a sent callback is provided to send(), the caller must handle a
  * zero return from the delivery handler by not sending any more packets
  * until we have invoked the callback. Only in that case will we queue
- * the packet.
+ * the packet, and the caller must leave the packet data untouched until
+ * the callback runs: we do not copy it.
  *
  * If a sent callback isn't provided, we just drop the packet to avoid
  * unbounded queueing.
+ *
+ * Queued packets sit in a single-producer, single-consumer ring.  send()
+ * delivers directly when it can and flushes what is queued, so it must run
+ * in the same thread as the flush.  A sender in another thread, e.g. a
+ * network I/O thread, uses push() instead: it only copies the packet into
+ * the ring and calls the notify callback, and the consumer flushes and
+ * recycles packets on its side.  Only one of the two feeds a given queue.
+ * A full queue drops packets, like a NIC whose receive ring has run over.
  */
 
 struct NetPacket {
-    QTAILQ_ENTRY(NetPacket) entry;
-    VLANClientState *sender;
+    VLANClientState *sender;    /* NULL once purged */
     unsigned flags;
     int size;
     NetPacketSent *sent_cb;
-    uint8_t data[0];
+    /* Packets queued with a sent callback are not copied: the sender keeps
+     * its buffers alive until the callback runs, so only the iovec array
+     * is saved (in storage).  Otherwise data points to a copy in storage.
+     */
+    const uint8_t *data;
+    struct iovec *iov;
+    int iovcnt;
+    size_t capacity;
+    uint8_t storage[0];
 };
 
+/* Packets are recycled through a second ring going the other way, so a
+ * queue that keeps stalling and flushing settles down without calling the
+ * allocator.
+ */
+#define NET_QUEUE_LEN           256
+#define NET_QUEUE_POOL_MAX      64
+#define NET_PACKET_MIN_CAPACITY 2048
+#define NET_PACKET_MAX_POOLED   (65536 + 4096)
+
 struct NetQueue {
     NetPacketDeliver *deliver;
     NetPacketDeliverIOV *deliver_iov;
     void *opaque;
 
-    QTAILQ_HEAD(packets, NetPacket) packets;
+    NetRing *packets;           /* senders -> flush */
+    NetRing *free_packets;      /* flush -> senders */
+
+    NetQueueNotify *notify;     /* called by push() */
+    void *notify_opaque;
 
     unsigned delivering : 1;
 };
@@ -69,26 +99,90 @@ NetQueue *qemu_new_net_queue(NetPacketDeliver *deliver,
     queue->deliver_iov = deliver_iov;
     queue->opaque = opaque;
 
-    QTAILQ_INIT(&queue->packets);
+    queue->packets = net_ring_new(NET_QUEUE_LEN);
+    queue->free_packets = net_ring_new(NET_QUEUE_POOL_MAX);
 
     queue->delivering = 0;
 
     return queue;
 }
 
+void qemu_net_queue_set_notify(NetQueue *queue, NetQueueNotify *notify,
+                               void *opaque)
+{
+    queue->notify = notify;
+    queue->notify_opaque = opaque;
+}
+
 void qemu_del_net_queue(NetQueue *queue)
 {
-    NetPacket *packet, *next;
+    NetPacket *packet;
 
-    QTAILQ_FOREACH_SAFE(packet, &queue->packets, entry, next) {
-        QTAILQ_REMOVE(&queue->packets, packet, entry);
+    while ((packet = net_ring_peek(queue->packets))) {
+        net_ring_pop(queue->packets);
         g_free(packet);
     }
+    while ((packet = net_ring_peek(queue->free_packets))) {
+        net_ring_pop(queue->free_packets);
+        g_free(packet);
+    }
+    net_ring_free(queue->packets);
+    net_ring_free(queue->free_packets);
 
     g_free(queue);
 }
 
-static ssize_t qemu_net_queue_append(NetQueue *queue,
+static NetPacket *qemu_net_packet_alloc(NetQueue *queue,
+                                        VLANClientState *sender,
+                                        unsigned flags,
+                                        size_t capacity,
+                                        NetPacketSent *sent_cb)
+{
+    NetPacket *packet = net_ring_peek(queue->free_packets);
+
+    if (packet) {
+        net_ring_pop(queue->free_packets);
+        if (packet->capacity < capacity) {
+            packet = g_realloc(packet, sizeof(NetPacket) + capacity);
+            packet->capacity = capacity;
+        }
+    } else {
+        capacity = MAX(capacity, NET_PACKET_MIN_CAPACITY);
+        packet = g_malloc(sizeof(NetPacket) + capacity);
+        packet->capacity = capacity;
+    }
+
+    packet->sender = sender;
+    packet->flags = flags;
+    packet->size = 0;
+    packet->sent_cb = sent_cb;
+    packet->data = packet->storage;
+    packet->iov = NULL;
+    packet->iovcnt = 0;
+    return packet;
+}
+
+/* Consumer side only: it is the one producer of free_packets */
+static void qemu_net_packet_free(NetQueue *queue, NetPacket *packet)
+{
+    if (packet->capacity > NET_PACKET_MAX_POOLED ||
+        !net_ring_push(queue->free_packets, packet)) {
+        g_free(packet);
+    }
+}
+
+/* Returns false if the queue is full and the packet was dropped */
+static bool qemu_net_queue_insert(NetQueue *queue, NetPacket *packet)
+{
+    if (!net_ring_push(queue->packets, packet)) {
+        /* This is the sender side, which must not push onto free_packets */
+        g_free(packet);
+        return false;
+    }
+    return true;
+}
+
+static bool qemu_net_queue_append(NetQueue *queue,
                                      VLANClientState *sender,
                                      unsigned flags,
                                      const uint8_t *buf,
@@ -97,19 +191,19 @@ static ssize_t qemu_net_queue_append(NetQueue *queue,
 {
     NetPacket *packet;
 
-    packet = g_malloc(sizeof(NetPacket) + size);
-    packet->sender = sender;
-    packet->flags = flags;
+    if (sent_cb) {
+        packet = qemu_net_packet_alloc(queue, sender, flags, 0, sent_cb);
+        packet->data = buf;
+    } else {
+        packet = qemu_net_packet_alloc(queue, sender, flags, size, sent_cb);
+        memcpy(packet->storage, buf, size);
+    }
     packet->size = size;
-    packet->sent_cb = sent_cb;
-    memcpy(packet->data, buf, size);
 
-    QTAILQ_INSERT_TAIL(&queue->packets, packet, entry);
-
-    return size;
+    return qemu_net_queue_insert(queue, packet);
 }
 
-static ssize_t qemu_net_queue_append_iov(NetQueue *queue,
+static bool qemu_net_queue_append_iov(NetQueue *queue,
                                          VLANClientState *sender,
                                          unsigned flags,
                                          const struct iovec *iov,
@@ -124,22 +218,24 @@ static ssize_t qemu_net_queue_append_iov(NetQueue *queue,
         max_len += iov[i].iov_len;
     }
 
-    packet = g_malloc(sizeof(NetPacket) + max_len);
-    packet->sender = sender;
-    packet->sent_cb = sent_cb;
-    packet->flags = flags;
-    packet->size = 0;
-
-    for (i = 0; i < iovcnt; i++) {
-        size_t len = iov[i].iov_len;
-
-        memcpy(packet->data + packet->size, iov[i].iov_base, len);
-        packet->size += len;
+    if (sent_cb) {
+        packet = qemu_net_packet_alloc(queue, sender, flags,
+                                       iovcnt * sizeof(*iov), sent_cb);
+        packet->iov = (struct iovec *)packet->storage;
+        packet->iovcnt = iovcnt;
+        memcpy(packet->iov, iov, iovcnt * sizeof(*iov));
+        packet->size = max_len;
+    } else {
+        packet = qemu_net_packet_alloc(queue, sender, flags, max_len, sent_cb);
+        for (i = 0; i < iovcnt; i++) {
+            size_t len = iov[i].iov_len;
+
+            memcpy(packet->storage + packet->size, iov[i].iov_base, len);
+            packet->size += len;
+        }
     }
 
-    QTAILQ_INSERT_TAIL(&queue->packets, packet, entry);
-
-    return packet->size;
+    return qemu_net_queue_insert(queue, packet);
 }
 
 static ssize_t qemu_net_queue_deliver(NetQueue *queue,
@@ -182,13 +278,16 @@ ssize_t qemu_net_queue_send(NetQueue *queue,
     ssize_t ret;
 
     if (queue->delivering) {
-        return qemu_net_queue_append(queue, sender, flags, data, size, NULL);
+        qemu_net_queue_append(queue, sender, flags, data, size, NULL);
+        return size;
     }
 
     ret = qemu_net_queue_deliver(queue, sender, flags, data, size);
     if (ret == 0) {
-        qemu_net_queue_append(queue, sender, flags, data, size, sent_cb);
-        return 0;
+        /* If the queue is full, the packet is dropped and the sender
+         * must not wait for a callback. */
+        return qemu_net_queue_append(queue, sender, flags, data, size,
+                                     sent_cb) ? 0 : size;
     }
 
     qemu_net_queue_flush(queue);
@@ -206,13 +305,14 @@ ssize_t qemu_net_queue_send_iov(NetQueue *queue,
     ssize_t ret;
 
     if (queue->delivering) {
-        return qemu_net_queue_append_iov(queue, sender, flags, iov, iovcnt, NULL);
+        qemu_net_queue_append_iov(queue, sender, flags, iov, iovcnt, NULL);
+        return iov_size(iov, iovcnt);
     }
 
     ret = qemu_net_queue_deliver_iov(queue, sender, flags, iov, iovcnt);
     if (ret == 0) {
-        qemu_net_queue_append_iov(queue, sender, flags, iov, iovcnt, sent_cb);
-        return 0;
+        return qemu_net_queue_append_iov(queue, sender, flags, iov, iovcnt,
+                                         sent_cb) ? 0 : iov_size(iov, iovcnt);
     }
 
     qemu_net_queue_flush(queue);
@@ -220,41 +320,92 @@ ssize_t qemu_net_queue_send_iov(NetQueue *queue,
     return ret;
 }
 
+bool qemu_net_queue_push(NetQueue *queue,
+                         VLANClientState *sender,
+                         unsigned flags,
+                         const uint8_t *data,
+                         size_t size)
+{
+    if (!qemu_net_queue_append(queue, sender, flags, data, size, NULL)) {
+        return false;
+    }
+    if (queue->notify) {
+        queue->notify(queue->notify_opaque);
+    }
+    return true;
+}
+
+bool qemu_net_queue_push_iov(NetQueue *queue,
+                             VLANClientState *sender,
+                             unsigned flags,
+                             const struct iovec *iov,
+                             int iovcnt)
+{
+    if (!qemu_net_queue_append_iov(queue, sender, flags, iov, iovcnt, NULL)) {
+        return false;
+    }
+    if (queue->notify) {
+        queue->notify(queue->notify_opaque);
+    }
+    return true;
+}
+
+/* Packets cannot be taken out of the middle of the ring; purged ones are
+ * only marked, and skipped by the next flush.  Like the flush itself, this
+ * runs on the consumer side.
+ */
 void qemu_net_queue_purge(NetQueue *queue, VLANClientState *from)
 {
-    NetPacket *packet, *next;
+    unsigned int i, count = net_ring_count(queue->packets);
+
+    for (i = 0; i < count; i++) {
+        NetPacket *packet = net_ring_entry(queue->packets, i);
 
-    QTAILQ_FOREACH_SAFE(packet, &queue->packets, entry, next) {
         if (packet->sender == from) {
-            QTAILQ_REMOVE(&queue->packets, packet, entry);
-            g_free(packet);
+            packet->sender = NULL;
         }
     }
 }
 
 void qemu_net_queue_flush(NetQueue *queue)
 {
-    while (!QTAILQ_EMPTY(&queue->packets)) {
-        NetPacket *packet;
+    NetPacket *packet;
+
+    if (queue->delivering) {
+        return;
+    }
+
+    while ((packet = net_ring_peek(queue->packets))) {
         int ret;
 
-        packet = QTAILQ_FIRST(&queue->packets);
-        QTAILQ_REMOVE(&queue->packets, packet, entry);
+        if (!packet->sender) {
+            net_ring_pop(queue->packets);
+            qemu_net_packet_free(queue, packet);
+            continue;
+        }
 
-        ret = qemu_net_queue_deliver(queue,
-                                     packet->sender,
-                                     packet->flags,
-                                     packet->data,
-                                     packet->size);
+        if (packet->iov) {
+            ret = qemu_net_queue_deliver_iov(queue,
+                                             packet->sender,
+                                             packet->flags,
+                                             packet->iov,
+                                             packet->iovcnt);
+        } else {
+            ret = qemu_net_queue_deliver(queue,
+                                         packet->sender,
+                                         packet->flags,
+                                         packet->data,
+                                         packet->size);
+        }
         if (ret == 0) {
-            QTAILQ_INSERT_HEAD(&queue->packets, packet, entry);
             break;
         }
 
+        net_ring_pop(queue->packets);
         if (packet->sent_cb) {
             packet->sent_cb(packet->sender, ret);
         }
 
-        g_free(packet);
+        qemu_net_packet_free(queue, packet);
     }
 }
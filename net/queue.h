@@ -43,6 +43,8 @@ typedef ssize_t (NetPacketDeliverIOV) (VLANClientState *sender,
                                        int iovcnt,
                                        void *opaque);
 
+typedef void (NetQueueNotify) (void *opaque);
+
 #define QEMU_NET_PACKET_FLAG_NONE  0
 #define QEMU_NET_PACKET_FLAG_RAW  (1<<0)
 
@@ -50,6 +52,8 @@ NetQueue *qemu_new_net_queue(NetPacketDeliver *deliver,
                              NetPacketDeliverIOV *deliver_iov,
                              void *opaque);
 void qemu_del_net_queue(NetQueue *queue);
+void qemu_net_queue_set_notify(NetQueue *queue, NetQueueNotify *notify,
+                               void *opaque);
 
 ssize_t qemu_net_queue_send(NetQueue *queue,
                             VLANClientState *sender,
@@ -65,6 +69,21 @@ ssize_t qemu_net_queue_send_iov(NetQueue *queue,
                                 int iovcnt,
                                 NetPacketSent *sent_cb);
 
+/* Producer side only, for a sender in another thread than the flush: the
+ * packet is copied into the queue, never delivered from here.  Returns
+ * false if the queue is full and the packet was dropped.  */
+bool qemu_net_queue_push(NetQueue *queue,
+                         VLANClientState *sender,
+                         unsigned flags,
+                         const uint8_t *data,
+                         size_t size);
+
+bool qemu_net_queue_push_iov(NetQueue *queue,
+                             VLANClientState *sender,
+                             unsigned flags,
+                             const struct iovec *iov,
+                             int iovcnt);
+
 void qemu_net_queue_purge(NetQueue *queue, VLANClientState *from);
 void qemu_net_queue_flush(NetQueue *queue);
 
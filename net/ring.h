@@ -0,0 +1,84 @@
+/*
+ * Single-producer, single-consumer ring of pointers
+ *
+ * Copyright (c) 2012 agent <agent@local>
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ *
+ */
+
+#ifndef QEMU_NET_RING_H
+#define QEMU_NET_RING_H
+
+#include "qemu-common.h"
+#include "qemu-barrier.h"
+
+/* One thread may push while another one peeks and pops, without a lock:
+ * each side only writes its own index and reads the other's.  The indices
+ * run freely and are reduced modulo the (power of two) size on access.
+ */
+typedef struct NetRing {
+    unsigned int head;      /* next entry to pop, written by the consumer */
+    unsigned int tail;      /* next slot to fill, written by the producer */
+    unsigned int mask;
+    void *slots[0];
+} NetRing;
+
+static inline NetRing *net_ring_new(unsigned int size)
+{
+    NetRing *ring;
+
+    assert(size && !(size & (size - 1)));
+    ring = g_malloc0(sizeof(NetRing) + size * sizeof(void *));
+    ring->mask = size - 1;
+    return ring;
+}
+
+static inline void net_ring_free(NetRing *ring)
+{
+    g_free(ring);
+}
+
+/* Producer side.  Returns false if the ring is full.  */
+static inline bool net_ring_push(NetRing *ring, void *entry)
+{
+    unsigned int tail = ring->tail;
+
+    if (tail - *(volatile unsigned int *)&ring->head > ring->mask) {
+        return false;
+    }
+    ring->slots[tail & ring->mask] = entry;
+    smp_wmb();
+    *(volatile unsigned int *)&ring->tail = tail + 1;
+    return true;
+}
+
+/* Consumer side: number of entries, the i-th one from the head, and
+ * removing the head once the consumer is done with it.  */
+static inline unsigned int net_ring_count(NetRing *ring)
+{
+    unsigned int count = *(volatile unsigned int *)&ring->tail - ring->head;
+
+    smp_rmb();
+    return count;
+}
+
+static inline void *net_ring_entry(NetRing *ring, unsigned int i)
+{
+    return ring->slots[(ring->head + i) & ring->mask];
+}
+
+static inline void *net_ring_peek(NetRing *ring)
+{
+    return net_ring_count(ring) ? net_ring_entry(ring, 0) : NULL;
+}
+
+static inline void net_ring_pop(NetRing *ring)
+{
+    /* The slot must have been read before the producer may reuse it */
+    smp_mb();
+    *(volatile unsigned int *)&ring->head = ring->head + 1;
+}
+
+#endif /* QEMU_NET_RING_H */
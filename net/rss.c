@@ -0,0 +1,176 @@
+/*
+ * Receive side scaling: Toeplitz flow hashing for NIC models
+ *
+ * Copyright (c) 2012 agent <agent@local>
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ *
+ */
+
+#include "net/rss.h"
+
+#define ETH_P_IP    0x0800
+#define ETH_P_8021Q 0x8100
+#define ETH_P_IPV6  0x86dd
+
+#define PROTO_TCP  6
+#define PROTO_UDP 17
+
+/* The key from the Microsoft specification, which guests know as well */
+static const uint8_t net_rss_default_key[NET_RSS_KEY_SIZE] = {
+    0x6d, 0x5a, 0x56, 0xda, 0x25, 0x5b, 0x0e, 0xc2,
+    0x41, 0x67, 0x25, 0x3d, 0x43, 0xa3, 0x8f, 0xb0,
+    0xd0, 0xca, 0x2b, 0xcb, 0xae, 0x7b, 0x30, 0xb4,
+    0x77, 0xcb, 0x2d, 0xa3, 0x80, 0x30, 0xf2, 0x0c,
+    0x6a, 0x42, 0xb7, 0x3b, 0xbe, 0xac, 0x01, 0xfa,
+};
+
+/*
+ * For every set bit of the input, XOR in the 32 bits of the key that
+ * start at the same bit position.
+ */
+uint32_t net_rss_toeplitz(const uint8_t *key, const uint8_t *data, size_t len)
+{
+    uint32_t hash = 0;
+    uint32_t v = key[0] << 24 | key[1] << 16 | key[2] << 8 | key[3];
+    size_t i;
+    int b;
+
+    assert(len <= NET_RSS_KEY_SIZE - 4);
+    for (i = 0; i < len; i++) {
+        for (b = 7; b >= 0; b--) {
+            if (data[i] & (1 << b)) {
+                hash ^= v;
+            }
+            v = v << 1 | ((key[i + 4] >> b) & 1);
+        }
+    }
+    return hash;
+}
+
+/* The hash is linear in its input, so it can be put together from the
+ * contributions of the single bytes, computed once per key.
+ */
+void net_rss_set_key(NetRSS *rss, const uint8_t *key)
+{
+    uint8_t data[NET_RSS_KEY_SIZE - 4];
+    int i, v;
+
+    memcpy(rss->key, key, NET_RSS_KEY_SIZE);
+    memset(data, 0, sizeof(data));
+    for (i = 0; i < sizeof(data); i++) {
+        for (v = 0; v < 256; v++) {
+            data[i] = v;
+            rss->table[i][v] = net_rss_toeplitz(key, data, i + 1);
+        }
+        data[i] = 0;
+    }
+}
+
+void net_rss_set_queues(NetRSS *rss, unsigned int queues)
+{
+    int i;
+
+    assert(queues > 0 && queues <= 256);
+    rss->indir_size = NET_RSS_INDIR_MAX;
+    for (i = 0; i < NET_RSS_INDIR_MAX; i++) {
+        rss->indir[i] = i % queues;
+    }
+}
+
+void net_rss_init(NetRSS *rss, unsigned int queues)
+{
+    rss->types = NET_RSS_HASH_ALL;
+    net_rss_set_queues(rss, queues);
+    net_rss_set_key(rss, net_rss_default_key);
+}
+
+static uint32_t net_rss_lookup(const NetRSS *rss, const uint8_t *data,
+                               size_t len)
+{
+    uint32_t hash = 0;
+    size_t i;
+
+    for (i = 0; i < len; i++) {
+        hash ^= rss->table[i][data[i]];
+    }
+    return hash;
+}
+
+bool net_rss_hash(const NetRSS *rss, const uint8_t *buf, size_t size,
+                  uint32_t *hash)
+{
+    uint8_t input[NET_RSS_KEY_SIZE - 4];
+    const uint8_t *ip;
+    size_t off = 14, hlen, len;
+    uint16_t proto;
+    uint32_t l4_types;
+    int l4;
+
+    if (size < off) {
+        return false;
+    }
+    proto = buf[12] << 8 | buf[13];
+    if (proto == ETH_P_8021Q && size >= off + 4) {
+        proto = buf[16] << 8 | buf[17];
+        off += 4;
+    }
+    ip = buf + off;
+
+    switch (proto) {
+    case ETH_P_IP:
+        if (size < off + 20 || (ip[0] >> 4) != 4) {
+            return false;
+        }
+        hlen = (ip[0] & 0xf) * 4;
+        memcpy(input, ip + 12, 8);
+        len = 8;
+        l4 = ip[9];
+        l4_types = l4 == PROTO_TCP ? NET_RSS_HASH_TCP_IPV4 :
+                   l4 == PROTO_UDP ? NET_RSS_HASH_UDP_IPV4 : 0;
+        /* Only the first fragment has the ports, so use none */
+        if ((ip[6] << 8 | ip[7]) & 0x3fff) {
+            l4_types = 0;
+        }
+        if (!(rss->types & l4_types) && !(rss->types & NET_RSS_HASH_IPV4)) {
+            return false;
+        }
+        break;
+    case ETH_P_IPV6:
+        if (size < off + 40 || (ip[0] >> 4) != 6) {
+            return false;
+        }
+        hlen = 40;
+        memcpy(input, ip + 8, 32);
+        len = 32;
+        /* Extension headers are not walked */
+        l4 = ip[6];
+        l4_types = l4 == PROTO_TCP ? NET_RSS_HASH_TCP_IPV6 :
+                   l4 == PROTO_UDP ? NET_RSS_HASH_UDP_IPV6 : 0;
+        if (!(rss->types & l4_types) && !(rss->types & NET_RSS_HASH_IPV6)) {
+            return false;
+        }
+        break;
+    default:
+        return false;
+    }
+
+    if ((rss->types & l4_types) && hlen >= 20 && size >= off + hlen + 4) {
+        memcpy(input + len, ip + hlen, 4);
+        len += 4;
+    }
+    *hash = net_rss_lookup(rss, input, len);
+    return true;
+}
+
+unsigned int net_rss_queue(const NetRSS *rss, const uint8_t *buf,
+                           size_t size)
+{
+    uint32_t hash;
+
+    if (!net_rss_hash(rss, buf, size, &hash)) {
+        return 0;
+    }
+    return rss->indir[hash & (rss->indir_size - 1)];
+}
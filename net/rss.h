@@ -0,0 +1,61 @@
+/*
+ * Receive side scaling: Toeplitz flow hashing for NIC models
+ *
+ * Copyright (c) 2012 agent <agent@local>
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ *
+ */
+
+#ifndef QEMU_NET_RSS_H
+#define QEMU_NET_RSS_H
+
+#include "qemu-common.h"
+
+#define NET_RSS_KEY_SIZE    40
+#define NET_RSS_INDIR_MAX   128
+
+/* Headers that may go into the hash, as in the Microsoft RSS
+ * specification that the NIC registers follow.  A TCP or UDP packet
+ * whose type is not enabled is hashed on its addresses alone, if that
+ * is enabled; anything else is not hashed and goes to queue 0.
+ */
+enum {
+    NET_RSS_HASH_IPV4       = 1 << 0,
+    NET_RSS_HASH_TCP_IPV4   = 1 << 1,
+    NET_RSS_HASH_UDP_IPV4   = 1 << 2,
+    NET_RSS_HASH_IPV6       = 1 << 3,
+    NET_RSS_HASH_TCP_IPV6   = 1 << 4,
+    NET_RSS_HASH_UDP_IPV6   = 1 << 5,
+    NET_RSS_HASH_ALL        = (1 << 6) - 1,
+};
+
+typedef struct NetRSS {
+    uint32_t types;
+    uint8_t key[NET_RSS_KEY_SIZE];
+    unsigned int indir_size;            /* power of two */
+    uint8_t indir[NET_RSS_INDIR_MAX];   /* hash -> queue */
+
+    /* Contribution of each input byte, derived from the key */
+    uint32_t table[NET_RSS_KEY_SIZE - 4][256];
+} NetRSS;
+
+/* Hash all types with the default key, spread over @queues queues */
+void net_rss_init(NetRSS *rss, unsigned int queues);
+/* Spread the indirection table evenly over @queues queues */
+void net_rss_set_queues(NetRSS *rss, unsigned int queues);
+void net_rss_set_key(NetRSS *rss, const uint8_t *key);
+
+/* Plain Toeplitz hash of up to NET_RSS_KEY_SIZE - 4 bytes */
+uint32_t net_rss_toeplitz(const uint8_t *key, const uint8_t *data, size_t len);
+
+/* Hash of an Ethernet frame; returns false if it is not hashed */
+bool net_rss_hash(const NetRSS *rss, const uint8_t *buf, size_t size,
+                  uint32_t *hash);
+
+/* Queue an Ethernet frame belongs to */
+unsigned int net_rss_queue(const NetRSS *rss, const uint8_t *buf,
+                           size_t size);
+
+#endif /* QEMU_NET_RSS_H */
@@ -69,6 +69,10 @@ typedef struct SlirpState {
     VLANClientState nc;
     QTAILQ_ENTRY(SlirpState) entry;
     Slirp *slirp;
+    int vnet_hdr;
+    int using_vnet_hdr;
+    int csum;
+    int tso4;
 #ifndef _WIN32
     char smb_dir[128];
 #endif
@@ -118,6 +122,56 @@ static ssize_t net_slirp_receive(VLANClientState *nc, const uint8_t *buf, size_t
     return size;
 }
 
+/* Raw frames come without the virtio-net header.  They are only the
+ * announcements sent after migration, which the stack ignores anyway.
+ */
+static ssize_t net_slirp_receive_raw(VLANClientState *nc, const uint8_t *buf,
+                                     size_t size)
+{
+    SlirpState *s = DO_UPCAST(SlirpState, nc, nc);
+
+    if (!s->using_vnet_hdr) {
+        slirp_input(s->slirp, buf, size);
+    }
+
+    return size;
+}
+
+/* The stack can deal with large TCP segments and partial checksums, which
+ * saves segmenting and checksumming bulk transfers twice, once on each side.
+ * This changes the features virtio-net offers to the guest, so it is only
+ * done when asked for with vnet_hdr=on.
+ */
+static int net_slirp_has_vnet_hdr(VLANClientState *nc)
+{
+    SlirpState *s = DO_UPCAST(SlirpState, nc, nc);
+
+    return s->vnet_hdr;
+}
+
+static int net_slirp_has_ufo(VLANClientState *nc)
+{
+    return 0;
+}
+
+static void net_slirp_using_vnet_hdr(VLANClientState *nc, int using_vnet_hdr)
+{
+    SlirpState *s = DO_UPCAST(SlirpState, nc, nc);
+
+    s->using_vnet_hdr = using_vnet_hdr;
+    slirp_set_offload(s->slirp, s->using_vnet_hdr, s->csum, s->tso4);
+}
+
+static void net_slirp_set_offload(VLANClientState *nc, int csum, int tso4,
+                                  int tso6, int ecn, int ufo)
+{
+    SlirpState *s = DO_UPCAST(SlirpState, nc, nc);
+
+    s->csum = csum;
+    s->tso4 = tso4;
+    slirp_set_offload(s->slirp, s->using_vnet_hdr, s->csum, s->tso4);
+}
+
 static void net_slirp_cleanup(VLANClientState *nc)
 {
     SlirpState *s = DO_UPCAST(SlirpState, nc, nc);
@@ -131,7 +185,12 @@ static NetClientInfo net_slirp_info = {
     .type = NET_CLIENT_TYPE_USER,
     .size = sizeof(SlirpState),
     .receive = net_slirp_receive,
+    .receive_raw = net_slirp_receive_raw,
     .cleanup = net_slirp_cleanup,
+    .has_ufo = net_slirp_has_ufo,
+    .has_vnet_hdr = net_slirp_has_vnet_hdr,
+    .using_vnet_hdr = net_slirp_using_vnet_hdr,
+    .set_offload = net_slirp_set_offload,
 };
 
 static int net_slirp_init(VLANState *vlan, const char *model,
@@ -140,7 +199,7 @@ static int net_slirp_init(VLANState *vlan, const char *model,
                           const char *vhostname, const char *tftp_export,
                           const char *bootfile, const char *vdhcp_start,
                           const char *vnameserver, const char *smb_export,
-                          const char *vsmbserver)
+                          const char *vsmbserver, int vnet_hdr)
 {
     /* default settings according to historic slirp */
     struct in_addr net  = { .s_addr = htonl(0x0a000200) }; /* 10.0.2.0 */
@@ -245,6 +304,7 @@ static int net_slirp_init(VLANState *vlan, const char *model,
 
     s = DO_UPCAST(SlirpState, nc, nc);
 
+    s->vnet_hdr = vnet_hdr;
     s->slirp = slirp_init(restricted, net, mask, host, vhostname,
                           tftp_export, bootfile, dhcp, dns, s);
     QTAILQ_INSERT_TAIL(&slirp_stacks, s, entry);
@@ -738,7 +798,8 @@ int net_init_slirp(QemuOpts *opts,
 
     ret = net_slirp_init(vlan, "user", name, restricted, vnet, vhost,
                          vhostname, tftp_export, bootfile, vdhcp_start,
-                         vnamesrv, smb_export, vsmbsrv);
+                         vnamesrv, smb_export, vsmbsrv,
+                         qemu_opt_get_bool(opts, "vnet_hdr", false));
 
     while (slirp_configs) {
         config = slirp_configs;
@@ -26,19 +26,43 @@
 #include "config-host.h"
 
 #include "net.h"
+#include "net/l2tpv3.h"
+#include "iov.h"
 #include "qemu-char.h"
 #include "qemu-common.h"
 #include "qemu-error.h"
 #include "qemu-option.h"
 #include "qemu_socket.h"
 
+/* Frames for the socket are collected and written with one system call
+ * from a bottom half, and datagrams are read up to a batch at a time.
+ */
+#define NET_SOCKET_BATCH            32
+#define NET_SOCKET_MAX_FRAME        65536
+#define NET_SOCKET_TX_SIZE          (256 * 1024)
+#define NET_SOCKET_STREAM_RX_SIZE   (256 * 1024)
+#define NET_SOCKET_DGRAM_RX_SIZE    (NET_SOCKET_MAX_FRAME + L2TPV3_HEADER_MAX)
+
 typedef struct NetSocketState {
     VLANClientState nc;
     int fd;
-    int state; /* 0 = getting length, 1 = getting data */
-    unsigned int index;
-    unsigned int packet_len;
-    uint8_t buf[4096];
+    bool dgram;
+    bool read_poll;
+    /* Stream: bytes of incomplete frames.  Datagrams: NET_SOCKET_BATCH
+     * slots, rx_count of them filled and the ones before rx_next delivered */
+    uint8_t *rx_buf;
+    size_t rx_len;
+    size_t rx_size[NET_SOCKET_BATCH];
+    int rx_next;
+    int rx_count;
+    /* Frames waiting for tx_bh, each with its length prefix or L2TPv3
+     * header; tx_start has the offsets of the datagrams */
+    QEMUBH *tx_bh;
+    uint8_t *tx_buf;
+    size_t tx_len;
+    size_t tx_start[NET_SOCKET_BATCH];
+    int tx_count;
+    L2TPv3 *l2tpv3;
     struct sockaddr_in dgram_dst; /* contains inet host and port destination iff connectionless (SOCK_DGRAM) */
 } NetSocketState;
 
@@ -49,104 +73,280 @@ typedef struct NetSocketListenState {
     int fd;
 } NetSocketListenState;
 
-/* XXX: we consider we can send the whole packet without blocking */
-static ssize_t net_socket_receive(VLANClientState *nc, const uint8_t *buf, size_t size)
+static void net_socket_send_dgrams(NetSocketState *s)
+{
+    struct iovec iov[NET_SOCKET_BATCH];
+    int i, ret;
+
+    for (i = 0; i < s->tx_count; i++) {
+        iov[i].iov_base = s->tx_buf + s->tx_start[i];
+        iov[i].iov_len = (i + 1 < s->tx_count ? s->tx_start[i + 1] : s->tx_len) -
+                         s->tx_start[i];
+    }
+#ifdef CONFIG_MMSG
+    {
+        struct mmsghdr msgs[NET_SOCKET_BATCH];
+        int done = 0;
+
+        memset(msgs, 0, sizeof(msgs));
+        for (i = 0; i < s->tx_count; i++) {
+            msgs[i].msg_hdr.msg_name = &s->dgram_dst;
+            msgs[i].msg_hdr.msg_namelen = sizeof(s->dgram_dst);
+            msgs[i].msg_hdr.msg_iov = &iov[i];
+            msgs[i].msg_hdr.msg_iovlen = 1;
+        }
+        while (done < s->tx_count) {
+            ret = sendmmsg(s->fd, msgs + done, s->tx_count - done, 0);
+            if (ret < 0 && errno == EINTR) {
+                continue;
+            }
+            if (ret == 0 || (ret < 0 && errno == EAGAIN)) {
+                /* Like on a congested link, the rest is lost */
+                break;
+            }
+            if (ret < 0) {
+                /* The first message failed, e.g. EMSGSIZE: drop only it */
+                ret = 1;
+            }
+            done += ret;
+        }
+    }
+#else
+    for (i = 0; i < s->tx_count; i++) {
+        do {
+            ret = sendto(s->fd, iov[i].iov_base, iov[i].iov_len, 0,
+                         (struct sockaddr *)&s->dgram_dst,
+                         sizeof(s->dgram_dst));
+        } while (ret < 0 && socket_error() == EINTR);
+        if (ret < 0 && socket_error() == EWOULDBLOCK) {
+            /* Like on a congested link, the rest is lost */
+            break;
+        }
+    }
+#endif
+}
+
+static void net_socket_flush_tx(NetSocketState *s)
+{
+    if (!s->tx_count) {
+        return;
+    }
+    if (s->dgram) {
+        net_socket_send_dgrams(s);
+    } else {
+        /* XXX: we consider we can send the whole batch without blocking */
+        send_all(s->fd, s->tx_buf, s->tx_len);
+    }
+    s->tx_count = 0;
+    s->tx_len = 0;
+}
+
+static void net_socket_tx_bh(void *opaque)
+{
+    net_socket_flush_tx(opaque);
+}
+
+/* Queue a frame of @size bytes, headers included, for the next flush */
+static uint8_t *net_socket_tx_reserve(NetSocketState *s, size_t size)
+{
+    if (s->tx_count == NET_SOCKET_BATCH ||
+        s->tx_len + size > NET_SOCKET_TX_SIZE) {
+        net_socket_flush_tx(s);
+    }
+    if (!s->tx_count) {
+        qemu_bh_schedule(s->tx_bh);
+    }
+    s->tx_start[s->tx_count++] = s->tx_len;
+    s->tx_len += size;
+    return s->tx_buf + s->tx_len - size;
+}
+
+static ssize_t net_socket_receive_iov(VLANClientState *nc,
+                                      const struct iovec *iov, int iovcnt)
 {
     NetSocketState *s = DO_UPCAST(NetSocketState, nc, nc);
+    size_t size = iov_size(iov, iovcnt);
+    size_t hlen;
     uint32_t len;
-    len = htonl(size);
+    uint8_t *p;
 
-    send_all(s->fd, (const uint8_t *)&len, sizeof(len));
-    return send_all(s->fd, buf, size);
+    /* Too big for the other end, which would drop the connection */
+    if (size > NET_SOCKET_MAX_FRAME) {
+        return size;
+    }
+
+    if (!s->dgram) {
+        hlen = sizeof(len);
+        p = net_socket_tx_reserve(s, hlen + size);
+        len = htonl(size);
+        memcpy(p, &len, sizeof(len));
+    } else if (s->l2tpv3) {
+        hlen = l2tpv3_header_size(s->l2tpv3);
+        p = net_socket_tx_reserve(s, hlen + size);
+        l2tpv3_write_header(s->l2tpv3, p);
+    } else {
+        hlen = 0;
+        p = net_socket_tx_reserve(s, size);
+    }
+    iov_to_buf(iov, iovcnt, p + hlen, 0, size);
+    return size;
 }
 
-static ssize_t net_socket_receive_dgram(VLANClientState *nc, const uint8_t *buf, size_t size)
+static ssize_t net_socket_receive(VLANClientState *nc, const uint8_t *buf, size_t size)
 {
-    NetSocketState *s = DO_UPCAST(NetSocketState, nc, nc);
+    struct iovec iov = {
+        .iov_base = (void *)buf,
+        .iov_len = size,
+    };
 
-    return sendto(s->fd, (const void *)buf, size, 0,
-                  (struct sockaddr *)&s->dgram_dst, sizeof(s->dgram_dst));
+    return net_socket_receive_iov(nc, &iov, 1);
 }
 
 static void net_socket_send(void *opaque)
 {
     NetSocketState *s = opaque;
     int size, err;
-    unsigned l;
-    uint8_t buf1[4096];
+    uint32_t len;
     const uint8_t *buf;
 
-    size = qemu_recv(s->fd, buf1, sizeof(buf1), 0);
+    size = qemu_recv(s->fd, s->rx_buf + s->rx_len,
+                     NET_SOCKET_STREAM_RX_SIZE - s->rx_len, 0);
     if (size < 0) {
         err = socket_error();
         if (err != EWOULDBLOCK)
             goto eoc;
+        return;
     } else if (size == 0) {
         /* end of connection */
-    eoc:
-        qemu_set_fd_handler(s->fd, NULL, NULL, NULL);
-        closesocket(s->fd);
-        return;
+        goto eoc;
     }
-    buf = buf1;
-    while (size > 0) {
-        /* reassemble a packet from the network */
-        switch(s->state) {
-        case 0:
-            l = 4 - s->index;
-            if (l > size)
-                l = size;
-            memcpy(s->buf + s->index, buf, l);
-            buf += l;
-            size -= l;
-            s->index += l;
-            if (s->index == 4) {
-                /* got length */
-                s->packet_len = ntohl(*(uint32_t *)s->buf);
-                s->index = 0;
-                s->state = 1;
-            }
-            break;
-        case 1:
-            l = s->packet_len - s->index;
-            if (l > size)
-                l = size;
-            if (s->index + l <= sizeof(s->buf)) {
-                memcpy(s->buf + s->index, buf, l);
-            } else {
-                fprintf(stderr, "serious error: oversized packet received,"
-                    "connection terminated.\n");
-                s->state = 0;
-                goto eoc;
-            }
 
-            s->index += l;
-            buf += l;
-            size -= l;
-            if (s->index >= s->packet_len) {
-                qemu_send_packet(&s->nc, s->buf, s->packet_len);
-                s->index = 0;
-                s->state = 0;
-            }
+    /* Complete frames go to the peer straight from the receive buffer */
+    buf = s->rx_buf;
+    size += s->rx_len;
+    while (size >= sizeof(len)) {
+        memcpy(&len, buf, sizeof(len));
+        len = ntohl(len);
+        if (len > NET_SOCKET_MAX_FRAME) {
+            fprintf(stderr, "serious error: oversized packet received,"
+                "connection terminated.\n");
+            goto eoc;
+        }
+        if (size < sizeof(len) + len) {
             break;
         }
+        qemu_send_packet(&s->nc, buf + sizeof(len), len);
+        buf += sizeof(len) + len;
+        size -= sizeof(len) + len;
+    }
+    /* Keep the start of the next frame for the next read */
+    memmove(s->rx_buf, buf, size);
+    s->rx_len = size;
+    return;
+
+eoc:
+    s->rx_len = 0;
+    qemu_set_fd_handler(s->fd, NULL, NULL, NULL);
+    closesocket(s->fd);
+}
+
+static void net_socket_send_dgram(void *opaque);
+
+static void net_socket_read_poll(NetSocketState *s, bool enable)
+{
+    if (s->read_poll != enable) {
+        s->read_poll = enable;
+        qemu_set_fd_handler(s->fd, enable ? net_socket_send_dgram : NULL,
+                            NULL, s);
+    }
+}
+
+static void net_socket_deliver_dgrams(NetSocketState *s);
+
+static void net_socket_send_completed(VLANClientState *nc, ssize_t len)
+{
+    NetSocketState *s = DO_UPCAST(NetSocketState, nc, nc);
+
+    s->rx_next++;
+    net_socket_deliver_dgrams(s);
+}
+
+/* Pass the received datagrams on until the peer is busy.  Then the slot
+ * of the queued one stays in use and reading stops, until
+ * net_socket_send_completed.
+ */
+static void net_socket_deliver_dgrams(NetSocketState *s)
+{
+    uint8_t *buf;
+    size_t size;
+    int hlen;
+
+    while (s->rx_next < s->rx_count) {
+        buf = s->rx_buf + s->rx_next * NET_SOCKET_DGRAM_RX_SIZE;
+        size = s->rx_size[s->rx_next];
+        hlen = s->l2tpv3 ? l2tpv3_check_header(s->l2tpv3, buf, size) : 0;
+        if (hlen < 0 || size == hlen) {
+            s->rx_next++;
+            continue;
+        }
+        if (qemu_send_packet_async(&s->nc, buf + hlen, size - hlen,
+                                   net_socket_send_completed) == 0) {
+            net_socket_read_poll(s, false);
+            return;
+        }
+        s->rx_next++;
+    }
+    net_socket_read_poll(s, true);
+}
+
+/* Fill the receive slots; returns how many, or -1 */
+static int net_socket_recv_dgrams(NetSocketState *s)
+{
+#ifdef CONFIG_MMSG
+    struct mmsghdr msgs[NET_SOCKET_BATCH];
+    struct iovec iov[NET_SOCKET_BATCH];
+    int i, n;
+
+    memset(msgs, 0, sizeof(msgs));
+    for (i = 0; i < NET_SOCKET_BATCH; i++) {
+        iov[i].iov_base = s->rx_buf + i * NET_SOCKET_DGRAM_RX_SIZE;
+        iov[i].iov_len = NET_SOCKET_DGRAM_RX_SIZE;
+        msgs[i].msg_hdr.msg_iov = &iov[i];
+        msgs[i].msg_hdr.msg_iovlen = 1;
+    }
+    do {
+        n = recvmmsg(s->fd, msgs, NET_SOCKET_BATCH, MSG_DONTWAIT, NULL);
+    } while (n < 0 && errno == EINTR);
+    for (i = 0; i < n; i++) {
+        /* Truncated datagrams are dropped */
+        s->rx_size[i] = msgs[i].msg_hdr.msg_flags & MSG_TRUNC ?
+                        0 : msgs[i].msg_len;
     }
+    return n;
+#else
+    int size;
+
+    size = qemu_recv(s->fd, s->rx_buf, NET_SOCKET_DGRAM_RX_SIZE, 0);
+    if (size < 0) {
+        return -1;
+    }
+    s->rx_size[0] = size;
+    return 1;
+#endif
 }
 
 static void net_socket_send_dgram(void *opaque)
 {
     NetSocketState *s = opaque;
-    int size;
+    int n;
 
-    size = qemu_recv(s->fd, s->buf, sizeof(s->buf), 0);
-    if (size < 0)
-        return;
-    if (size == 0) {
-        /* end of connection */
-        qemu_set_fd_handler(s->fd, NULL, NULL, NULL);
+    n = net_socket_recv_dgrams(s);
+    if (n <= 0) {
         return;
     }
-    qemu_send_packet(&s->nc, s->buf, size);
+    s->rx_next = 0;
+    s->rx_count = n;
+    net_socket_deliver_dgrams(s);
 }
 
 static int net_socket_mcast_create(struct sockaddr_in *mcastaddr, struct in_addr *localaddr)
@@ -233,14 +433,30 @@ fail:
 static void net_socket_cleanup(VLANClientState *nc)
 {
     NetSocketState *s = DO_UPCAST(NetSocketState, nc, nc);
+
+    /* Queued datagrams point into rx_buf */
+    qemu_purge_queued_packets(nc);
+    net_socket_flush_tx(s);
+    qemu_bh_delete(s->tx_bh);
     qemu_set_fd_handler(s->fd, NULL, NULL, NULL);
     close(s->fd);
+    g_free(s->tx_buf);
+    g_free(s->rx_buf);
+    g_free(s->l2tpv3);
+}
+
+static void net_socket_init_buffers(NetSocketState *s, size_t rx_size)
+{
+    s->tx_bh = qemu_bh_new(net_socket_tx_bh, s);
+    s->tx_buf = g_malloc(NET_SOCKET_TX_SIZE);
+    s->rx_buf = g_malloc(rx_size);
 }
 
 static NetClientInfo net_dgram_socket_info = {
     .type = NET_CLIENT_TYPE_SOCKET,
     .size = sizeof(NetSocketState),
-    .receive = net_socket_receive_dgram,
+    .receive = net_socket_receive,
+    .receive_iov = net_socket_receive_iov,
     .cleanup = net_socket_cleanup,
 };
 
@@ -296,8 +512,10 @@ static NetSocketState *net_socket_fd_init_dgram(VLANState *vlan,
     s = DO_UPCAST(NetSocketState, nc, nc);
 
     s->fd = fd;
+    s->dgram = true;
+    net_socket_init_buffers(s, NET_SOCKET_BATCH * NET_SOCKET_DGRAM_RX_SIZE);
 
-    qemu_set_fd_handler(s->fd, net_socket_send_dgram, NULL, s);
+    net_socket_read_poll(s, true);
 
     /* mcast: save bound address as dst */
     if (is_connected) s->dgram_dst=saddr;
@@ -319,6 +537,7 @@ static NetClientInfo net_socket_info = {
     .type = NET_CLIENT_TYPE_SOCKET,
     .size = sizeof(NetSocketState),
     .receive = net_socket_receive,
+    .receive_iov = net_socket_receive_iov,
     .cleanup = net_socket_cleanup,
 };
 
@@ -337,6 +556,7 @@ static NetSocketState *net_socket_fd_init_stream(VLANState *vlan,
     s = DO_UPCAST(NetSocketState, nc, nc);
 
     s->fd = fd;
+    net_socket_init_buffers(s, NET_SOCKET_STREAM_RX_SIZE);
 
     if (is_connected) {
         net_socket_connect(s);
@@ -538,7 +758,8 @@ static int net_socket_udp_init(VLANState *vlan,
                                  const char *model,
                                  const char *name,
                                  const char *rhost,
-                                 const char *lhost)
+                                 const char *lhost,
+                                 L2TPv3 *l2tpv3)
 {
     NetSocketState *s;
     int fd, val, ret;
@@ -578,18 +799,65 @@ static int net_socket_udp_init(VLANState *vlan,
     }
 
     s->dgram_dst = raddr;
+    s->l2tpv3 = l2tpv3;
 
     snprintf(s->nc.info_str, sizeof(s->nc.info_str),
-             "socket: udp=%s:%d",
-             inet_ntoa(raddr.sin_addr), ntohs(raddr.sin_port));
+             "socket: udp=%s:%d%s",
+             inet_ntoa(raddr.sin_addr), ntohs(raddr.sin_port),
+             l2tpv3 ? " l2tpv3" : "");
     return 0;
 }
 
+static L2TPv3 *net_socket_l2tpv3_opts(QemuOpts *opts)
+{
+    L2TPv3 *l;
+    uint64_t tx_session, rx_session;
+
+    if (!qemu_opt_get(opts, "txsession")) {
+        error_report("txsession= is mandatory with l2tpv3=on");
+        return NULL;
+    }
+    if (!qemu_opt_get(opts, "txcookie") != !qemu_opt_get(opts, "rxcookie")) {
+        error_report("txcookie= and rxcookie= must be given together");
+        return NULL;
+    }
+    tx_session = qemu_opt_get_number(opts, "txsession", 0);
+    rx_session = qemu_opt_get_number(opts, "rxsession", tx_session);
+    if (!tx_session || tx_session > UINT32_MAX ||
+        !rx_session || rx_session > UINT32_MAX) {
+        error_report("L2TPv3 session ids must be between 1 and %u",
+                     UINT32_MAX);
+        return NULL;
+    }
+
+    l = g_malloc0(sizeof(*l));
+    l->tx_session = tx_session;
+    l->rx_session = rx_session;
+    if (qemu_opt_get(opts, "txcookie")) {
+        l->cookie_size = qemu_opt_get_bool(opts, "cookie64", false) ? 8 : 4;
+        l->tx_cookie = qemu_opt_get_number(opts, "txcookie", 0);
+        l->rx_cookie = qemu_opt_get_number(opts, "rxcookie", 0);
+        if (l->cookie_size == 4 &&
+            (l->tx_cookie > UINT32_MAX || l->rx_cookie > UINT32_MAX)) {
+            error_report("L2TPv3 cookies over 32 bits need cookie64=on");
+            g_free(l);
+            return NULL;
+        }
+    }
+    l->counter = qemu_opt_get_bool(opts, "counter", false);
+    return l;
+}
+
 int net_init_socket(QemuOpts *opts,
                     Monitor *mon,
                     const char *name,
                     VLANState *vlan)
 {
+    if (qemu_opt_get(opts, "l2tpv3") && !qemu_opt_get(opts, "udp")) {
+        error_report("l2tpv3= is only valid with udp=");
+        return -1;
+    }
+
     if (qemu_opt_get(opts, "fd")) {
         int fd;
 
@@ -659,6 +927,7 @@ int net_init_socket(QemuOpts *opts,
         }
     } else if (qemu_opt_get(opts, "udp")) {
         const char *udp, *localaddr;
+        L2TPv3 *l2tpv3 = NULL;
 
         if (qemu_opt_get(opts, "fd") ||
             qemu_opt_get(opts, "connect") ||
@@ -676,7 +945,16 @@ int net_init_socket(QemuOpts *opts,
                 return -1;
         }
 
-        if (net_socket_udp_init(vlan, "udp", name, udp, localaddr) == -1) {
+        if (qemu_opt_get_bool(opts, "l2tpv3", false)) {
+            l2tpv3 = net_socket_l2tpv3_opts(opts);
+            if (!l2tpv3) {
+                return -1;
+            }
+        }
+
+        if (net_socket_udp_init(vlan, "udp", name, udp, localaddr,
+                                l2tpv3) == -1) {
+            g_free(l2tpv3);
             return -1;
         }
     } else {
@@ -48,6 +48,11 @@
  */
 #define TAP_BUFSIZE (4096 + 65536)
 
+/* Packets read per wakeup at most, so that a busy tap cannot starve the
+ * rest of the main loop.  The fd stays readable, so we come back for more.
+ */
+#define TAP_RX_BATCH 64
+
 typedef struct TAPState {
     VLANClientState nc;
     int fd;
@@ -191,6 +196,7 @@ static void tap_send_completed(VLANClientState *nc, ssize_t len)
 static void tap_send(void *opaque)
 {
     TAPState *s = opaque;
+    int packets = 0;
     int size;
 
     do {
@@ -206,11 +212,14 @@ static void tap_send(void *opaque)
             size -= s->host_vnet_hdr_len;
         }
 
+        /* If the peer is busy, the queue keeps a reference to s->buf
+         * until tap_send_completed; we stop reading until then. */
         size = qemu_send_packet_async(&s->nc, buf, size, tap_send_completed);
         if (size == 0) {
             tap_read_poll(s, 0);
         }
-    } while (size > 0 && qemu_can_send_packet(&s->nc));
+    } while (size > 0 && ++packets < TAP_RX_BATCH &&
+             qemu_can_send_packet(&s->nc));
 }
 
 int tap_has_ufo(VLANClientState *nc)
@@ -319,6 +328,11 @@ static NetClientInfo net_tap_info = {
     .receive_iov = tap_receive_iov,
     .poll = tap_poll,
     .cleanup = tap_cleanup,
+    .has_ufo = tap_has_ufo,
+    .has_vnet_hdr = tap_has_vnet_hdr,
+    .using_vnet_hdr = tap_using_vnet_hdr,
+    .set_offload = tap_set_offload,
+    .get_vhost_net = tap_get_vhost_net,
 };
 
 static TAPState *net_tap_fd_init(VLANState *vlan,
@@ -0,0 +1,108 @@
+/*
+ * vhost-user network backend
+ *
+ * Copyright (c) 2012 agent <agent@local>
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ *
+ */
+
+#include "net/vhost-user.h"
+#include "hw/vhost_net.h"
+#include "qemu_socket.h"
+#include "qemu-error.h"
+#include "migration.h"
+#include "qerror.h"
+
+/*
+ * The frames never go through QEMU: the process at the other end of the
+ * socket reads and writes the virtqueues of the peer virtio-net device
+ * directly, in guest RAM that it maps from the files that back it.  The
+ * virtio-net device must be the peer of the backend and use host and
+ * guest notifiers, so that kicks and interrupts are eventfds.
+ */
+typedef struct VhostUserState {
+    VLANClientState nc;
+    VHostNetState *vhost_net;
+    Error *migration_blocker;
+} VhostUserState;
+
+/* Only reached while the device is not started: there is nowhere to put
+ * the frame.  */
+static ssize_t vhost_user_receive(VLANClientState *nc, const uint8_t *buf,
+                                  size_t size)
+{
+    return size;
+}
+
+static void vhost_user_cleanup(VLANClientState *nc)
+{
+    VhostUserState *s = DO_UPCAST(VhostUserState, nc, nc);
+
+    if (s->vhost_net) {
+        vhost_net_cleanup(s->vhost_net);
+        s->vhost_net = NULL;
+    }
+    migrate_del_blocker(s->migration_blocker);
+    error_free(s->migration_blocker);
+}
+
+static VHostNetState *vhost_user_get_vhost_net(VLANClientState *nc)
+{
+    VhostUserState *s = DO_UPCAST(VhostUserState, nc, nc);
+
+    return s->vhost_net;
+}
+
+static NetClientInfo net_vhost_user_info = {
+    .type = NET_CLIENT_TYPE_VHOST_USER,
+    .size = sizeof(VhostUserState),
+    .receive = vhost_user_receive,
+    .cleanup = vhost_user_cleanup,
+    .get_vhost_net = vhost_user_get_vhost_net,
+};
+
+int net_init_vhost_user(QemuOpts *opts, Monitor *mon,
+                        const char *name, VLANState *vlan)
+{
+    VLANClientState *nc;
+    VhostUserState *s;
+    const char *path;
+    int fd;
+
+    path = qemu_opt_get(opts, "path");
+    if (!path) {
+        error_report("vhost-user requires path=");
+        return -1;
+    }
+    if (vlan) {
+        error_report("vhost-user is only supported with -netdev");
+        return -1;
+    }
+
+    fd = unix_connect(path);
+    if (fd < 0) {
+        return -1;
+    }
+    socket_set_block(fd);
+
+    nc = qemu_new_net_client(&net_vhost_user_info, vlan, NULL, "vhost-user",
+                             name);
+    snprintf(nc->info_str, sizeof(nc->info_str), "path=%s", path);
+    s = DO_UPCAST(VhostUserState, nc, nc);
+
+    /* The other process does not log the pages it dirties */
+    error_set(&s->migration_blocker, QERR_DEVICE_FEATURE_BLOCKS_MIGRATION,
+              "vhost-user", "dirty page logging");
+    migrate_add_blocker(s->migration_blocker);
+
+    /* vhost_net owns the socket from here on */
+    s->vhost_net = vhost_net_init(nc, fd, true);
+    if (!s->vhost_net) {
+        error_report("vhost-user: could not initialize %s", path);
+        qemu_del_vlan_client(nc);
+        return -1;
+    }
+    return 0;
+}
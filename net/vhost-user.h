@@ -0,0 +1,20 @@
+/*
+ * vhost-user network backend
+ *
+ * Copyright (c) 2012 agent <agent@local>
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ *
+ */
+
+#ifndef QEMU_NET_VHOST_USER_H
+#define QEMU_NET_VHOST_USER_H
+
+#include "net.h"
+#include "qemu-common.h"
+
+int net_init_vhost_user(QemuOpts *opts, Monitor *mon,
+                        const char *name, VLANState *vlan);
+
+#endif /* QEMU_NET_VHOST_USER_H */
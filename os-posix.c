@@ -28,8 +28,6 @@
 #include <signal.h>
 #include <sys/types.h>
 #include <sys/wait.h>
-/*needed for MAP_POPULATE before including qemu-options.h */
-#include <sys/mman.h>
 #include <pwd.h>
 #include <grp.h>
 #include <libgen.h>
@@ -87,12 +87,22 @@ specifies the maximum number of hotpluggable CPUs.
 ETEXI
 
 DEF("numa", HAS_ARG, QEMU_OPTION_numa,
-    "-numa node[,mem=size][,cpus=cpu[-cpu]][,nodeid=node]\n", QEMU_ARCH_ALL)
+    "-numa node[,mem=size][,cpus=cpu[-cpu]][,nodeid=node]\n"
+    "           [,hostnodes=node[-node]][,policy=default|preferred|bind|interleave]\n"
+    "           [,mem-path=path]\n", QEMU_ARCH_ALL)
 STEXI
 @item -numa @var{opts}
 @findex -numa
 Simulate a multi node NUMA system. If mem and cpus are omitted, resources
 are split equally.
+
+@option{hostnodes} places the RAM of the node on the given host NUMA nodes,
+with the memory policy given by @option{policy} (@code{bind} by default).
+@option{mem-path} allocates the RAM of the node from a file in @var{path},
+like @option{-mem-path} does for the whole guest; different nodes can use
+hugetlbfs mounts with different page sizes.  With @option{-mem-prealloc},
+the RAM of all nodes is faulted in in parallel, after it has been bound.
+The placement can be queried with the @code{query-numa} QMP command.
 ETEXI
 
 DEF("fda", HAS_ARG, QEMU_OPTION_fda,
@@ -399,15 +409,15 @@ STEXI
 Allocate guest RAM from a temporarily created file in @var{path}.
 ETEXI
 
-#ifdef MAP_POPULATE
 DEF("mem-prealloc", 0, QEMU_OPTION_mem_prealloc,
-    "-mem-prealloc   preallocate guest memory (use with -mem-path)\n",
+    "-mem-prealloc   preallocate guest memory\n",
     QEMU_ARCH_ALL)
 STEXI
 @item -mem-prealloc
-Preallocate memory when using -mem-path.
+Preallocate guest RAM at startup, whether it comes from @option{-mem-path}
+or is anonymous memory, so that the guest does not take page faults on it
+while it runs.  The work is spread over one thread per host CPU.
 ETEXI
-#endif
 
 DEF("k", HAS_ARG, QEMU_OPTION_k,
     "-k language     use keyboard layout (for example 'fr' for French)\n",
@@ -1237,7 +1247,7 @@ DEF("net", HAS_ARG, QEMU_OPTION_net,
 #ifdef CONFIG_SLIRP
     "-net user[,vlan=n][,name=str][,net=addr[/mask]][,host=addr][,restrict=on|off]\n"
     "         [,hostname=host][,dhcpstart=addr][,dns=addr][,tftp=dir][,bootfile=f]\n"
-    "         [,hostfwd=rule][,guestfwd=rule]"
+    "         [,hostfwd=rule][,guestfwd=rule][,vnet_hdr=on|off]"
 #ifndef _WIN32
                                              "[,smb=dir[,smbserver=addr]]\n"
 #endif
@@ -1276,7 +1286,10 @@ DEF("net", HAS_ARG, QEMU_OPTION_net,
     "                connect the vlan 'n' to multicast maddr and port\n"
     "                use 'localaddr=addr' to specify the host address to send packets from\n"
     "-net socket[,vlan=n][,name=str][,fd=h][,udp=host:port][,localaddr=host:port]\n"
+    "         [,l2tpv3=on,txsession=n[,rxsession=n][,txcookie=n,rxcookie=n][,cookie64=on]\n"
+    "         [,counter=on]]\n"
     "                connect the vlan 'n' to another VLAN using an UDP tunnel\n"
+    "                use 'l2tpv3=on' to encapsulate the frames in L2TPv3 (RFC 3931)\n"
 #ifdef CONFIG_VDE
     "-net vde[,vlan=n][,name=str][,sock=socketpath][,port=n][,group=groupname][,mode=octalmode]\n"
     "                connect the vlan 'n' to port 'n' of a vde switch running\n"
@@ -1284,8 +1297,17 @@ DEF("net", HAS_ARG, QEMU_OPTION_net,
     "                Use group 'groupname' and mode 'octalmode' to change default\n"
     "                ownership and permissions for communication port.\n"
 #endif
-    "-net dump[,vlan=n][,file=f][,len=n]\n"
+#ifdef CONFIG_LINUX
+    "-netdev vhost-user,id=str,path=socketpath\n"
+    "                hand the virtqueues of the virtio-net device to the process\n"
+    "                listening on 'socketpath' (needs -mem-path and -mem-prealloc)\n"
+#endif
+    "-net dump[,vlan=n][,file=f][,len=n][,filter=expr][,bufsize=n]\n"
+    "         [,filesize=n][,files=n]\n"
     "                dump traffic on vlan 'n' to file 'f' (max n bytes per packet)\n"
+    "                use 'filter' to only dump matching packets\n"
+    "                use 'filesize' to start a new file, f.1, f.2..., every n bytes\n"
+    "                and 'files' to reuse the names after n files\n"
     "-net none       use it alone to have zero network devices. If no -net option\n"
     "                is provided, the default is '-net nic -net user'\n", QEMU_ARCH_ALL)
 DEF("netdev", HAS_ARG, QEMU_OPTION_netdev,
@@ -1297,6 +1319,9 @@ DEF("netdev", HAS_ARG, QEMU_OPTION_netdev,
     "bridge|"
 #ifdef CONFIG_VDE
     "vde|"
+#endif
+#ifdef CONFIG_LINUX
+    "vhost-user|"
 #endif
     "socket],id=str[,option][,option][,...]\n", QEMU_ARCH_ALL)
 STEXI
@@ -1346,6 +1371,12 @@ to the outside. This option does not affect any explicitly set forwarding rules.
 @item hostname=@var{name}
 Specifies the client hostname reported by the builtin DHCP server.
 
+@item vnet_hdr=on|off
+Exchange frames with a virtio-net guest together with the virtio-net header,
+so that the guest can hand over large TCP segments and leave checksums to the
+user mode stack, and receive them the same way.  This changes the features
+virtio-net offers to the guest, so it is off by default.
+
 @item dhcpstart=@var{addr}
 Specify the first of the 16 IPs the built-in DHCP server can assign. Default
 is the 15th to 31st IP in the guest network, i.e. x.x.x.15 to x.x.x.31.
@@ -1565,6 +1596,32 @@ qemu-system-i386 linux.img \
                  -net socket,mcast=239.192.168.1:1102,localaddr=1.2.3.4
 @end example
 
+@item -net socket[,vlan=@var{n}][,name=@var{name}][,udp=@var{host}:@var{port}][,localaddr=@var{host}:@var{port}][,l2tpv3=on,txsession=@var{n}[,rxsession=@var{n}][,txcookie=@var{n},rxcookie=@var{n}][,cookie64=on][,counter=on]]
+
+Connect the VLAN @var{n} to another QEMU virtual machine, or to any other
+point-to-point tunnel endpoint, with UDP datagrams sent from
+@option{localaddr} to @option{udp}.  Each datagram carries one frame.
+
+With @option{l2tpv3=on} the frames are encapsulated in L2TPv3 over UDP
+(RFC 3931), which is understood by Linux and by routers, with the session
+id @option{txsession} on sent frames.  Received frames must have session
+id @option{rxsession}, which defaults to @option{txsession}.
+@option{txcookie} and @option{rxcookie} add 32-bit cookies, or 64-bit ones
+with @option{cookie64=on}.  @option{counter=on} adds sequence numbers, and
+has to be given on both ends.
+
+Example:
+@example
+# launch a first QEMU instance
+qemu-system-i386 linux.img \
+                 -net nic,macaddr=52:54:00:12:34:56 \
+                 -net socket,udp=10.0.0.2:1701,localaddr=10.0.0.1:1701,l2tpv3=on,txsession=1,rxsession=2
+# on another host, connect it
+qemu-system-i386 linux.img \
+                 -net nic,macaddr=52:54:00:12:34:57 \
+                 -net socket,udp=10.0.0.1:1701,localaddr=10.0.0.2:1701,l2tpv3=on,txsession=2,rxsession=1
+@end example
+
 @item -net vde[,vlan=@var{n}][,name=@var{name}][,sock=@var{socketpath}] [,port=@var{n}][,group=@var{groupname}][,mode=@var{octalmode}]
 Connect VLAN @var{n} to PORT @var{n} of a vde switch running on host and
 listening for incoming connections on @var{socketpath}. Use GROUP @var{groupname}
@@ -1580,11 +1637,57 @@ vde_switch -F -sock /tmp/myswitch
 qemu-system-i386 linux.img -net nic -net vde,sock=/tmp/myswitch
 @end example
 
-@item -net dump[,vlan=@var{n}][,file=@var{file}][,len=@var{len}]
+@item -netdev vhost-user,id=@var{id},path=@var{socketpath}
+Connect to the process listening on the Unix socket @var{socketpath} and let
+it move the packets of the virtio-net device whose netdev is @var{id}, like
+@option{vhost=on} does with the kernel.  The process gets the descriptors of
+the files backing guest RAM and maps them, so QEMU must be started with
+@option{-mem-path} and @option{-mem-prealloc}; it also needs KVM for the
+eventfd notifications.  Migration is not supported while the backend is in use.
+
+The protocol is described in @file{hw/vhost-user.h}; @file{tests/vhost-user-loopback.c}
+is a simple backend that sends every packet of the guest back to it.  It is
+built as @file{tests/vhost-user-loopback} by @code{make check-unit}.
+
+Example:
+@example
+tests/vhost-user-loopback /tmp/vu.sock &
+qemu-system-x86_64 -enable-kvm linux.img -m 1024 \
+                   -mem-path /dev/hugepages -mem-prealloc \
+                   -netdev vhost-user,id=vu0,path=/tmp/vu.sock \
+                   -device virtio-net-pci,netdev=vu0
+@end example
+
+@item -net dump[,vlan=@var{n}][,file=@var{file}][,len=@var{len}][,filter=@var{expr}][,bufsize=@var{size}][,filesize=@var{size}][,files=@var{count}]
 Dump network traffic on VLAN @var{n} to file @var{file} (@file{qemu-vlan0.pcap} by default).
 At most @var{len} bytes (64k by default) per packet are stored. The file format is
 libpcap, so it can be analyzed with tools such as tcpdump or Wireshark.
 
+Packets are collected in a buffer of @var{size} bytes (4M by default) and written
+to the file by a separate thread; if the buffer fills up, packets are dropped
+and the number of dropped packets is reported when the dump ends.
+
+@option{filter} restricts the dump to packets matching @var{expr}, which uses
+a subset of the tcpdump filter syntax: @code{arp}, @code{ip}, @code{ip6},
+@code{tcp}, @code{udp}, @code{icmp}, @code{vlan}, @code{broadcast},
+@code{multicast}, @code{[src|dst] host @var{a.b.c.d}},
+@code{[src|dst] port @var{n}}, @code{less @var{n}} and @code{greater @var{n}},
+combined with @code{not}, @code{and}, @code{or} and parentheses.  The filter
+only looks at the first 128 bytes of each frame, so conditions on headers
+beyond them, e.g. ports after a long chain of IPv6 extension headers, do
+not match.
+
+With @option{filesize}, a new file is started whenever the current one would
+exceed @var{size} bytes; the files are named @var{file}, @var{file}.1,
+@var{file}.2 and so on.  With @option{files}, only @var{count} names are used
+and the oldest file is overwritten.
+
+Example:
+@example
+qemu-system-i386 linux.img -net nic -net user \
+                 -net dump,file=web.pcap,filter="tcp and port 80",filesize=100M,files=10
+@end example
+
 @item -net none
 Indicate that no network devices should be configured. It is used to
 override the default configuration (@option{-net nic -net user}) which
@@ -2279,6 +2382,50 @@ STEXI
 Run the emulation in single step mode.
 ETEXI
 
+DEF("tb-hot-threshold", HAS_ARG, QEMU_OPTION_tb_hot_threshold, \
+    "-tb-hot-threshold n\n"
+    "                retranslate blocks executed n times as superblocks\n",
+    QEMU_ARCH_ALL)
+STEXI
+@item -tb-hot-threshold @var{n}
+@findex -tb-hot-threshold
+Count the executions of each translated block and retranslate a block
+as a superblock, following direct jumps, once it has run @var{n} times.
+Only the x86 frontend builds superblocks; 0 (the default) disables the
+feature.
+ETEXI
+
+DEF("tb-cache", HAS_ARG, QEMU_OPTION_tb_cache, \
+    "-tb-cache file  reuse translated code saved in file by earlier runs\n",
+    QEMU_ARCH_ALL)
+STEXI
+@item -tb-cache @var{file}
+@findex -tb-cache
+Load translated blocks from @var{file} instead of translating the guest
+code again, and save the blocks translated during this run to @var{file}
+at exit.  A block is only reused if the guest code it was translated from
+is unchanged; the whole file is ignored if it was written by a different
+QEMU binary, for another target or for another CPU model.  Hit rates are
+shown by @code{info jit}.  Only x86 hosts are supported, and the option
+cannot be combined with @option{-tb-hot-threshold}.
+ETEXI
+
+DEF("halt-poll-ns", HAS_ARG, QEMU_OPTION_halt_poll_ns, \
+    "-halt-poll-ns ns\n"
+    "                poll for up to ns nanoseconds before a halted CPU sleeps\n",
+    QEMU_ARCH_ALL)
+STEXI
+@item -halt-poll-ns @var{ns}
+@findex -halt-poll-ns
+Let a halted CPU spin for a while, waiting for an interrupt, before it goes
+to sleep.  This avoids the cost of a sleep and wakeup for workloads that
+receive interrupts in quick succession.  The polling window of each CPU
+adapts to the time it actually stays halted, and never exceeds @var{ns}
+nanoseconds (200000 by default; 0 disables polling).  Only applies when
+QEMU itself waits for halted CPUs, i.e. with TCG or without the in-kernel
+irqchip.  The current window and the hit rate are shown by @code{info cpus}.
+ETEXI
+
 DEF("S", 0, QEMU_OPTION_S, \
     "-S              freeze CPU at startup (use 'c' to start execution)\n",
     QEMU_ARCH_ALL)
@@ -1441,6 +1441,9 @@ Return a json-array. Each CPU is represented by a json-object, which contains:
      "pc" and "npc": sparc (json-int)
      "PC": mips (json-int)
 - "thread_id": ID of the underlying host thread (json-int)
+- "halt_poll_ns": current halt polling window in ns (json-int, optional)
+- "halt_poll_hits": halts that ended while polling (json-int, optional)
+- "halt_poll_misses": halts that polled, then slept (json-int, optional)
 
 Example:
 
@@ -1472,6 +1475,62 @@ EQMP
         .mhandler.cmd_new = qmp_marshal_input_query_cpus,
     },
 
+SQMP
+query-numa
+----------
+
+Show where the RAM of the guest NUMA nodes is allocated on the host.
+
+Return a json-array. Each guest node is represented by a json-object, which
+contains:
+
+- "node": guest node id (json-int)
+- "size": guest RAM in the node, in bytes (json-int)
+- "policy": host memory policy (json-string, one of "default", "preferred",
+            "bind" or "interleave")
+- "host_nodes": bitmask of the host nodes the policy refers to (json-int,
+                optional)
+- "page_size": size of the host pages backing the RAM (json-int)
+- "mem_path": directory the RAM was allocated from (json-string, optional)
+- "usage": json-array of json-objects, one per host node that holds some of
+           the touched RAM, estimated from a sample of the pages:
+    - "host_node": host node id (json-int)
+    - "bytes": amount of guest RAM on that node (json-int)
+
+Example:
+
+-> { "execute": "query-numa" }
+<- {
+      "return":[
+         {
+            "node":0,
+            "size":4294967296,
+            "policy":"bind",
+            "host_nodes":1,
+            "page_size":2097152,
+            "mem_path":"/dev/hugepages",
+            "usage":[ { "host_node":0, "bytes":4294967296 } ]
+         },
+         {
+            "node":1,
+            "size":4294967296,
+            "policy":"bind",
+            "host_nodes":2,
+            "page_size":2097152,
+            "mem_path":"/dev/hugepages",
+            "usage":[ { "host_node":1, "bytes":4294967296 } ]
+         }
+      ]
+   }
+
+EQMP
+
+    {
+        .name       = "query-numa",
+        .args_type  = "",
+        .mhandler.cmd_new = qmp_marshal_input_query_numa,
+    },
+
 SQMP
 query-pci
 ---------
@@ -20,4 +20,22 @@
 /* 2 for alignment, 14 for ethernet, 40 for TCP/IP */
 #define IF_MAXLINKHDR (2 + 14 + 40)
 
+/*
+ * Header in front of every frame once slirp_set_offload() asked for it.
+ * This is struct virtio_net_hdr, which the NIC passes to and from the guest.
+ */
+struct slirp_vnet_hdr {
+	uint8_t  flags;
+	uint8_t  gso_type;
+	uint16_t hdr_len;	/* Ethernet + IP + TCP header length */
+	uint16_t gso_size;	/* Bytes of payload per segment */
+	uint16_t csum_start;	/* Where to start checksumming */
+	uint16_t csum_offset;	/* Where after csum_start to store it */
+};
+
+#define SLIRP_VNET_HDR_LEN		sizeof(struct slirp_vnet_hdr)
+#define SLIRP_VNET_HDR_F_NEEDS_CSUM	1
+#define SLIRP_VNET_HDR_GSO_NONE		0
+#define SLIRP_VNET_HDR_GSO_TCPV4	1
+
 #endif
@@ -73,9 +73,10 @@ ip_output(struct socket *so, struct mbuf *m0)
 	ip->ip_hl = hlen >> 2;
 
 	/*
-	 * If small enough for interface, can just send directly.
+	 * If small enough for interface, or to be split by the
+	 * NIC anyway, can just send directly.
 	 */
-	if ((uint16_t)ip->ip_len <= IF_MTU) {
+	if ((uint16_t)ip->ip_len <= IF_MTU || m->gso_size) {
 		ip->ip_len = htons((uint16_t)ip->ip_len);
 		ip->ip_off = htons((uint16_t)ip->ip_off);
 		ip->ip_sum = 0;
@@ -23,6 +23,7 @@ void slirp_select_poll(fd_set *readfds, fd_set *writefds, fd_set *xfds,
                        int select_error);
 
 void slirp_input(Slirp *slirp, const uint8_t *pkt, int pkt_len);
+void slirp_set_offload(Slirp *slirp, int vnet_hdr, int csum, int tso4);
 
 /* you must provide the following functions: */
 int slirp_can_output(void *opaque);
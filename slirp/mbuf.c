@@ -16,8 +16,7 @@
  */
 
 #include <slirp.h>
-
-#define MBUF_THRESH 30
+#include "monitor.h"
 
 /*
  * Find a nice value for msize
@@ -25,6 +24,21 @@
  */
 #define SLIRP_MSIZE (IF_MTU + IF_MAXLINKHDR + offsetof(struct mbuf, m_dat) + 6)
 
+/*
+ * mbufs are carved MBUF_SLAB_SIZE at a time out of slabs that belong to
+ * one Slirp instance, and always go back to its free list.  Past
+ * MBUF_POOL_MAX, e.g. while the guest is not picking up its packets,
+ * mbufs are malloced singly and given back to the system when freed.
+ */
+#define MBUF_SLAB_SIZE 32
+#define MBUF_POOL_MAX 1024
+#define MBUF_STRIDE ((SLIRP_MSIZE + 7) & ~7)
+
+struct mbuf_slab {
+	struct mbuf_slab *next;
+	uint64_t mbufs[];	/* MBUF_SLAB_SIZE mbufs, MBUF_STRIDE apart */
+};
+
 void
 m_init(Slirp *slirp)
 {
@@ -35,6 +49,7 @@ m_init(Slirp *slirp)
 void m_cleanup(Slirp *slirp)
 {
     struct mbuf *m, *next;
+    struct mbuf_slab *slab;
 
     m = slirp->m_usedlist.m_next;
     while (m != &slirp->m_usedlist) {
@@ -42,24 +57,46 @@ void m_cleanup(Slirp *slirp)
         if (m->m_flags & M_EXT) {
             free(m->m_ext);
         }
-        free(m);
+        if (m->m_flags & M_DOFREE) {
+            free(m);
+        }
         m = next;
     }
-    m = slirp->m_freelist.m_next;
-    while (m != &slirp->m_freelist) {
-        next = m->m_next;
-        free(m);
-        m = next;
+    while (slirp->mbuf_slabs) {
+        slab = slirp->mbuf_slabs;
+        slirp->mbuf_slabs = slab->next;
+        free(slab);
     }
 }
 
+/* Add a slab's worth of mbufs to the free list */
+static void
+m_grow(Slirp *slirp)
+{
+	struct mbuf_slab *slab;
+	struct mbuf *m;
+	int i;
+
+	slab = (struct mbuf_slab *)malloc(sizeof(*slab) +
+					  MBUF_SLAB_SIZE * MBUF_STRIDE);
+	if (slab == NULL)
+		return;
+	slab->next = slirp->mbuf_slabs;
+	slirp->mbuf_slabs = slab;
+
+	for (i = 0; i < MBUF_SLAB_SIZE; i++) {
+		m = (struct mbuf *)((char *)slab->mbufs + i * MBUF_STRIDE);
+		m->slirp = slirp;
+		m->m_flags = M_FREELIST;
+		insque(m, &slirp->m_freelist);
+	}
+	slirp->mbuf_pooled += MBUF_SLAB_SIZE;
+}
+
 /*
- * Get an mbuf from the free list, if there are none
- * malloc one
- *
- * Because fragmentation can occur if we alloc new mbufs and
- * free old mbufs, we mark all mbufs above mbuf_thresh as M_DOFREE,
- * which tells m_free to actually free() it
+ * Get an mbuf from the free list, growing the pool if it is
+ * empty.  Once the pool is at its limit, malloc one and mark it
+ * M_DOFREE, which tells m_free to actually free() it
  */
 struct mbuf *
 m_get(Slirp *slirp)
@@ -69,18 +106,26 @@ m_get(Slirp *slirp)
 
 	DEBUG_CALL("m_get");
 
+	if (slirp->m_freelist.m_next == &slirp->m_freelist &&
+	    slirp->mbuf_pooled < MBUF_POOL_MAX)
+		m_grow(slirp);
+
 	if (slirp->m_freelist.m_next == &slirp->m_freelist) {
 		m = (struct mbuf *)malloc(SLIRP_MSIZE);
 		if (m == NULL) goto end_error;
 		slirp->mbuf_alloced++;
-		if (slirp->mbuf_alloced > MBUF_THRESH)
-			flags = M_DOFREE;
+		slirp->mbuf_stats.unpooled++;
+		flags = M_DOFREE;
 		m->slirp = slirp;
 	} else {
 		m = slirp->m_freelist.m_next;
 		remque(m);
 	}
 
+	slirp->mbuf_stats.gets++;
+	if (++slirp->mbuf_stats.in_use > slirp->mbuf_stats.in_use_peak)
+		slirp->mbuf_stats.in_use_peak = slirp->mbuf_stats.in_use;
+
 	/* Insert it in the used list */
 	insque(m,&slirp->m_usedlist);
 	m->m_flags = (flags | M_USEDLIST);
@@ -93,6 +138,8 @@ m_get(Slirp *slirp)
         m->m_prevpkt = NULL;
         m->arp_requested = false;
         m->expiration_date = (uint64_t)-1;
+        m->csum_partial = false;
+        m->gso_size = 0;
 end_error:
 	DEBUG_ARG("m = %lx", (long )m);
 	return m;
@@ -115,12 +162,14 @@ m_free(struct mbuf *m)
 	   free(m->m_ext);
 
 	/*
-	 * Either free() it or put it on the free list
+	 * Either free() it or put it back on the free list
 	 */
 	if (m->m_flags & M_DOFREE) {
 		m->slirp->mbuf_alloced--;
+		m->slirp->mbuf_stats.in_use--;
 		free(m);
 	} else if ((m->m_flags & M_FREELIST) == 0) {
+		m->slirp->mbuf_stats.in_use--;
 		insque(m,&m->slirp->m_freelist);
 		m->m_flags = M_FREELIST; /* Clobber other flags */
 	}
@@ -166,6 +215,7 @@ m_inc(struct mbuf *m, int size)
 	  datasize = m->m_data - m->m_dat;
 	  dat = (char *)malloc(size);
 	  memcpy(dat, m->m_dat, m->m_size);
+	  m->slirp->mbuf_stats.ext++;
 
 	  m->m_ext = dat;
 	  m->m_data = m->m_ext + datasize;
@@ -239,3 +289,17 @@ dtom(Slirp *slirp, void *dat)
 
 	return (struct mbuf *)0;
 }
+
+void
+m_stats(Slirp *slirp, Monitor *mon)
+{
+	struct mbuf_stats *st = &slirp->mbuf_stats;
+
+	monitor_printf(mon, "  mbufs: %d in use (peak %d), %d pooled, "
+		       "%d outside the pool\n",
+		       st->in_use, st->in_use_peak, slirp->mbuf_pooled,
+		       slirp->mbuf_alloced);
+	monitor_printf(mon, "  mbuf allocations: %" PRIu64 ", %" PRIu64
+		       " not from the pool, %" PRIu64 " external buffers\n",
+		       st->gets, st->unpooled, st->ext);
+}
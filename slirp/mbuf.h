@@ -79,11 +79,19 @@ struct m_hdr {
 #define M_FREEROOM(m) (M_ROOM(m) - (m)->m_len)
 #define M_TRAILINGSPACE M_FREEROOM
 
+/*
+ * How much room there is in front of m_data, for link headers
+ */
+#define M_LEADINGSPACE(m) ((m)->m_data - (((m)->m_flags & M_EXT) ? \
+					   (m)->m_ext : (m)->m_dat))
+
 struct mbuf {
 	struct	m_hdr m_hdr;
 	Slirp *slirp;
 	bool	arp_requested;
 	uint64_t expiration_date;
+	bool	csum_partial;	/* TCP sum covers the pseudo-header only */
+	uint16_t gso_size;	/* if non-zero, the NIC splits the TCP payload */
 	/* start of dynamic buffer area, must be last element */
 	union M_dat {
 		char	m_dat_[1]; /* ANSI don't like 0 sized arrays */
@@ -114,9 +122,19 @@ struct mbuf {
 #define M_USEDLIST		0x04	/* XXX mbuf is on used list (for dtom()) */
 #define M_DOFREE		0x08	/* when m_free is called on the mbuf, free()
 					 * it rather than putting it on the free list */
+#define M_CSUM_OK		0x10	/* transport checksum need not be checked */
+
+struct mbuf_stats {
+	uint64_t gets;		/* m_get() calls */
+	uint64_t unpooled;	/* ... that had to malloc() an mbuf */
+	uint64_t ext;		/* external data buffers malloced by m_inc() */
+	int	in_use;		/* mbufs handed out and not yet freed */
+	int	in_use_peak;
+};
 
 void m_init(Slirp *);
 void m_cleanup(Slirp *slirp);
+void m_stats(Slirp *slirp, Monitor *mon);
 struct mbuf * m_get(Slirp *);
 void m_free(struct mbuf *);
 void m_cat(register struct mbuf *, register struct mbuf *);
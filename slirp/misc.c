@@ -354,4 +354,6 @@ void slirp_connection_info(Slirp *slirp, Monitor *mon)
         monitor_printf(mon, "%15s  -    %5d %5d\n", inet_ntoa(dst_addr),
                        so->so_rcv.sb_cc, so->so_snd.sb_cc);
     }
+
+    m_stats(slirp, mon);
 }
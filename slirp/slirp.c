@@ -604,10 +604,31 @@ void slirp_select_poll(fd_set *readfds, fd_set *writefds, fd_set *xfds,
 	 global_xfds = NULL;
 }
 
+/* Pass @frame on to the NIC.  If the NIC asked for a virtio-net header,
+ * it is built in the SLIRP_VNET_HDR_LEN bytes in front of @frame, from
+ * @hdr or, if that is NULL, as one requesting no offloads.
+ */
+static void slirp_output_frame(Slirp *slirp, uint8_t *frame, int len,
+                               const struct slirp_vnet_hdr *hdr)
+{
+    if (slirp->vnet_hdr_len) {
+        frame -= slirp->vnet_hdr_len;
+        len += slirp->vnet_hdr_len;
+        if (hdr) {
+            memcpy(frame, hdr, slirp->vnet_hdr_len);
+        } else {
+            memset(frame, 0, slirp->vnet_hdr_len);
+        }
+    }
+    slirp_output(slirp->opaque, frame, len);
+}
+
 static void arp_input(Slirp *slirp, const uint8_t *pkt, int pkt_len)
 {
     struct arphdr *ah = (struct arphdr *)(pkt + ETH_HLEN);
-    uint8_t arp_reply[max(ETH_HLEN + sizeof(struct arphdr), 64)];
+    uint8_t buf[SLIRP_VNET_HDR_LEN + max(ETH_HLEN + sizeof(struct arphdr), 64)];
+    uint8_t *arp_reply = buf + SLIRP_VNET_HDR_LEN;
+    int arp_reply_len = sizeof(buf) - SLIRP_VNET_HDR_LEN;
     struct ethhdr *reh = (struct ethhdr *)arp_reply;
     struct arphdr *rah = (struct arphdr *)(arp_reply + ETH_HLEN);
     int ar_op;
@@ -633,7 +654,7 @@ static void arp_input(Slirp *slirp, const uint8_t *pkt, int pkt_len)
             }
             return;
         arp_ok:
-            memset(arp_reply, 0, sizeof(arp_reply));
+            memset(arp_reply, 0, arp_reply_len);
 
             arp_table_add(slirp, ah->ar_sip, ah->ar_sha);
 
@@ -652,7 +673,7 @@ static void arp_input(Slirp *slirp, const uint8_t *pkt, int pkt_len)
             rah->ar_sip = ah->ar_tip;
             memcpy(rah->ar_tha, ah->ar_sha, ETH_ALEN);
             rah->ar_tip = ah->ar_sip;
-            slirp_output(slirp->opaque, arp_reply, sizeof(arp_reply));
+            slirp_output_frame(slirp, arp_reply, arp_reply_len, NULL);
         }
         break;
     case ARPOP_REPLY:
@@ -665,9 +686,19 @@ static void arp_input(Slirp *slirp, const uint8_t *pkt, int pkt_len)
 
 void slirp_input(Slirp *slirp, const uint8_t *pkt, int pkt_len)
 {
+    struct slirp_vnet_hdr hdr = { .flags = 0 };
     struct mbuf *m;
     int proto;
 
+    if (slirp->vnet_hdr_len) {
+        if (pkt_len < slirp->vnet_hdr_len) {
+            return;
+        }
+        memcpy(&hdr, pkt, slirp->vnet_hdr_len);
+        pkt += slirp->vnet_hdr_len;
+        pkt_len -= slirp->vnet_hdr_len;
+    }
+
     if (pkt_len < ETH_HLEN)
         return;
 
@@ -680,15 +711,24 @@ void slirp_input(Slirp *slirp, const uint8_t *pkt, int pkt_len)
         m = m_get(slirp);
         if (!m)
             return;
-        /* Note: we add to align the IP header */
-        if (M_FREEROOM(m) < pkt_len + 2) {
-            m_inc(m, pkt_len + 2);
+        /* Place the IP header where locally built packets have it, which
+         * also aligns it, so that replies built in place have room for
+         * the link headers.  The Ethernet header itself is not kept.
+         */
+        if (M_FREEROOM(m) < IF_MAXLINKHDR + pkt_len - ETH_HLEN) {
+            m_inc(m, IF_MAXLINKHDR + pkt_len - ETH_HLEN);
+        }
+        m->m_data += IF_MAXLINKHDR;
+        m->m_len = pkt_len - ETH_HLEN;
+        memcpy(m->m_data, pkt + ETH_HLEN, m->m_len);
+
+        /* A partial checksum means the packet came straight out of guest
+         * memory, so there is nothing to verify.  The guest may also
+         * have sent more than one MSS at once; the stack copes with that.
+         */
+        if (hdr.flags & SLIRP_VNET_HDR_F_NEEDS_CSUM) {
+            m->m_flags |= M_CSUM_OK;
         }
-        m->m_len = pkt_len + 2;
-        memcpy(m->m_data + 2, pkt, pkt_len);
-
-        m->m_data += 2 + ETH_HLEN;
-        m->m_len -= 2 + ETH_HLEN;
 
         ip_input(m);
         break;
@@ -697,22 +737,44 @@ void slirp_input(Slirp *slirp, const uint8_t *pkt, int pkt_len)
     }
 }
 
+/* Offloads are set up by the NIC: whether frames carry a virtio-net header
+ * both ways, and whether the guest takes partial TCP checksums and TCP
+ * segments larger than the MSS.  Large segments need partial checksums.
+ */
+void slirp_set_offload(Slirp *slirp, int vnet_hdr, int csum, int tso4)
+{
+    slirp->vnet_hdr_len = vnet_hdr ? SLIRP_VNET_HDR_LEN : 0;
+    slirp->csum_offload = vnet_hdr && csum;
+    slirp->tso4 = slirp->csum_offload && tso4;
+}
+
 /* Output the IP packet to the ethernet device. Returns 0 if the packet must be
  * re-queued.
  */
 int if_encap(Slirp *slirp, struct mbuf *ifm)
 {
-    uint8_t buf[1600];
-    struct ethhdr *eh = (struct ethhdr *)buf;
+    uint8_t buf[SLIRP_VNET_HDR_LEN + 1600];
+    struct slirp_vnet_hdr hdr;
+    uint8_t *frame;
+    struct ethhdr *eh;
     uint8_t ethaddr[ETH_ALEN];
     const struct ip *iph = (const struct ip *)ifm->m_data;
 
-    if (ifm->m_len + ETH_HLEN > sizeof(buf)) {
+    /* Everything the stack builds itself has room for the link headers
+     * in front of the IP header, so the frame is put together in place;
+     * only the odd packet without that room is copied.
+     */
+    if (M_LEADINGSPACE(ifm) >= slirp->vnet_hdr_len + ETH_HLEN) {
+        frame = (uint8_t *)ifm->m_data - ETH_HLEN;
+    } else if (ifm->m_len + ETH_HLEN <= sizeof(buf) - SLIRP_VNET_HDR_LEN) {
+        frame = buf + SLIRP_VNET_HDR_LEN;
+    } else {
         return 1;
     }
 
     if (!arp_table_search(slirp, iph->ip_dst.s_addr, ethaddr)) {
-        uint8_t arp_req[ETH_HLEN + sizeof(struct arphdr)];
+        uint8_t req_buf[SLIRP_VNET_HDR_LEN + ETH_HLEN + sizeof(struct arphdr)];
+        uint8_t *arp_req = req_buf + SLIRP_VNET_HDR_LEN;
         struct ethhdr *reh = (struct ethhdr *)arp_req;
         struct arphdr *rah = (struct arphdr *)(arp_req + ETH_HLEN);
 
@@ -741,7 +803,8 @@ int if_encap(Slirp *slirp, struct mbuf *ifm)
             /* target IP */
             rah->ar_tip = iph->ip_dst.s_addr;
             slirp->client_ipaddr = iph->ip_dst;
-            slirp_output(slirp->opaque, arp_req, sizeof(arp_req));
+            slirp_output_frame(slirp, arp_req, ETH_HLEN + sizeof(struct arphdr),
+                               NULL);
             ifm->arp_requested = true;
 
             /* Expire request and drop outgoing packet after 1 second */
@@ -749,13 +812,32 @@ int if_encap(Slirp *slirp, struct mbuf *ifm)
         }
         return 0;
     } else {
+        if (frame == buf + SLIRP_VNET_HDR_LEN) {
+            memcpy(frame + ETH_HLEN, ifm->m_data, ifm->m_len);
+        }
+        eh = (struct ethhdr *)frame;
         memcpy(eh->h_dest, ethaddr, ETH_ALEN);
         memcpy(eh->h_source, special_ethaddr, ETH_ALEN - 4);
         /* XXX: not correct */
         memcpy(&eh->h_source[2], &slirp->vhost_addr, 4);
         eh->h_proto = htons(ETH_P_IP);
-        memcpy(buf + sizeof(struct ethhdr), ifm->m_data, ifm->m_len);
-        slirp_output(slirp->opaque, buf, ifm->m_len + ETH_HLEN);
+
+        memset(&hdr, 0, sizeof(hdr));
+        if (ifm->csum_partial) {
+            int iphlen = iph->ip_hl << 2;
+            const struct tcphdr *th =
+                (const struct tcphdr *)((const uint8_t *)iph + iphlen);
+
+            hdr.flags = SLIRP_VNET_HDR_F_NEEDS_CSUM;
+            hdr.csum_start = ETH_HLEN + iphlen;
+            hdr.csum_offset = offsetof(struct tcphdr, th_sum);
+            if (ifm->gso_size) {
+                hdr.gso_type = SLIRP_VNET_HDR_GSO_TCPV4;
+                hdr.gso_size = ifm->gso_size;
+                hdr.hdr_len = ETH_HLEN + iphlen + (th->th_off << 2);
+            }
+        }
+        slirp_output_frame(slirp, frame, ifm->m_len + ETH_HLEN, &hdr);
         return 1;
     }
 }
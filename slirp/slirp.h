@@ -220,7 +220,10 @@ struct Slirp {
 
     /* mbuf states */
     struct mbuf m_freelist, m_usedlist;
-    int mbuf_alloced;
+    struct mbuf_slab *mbuf_slabs;   /* arena pooled mbufs are carved from */
+    int mbuf_pooled;        /* mbufs in the arena */
+    int mbuf_alloced;       /* mbufs malloced singly once the arena is full */
+    struct mbuf_stats mbuf_stats;
 
     /* if states */
     struct mbuf if_fastq;   /* fast queue (for interactive data) */
@@ -228,6 +231,11 @@ struct Slirp {
     struct mbuf *next_m;    /* pointer to next mbuf to output */
     bool if_start_busy;     /* avoid if_start recursion */
 
+    /* offloads agreed with the NIC, see slirp_set_offload() */
+    int vnet_hdr_len;       /* header in front of each frame, or 0 */
+    bool csum_offload;      /* NIC takes partial TCP checksums */
+    bool tso4;              /* NIC takes TCP segments larger than the MSS */
+
     /* ip states */
     struct ipq ipq;         /* ip reass. queue */
     uint16_t ip_id;         /* ip packet ctr, for ids */
@@ -38,8 +38,12 @@ typedef	uint32_t tcp_seq;
 #define      PR_SLOWHZ       2               /* 2 slow timeouts per second (approx) */
 #define      PR_FASTHZ       5               /* 5 fast timeouts per second (not important) */
 
-#define TCP_SNDSPACE 8192
-#define TCP_RCVSPACE 8192
+/*
+ * Socket buffers: as much as fits in the largest window we can
+ * advertise or be offered without window scaling.
+ */
+#define TCP_SNDSPACE 65535
+#define TCP_RCVSPACE 65535
 
 /*
  * TCP header.
@@ -49,6 +49,12 @@ static const u_char  tcp_outflags[TCP_NSTATES] = {
 
 #define MAX_TCPOPTLEN	32	/* max # bytes that go in options */
 
+/*
+ * Most payload handed to a NIC that segments for us: with the
+ * headers, it must fit the guest's 64k receive buffers.
+ */
+#define TCP_GSO_MAXLEN	(65536 - IF_MAXLINKHDR - sizeof(struct tcpiphdr))
+
 /*
  * Tcp output routine: figure out what should be sent and send it.
  */
@@ -63,6 +69,7 @@ tcp_output(struct tcpcb *tp)
 	u_char opt[MAX_TCPOPTLEN];
 	unsigned optlen, hdrlen;
 	int idle, sendalot;
+	long maxlen;
 
 	DEBUG_CALL("tcp_output");
 	DEBUG_ARG("tp = %lx", (long )tp);
@@ -88,6 +95,14 @@ again:
 
 	flags = tcp_outflags[tp->t_state];
 
+	/*
+	 * If the NIC segments for us, send as many whole segments
+	 * at once as it takes.
+	 */
+	maxlen = tp->t_maxseg;
+	if (so->slirp->tso4)
+		maxlen = TCP_GSO_MAXLEN / tp->t_maxseg * tp->t_maxseg;
+
 	DEBUG_MISC((dfd, " --- tcp_output flags = 0x%x\n",flags));
 
 	/*
@@ -143,8 +158,8 @@ again:
 		}
 	}
 
-	if (len > tp->t_maxseg) {
-		len = tp->t_maxseg;
+	if (len > maxlen) {
+		len = maxlen;
 		sendalot = 1;
 	}
 	if (SEQ_LT(tp->snd_nxt + len, tp->snd_una + so->so_snd.sb_cc))
@@ -163,7 +178,7 @@ again:
 	 * to send into a small window), then must resend.
 	 */
 	if (len) {
-		if (len == tp->t_maxseg)
+		if (len >= tp->t_maxseg)
 			goto send;
 		if ((1 || idle || tp->t_flags & TF_NODELAY) &&
 		    len + off >= so->so_snd.sb_cc)
@@ -278,9 +293,12 @@ send:
 	/*
 	 * Adjust data length if insertion of options will
 	 * bump the packet length beyond the t_maxseg length.
+	 * Segments with options are not left to the NIC to split.
 	 */
-	 if (len > tp->t_maxseg - optlen) {
-		len = tp->t_maxseg - optlen;
+	 if (optlen)
+		maxlen = tp->t_maxseg;
+	 if (len > maxlen - optlen) {
+		len = maxlen - optlen;
 		sendalot = 1;
 	 }
 
@@ -297,6 +315,8 @@ send:
 		}
 		m->m_data += IF_MAXLINKHDR;
 		m->m_len = hdrlen;
+		if (M_FREEROOM(m) < len)
+			m_inc(m, IF_MAXLINKHDR + hdrlen + len);
 
 		sbcopy(&so->so_snd, off, (int) len, mtod(m, caddr_t) + hdrlen);
 		m->m_len += len;
@@ -385,7 +405,17 @@ send:
 	if (len + optlen)
 		ti->ti_len = htons((uint16_t)(sizeof (struct tcphdr) +
 		    optlen + len));
-	ti->ti_sum = cksum(m, (int)(hdrlen + len));
+	if (so->slirp->csum_offload) {
+		/*
+		 * Leave the sum over the segment to the NIC, seeded with
+		 * that of the pseudo-header as it expects.
+		 */
+		ti->ti_sum = ~cksum(m, sizeof(struct ipovly));
+		m->csum_partial = true;
+		if (len > tp->t_maxseg)
+			m->gso_size = tp->t_maxseg;
+	} else
+		ti->ti_sum = cksum(m, (int)(hdrlen + len));
 
 	/*
 	 * In transmit state, time the transmission and arrange for
@@ -136,6 +136,9 @@ extern QEMUClock *rtc_clock;
 extern int nb_numa_nodes;
 extern uint64_t node_mem[MAX_NODES];
 extern uint64_t node_cpumask[MAX_NODES];
+extern uint64_t node_host_nodes[MAX_NODES];
+extern NumaMemPolicy node_mem_policy[MAX_NODES];
+extern const char *node_mem_path[MAX_NODES];
 
 #define MAX_OPTION_ROMS 16
 typedef struct QEMUOptionRom {
@@ -717,12 +717,14 @@ static const uint8_t table_logic_cc[16] = {
     1, /* mvn */
 };
 
-/* Set PC and Thumb state from an immediate address.  */
+/* Set PC and Thumb state from an immediate address.  The Thumb bit is
+   part of the TB flags, so the next TB can still be found through the
+   jump cache.  */
 static inline void gen_bx_im(DisasContext *s, uint32_t addr)
 {
     TCGv tmp;
 
-    s->is_jmp = DISAS_UPDATE;
+    s->is_jmp = DISAS_JUMP;
     if (s->thumb != (addr & 1)) {
         tmp = tcg_temp_new_i32();
         tcg_gen_movi_i32(tmp, addr & 1);
@@ -735,7 +737,7 @@ static inline void gen_bx_im(DisasContext *s, uint32_t addr)
 /* Set PC and Thumb state from var.  var is marked as dead.  */
 static inline void gen_bx(DisasContext *s, TCGv var)
 {
-    s->is_jmp = DISAS_UPDATE;
+    s->is_jmp = DISAS_JUMP;
     tcg_gen_andi_i32(cpu_R[15], var, ~1);
     tcg_gen_andi_i32(var, var, 1);
     store_cpu_field(var, thumb);
@@ -3709,8 +3711,8 @@ static void gen_nop_hint(DisasContext *s, int val)
 static inline void gen_neon_add(int size, TCGv t0, TCGv t1)
 {
     switch (size) {
-    case 0: gen_helper_neon_add_u8(t0, t0, t1); break;
-    case 1: gen_helper_neon_add_u16(t0, t0, t1); break;
+    case 0: tcg_gen_vec_add8_i32(t0, t0, t1); break;
+    case 1: tcg_gen_vec_add16_i32(t0, t0, t1); break;
     case 2: tcg_gen_add_i32(t0, t0, t1); break;
     default: abort();
     }
@@ -3719,8 +3721,8 @@ static inline void gen_neon_add(int size, TCGv t0, TCGv t1)
 static inline void gen_neon_rsb(int size, TCGv t0, TCGv t1)
 {
     switch (size) {
-    case 0: gen_helper_neon_sub_u8(t0, t1, t0); break;
-    case 1: gen_helper_neon_sub_u16(t0, t1, t0); break;
+    case 0: tcg_gen_vec_sub8_i32(t0, t1, t0); break;
+    case 1: tcg_gen_vec_sub16_i32(t0, t1, t0); break;
     case 2: tcg_gen_sub_i32(t0, t1, t0); break;
     default: return;
     }
@@ -4898,8 +4900,8 @@ static int disas_neon_data_insn(CPUARMState * env, DisasContext *s, uint32_t ins
                 gen_neon_add(size, tmp, tmp2);
             } else { /* VSUB */
                 switch (size) {
-                case 0: gen_helper_neon_sub_u8(tmp, tmp, tmp2); break;
-                case 1: gen_helper_neon_sub_u16(tmp, tmp, tmp2); break;
+                case 0: tcg_gen_vec_sub8_i32(tmp, tmp, tmp2); break;
+                case 1: tcg_gen_vec_sub16_i32(tmp, tmp, tmp2); break;
                 case 2: tcg_gen_sub_i32(tmp, tmp, tmp2); break;
                 default: abort();
                 }
@@ -10075,8 +10077,16 @@ static inline void gen_intermediate_code_internal(CPUARMState *env,
         case DISAS_NEXT:
             gen_goto_tb(dc, 1, dc->pc);
             break;
-        default:
         case DISAS_JUMP:
+            /* look up the next TB in the jump cache without going
+               through the main loop */
+            {
+                TCGv_ptr ptr = tcg_temp_local_new_ptr();
+                gen_helper_lookup_tb_ptr(ptr, cpu_env);
+                tcg_gen_goto_ptr(ptr);
+            }
+            break;
+        default:
         case DISAS_UPDATE:
             /* indicate that the hash table must be used to find the next TB */
             tcg_gen_exit_tb(0);
@@ -63,6 +63,7 @@ DEF_HELPER_1(monitor, void, tl)
 DEF_HELPER_1(mwait, void, int)
 DEF_HELPER_0(debug, void)
 DEF_HELPER_0(reset_rf, void)
+DEF_HELPER_1(lookup_tb_ptr, ptr, env)
 DEF_HELPER_2(raise_interrupt, void, int, int)
 DEF_HELPER_1(raise_exception, void, int)
 DEF_HELPER_0(cli, void)
@@ -115,6 +115,8 @@ typedef struct DisasContext {
     int cpuid_ext_features;
     int cpuid_ext2_features;
     int cpuid_ext3_features;
+    int sb_jumps; /* direct jumps followed in this superblock */
+    target_ulong sb_end; /* end of the furthest insn translated */
 } DisasContext;
 
 static void gen_eob(DisasContext *s);
@@ -2707,6 +2709,23 @@ static void gen_eob(DisasContext *s)
     s->is_jmp = DISAS_TB_JUMP;
 }
 
+/* end of block after an indirect jump whose target is already in eip:
+   the next TB is looked up in the jump cache by the generated code */
+static void gen_jr(DisasContext *s)
+{
+    TCGv_ptr ptr;
+
+    if (!s->jmp_opt || (s->tb->flags & HF_RF_MASK)) {
+        gen_eob(s);
+        return;
+    }
+    gen_update_cc_op(s);
+    ptr = tcg_temp_local_new_ptr();
+    gen_helper_lookup_tb_ptr(ptr, cpu_env);
+    tcg_gen_goto_ptr(ptr);
+    s->is_jmp = DISAS_TB_JUMP;
+}
+
 /* generate a jump to eip. No segment change must happen before as a
    direct call to the next block may occur */
 static void gen_jmp_tb(DisasContext *s, target_ulong eip, int tb_num)
@@ -2726,6 +2745,31 @@ static void gen_jmp(DisasContext *s, target_ulong eip)
     gen_jmp_tb(s, eip, 0);
 }
 
+/* maximum number of direct jumps followed inside a superblock */
+#define SUPERBLOCK_MAX_JUMPS 8
+
+/* generate an unconditional direct jump to eip. In a superblock the
+   translation simply continues at the target, provided it stays after
+   the block start on the first page so that tb->size still covers all
+   translated code. */
+static void gen_jmp_direct(DisasContext *s, target_ulong eip)
+{
+    target_ulong pc = s->cs_base + eip;
+
+    if (s->jmp_opt && (s->tb->cflags & CF_SUPERBLOCK) &&
+        s->sb_jumps < SUPERBLOCK_MAX_JUMPS &&
+        pc > s->tb->pc &&
+        (pc & TARGET_PAGE_MASK) == (s->tb->pc & TARGET_PAGE_MASK)) {
+        s->sb_jumps++;
+        if (s->pc > s->sb_end) {
+            s->sb_end = s->pc;
+        }
+        s->pc = pc;
+        return;
+    }
+    gen_jmp(s, eip);
+}
+
 static inline void gen_ldq_env_A0(int idx, int offset)
 {
     int mem_index = (idx >> 2) - 1;
@@ -3073,6 +3117,98 @@ static struct sse_op_helper_s sse_op_table7[256] = {
     [0x63] = SSE42_OP(pcmpistri),
 };
 
+/* expand the most common integer MMX/SSE operations with a TCG vector
+   operation instead of calling a helper.  Return 0 if 'b' is not
+   handled here. */
+static int gen_sse_inline(int b, int op1_offset, int op2_offset, int is_xmm)
+{
+    TCGVecOp op;
+
+    switch(b) {
+    case 0x54: /* andps, andpd */
+    case 0xdb: /* pand */
+        op = TCG_VEC_AND;
+        break;
+    case 0x55: /* andnps, andnpd */
+    case 0xdf: /* pandn */
+        op = TCG_VEC_ANDN;
+        break;
+    case 0x56: /* orps, orpd */
+    case 0xeb: /* por */
+        op = TCG_VEC_OR;
+        break;
+    case 0x57: /* xorps, xorpd */
+    case 0xef: /* pxor */
+        op = TCG_VEC_XOR;
+        break;
+    case 0xfc: /* paddb */
+    case 0xfd: /* paddw */
+    case 0xfe: /* paddl */
+        op = TCG_VEC_ADD8 + b - 0xfc;
+        break;
+    case 0xd4: /* paddq */
+        op = TCG_VEC_ADD64;
+        break;
+    case 0xf8: /* psubb */
+    case 0xf9: /* psubw */
+    case 0xfa: /* psubl */
+    case 0xfb: /* psubq */
+        op = TCG_VEC_SUB8 + b - 0xf8;
+        break;
+    case 0x74: /* pcmpeqb */
+    case 0x75: /* pcmpeqw */
+    case 0x76: /* pcmpeql */
+        op = TCG_VEC_CMPEQ8 + b - 0x74;
+        break;
+    case 0x64: /* pcmpgtb */
+    case 0x65: /* pcmpgtw */
+    case 0x66: /* pcmpgtl */
+        op = TCG_VEC_CMPGT8 + b - 0x64;
+        break;
+#ifndef HOST_WORDS_BIGENDIAN
+    case 0x60: /* punpcklbw */
+    case 0x61: /* punpcklwd */
+    case 0x62: /* punpckldq */
+        op = TCG_VEC_ZIPLO8 + b - 0x60;
+        break;
+    case 0x6c: /* punpcklqdq */
+        op = TCG_VEC_ZIPLO64;
+        break;
+    case 0x68: /* punpckhbw */
+    case 0x69: /* punpckhwd */
+    case 0x6a: /* punpckhdq */
+        op = TCG_VEC_ZIPHI8 + b - 0x68;
+        break;
+    case 0x6d: /* punpckhqdq */
+        op = TCG_VEC_ZIPHI64;
+        break;
+#endif
+    default:
+        return 0;
+    }
+
+    tcg_gen_vec_env(cpu_env, op, is_xmm ? 16 : 8,
+                    op1_offset, op1_offset, op2_offset);
+    return 1;
+}
+
+#ifndef HOST_WORDS_BIGENDIAN
+/* immediate shifts, indexed by ((b - 1) & 3) * 8 + the modrm reg field */
+static const signed char sse_shift_vec_op[3 * 8] = {
+    [0 * 8 + 2] = TCG_VEC_SHRI16, [0 * 8 + 4] = TCG_VEC_SARI16,
+    [0 * 8 + 6] = TCG_VEC_SHLI16,
+    [1 * 8 + 2] = TCG_VEC_SHRI32, [1 * 8 + 4] = TCG_VEC_SARI32,
+    [1 * 8 + 6] = TCG_VEC_SHLI32,
+    [2 * 8 + 2] = TCG_VEC_SHRI64, [2 * 8 + 3] = TCG_VEC_SHRI128,
+    [2 * 8 + 6] = TCG_VEC_SHLI64, [2 * 8 + 7] = TCG_VEC_SHLI128,
+};
+
+/* pshufw, pshufd, pshufhw, pshuflw, indexed by b1 */
+static const TCGVecOp sse_pshuf_vec_op[4] = {
+    TCG_VEC_SHUF16LO, TCG_VEC_SHUF32, TCG_VEC_SHUF16HI, TCG_VEC_SHUF16LO,
+};
+#endif
+
 static void gen_sse(DisasContext *s, int b, target_ulong pc_start, int rex_r)
 {
     int b1, op1_offset, op2_offset, is_xmm, val, ot;
@@ -3461,6 +3597,23 @@ static void gen_sse(DisasContext *s, int b, target_ulong pc_start, int rex_r)
 	        goto illegal_op;
             }
             val = ldub_code(s->pc++);
+            sse_op2 = sse_op_table2[((b - 1) & 3) * 8 + (((modrm >> 3)) & 7)][b1];
+            if (!sse_op2)
+                goto illegal_op;
+            if (is_xmm) {
+                rm = (modrm & 7) | REX_B(s);
+                op2_offset = offsetof(CPUX86State,xmm_regs[rm]);
+            } else {
+                rm = (modrm & 7);
+                op2_offset = offsetof(CPUX86State,fpregs[rm].mmx);
+            }
+#ifndef HOST_WORDS_BIGENDIAN
+            /* every valid entry of sse_op_table2 has a vector op */
+            tcg_gen_vec_env(cpu_env,
+                            sse_shift_vec_op[((b - 1) & 3) * 8 +
+                                             ((modrm >> 3) & 7)],
+                            is_xmm ? 16 : 8, op2_offset, op2_offset, val);
+#else
             if (is_xmm) {
                 gen_op_movl_T0_im(val);
                 tcg_gen_st32_tl(cpu_T[0], cpu_env, offsetof(CPUX86State,xmm_t0.XMM_L(0)));
@@ -3474,19 +3627,10 @@ static void gen_sse(DisasContext *s, int b, target_ulong pc_start, int rex_r)
                 tcg_gen_st32_tl(cpu_T[0], cpu_env, offsetof(CPUX86State,mmx_t0.MMX_L(1)));
                 op1_offset = offsetof(CPUX86State,mmx_t0);
             }
-            sse_op2 = sse_op_table2[((b - 1) & 3) * 8 + (((modrm >> 3)) & 7)][b1];
-            if (!sse_op2)
-                goto illegal_op;
-            if (is_xmm) {
-                rm = (modrm & 7) | REX_B(s);
-                op2_offset = offsetof(CPUX86State,xmm_regs[rm]);
-            } else {
-                rm = (modrm & 7);
-                op2_offset = offsetof(CPUX86State,fpregs[rm].mmx);
-            }
             tcg_gen_addi_ptr(cpu_ptr0, cpu_env, op2_offset);
             tcg_gen_addi_ptr(cpu_ptr1, cpu_env, op1_offset);
             ((void (*)(TCGv_ptr, TCGv_ptr))sse_op2)(cpu_ptr0, cpu_ptr1);
+#endif
             break;
         case 0x050: /* movmskps */
             rm = (modrm & 7) | REX_B(s);
@@ -4025,6 +4169,13 @@ static void gen_sse(DisasContext *s, int b, target_ulong pc_start, int rex_r)
         case 0x70: /* pshufx insn */
         case 0xc6: /* pshufx insn */
             val = ldub_code(s->pc++);
+#ifndef HOST_WORDS_BIGENDIAN
+            if (b == 0x70) {
+                tcg_gen_vec_env(cpu_env, sse_pshuf_vec_op[b1], is_xmm ? 16 : 8,
+                                op1_offset, op2_offset, val);
+                break;
+            }
+#endif
             tcg_gen_addi_ptr(cpu_ptr0, cpu_env, op1_offset);
             tcg_gen_addi_ptr(cpu_ptr1, cpu_env, op2_offset);
             ((void (*)(TCGv_ptr, TCGv_ptr, TCGv_i32))sse_op2)(cpu_ptr0, cpu_ptr1, tcg_const_i32(val));
@@ -4060,6 +4211,9 @@ static void gen_sse(DisasContext *s, int b, target_ulong pc_start, int rex_r)
             ((void (*)(TCGv_ptr, TCGv_ptr, TCGv))sse_op2)(cpu_ptr0, cpu_ptr1, cpu_A0);
             break;
         default:
+            if (gen_sse_inline(b, op1_offset, op2_offset, is_xmm)) {
+                break;
+            }
             tcg_gen_addi_ptr(cpu_ptr0, cpu_env, op1_offset);
             tcg_gen_addi_ptr(cpu_ptr1, cpu_env, op2_offset);
             ((void (*)(TCGv_ptr, TCGv_ptr))sse_op2)(cpu_ptr0, cpu_ptr1);
@@ -4626,7 +4780,7 @@ static target_ulong disas_insn(DisasContext *s, target_ulong pc_start)
             gen_movtl_T1_im(next_eip);
             gen_push_T1(s);
             gen_op_jmp_T0();
-            gen_eob(s);
+            gen_jr(s);
             break;
         case 3: /* lcall Ev */
             gen_op_ld_T1_A0(ot + s->mem_index);
@@ -4653,7 +4807,7 @@ static target_ulong disas_insn(DisasContext *s, target_ulong pc_start)
             if (s->dflag == 0)
                 gen_op_andl_T0_ffff();
             gen_op_jmp_T0();
-            gen_eob(s);
+            gen_jr(s);
             break;
         case 5: /* ljmp Ev */
             gen_op_ld_T1_A0(ot + s->mem_index);
@@ -6181,7 +6335,7 @@ static target_ulong disas_insn(DisasContext *s, target_ulong pc_start)
         if (s->dflag == 0)
             gen_op_andl_T0_ffff();
         gen_op_jmp_T0();
-        gen_eob(s);
+        gen_jr(s);
         break;
     case 0xc3: /* ret */
         gen_pop_T0(s);
@@ -6189,7 +6343,7 @@ static target_ulong disas_insn(DisasContext *s, target_ulong pc_start)
         if (s->dflag == 0)
             gen_op_andl_T0_ffff();
         gen_op_jmp_T0();
-        gen_eob(s);
+        gen_jr(s);
         break;
     case 0xca: /* lret im */
         val = ldsw_code(s->pc);
@@ -6259,7 +6413,7 @@ static target_ulong disas_insn(DisasContext *s, target_ulong pc_start)
                 tval &= 0xffffffff;
             gen_movtl_T0_im(next_eip);
             gen_push_T0(s);
-            gen_jmp(s, tval);
+            gen_jmp_direct(s, tval);
         }
         break;
     case 0x9a: /* lcall im */
@@ -6286,7 +6440,7 @@ static target_ulong disas_insn(DisasContext *s, target_ulong pc_start)
             tval &= 0xffff;
         else if(!CODE64(s))
             tval &= 0xffffffff;
-        gen_jmp(s, tval);
+        gen_jmp_direct(s, tval);
         break;
     case 0xea: /* ljmp im */
         {
@@ -6307,7 +6461,7 @@ static target_ulong disas_insn(DisasContext *s, target_ulong pc_start)
         tval += s->pc - s->cs_base;
         if (s->dflag == 0)
             tval &= 0xffff;
-        gen_jmp(s, tval);
+        gen_jmp_direct(s, tval);
         break;
     case 0x70 ... 0x7f: /* jcc Jb */
         tval = (int8_t)insn_get(s, OT_BYTE);
@@ -7727,6 +7881,7 @@ static inline void gen_intermediate_code_internal(CPUX86State *env,
     target_ulong cs_base;
     int num_insns;
     int max_insns;
+    int hot_label;
 
     /* generate intermediate code */
     pc_start = tb->pc;
@@ -7793,6 +7948,8 @@ static inline void gen_intermediate_code_internal(CPUX86State *env,
     gen_opc_end = gen_opc_buf + OPC_MAX_SIZE;
 
     dc->is_jmp = DISAS_NEXT;
+    dc->sb_jumps = 0;
+    dc->sb_end = pc_start;
     pc_ptr = pc_start;
     lj = -1;
     num_insns = 0;
@@ -7801,6 +7958,21 @@ static inline void gen_intermediate_code_internal(CPUX86State *env,
         max_insns = CF_COUNT_MASK;
 
     gen_icount_start();
+    hot_label = -1;
+    if (tb_hot_threshold && tb->cflags == 0 && dc->jmp_opt && !use_icount) {
+        /* count executions and leave to the main loop once the block
+           is hot, so that it gets retranslated as a superblock */
+        TCGv_ptr ptr = tcg_const_ptr(&tb->hot_count);
+        TCGv_i32 count = tcg_temp_new_i32();
+
+        hot_label = gen_new_label();
+        tcg_gen_ld_i32(count, ptr, 0);
+        tcg_gen_subi_i32(count, count, 1);
+        tcg_gen_st_i32(count, ptr, 0);
+        tcg_gen_brcondi_i32(TCG_COND_EQ, count, 0, hot_label);
+        tcg_temp_free_i32(count);
+        tcg_temp_free_ptr(ptr);
+    }
     for(;;) {
         if (unlikely(!QTAILQ_EMPTY(&env->breakpoints))) {
             QTAILQ_FOREACH(bp, &env->breakpoints, entry) {
@@ -7828,6 +8000,9 @@ static inline void gen_intermediate_code_internal(CPUX86State *env,
 
         pc_ptr = disas_insn(dc, pc_ptr);
         num_insns++;
+        if (pc_ptr > dc->sb_end) {
+            dc->sb_end = pc_ptr;
+        }
         /* stop translation if indicated */
         if (dc->is_jmp)
             break;
@@ -7844,7 +8019,7 @@ static inline void gen_intermediate_code_internal(CPUX86State *env,
         }
         /* if too long translation, stop generation too */
         if (gen_opc_ptr >= gen_opc_end ||
-            (pc_ptr - pc_start) >= (TARGET_PAGE_SIZE - 32) ||
+            (dc->sb_end - pc_start) >= (TARGET_PAGE_SIZE - 32) ||
             num_insns >= max_insns) {
             gen_jmp_im(pc_ptr - dc->cs_base);
             gen_eob(dc);
@@ -7858,6 +8033,10 @@ static inline void gen_intermediate_code_internal(CPUX86State *env,
     }
     if (tb->cflags & CF_LAST_IO)
         gen_io_end();
+    if (hot_label >= 0) {
+        gen_set_label(hot_label);
+        tcg_gen_exit_tb((tcg_target_long)tb + 3);
+    }
     gen_icount_end(tb, num_insns);
     *gen_opc_ptr = INDEX_op_end;
     /* we don't forget to fill the last values */
@@ -7872,20 +8051,21 @@ static inline void gen_intermediate_code_internal(CPUX86State *env,
     if (qemu_loglevel_mask(CPU_LOG_TB_IN_ASM)) {
         int disas_flags;
         qemu_log("----------------\n");
-        qemu_log("IN: %s\n", lookup_symbol(pc_start));
+        qemu_log("IN: %s%s\n", lookup_symbol(pc_start),
+                 tb->cflags & CF_SUPERBLOCK ? " [superblock]" : "");
 #ifdef TARGET_X86_64
         if (dc->code64)
             disas_flags = 2;
         else
 #endif
             disas_flags = !dc->code32;
-        log_target_disas(pc_start, pc_ptr - pc_start, disas_flags);
+        log_target_disas(pc_start, dc->sb_end - pc_start, disas_flags);
         qemu_log("\n");
     }
 #endif
 
     if (!search_pc) {
-        tb->size = pc_ptr - pc_start;
+        tb->size = dc->sb_end - pc_start;
         tb->icount = num_insns;
     }
 }
@@ -0,0 +1,570 @@
+/*
+ * Persistent cache of translated blocks
+ *
+ * Translated blocks are saved to a file at exit and copied back into the
+ * code buffer by later runs instead of being retranslated.  An entry is
+ * reused only if the guest code it was translated from is unchanged, and
+ * the whole file is discarded if the QEMU binary, the prologue, the target
+ * or the CPU model differ.
+ *
+ * The host code is moved with the relocations the TCG backend records
+ * for references to addresses outside of the generated code (helpers,
+ * the epilogue and the TB itself), so only hosts that define
+ * TCG_TARGET_HAS_EXT_RELOCS support the cache.  Helpers are saved as
+ * offsets into the QEMU binary and epilogue addresses as offsets into
+ * the prologue, so that a cache survives address space randomization.
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "config.h"
+#include "qemu-common.h"
+#include "cpu.h"
+#include "tcg.h"
+
+#define TB_CACHE_MAGIC          0x43425451 /* "QTBC" */
+#define TB_CACHE_VERSION        2
+
+#define TB_CACHE_HASH_BITS      16
+#define TB_CACHE_HASH_SIZE      (1 << TB_CACHE_HASH_BITS)
+
+/* stop recording new blocks once this much memory is used */
+#define TB_CACHE_MAX_BYTES      (256 * 1024 * 1024)
+
+#define TB_CACHE_FNV_INIT       0xcbf29ce484222325ULL
+#define TB_CACHE_FNV_PRIME      0x100000001b3ULL
+
+typedef struct TBCacheHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t key;               /* see tb_cache_compute_key */
+    uint32_t nb_entries;
+    uint32_t reserved;
+} TBCacheHeader;
+
+/* One translated block.  The host code follows, padded to 8 bytes, and
+   then nb_relocs TBCacheReloc.  */
+typedef struct TBCacheRecord {
+    uint64_t pc;
+    uint64_t cs_base;
+    uint64_t flags;
+    uint64_t code_hash;         /* hash of the guest code */
+    uint32_t cflags;
+    uint32_t icount;
+    uint16_t size;
+    uint16_t tb_next_offset[2];
+    uint16_t tb_jmp_offset[2];
+    uint16_t reserved;
+    uint32_t code_size;
+    uint32_t nb_relocs;
+} TBCacheRecord;
+
+/* what TBCacheReloc.value is relative to */
+enum {
+    TB_CACHE_RELOC_TEXT,        /* tb_gen_code, for helpers */
+    TB_CACHE_RELOC_PROLOGUE,    /* code_gen_prologue */
+    TB_CACHE_RELOC_TB,          /* the TB, for exit_tb values */
+};
+
+typedef struct TBCacheReloc {
+    int32_t kind;
+    int32_t type;
+    uint32_t offset;
+    uint32_t reserved;
+    int64_t value;
+} TBCacheReloc;
+
+typedef struct TBCacheEntry {
+    struct TBCacheEntry *next;
+    TBCacheRecord *rec;
+} TBCacheEntry;
+
+/* 0 until the first lookup, then 1 if the cache is in use, -1 if not */
+static int tb_cache_state;
+static uint64_t tb_cache_key;
+static TBCacheEntry *tb_cache_hash[TB_CACHE_HASH_SIZE];
+static unsigned int tb_cache_nb_entries;
+static size_t tb_cache_bytes;
+
+static uint64_t tb_cache_hits;
+static uint64_t tb_cache_misses;
+static uint64_t tb_cache_stale;
+static uint64_t tb_cache_stored;
+
+static uint64_t tb_cache_fnv(uint64_t h, const void *buf, size_t len)
+{
+    const uint8_t *p = buf;
+
+    while (len--) {
+        h ^= *p++;
+        h *= TB_CACHE_FNV_PRIME;
+    }
+    return h;
+}
+
+static size_t tb_cache_record_size(const TBCacheRecord *rec)
+{
+    return sizeof(TBCacheRecord) + ((rec->code_size + 7) & ~7) +
+           rec->nb_relocs * sizeof(TBCacheReloc);
+}
+
+static uint8_t *tb_cache_record_code(TBCacheRecord *rec)
+{
+    return (uint8_t *)(rec + 1);
+}
+
+static TBCacheReloc *tb_cache_record_relocs(TBCacheRecord *rec)
+{
+    return (TBCacheReloc *)(tb_cache_record_code(rec) +
+                            ((rec->code_size + 7) & ~7));
+}
+
+static unsigned int tb_cache_hash_func(uint64_t pc, uint64_t flags)
+{
+    return (pc ^ (pc >> TB_CACHE_HASH_BITS) ^ flags) &
+           (TB_CACHE_HASH_SIZE - 1);
+}
+
+/* Everything the generated code depends on besides the guest code and
+   the TB flags.  Zero if the QEMU binary cannot be identified.  Nothing
+   in here may depend on where the binary is loaded.  */
+static uint64_t tb_cache_compute_key(CPUArchState *env)
+{
+    struct stat st;
+    uint64_t h = TB_CACHE_FNV_INIT;
+#if defined(CONFIG_USER_ONLY) && defined(CONFIG_USE_GUEST_BASE)
+    uintptr_t addr;
+#endif
+    const char *model;
+    int val;
+
+    if (stat("/proc/self/exe", &st) < 0) {
+        return 0;
+    }
+    h = tb_cache_fnv(h, QEMU_VERSION, strlen(QEMU_VERSION));
+    h = tb_cache_fnv(h, &st.st_ino, sizeof(st.st_ino));
+    h = tb_cache_fnv(h, &st.st_size, sizeof(st.st_size));
+    h = tb_cache_fnv(h, &st.st_mtime, sizeof(st.st_mtime));
+
+    /* the epilogue addresses saved in the cache are only valid for the
+       same prologue */
+    h = tb_cache_fnv(h, code_gen_prologue, sizeof(code_gen_prologue));
+#if defined(CONFIG_USER_ONLY) && defined(CONFIG_USE_GUEST_BASE)
+    addr = guest_base;
+    h = tb_cache_fnv(h, &addr, sizeof(addr));
+#endif
+
+    h = tb_cache_fnv(h, TARGET_ARCH, strlen(TARGET_ARCH));
+    model = env->cpu_model_str ? env->cpu_model_str : "";
+    h = tb_cache_fnv(h, model, strlen(model) + 1);
+    val = use_icount;
+    h = tb_cache_fnv(h, &val, sizeof(val));
+    val = singlestep;
+    h = tb_cache_fnv(h, &val, sizeof(val));
+    return h;
+}
+
+static void *tb_cache_code_ptr(tb_page_addr_t addr)
+{
+#if defined(CONFIG_USER_ONLY)
+    return g2h(addr);
+#else
+    return qemu_get_ram_ptr(addr);
+#endif
+}
+
+static uint64_t tb_cache_hash_code(CPUArchState *env, target_ulong pc,
+                                   unsigned int size, tb_page_addr_t phys_pc)
+{
+    uint64_t h = TB_CACHE_FNV_INIT;
+    unsigned int len;
+    tb_page_addr_t phys_page2;
+
+    len = TARGET_PAGE_SIZE - (pc & ~TARGET_PAGE_MASK);
+    if (len > size) {
+        len = size;
+    }
+    h = tb_cache_fnv(h, tb_cache_code_ptr(phys_pc), len);
+    if (len < size) {
+        phys_page2 = get_page_addr_code(env, (pc & TARGET_PAGE_MASK) +
+                                             TARGET_PAGE_SIZE);
+        h = tb_cache_fnv(h, tb_cache_code_ptr(phys_page2), size - len);
+    }
+    return h;
+}
+
+/* Split an absolute address from the generated code into a base that
+   stays the same across runs and an offset from it.  */
+static void tb_cache_reloc_to_file(TBCacheReloc *r, TranslationBlock *tb,
+                                   int kind, tcg_target_long value)
+{
+    uintptr_t prologue = (uintptr_t)code_gen_prologue;
+
+    if (kind == TCG_EXT_RELOC_TB) {
+        r->kind = TB_CACHE_RELOC_TB;
+        r->value = value - (tcg_target_long)tb;
+    } else if (value - prologue < sizeof(code_gen_prologue)) {
+        r->kind = TB_CACHE_RELOC_PROLOGUE;
+        r->value = value - prologue;
+    } else {
+        /* all helpers are part of the QEMU binary */
+        r->kind = TB_CACHE_RELOC_TEXT;
+        r->value = value - (uintptr_t)tb_gen_code;
+    }
+}
+
+static tcg_target_long tb_cache_reloc_from_file(TBCacheReloc *r,
+                                                TranslationBlock *tb)
+{
+    switch (r->kind) {
+    case TB_CACHE_RELOC_TB:
+        return r->value + (tcg_target_long)tb;
+    case TB_CACHE_RELOC_PROLOGUE:
+        return r->value + (uintptr_t)code_gen_prologue;
+    default:
+        return r->value + (uintptr_t)tb_gen_code;
+    }
+}
+
+static TBCacheEntry **tb_cache_find(uint64_t pc, uint64_t cs_base,
+                                    uint64_t flags, uint32_t cflags)
+{
+    TBCacheEntry **pe;
+    TBCacheRecord *rec;
+
+    pe = &tb_cache_hash[tb_cache_hash_func(pc, flags)];
+    for (; *pe != NULL; pe = &(*pe)->next) {
+        rec = (*pe)->rec;
+        if (rec->pc == pc && rec->cs_base == cs_base &&
+            rec->flags == flags && rec->cflags == cflags) {
+            break;
+        }
+    }
+    return pe;
+}
+
+/* add a record, replacing any previous one for the same block */
+static void tb_cache_insert(TBCacheRecord *rec)
+{
+    TBCacheEntry **pe, *e;
+
+    pe = tb_cache_find(rec->pc, rec->cs_base, rec->flags, rec->cflags);
+    e = *pe;
+    if (e) {
+        tb_cache_bytes -= tb_cache_record_size(e->rec);
+        g_free(e->rec);
+    } else {
+        e = g_malloc(sizeof(*e));
+        e->next = NULL;
+        *pe = e;
+        tb_cache_nb_entries++;
+    }
+    e->rec = rec;
+    tb_cache_bytes += tb_cache_record_size(rec);
+}
+
+/* Write the cache to a file of its own and move it into place, so that
+   several instances can share a cache.  The last one to exit wins.  */
+void tb_cache_save(void)
+{
+    TBCacheHeader hdr;
+    TBCacheEntry *e;
+    char *tmp;
+    FILE *f;
+    int i, fd, ret;
+
+    /* other threads of the user emulator may still be translating */
+    spin_lock(&tb_lock);
+    if (tb_cache_state <= 0 || tb_cache_stored == 0) {
+        spin_unlock(&tb_lock);
+        return;
+    }
+    /* once is enough, whether called at exit or by the user emulator */
+    tb_cache_state = -1;
+
+    tmp = g_strdup_printf("%s.XXXXXX", tb_cache_path);
+    fd = g_mkstemp(tmp);
+    f = fd < 0 ? NULL : fdopen(fd, "wb");
+    if (!f) {
+        fprintf(stderr, "qemu: could not write TB cache '%s': %s\n",
+                tmp, strerror(errno));
+        if (fd >= 0) {
+            close(fd);
+            unlink(tmp);
+        }
+        g_free(tmp);
+        spin_unlock(&tb_lock);
+        return;
+    }
+    memset(&hdr, 0, sizeof(hdr));
+    hdr.magic = TB_CACHE_MAGIC;
+    hdr.version = TB_CACHE_VERSION;
+    hdr.key = tb_cache_key;
+    hdr.nb_entries = tb_cache_nb_entries;
+    ret = fwrite(&hdr, sizeof(hdr), 1, f) == 1;
+    for (i = 0; ret && i < TB_CACHE_HASH_SIZE; i++) {
+        for (e = tb_cache_hash[i]; ret && e != NULL; e = e->next) {
+            ret = fwrite(e->rec, tb_cache_record_size(e->rec), 1, f) == 1;
+        }
+    }
+    if (fclose(f) != 0) {
+        ret = 0;
+    }
+    if (!ret || rename(tmp, tb_cache_path) < 0) {
+        fprintf(stderr, "qemu: could not write TB cache '%s'\n",
+                tb_cache_path);
+        unlink(tmp);
+    }
+    g_free(tmp);
+    spin_unlock(&tb_lock);
+}
+
+/* Check that the offsets in a record read from the file stay within the
+   code and the guest page it covers, the file may be corrupt.  */
+static int tb_cache_record_valid(TBCacheRecord *rec)
+{
+    TBCacheReloc *r;
+    uint32_t i;
+
+    /* a block never spans more than two guest pages */
+    if (rec->size == 0 || rec->size > TARGET_PAGE_SIZE) {
+        return 0;
+    }
+    for (i = 0; i < 2; i++) {
+        /* the jump offsets are only used if there is a goto_tb */
+        if (rec->tb_next_offset[i] == 0xffff) {
+            continue;
+        }
+        if (rec->tb_next_offset[i] + 4 > rec->code_size) {
+            return 0;
+        }
+#ifdef USE_DIRECT_JUMP
+        if (rec->tb_jmp_offset[i] + 4 > rec->code_size) {
+            return 0;
+        }
+#endif
+    }
+    r = tb_cache_record_relocs(rec);
+    for (i = 0; i < rec->nb_relocs; i++, r++) {
+        /* tcg_patch_ext_reloc checks the size of each reference */
+        if (r->offset >= rec->code_size ||
+            r->kind < TB_CACHE_RELOC_TEXT || r->kind > TB_CACHE_RELOC_TB) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+static void tb_cache_load(FILE *f)
+{
+    TBCacheHeader hdr;
+    TBCacheRecord rec, *p;
+    uint32_t i;
+    size_t size;
+
+    if (fread(&hdr, sizeof(hdr), 1, f) != 1 ||
+        hdr.magic != TB_CACHE_MAGIC || hdr.version != TB_CACHE_VERSION ||
+        hdr.key != tb_cache_key) {
+        /* stale or foreign file, it is rewritten at exit */
+        return;
+    }
+    for (i = 0; i < hdr.nb_entries; i++) {
+        if (fread(&rec, sizeof(rec), 1, f) != 1 ||
+            rec.code_size > TCG_MAX_OP_SIZE * OPC_BUF_SIZE ||
+            rec.nb_relocs > rec.code_size) {
+            break;
+        }
+        size = tb_cache_record_size(&rec);
+        p = g_malloc(size);
+        *p = rec;
+        if (fread(p + 1, size - sizeof(rec), 1, f) != 1 ||
+            !tb_cache_record_valid(p)) {
+            g_free(p);
+            break;
+        }
+        tb_cache_insert(p);
+    }
+}
+
+static void tb_cache_open(CPUArchState *env)
+{
+    FILE *f;
+
+    tb_cache_state = -1;
+#ifndef TCG_TARGET_HAS_EXT_RELOCS
+    fprintf(stderr, "qemu: -tb-cache is not supported on this host\n");
+    return;
+#endif
+    if (tb_hot_threshold) {
+        /* superblock counters embed the address of the TB */
+        fprintf(stderr, "qemu: -tb-cache cannot be combined with "
+                "-tb-hot-threshold, disabling the TB cache\n");
+        return;
+    }
+    tb_cache_key = tb_cache_compute_key(env);
+    if (tb_cache_key == 0) {
+        fprintf(stderr, "qemu: cannot identify the QEMU binary, "
+                "disabling the TB cache\n");
+        return;
+    }
+    tb_cache_state = 1;
+    atexit(tb_cache_save);
+
+    f = fopen(tb_cache_path, "rb");
+    if (f) {
+        tb_cache_load(f);
+        fclose(f);
+    }
+}
+
+/* Breakpoints and single-stepping are compiled into the translated code,
+   but are not part of the lookup key; leave the cache alone while either
+   is active.  */
+static bool tb_cache_debugging(CPUArchState *env)
+{
+    return !QTAILQ_EMPTY(&env->breakpoints) || env->singlestep_enabled;
+}
+
+/* Copy the cached translation of 'tb' to tb->tc_ptr.  Return 0 if there
+   is none, or if it cannot be used; the block must then be translated.  */
+int tb_cache_fetch(CPUArchState *env, TranslationBlock *tb,
+                   tb_page_addr_t phys_pc, int *gen_code_size_ptr)
+{
+    TBCacheEntry *e;
+    TBCacheRecord *rec;
+    uint8_t *code;
+#ifdef TCG_TARGET_HAS_EXT_RELOCS
+    TBCacheReloc *r;
+    tcg_target_long value;
+    uint32_t i;
+#endif
+
+    if (tb_cache_debugging(env)) {
+        return 0;
+    }
+    if (tb_cache_state == 0) {
+        tb_cache_open(env);
+    }
+    if (tb_cache_state < 0) {
+        return 0;
+    }
+
+    e = *tb_cache_find(tb->pc, tb->cs_base, tb->flags, tb->cflags);
+    if (!e) {
+        tb_cache_misses++;
+        return 0;
+    }
+    rec = e->rec;
+    if (rec->code_hash != tb_cache_hash_code(env, tb->pc, rec->size,
+                                             phys_pc)) {
+        tb_cache_stale++;
+        return 0;
+    }
+
+    code = tb->tc_ptr;
+    memcpy(code, tb_cache_record_code(rec), rec->code_size);
+#ifdef TCG_TARGET_HAS_EXT_RELOCS
+    r = tb_cache_record_relocs(rec);
+    for (i = 0; i < rec->nb_relocs; i++, r++) {
+        value = tb_cache_reloc_from_file(r, tb);
+        if (!tcg_patch_ext_reloc(code, rec->code_size, r->type, r->offset,
+                                 value)) {
+            tb_cache_stale++;
+            return 0;
+        }
+    }
+#endif
+    flush_icache_range((uintptr_t)code, (uintptr_t)code + rec->code_size);
+
+    tb->size = rec->size;
+    tb->icount = rec->icount;
+    tb->tb_next_offset[0] = rec->tb_next_offset[0];
+    tb->tb_next_offset[1] = rec->tb_next_offset[1];
+#ifdef USE_DIRECT_JUMP
+    tb->tb_jmp_offset[0] = rec->tb_jmp_offset[0];
+    tb->tb_jmp_offset[1] = rec->tb_jmp_offset[1];
+#endif
+    *gen_code_size_ptr = rec->code_size;
+    tb_cache_hits++;
+    return 1;
+}
+
+/* Record the block cpu_gen_code just translated.  */
+void tb_cache_store(CPUArchState *env, TranslationBlock *tb,
+                    tb_page_addr_t phys_pc, int gen_code_size)
+{
+#ifdef TCG_TARGET_HAS_EXT_RELOCS
+    TCGExtReloc *er;
+    TBCacheRecord rec, *p;
+    TBCacheReloc *r;
+    tcg_target_long ofs;
+
+    if (tb_cache_state <= 0 || tb_cache_bytes >= TB_CACHE_MAX_BYTES ||
+        tb_cache_debugging(env)) {
+        return;
+    }
+
+    memset(&rec, 0, sizeof(rec));
+    for (er = tcg_ctx.ext_relocs; er != NULL; er = er->next) {
+        if (er->kind == TCG_EXT_RELOC_TB) {
+            ofs = er->value - (tcg_target_long)tb;
+            if (ofs < 0 || ofs > 3) {
+                return;
+            }
+        }
+        rec.nb_relocs++;
+    }
+    rec.pc = tb->pc;
+    rec.cs_base = tb->cs_base;
+    rec.flags = tb->flags;
+    rec.cflags = tb->cflags;
+    rec.icount = tb->icount;
+    rec.size = tb->size;
+    rec.tb_next_offset[0] = tb->tb_next_offset[0];
+    rec.tb_next_offset[1] = tb->tb_next_offset[1];
+#ifdef USE_DIRECT_JUMP
+    rec.tb_jmp_offset[0] = tb->tb_jmp_offset[0];
+    rec.tb_jmp_offset[1] = tb->tb_jmp_offset[1];
+#endif
+    rec.code_size = gen_code_size;
+    rec.code_hash = tb_cache_hash_code(env, tb->pc, tb->size, phys_pc);
+
+    p = g_malloc0(tb_cache_record_size(&rec));
+    *p = rec;
+    memcpy(tb_cache_record_code(p), tb->tc_ptr, gen_code_size);
+    r = tb_cache_record_relocs(p);
+    for (er = tcg_ctx.ext_relocs; er != NULL; er = er->next, r++) {
+        tb_cache_reloc_to_file(r, tb, er->kind, er->value);
+        r->type = er->type;
+        r->offset = er->offset;
+    }
+    tb_cache_insert(p);
+    tb_cache_stored++;
+#endif
+}
+
+void tb_cache_dump_info(FILE *f, fprintf_function cpu_fprintf)
+{
+    uint64_t lookups;
+
+    if (tb_cache_state <= 0) {
+        return;
+    }
+    lookups = tb_cache_hits + tb_cache_misses + tb_cache_stale;
+    cpu_fprintf(f, "TB cache entries    %u (%" PRIu64 " new, %u KB)\n",
+                tb_cache_nb_entries, tb_cache_stored,
+                (unsigned int)(tb_cache_bytes >> 10));
+    cpu_fprintf(f, "TB cache hits       %" PRIu64 " (%d%%) "
+                "misses %" PRIu64 " stale %" PRIu64 "\n",
+                tb_cache_hits,
+                lookups ? (int)(tb_cache_hits * 100 / lookups) : 0,
+                tb_cache_misses, tb_cache_stale);
+}
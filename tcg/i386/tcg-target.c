@@ -114,6 +114,63 @@ static void patch_reloc(uint8_t *code_ptr, int type,
     }
 }
 
+/* Number of bytes patched by patch_ext_reloc for 'type'.  */
+static int ext_reloc_size(int type)
+{
+#if TCG_TARGET_REG_BITS == 64
+    if (type == R_X86_64_64) {
+        return 8;
+    }
+#endif
+    return 4;
+}
+
+/* Re-resolve a reference recorded with tcg_out_ext_reloc.  The encoding
+   must be the one tcg_out_branch or tcg_out_movi would pick for the new
+   value, so that regenerating the code gives the same layout.  */
+static int patch_ext_reloc(uint8_t *code_ptr, int type,
+                           tcg_target_long value)
+{
+    switch (type) {
+    case R_386_PC32:
+        value -= (uintptr_t)code_ptr + 4;
+        if (value != (int32_t)value) {
+            return 0;
+        }
+        *(uint32_t *)code_ptr = value;
+        return 1;
+#if TCG_TARGET_REG_BITS == 64
+    case R_X86_64_32:
+        if (value == 0 || value != (uint32_t)value) {
+            return 0;
+        }
+        *(uint32_t *)code_ptr = value;
+        return 1;
+    case R_X86_64_32S:
+        if (value == (uint32_t)value || value != (int32_t)value) {
+            return 0;
+        }
+        *(uint32_t *)code_ptr = value;
+        return 1;
+    case R_X86_64_64:
+        if (value == (int32_t)value || value == (uint32_t)value) {
+            return 0;
+        }
+        *(uint64_t *)code_ptr = value;
+        return 1;
+#else
+    case R_386_32:
+        if (value == 0) {
+            return 0;
+        }
+        *(uint32_t *)code_ptr = value;
+        return 1;
+#endif
+    default:
+        return 0;
+    }
+}
+
 /* maximum number of register used for input function arguments */
 static inline int tcg_target_get_call_iarg_regs_count(int flags)
 {
@@ -244,6 +301,8 @@ static inline int tcg_target_const_match(tcg_target_long val,
 # define P_REXB_R	0
 # define P_REXB_RM	0
 #endif
+#define P_SIMDF3	0x4000		/* 0xf3 opcode prefix */
+#define P_SIMDF2	0x8000		/* 0xf2 opcode prefix */
 
 #define OPC_ARITH_EvIz	(0x81)
 #define OPC_ARITH_EvIb	(0x83)
@@ -284,6 +343,14 @@ static inline int tcg_target_const_match(tcg_target_long val,
 #define OPC_TESTL	(0x85)
 #define OPC_XCHG_ax_r32	(0x90)
 
+#define OPC_MOVDQU_VxWx	(0x6f | P_EXT | P_SIMDF3)
+#define OPC_MOVDQU_WxVx	(0x7f | P_EXT | P_SIMDF3)
+#define OPC_MOVQ_VqWq	(0x7e | P_EXT | P_SIMDF3)
+#define OPC_MOVQ_WqVq	(0xd6 | P_EXT | P_DATA16)
+#define OPC_PSHIFTW_Ib	(0x71 | P_EXT | P_DATA16) /* /2 srl, /4 sra, /6 sll */
+#define OPC_PSHIFTD_Ib	(0x72 | P_EXT | P_DATA16)
+#define OPC_PSHIFTQ_Ib	(0x73 | P_EXT | P_DATA16) /* /3 srldq, /7 slldq */
+
 #define OPC_GRP3_Ev	(0xf7)
 #define OPC_GRP5	(0xff)
 
@@ -364,6 +431,11 @@ static void tcg_out_opc(TCGContext *s, int opc, int r, int rm, int x)
     if (opc & P_ADDR32) {
         tcg_out8(s, 0x67);
     }
+    if (opc & P_SIMDF3) {
+        tcg_out8(s, 0xf3);
+    } else if (opc & P_SIMDF2) {
+        tcg_out8(s, 0xf2);
+    }
 
     rex = 0;
     rex |= (opc & P_REXW) >> 8;		/* REX.W */
@@ -394,6 +466,11 @@ static void tcg_out_opc(TCGContext *s, int opc)
     if (opc & P_DATA16) {
         tcg_out8(s, 0x66);
     }
+    if (opc & P_SIMDF3) {
+        tcg_out8(s, 0xf3);
+    } else if (opc & P_SIMDF2) {
+        tcg_out8(s, 0xf2);
+    }
     if (opc & P_EXT) {
         tcg_out8(s, 0x0f);
     }
@@ -544,6 +621,26 @@ static void tcg_out_movi(TCGContext *s, TCGType type,
     }
 }
 
+/* Record the immediate just emitted by tcg_out_movi, for an exit_tb
+   value or the address of a helper.  */
+static void tcg_out_movi_reloc(TCGContext *s, int kind, tcg_target_long arg)
+{
+    if (arg == 0) {
+        return;
+    }
+#if TCG_TARGET_REG_BITS == 64
+    if (arg == (uint32_t)arg) {
+        tcg_out_ext_reloc(s, s->code_ptr - 4, kind, R_X86_64_32, arg);
+    } else if (arg == (int32_t)arg) {
+        tcg_out_ext_reloc(s, s->code_ptr - 4, kind, R_X86_64_32S, arg);
+    } else {
+        tcg_out_ext_reloc(s, s->code_ptr - 8, kind, R_X86_64_64, arg);
+    }
+#else
+    tcg_out_ext_reloc(s, s->code_ptr - 4, kind, R_386_32, arg);
+#endif
+}
+
 static inline void tcg_out_pushi(TCGContext *s, tcg_target_long val)
 {
     if (val == (int8_t)val) {
@@ -943,9 +1040,12 @@ static void tcg_out_branch(TCGContext *s, int call, tcg_target_long dest)
 
     if (disp == (int32_t)disp) {
         tcg_out_opc(s, call ? OPC_CALL_Jz : OPC_JMP_long, 0, 0, 0);
+        tcg_out_ext_reloc(s, s->code_ptr, TCG_EXT_RELOC_ADDR,
+                          R_386_PC32, dest);
         tcg_out32(s, disp);
     } else {
         tcg_out_movi(s, TCG_TYPE_PTR, TCG_REG_R10, dest);
+        tcg_out_movi_reloc(s, TCG_EXT_RELOC_ADDR, dest);
         tcg_out_modrm(s, OPC_GRP5,
                       call ? EXT5_CALLN_Ev : EXT5_JMPN_Ev, TCG_REG_R10);
     }
@@ -1496,6 +1596,95 @@ static void tcg_out_qemu_st(TCGContext *s, const TCGArg *args,
 #endif
 }
 
+#if TCG_TARGET_HAS_vec_env
+/* SSE2 instructions for the TCG_VEC_* operations, done on %xmm0 with
+   the second operand in %xmm1.  For the immediate shifts, @ext is the
+   operation in the reg field of the modrm byte.  */
+static const struct {
+    int opc;
+    int ext;
+} tcg_vec_insn[] = {
+    [TCG_VEC_AND] = { 0xdb | P_EXT | P_DATA16 },        /* pand */
+    [TCG_VEC_ANDN] = { 0xdf | P_EXT | P_DATA16 },       /* pandn */
+    [TCG_VEC_OR] = { 0xeb | P_EXT | P_DATA16 },         /* por */
+    [TCG_VEC_XOR] = { 0xef | P_EXT | P_DATA16 },        /* pxor */
+    [TCG_VEC_ADD8] = { 0xfc | P_EXT | P_DATA16 },       /* paddb */
+    [TCG_VEC_ADD16] = { 0xfd | P_EXT | P_DATA16 },
+    [TCG_VEC_ADD32] = { 0xfe | P_EXT | P_DATA16 },
+    [TCG_VEC_ADD64] = { 0xd4 | P_EXT | P_DATA16 },
+    [TCG_VEC_SUB8] = { 0xf8 | P_EXT | P_DATA16 },       /* psubb */
+    [TCG_VEC_SUB16] = { 0xf9 | P_EXT | P_DATA16 },
+    [TCG_VEC_SUB32] = { 0xfa | P_EXT | P_DATA16 },
+    [TCG_VEC_SUB64] = { 0xfb | P_EXT | P_DATA16 },
+    [TCG_VEC_CMPEQ8] = { 0x74 | P_EXT | P_DATA16 },     /* pcmpeqb */
+    [TCG_VEC_CMPEQ16] = { 0x75 | P_EXT | P_DATA16 },
+    [TCG_VEC_CMPEQ32] = { 0x76 | P_EXT | P_DATA16 },
+    [TCG_VEC_CMPGT8] = { 0x64 | P_EXT | P_DATA16 },     /* pcmpgtb */
+    [TCG_VEC_CMPGT16] = { 0x65 | P_EXT | P_DATA16 },
+    [TCG_VEC_CMPGT32] = { 0x66 | P_EXT | P_DATA16 },
+    [TCG_VEC_ZIPLO8] = { 0x60 | P_EXT | P_DATA16 },     /* punpcklbw */
+    [TCG_VEC_ZIPLO16] = { 0x61 | P_EXT | P_DATA16 },
+    [TCG_VEC_ZIPLO32] = { 0x62 | P_EXT | P_DATA16 },
+    [TCG_VEC_ZIPLO64] = { 0x6c | P_EXT | P_DATA16 },
+    [TCG_VEC_ZIPHI8] = { 0x68 | P_EXT | P_DATA16 },     /* punpckhbw */
+    [TCG_VEC_ZIPHI16] = { 0x69 | P_EXT | P_DATA16 },
+    [TCG_VEC_ZIPHI32] = { 0x6a | P_EXT | P_DATA16 },
+    [TCG_VEC_ZIPHI64] = { 0x6d | P_EXT | P_DATA16 },
+    [TCG_VEC_SHLI16] = { OPC_PSHIFTW_Ib, 6 },
+    [TCG_VEC_SHLI32] = { OPC_PSHIFTD_Ib, 6 },
+    [TCG_VEC_SHLI64] = { OPC_PSHIFTQ_Ib, 6 },
+    [TCG_VEC_SHRI16] = { OPC_PSHIFTW_Ib, 2 },
+    [TCG_VEC_SHRI32] = { OPC_PSHIFTD_Ib, 2 },
+    [TCG_VEC_SHRI64] = { OPC_PSHIFTQ_Ib, 2 },
+    [TCG_VEC_SARI16] = { OPC_PSHIFTW_Ib, 4 },
+    [TCG_VEC_SARI32] = { OPC_PSHIFTD_Ib, 4 },
+    [TCG_VEC_SHLI128] = { OPC_PSHIFTQ_Ib, 7 },
+    [TCG_VEC_SHRI128] = { OPC_PSHIFTQ_Ib, 3 },
+    [TCG_VEC_SHUF32] = { 0x70 | P_EXT | P_DATA16 },     /* pshufd */
+    [TCG_VEC_SHUF16LO] = { 0x70 | P_EXT | P_SIMDF2 },   /* pshuflw */
+    [TCG_VEC_SHUF16HI] = { 0x70 | P_EXT | P_SIMDF3 },   /* pshufhw */
+};
+
+/* %xmm0 and %xmm1 are call-clobbered and never hold TCG values, so they
+   are free to use as scratch here.  */
+static void tcg_out_vec_env(TCGContext *s, int env, TCGVecOp op, int size,
+                            tcg_target_long dofs, tcg_target_long aofs,
+                            tcg_target_long b)
+{
+    int ld = size == 16 ? OPC_MOVDQU_VxWx : OPC_MOVQ_VqWq;
+    int st = size == 16 ? OPC_MOVDQU_WxVx : OPC_MOVQ_WqVq;
+
+    tcg_out_modrm_offset(s, ld, 0, env, aofs);
+    switch (op) {
+    case TCG_VEC_SHLI16 ... TCG_VEC_SHRI128:
+        tcg_out_modrm(s, tcg_vec_insn[op].opc, tcg_vec_insn[op].ext, 0);
+        tcg_out8(s, b);
+        break;
+    case TCG_VEC_SHUF32 ... TCG_VEC_SHUF16HI:
+        tcg_out_modrm(s, tcg_vec_insn[op].opc, 0, 0);
+        tcg_out8(s, b);
+        break;
+    case TCG_VEC_ZIPHI8 ... TCG_VEC_ZIPHI32:
+        if (size == 8) {
+            /* interleaving the whole 8 bytes leaves the result for the
+               high halves in the top of the register */
+            tcg_out_modrm_offset(s, ld, 1, env, b);
+            tcg_out_modrm(s, tcg_vec_insn[op - TCG_VEC_ZIPHI8 +
+                                          TCG_VEC_ZIPLO8].opc, 0, 1);
+            tcg_out_modrm(s, OPC_PSHIFTQ_Ib, 3, 0);
+            tcg_out8(s, 8);
+            break;
+        }
+        /* FALLTHRU */
+    default:
+        tcg_out_modrm_offset(s, ld, 1, env, b);
+        tcg_out_modrm(s, tcg_vec_insn[op].opc, 0, 1);
+        break;
+    }
+    tcg_out_modrm_offset(s, st, 0, env, dofs);
+}
+#endif
+
 static inline void tcg_out_op(TCGContext *s, TCGOpcode opc,
                               const TCGArg *args, const int *const_args)
 {
@@ -1514,6 +1703,7 @@ static inline void tcg_out_op(TCGContext *s, TCGOpcode opc,
     switch(opc) {
     case INDEX_op_exit_tb:
         tcg_out_movi(s, TCG_TYPE_PTR, TCG_REG_EAX, args[0]);
+        tcg_out_movi_reloc(s, TCG_EXT_RELOC_TB, args[0]);
         tcg_out_jmp(s, (tcg_target_long) tb_ret_addr);
         break;
     case INDEX_op_goto_tb:
@@ -1830,6 +2020,13 @@ static inline void tcg_out_op(TCGContext *s, TCGOpcode opc,
         }
         break;
 
+#if TCG_TARGET_HAS_vec_env
+    case INDEX_op_vec_env:
+        tcg_out_vec_env(s, args[0], args[1], args[2], args[3], args[4],
+                        args[5]);
+        break;
+#endif
+
     default:
         tcg_abort();
     }
@@ -1940,6 +2137,8 @@ static const TCGTargetOpDef x86_op_defs[] = {
     { INDEX_op_ext32u_i64, { "r", "r" } },
 
     { INDEX_op_deposit_i64, { "Q", "0", "Q" } },
+
+    { INDEX_op_vec_env, { "r" } },
 #endif
 
 #if TCG_TARGET_REG_BITS == 64
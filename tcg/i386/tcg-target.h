@@ -86,6 +86,8 @@ typedef enum {
 #define TCG_TARGET_HAS_nand_i32         0
 #define TCG_TARGET_HAS_nor_i32          0
 #define TCG_TARGET_HAS_deposit_i32      1
+/* SSE2 is always there on x86-64 */
+#define TCG_TARGET_HAS_vec_env          (TCG_TARGET_REG_BITS == 64)
 
 #if TCG_TARGET_REG_BITS == 64
 #define TCG_TARGET_HAS_div2_i64         1
@@ -115,6 +117,7 @@ typedef enum {
 #define TCG_TARGET_deposit_i64_valid    TCG_TARGET_deposit_i32_valid
 
 #define TCG_TARGET_HAS_GUEST_BASE
+#define TCG_TARGET_HAS_EXT_RELOCS
 
 /* Note: must be synced with dyngen-exec.h */
 #if TCG_TARGET_REG_BITS == 64
@@ -2118,6 +2118,450 @@ static inline void tcg_gen_deposit_i64(TCGv_i64 ret, TCGv_i64 arg1,
     tcg_temp_free_i64(t1);
 }
 
+/* Element-wise add and subtract of 8, 16 or 32 bit lanes packed in a
+   scalar register.  m has the most significant bit of each lane set;
+   clearing it before the operation keeps carries and borrows from
+   crossing lanes, and the top bits are fixed up afterwards.  This lets
+   frontends emulate the common SIMD integer instructions inline
+   instead of calling one helper per element.  */
+static inline void tcg_gen_vec_add_mask_i32(TCGv_i32 ret, TCGv_i32 arg1,
+                                            TCGv_i32 arg2, uint32_t m)
+{
+    TCGv_i32 t1 = tcg_temp_new_i32();
+    TCGv_i32 t2 = tcg_temp_new_i32();
+    TCGv_i32 t3 = tcg_temp_new_i32();
+
+    tcg_gen_andi_i32(t1, arg1, ~m);
+    tcg_gen_andi_i32(t2, arg2, ~m);
+    tcg_gen_xor_i32(t3, arg1, arg2);
+    tcg_gen_add_i32(ret, t1, t2);
+    tcg_gen_andi_i32(t3, t3, m);
+    tcg_gen_xor_i32(ret, ret, t3);
+
+    tcg_temp_free_i32(t1);
+    tcg_temp_free_i32(t2);
+    tcg_temp_free_i32(t3);
+}
+
+static inline void tcg_gen_vec_sub_mask_i32(TCGv_i32 ret, TCGv_i32 arg1,
+                                            TCGv_i32 arg2, uint32_t m)
+{
+    TCGv_i32 t1 = tcg_temp_new_i32();
+    TCGv_i32 t2 = tcg_temp_new_i32();
+    TCGv_i32 t3 = tcg_temp_new_i32();
+
+    tcg_gen_ori_i32(t1, arg1, m);
+    tcg_gen_andi_i32(t2, arg2, ~m);
+    tcg_gen_eqv_i32(t3, arg1, arg2);
+    tcg_gen_sub_i32(ret, t1, t2);
+    tcg_gen_andi_i32(t3, t3, m);
+    tcg_gen_xor_i32(ret, ret, t3);
+
+    tcg_temp_free_i32(t1);
+    tcg_temp_free_i32(t2);
+    tcg_temp_free_i32(t3);
+}
+
+static inline void tcg_gen_vec_add_mask_i64(TCGv_i64 ret, TCGv_i64 arg1,
+                                            TCGv_i64 arg2, uint64_t m)
+{
+    TCGv_i64 t1 = tcg_temp_new_i64();
+    TCGv_i64 t2 = tcg_temp_new_i64();
+    TCGv_i64 t3 = tcg_temp_new_i64();
+
+    tcg_gen_andi_i64(t1, arg1, ~m);
+    tcg_gen_andi_i64(t2, arg2, ~m);
+    tcg_gen_xor_i64(t3, arg1, arg2);
+    tcg_gen_add_i64(ret, t1, t2);
+    tcg_gen_andi_i64(t3, t3, m);
+    tcg_gen_xor_i64(ret, ret, t3);
+
+    tcg_temp_free_i64(t1);
+    tcg_temp_free_i64(t2);
+    tcg_temp_free_i64(t3);
+}
+
+static inline void tcg_gen_vec_sub_mask_i64(TCGv_i64 ret, TCGv_i64 arg1,
+                                            TCGv_i64 arg2, uint64_t m)
+{
+    TCGv_i64 t1 = tcg_temp_new_i64();
+    TCGv_i64 t2 = tcg_temp_new_i64();
+    TCGv_i64 t3 = tcg_temp_new_i64();
+
+    tcg_gen_ori_i64(t1, arg1, m);
+    tcg_gen_andi_i64(t2, arg2, ~m);
+    tcg_gen_eqv_i64(t3, arg1, arg2);
+    tcg_gen_sub_i64(ret, t1, t2);
+    tcg_gen_andi_i64(t3, t3, m);
+    tcg_gen_xor_i64(ret, ret, t3);
+
+    tcg_temp_free_i64(t1);
+    tcg_temp_free_i64(t2);
+    tcg_temp_free_i64(t3);
+}
+
+static inline void tcg_gen_vec_add8_i32(TCGv_i32 ret, TCGv_i32 arg1,
+                                        TCGv_i32 arg2)
+{
+    tcg_gen_vec_add_mask_i32(ret, arg1, arg2, 0x80808080u);
+}
+
+static inline void tcg_gen_vec_add16_i32(TCGv_i32 ret, TCGv_i32 arg1,
+                                         TCGv_i32 arg2)
+{
+    tcg_gen_vec_add_mask_i32(ret, arg1, arg2, 0x80008000u);
+}
+
+static inline void tcg_gen_vec_sub8_i32(TCGv_i32 ret, TCGv_i32 arg1,
+                                        TCGv_i32 arg2)
+{
+    tcg_gen_vec_sub_mask_i32(ret, arg1, arg2, 0x80808080u);
+}
+
+static inline void tcg_gen_vec_sub16_i32(TCGv_i32 ret, TCGv_i32 arg1,
+                                         TCGv_i32 arg2)
+{
+    tcg_gen_vec_sub_mask_i32(ret, arg1, arg2, 0x80008000u);
+}
+
+static inline void tcg_gen_vec_add8_i64(TCGv_i64 ret, TCGv_i64 arg1,
+                                        TCGv_i64 arg2)
+{
+    tcg_gen_vec_add_mask_i64(ret, arg1, arg2, 0x8080808080808080ull);
+}
+
+static inline void tcg_gen_vec_add16_i64(TCGv_i64 ret, TCGv_i64 arg1,
+                                         TCGv_i64 arg2)
+{
+    tcg_gen_vec_add_mask_i64(ret, arg1, arg2, 0x8000800080008000ull);
+}
+
+static inline void tcg_gen_vec_add32_i64(TCGv_i64 ret, TCGv_i64 arg1,
+                                         TCGv_i64 arg2)
+{
+    tcg_gen_vec_add_mask_i64(ret, arg1, arg2, 0x8000000080000000ull);
+}
+
+static inline void tcg_gen_vec_sub8_i64(TCGv_i64 ret, TCGv_i64 arg1,
+                                        TCGv_i64 arg2)
+{
+    tcg_gen_vec_sub_mask_i64(ret, arg1, arg2, 0x8080808080808080ull);
+}
+
+static inline void tcg_gen_vec_sub16_i64(TCGv_i64 ret, TCGv_i64 arg1,
+                                         TCGv_i64 arg2)
+{
+    tcg_gen_vec_sub_mask_i64(ret, arg1, arg2, 0x8000800080008000ull);
+}
+
+static inline void tcg_gen_vec_sub32_i64(TCGv_i64 ret, TCGv_i64 arg1,
+                                         TCGv_i64 arg2)
+{
+    tcg_gen_vec_sub_mask_i64(ret, arg1, arg2, 0x8000000080000000ull);
+}
+
+/* Scalar expansion of tcg_gen_vec_env, for hosts without vector
+   instructions in the backend.  */
+static inline void tcg_gen_vec_ld_i32(TCGv_i32 ret, TCGv_ptr env,
+                                      tcg_target_long ofs, int esz, int sign)
+{
+    switch (esz) {
+    case 1:
+        if (sign) {
+            tcg_gen_ld8s_i32(ret, env, ofs);
+        } else {
+            tcg_gen_ld8u_i32(ret, env, ofs);
+        }
+        break;
+    case 2:
+        if (sign) {
+            tcg_gen_ld16s_i32(ret, env, ofs);
+        } else {
+            tcg_gen_ld16u_i32(ret, env, ofs);
+        }
+        break;
+    default:
+        tcg_gen_ld_i32(ret, env, ofs);
+        break;
+    }
+}
+
+static inline void tcg_gen_vec_st_i32(TCGv_i32 arg, TCGv_ptr env,
+                                      tcg_target_long ofs, int esz)
+{
+    switch (esz) {
+    case 1:
+        tcg_gen_st8_i32(arg, env, ofs);
+        break;
+    case 2:
+        tcg_gen_st16_i32(arg, env, ofs);
+        break;
+    default:
+        tcg_gen_st_i32(arg, env, ofs);
+        break;
+    }
+}
+
+static inline void tcg_gen_vec_env_expand(TCGv_ptr env, TCGVecOp op, int size,
+                                          tcg_target_long dofs,
+                                          tcg_target_long aofs,
+                                          tcg_target_long b)
+{
+    void (*gen_op)(TCGv_i64, TCGv_i64, TCGv_i64) = NULL;
+    TCGv_i32 t32[16];
+    TCGv_i64 t0, t1;
+    int i, n, esz;
+
+    switch (op) {
+    case TCG_VEC_AND:
+        gen_op = tcg_gen_and_i64;
+        break;
+    case TCG_VEC_ANDN:
+        gen_op = tcg_gen_andc_i64;
+        break;
+    case TCG_VEC_OR:
+        gen_op = tcg_gen_or_i64;
+        break;
+    case TCG_VEC_XOR:
+        gen_op = tcg_gen_xor_i64;
+        break;
+    case TCG_VEC_ADD8:
+        gen_op = tcg_gen_vec_add8_i64;
+        break;
+    case TCG_VEC_ADD16:
+        gen_op = tcg_gen_vec_add16_i64;
+        break;
+    case TCG_VEC_ADD32:
+        gen_op = tcg_gen_vec_add32_i64;
+        break;
+    case TCG_VEC_ADD64:
+        gen_op = tcg_gen_add_i64;
+        break;
+    case TCG_VEC_SUB8:
+        gen_op = tcg_gen_vec_sub8_i64;
+        break;
+    case TCG_VEC_SUB16:
+        gen_op = tcg_gen_vec_sub16_i64;
+        break;
+    case TCG_VEC_SUB32:
+        gen_op = tcg_gen_vec_sub32_i64;
+        break;
+    case TCG_VEC_SUB64:
+        gen_op = tcg_gen_sub_i64;
+        break;
+    default:
+        break;
+    }
+    if (gen_op) {
+        /* lanes never cross the 64 bit halves */
+        t0 = tcg_temp_new_i64();
+        t1 = tcg_temp_new_i64();
+        for (i = 0; i < size; i += 8) {
+            tcg_gen_ld_i64(t0, env, aofs + i);
+            tcg_gen_ld_i64(t1, env, b + i);
+            if (op == TCG_VEC_ANDN) {
+                gen_op(t0, t1, t0);
+            } else {
+                gen_op(t0, t0, t1);
+            }
+            tcg_gen_st_i64(t0, env, dofs + i);
+        }
+        tcg_temp_free_i64(t0);
+        tcg_temp_free_i64(t1);
+        return;
+    }
+
+    switch (op) {
+    case TCG_VEC_CMPEQ8 ... TCG_VEC_CMPGT32:
+        esz = 1 << ((op - TCG_VEC_CMPEQ8) % 3);
+        t32[0] = tcg_temp_new_i32();
+        t32[1] = tcg_temp_new_i32();
+        for (i = 0; i < size; i += esz) {
+            tcg_gen_vec_ld_i32(t32[0], env, aofs + i, esz, 1);
+            tcg_gen_vec_ld_i32(t32[1], env, b + i, esz, 1);
+            tcg_gen_setcond_i32(op >= TCG_VEC_CMPGT8 ? TCG_COND_GT
+                                                     : TCG_COND_EQ,
+                                t32[0], t32[0], t32[1]);
+            tcg_gen_neg_i32(t32[0], t32[0]);
+            tcg_gen_vec_st_i32(t32[0], env, dofs + i, esz);
+        }
+        tcg_temp_free_i32(t32[0]);
+        tcg_temp_free_i32(t32[1]);
+        break;
+
+    case TCG_VEC_ZIPLO64:
+    case TCG_VEC_ZIPHI64:
+        t0 = tcg_temp_new_i64();
+        t1 = tcg_temp_new_i64();
+        i = op == TCG_VEC_ZIPHI64 ? 8 : 0;
+        tcg_gen_ld_i64(t0, env, aofs + i);
+        tcg_gen_ld_i64(t1, env, b + i);
+        tcg_gen_st_i64(t0, env, dofs);
+        tcg_gen_st_i64(t1, env, dofs + 8);
+        tcg_temp_free_i64(t0);
+        tcg_temp_free_i64(t1);
+        break;
+
+    case TCG_VEC_ZIPLO8 ... TCG_VEC_ZIPLO32:
+    case TCG_VEC_ZIPHI8 ... TCG_VEC_ZIPHI32:
+        esz = 1 << ((op - TCG_VEC_ZIPLO8) % 4);
+        n = size / esz / 2;
+        if (op >= TCG_VEC_ZIPHI8) {
+            aofs += size / 2;
+            b += size / 2;
+        }
+        /* load everything first, the destination may be a or b */
+        for (i = 0; i < n; i++) {
+            t32[2 * i] = tcg_temp_new_i32();
+            t32[2 * i + 1] = tcg_temp_new_i32();
+            tcg_gen_vec_ld_i32(t32[2 * i], env, aofs + i * esz, esz, 0);
+            tcg_gen_vec_ld_i32(t32[2 * i + 1], env, b + i * esz, esz, 0);
+        }
+        for (i = 0; i < 2 * n; i++) {
+            tcg_gen_vec_st_i32(t32[i], env, dofs + i * esz, esz);
+            tcg_temp_free_i32(t32[i]);
+        }
+        break;
+
+    case TCG_VEC_SHLI16:
+    case TCG_VEC_SHLI32:
+    case TCG_VEC_SHRI16:
+    case TCG_VEC_SHRI32:
+    case TCG_VEC_SARI16:
+    case TCG_VEC_SARI32:
+        esz = op == TCG_VEC_SHLI16 || op == TCG_VEC_SHRI16 ||
+              op == TCG_VEC_SARI16 ? 2 : 4;
+        if (op >= TCG_VEC_SARI16 && b >= esz * 8) {
+            b = esz * 8 - 1;
+        }
+        t32[0] = tcg_temp_new_i32();
+        for (i = 0; i < size; i += esz) {
+            if (b >= esz * 8) {
+                tcg_gen_movi_i32(t32[0], 0);
+            } else {
+                tcg_gen_vec_ld_i32(t32[0], env, aofs + i, esz,
+                                   op >= TCG_VEC_SARI16);
+                if (op >= TCG_VEC_SARI16) {
+                    tcg_gen_sari_i32(t32[0], t32[0], b);
+                } else if (op >= TCG_VEC_SHRI16) {
+                    tcg_gen_shri_i32(t32[0], t32[0], b);
+                } else {
+                    tcg_gen_shli_i32(t32[0], t32[0], b);
+                }
+            }
+            tcg_gen_vec_st_i32(t32[0], env, dofs + i, esz);
+        }
+        tcg_temp_free_i32(t32[0]);
+        break;
+
+    case TCG_VEC_SHLI64:
+    case TCG_VEC_SHRI64:
+        t0 = tcg_temp_new_i64();
+        for (i = 0; i < size; i += 8) {
+            if (b >= 64) {
+                tcg_gen_movi_i64(t0, 0);
+            } else {
+                tcg_gen_ld_i64(t0, env, aofs + i);
+                if (op == TCG_VEC_SHLI64) {
+                    tcg_gen_shli_i64(t0, t0, b);
+                } else {
+                    tcg_gen_shri_i64(t0, t0, b);
+                }
+            }
+            tcg_gen_st_i64(t0, env, dofs + i);
+        }
+        tcg_temp_free_i64(t0);
+        break;
+
+    case TCG_VEC_SHLI128:
+    case TCG_VEC_SHRI128:
+        t0 = tcg_temp_new_i64();
+        t1 = tcg_temp_new_i64();
+        tcg_gen_ld_i64(t0, env, aofs);
+        tcg_gen_ld_i64(t1, env, aofs + 8);
+        if (b >= 16) {
+            tcg_gen_movi_i64(t0, 0);
+            tcg_gen_movi_i64(t1, 0);
+        } else if (b >= 8 && op == TCG_VEC_SHRI128) {
+            tcg_gen_shri_i64(t0, t1, (b - 8) * 8);
+            tcg_gen_movi_i64(t1, 0);
+        } else if (b >= 8) {
+            tcg_gen_shli_i64(t1, t0, (b - 8) * 8);
+            tcg_gen_movi_i64(t0, 0);
+        } else if (b) {
+            TCGv_i64 t2 = tcg_temp_new_i64();
+
+            if (op == TCG_VEC_SHRI128) {
+                tcg_gen_shri_i64(t0, t0, b * 8);
+                tcg_gen_shli_i64(t2, t1, 64 - b * 8);
+                tcg_gen_shri_i64(t1, t1, b * 8);
+                tcg_gen_or_i64(t0, t0, t2);
+            } else {
+                tcg_gen_shli_i64(t1, t1, b * 8);
+                tcg_gen_shri_i64(t2, t0, 64 - b * 8);
+                tcg_gen_shli_i64(t0, t0, b * 8);
+                tcg_gen_or_i64(t1, t1, t2);
+            }
+            tcg_temp_free_i64(t2);
+        }
+        tcg_gen_st_i64(t0, env, dofs);
+        tcg_gen_st_i64(t1, env, dofs + 8);
+        tcg_temp_free_i64(t0);
+        tcg_temp_free_i64(t1);
+        break;
+
+    case TCG_VEC_SHUF32:
+    case TCG_VEC_SHUF16LO:
+    case TCG_VEC_SHUF16HI:
+        esz = op == TCG_VEC_SHUF32 ? 4 : 2;
+        n = op == TCG_VEC_SHUF16HI ? 8 : 0;
+        t0 = tcg_temp_new_i64();
+        if (op != TCG_VEC_SHUF32 && size == 16) {
+            /* the other half is copied */
+            tcg_gen_ld_i64(t0, env, aofs + 8 - n);
+        }
+        for (i = 0; i < 4; i++) {
+            t32[i] = tcg_temp_new_i32();
+            tcg_gen_vec_ld_i32(t32[i], env,
+                               aofs + n + ((b >> (2 * i)) & 3) * esz, esz, 0);
+        }
+        for (i = 0; i < 4; i++) {
+            tcg_gen_vec_st_i32(t32[i], env, dofs + n + i * esz, esz);
+            tcg_temp_free_i32(t32[i]);
+        }
+        if (op != TCG_VEC_SHUF32 && size == 16) {
+            tcg_gen_st_i64(t0, env, dofs + 8 - n);
+        }
+        tcg_temp_free_i64(t0);
+        break;
+
+    default:
+        tcg_abort();
+    }
+}
+
+/* Perform @op on the vectors of @size (8 or 16) bytes at offsets @aofs
+   and @b of @env, or on @aofs and the immediate @b, and store the result
+   at @dofs.  The destination may overlap the sources.  This is a single
+   host vector instruction where the backend has them, instead of a
+   helper call that loops over the lanes.  */
+static inline void tcg_gen_vec_env(TCGv_ptr env, TCGVecOp op, int size,
+                                   tcg_target_long dofs, tcg_target_long aofs,
+                                   tcg_target_long b)
+{
+    if (TCG_TARGET_HAS_vec_env) {
+        *gen_opc_ptr++ = INDEX_op_vec_env;
+        *gen_opparam_ptr++ = GET_TCGV_PTR(env);
+        *gen_opparam_ptr++ = op;
+        *gen_opparam_ptr++ = size;
+        *gen_opparam_ptr++ = dofs;
+        *gen_opparam_ptr++ = aofs;
+        *gen_opparam_ptr++ = b;
+    } else {
+        tcg_gen_vec_env_expand(env, op, size, dofs, aofs, b);
+    }
+}
+
 /***************************************/
 /* QEMU specific operations. Their type depend on the QEMU CPU
    type. */
@@ -2171,6 +2615,27 @@ static inline void tcg_gen_goto_tb(int idx)
     tcg_gen_op1i(INDEX_op_goto_tb, idx);
 }
 
+/* Jump to the translated code at ptr, or return to the main loop with
+   an exit value of 0 if ptr is NULL.  ptr must be a local temporary;
+   it is freed.  */
+static inline void tcg_gen_goto_ptr(TCGv_ptr ptr)
+{
+#if !defined(CONFIG_TCG_INTERPRETER)
+    int l1 = gen_new_label();
+
+#if TCG_TARGET_REG_BITS == 32
+    tcg_gen_brcondi_i32(TCG_COND_EQ, TCGV_PTR_TO_NAT(ptr), 0, l1);
+    tcg_gen_op1_i32(INDEX_op_jmp, TCGV_PTR_TO_NAT(ptr));
+#else
+    tcg_gen_brcondi_i64(TCG_COND_EQ, TCGV_PTR_TO_NAT(ptr), 0, l1);
+    tcg_gen_op1_i64(INDEX_op_jmp, TCGV_PTR_TO_NAT(ptr));
+#endif
+    gen_set_label(l1);
+#endif
+    tcg_temp_free_ptr(ptr);
+    tcg_gen_exit_tb(0);
+}
+
 #if TCG_TARGET_REG_BITS == 32
 static inline void tcg_gen_qemu_ld8u(TCGv ret, TCGv addr, int mem_index)
 {
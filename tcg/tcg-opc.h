@@ -158,6 +158,9 @@ DEF(eqv_i64, 1, 2, 0, IMPL64 | IMPL(TCG_TARGET_HAS_eqv_i64))
 DEF(nand_i64, 1, 2, 0, IMPL64 | IMPL(TCG_TARGET_HAS_nand_i64))
 DEF(nor_i64, 1, 2, 0, IMPL64 | IMPL(TCG_TARGET_HAS_nor_i64))
 
+/* env, TCGVecOp, size, dest offset, offset of a, offset of b or imm */
+DEF(vec_env, 0, 1, 5, TCG_OPF_SIDE_EFFECTS | IMPL(TCG_TARGET_HAS_vec_env))
+
 /* QEMU specific */
 #if TARGET_LONG_BITS > TCG_TARGET_REG_BITS
 DEF(debug_insn_start, 0, 0, 2, 0)
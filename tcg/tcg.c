@@ -71,6 +71,11 @@ static void tcg_target_init(TCGContext *s);
 static void tcg_target_qemu_prologue(TCGContext *s);
 static void patch_reloc(uint8_t *code_ptr, int type, 
                         tcg_target_long value, tcg_target_long addend);
+#ifdef TCG_TARGET_HAS_EXT_RELOCS
+static int ext_reloc_size(int type);
+static int patch_ext_reloc(uint8_t *code_ptr, int type,
+                           tcg_target_long value);
+#endif
 
 static void tcg_register_jit_int(void *buf, size_t size,
                                  void *debug_frame, size_t debug_frame_size)
@@ -165,6 +170,35 @@ static void tcg_out_label(TCGContext *s, int label_index, void *ptr)
     l->u.value = value;
 }
 
+#ifdef TCG_TARGET_HAS_EXT_RELOCS
+/* record a reference to an address outside of the generated code */
+static void tcg_out_ext_reloc(TCGContext *s, uint8_t *code_ptr, int kind,
+                              int type, tcg_target_long value)
+{
+    TCGExtReloc *r;
+
+    r = tcg_malloc(sizeof(TCGExtReloc));
+    r->kind = kind;
+    r->type = type;
+    r->offset = code_ptr - s->code_buf;
+    r->value = value;
+    r->next = s->ext_relocs;
+    s->ext_relocs = r;
+}
+
+/* Re-resolve a recorded reference after the code has been copied to
+   code_buf.  Return 0 if 'value' cannot be encoded in place, or if the
+   reference does not lie within the code_size bytes of code.  */
+int tcg_patch_ext_reloc(uint8_t *code_buf, int code_size, int type,
+                        int offset, tcg_target_long value)
+{
+    if (offset < 0 || offset > code_size - ext_reloc_size(type)) {
+        return 0;
+    }
+    return patch_ext_reloc(code_buf + offset, type, value);
+}
+#endif
+
 int gen_new_label(void)
 {
     TCGContext *s = &tcg_ctx;
@@ -298,6 +332,9 @@ void tcg_func_start(TCGContext *s)
     s->labels = tcg_malloc(sizeof(TCGLabel) * TCG_MAX_LABELS);
     s->nb_labels = 0;
     s->current_frame_offset = s->frame_start;
+#ifdef TCG_TARGET_HAS_EXT_RELOCS
+    s->ext_relocs = NULL;
+#endif
 
     gen_opc_ptr = gen_opc_buf;
     gen_opparam_ptr = gen_opparam_buf;
@@ -279,6 +279,54 @@ typedef enum {
     TCG_COND_GTU,
 } TCGCond;
 
+/* Lane-wise operations on 8 or 16 byte vectors in the CPU state, for
+   tcg_gen_vec_env.  Element i is i * element size bytes from the start
+   of a vector; the operations that move elements between lanes (the
+   interleaves, the byte shifts and the shuffles) therefore assume a
+   little-endian host.  */
+typedef enum {
+    TCG_VEC_AND,
+    TCG_VEC_ANDN,               /* ~a & b */
+    TCG_VEC_OR,
+    TCG_VEC_XOR,
+    TCG_VEC_ADD8,
+    TCG_VEC_ADD16,
+    TCG_VEC_ADD32,
+    TCG_VEC_ADD64,
+    TCG_VEC_SUB8,
+    TCG_VEC_SUB16,
+    TCG_VEC_SUB32,
+    TCG_VEC_SUB64,
+    TCG_VEC_CMPEQ8,             /* all ones where equal */
+    TCG_VEC_CMPEQ16,
+    TCG_VEC_CMPEQ32,
+    TCG_VEC_CMPGT8,             /* all ones where a > b, signed */
+    TCG_VEC_CMPGT16,
+    TCG_VEC_CMPGT32,
+    TCG_VEC_ZIPLO8,             /* interleave the low halves of a and b */
+    TCG_VEC_ZIPLO16,
+    TCG_VEC_ZIPLO32,
+    TCG_VEC_ZIPLO64,            /* 16 byte vectors only */
+    TCG_VEC_ZIPHI8,             /* interleave the high halves */
+    TCG_VEC_ZIPHI16,
+    TCG_VEC_ZIPHI32,
+    TCG_VEC_ZIPHI64,            /* 16 byte vectors only */
+    /* b is an immediate for the rest */
+    TCG_VEC_SHLI16,             /* counts past the lane size give 0 */
+    TCG_VEC_SHLI32,
+    TCG_VEC_SHLI64,
+    TCG_VEC_SHRI16,
+    TCG_VEC_SHRI32,
+    TCG_VEC_SHRI64,
+    TCG_VEC_SARI16,             /* counts past the lane size fill with sign */
+    TCG_VEC_SARI32,
+    TCG_VEC_SHLI128,            /* whole vector by bytes, 16 bytes only */
+    TCG_VEC_SHRI128,
+    TCG_VEC_SHUF32,             /* lane i = a[(b >> 2 * i) & 3], 16 bytes only */
+    TCG_VEC_SHUF16LO,           /* same for the 16 bit lanes of the low */
+    TCG_VEC_SHUF16HI,           /* or high 8 bytes, 16 bytes only */
+} TCGVecOp;
+
 /* Invert the sense of the comparison.  */
 static inline TCGCond tcg_invert_cond(TCGCond c)
 {
@@ -328,6 +376,23 @@ typedef struct TCGHelperInfo {
     const char *name;
 } TCGHelperInfo;
 
+#ifdef TCG_TARGET_HAS_EXT_RELOCS
+/* References from the generated code to addresses outside of it.  The
+   backend records them so that the code can be moved (see tb-cache.c). */
+enum {
+    TCG_EXT_RELOC_ADDR, /* fixed host address: helper, epilogue */
+    TCG_EXT_RELOC_TB,   /* exit_tb value: TB pointer + jump index */
+};
+
+typedef struct TCGExtReloc {
+    struct TCGExtReloc *next;
+    int kind;
+    int type;   /* host specific encoding */
+    int offset; /* from the start of the generated code */
+    tcg_target_long value;
+} TCGExtReloc;
+#endif
+
 typedef struct TCGContext TCGContext;
 
 struct TCGContext {
@@ -346,6 +411,9 @@ struct TCGContext {
     unsigned long *tb_next;
     uint16_t *tb_next_offset;
     uint16_t *tb_jmp_offset; /* != NULL if USE_DIRECT_JUMP */
+#ifdef TCG_TARGET_HAS_EXT_RELOCS
+    TCGExtReloc *ext_relocs;
+#endif
 
     /* liveness analysis */
     uint16_t *op_dead_args; /* for each operation, each bit tells if the
@@ -423,6 +491,10 @@ void tcg_prologue_init(TCGContext *s);
 void tcg_func_start(TCGContext *s);
 
 int tcg_gen_code(TCGContext *s, uint8_t *gen_code_buf);
+#ifdef TCG_TARGET_HAS_EXT_RELOCS
+int tcg_patch_ext_reloc(uint8_t *code_buf, int code_size, int type,
+                        int offset, tcg_target_long value);
+#endif
 int tcg_gen_code_search_pc(TCGContext *s, uint8_t *gen_code_buf, long offset);
 
 void tcg_set_frame(TCGContext *s, int reg,
@@ -545,6 +617,7 @@ void tcg_add_target_add_op_defs(const TCGTargetOpDef *tdefs);
 #define tcg_global_mem_new_ptr(R, O, N) \
     TCGV_NAT_TO_PTR(tcg_global_mem_new_i32((R), (O), (N)))
 #define tcg_temp_new_ptr() TCGV_NAT_TO_PTR(tcg_temp_new_i32())
+#define tcg_temp_local_new_ptr() TCGV_NAT_TO_PTR(tcg_temp_local_new_i32())
 #define tcg_temp_free_ptr(T) tcg_temp_free_i32(TCGV_PTR_TO_NAT(T))
 #else
 #define TCGV_NAT_TO_PTR(n) MAKE_TCGV_PTR(GET_TCGV_I64(n))
@@ -556,6 +629,7 @@ void tcg_add_target_add_op_defs(const TCGTargetOpDef *tdefs);
 #define tcg_global_mem_new_ptr(R, O, N) \
     TCGV_NAT_TO_PTR(tcg_global_mem_new_i64((R), (O), (N)))
 #define tcg_temp_new_ptr() TCGV_NAT_TO_PTR(tcg_temp_new_i64())
+#define tcg_temp_local_new_ptr() TCGV_NAT_TO_PTR(tcg_temp_local_new_i64())
 #define tcg_temp_free_ptr(T) tcg_temp_free_i64(TCGV_PTR_TO_NAT(T))
 #endif
 
@@ -579,7 +653,8 @@ TCGv_i64 tcg_const_i64(int64_t val);
 TCGv_i32 tcg_const_local_i32(int32_t val);
 TCGv_i64 tcg_const_local_i64(int64_t val);
 
-extern uint8_t code_gen_prologue[];
+#define CODE_GEN_PROLOGUE_SIZE 1024
+extern uint8_t code_gen_prologue[CODE_GEN_PROLOGUE_SIZE];
 
 /* TCG targets may use a different definition of tcg_qemu_tb_exec. */
 #if !defined(tcg_qemu_tb_exec)
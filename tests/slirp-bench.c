@@ -0,0 +1,191 @@
+/*
+ * TCP throughput benchmark for user mode networking
+ *
+ * Copyright (c) 2012 agent <agent@local>
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ *
+ * A minimal iperf.  Start the server on the host, bound to the loopback
+ * interface, then run the client in a guest started with -netdev user:
+ *
+ *     host$  ./slirp-bench server 5001
+ *     guest$ ./slirp-bench send 10.0.2.2 5001 10
+ *     guest$ ./slirp-bench recv 10.0.2.2 5001 10
+ *
+ * "send" measures guest to host throughput, "recv" host to guest, each
+ * for the given number of seconds.  The program needs nothing but libc,
+ * so that it can be built for any guest.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/time.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#define BUF_SIZE (128 * 1024)
+
+static char buf[BUF_SIZE];
+
+static double now(void)
+{
+    struct timeval tv;
+
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+static void die(const char *what)
+{
+    perror(what);
+    exit(1);
+}
+
+/* Send for @seconds, or receive until the peer closes; return bytes moved */
+static long long transfer(int fd, int sending, int seconds)
+{
+    long long total = 0;
+    double end = now() + seconds;
+    ssize_t n;
+
+    for (;;) {
+        if (sending) {
+            if (now() >= end) {
+                break;
+            }
+            n = write(fd, buf, sizeof(buf));
+        } else {
+            n = read(fd, buf, sizeof(buf));
+        }
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            break;
+        }
+        total += n;
+    }
+    return total;
+}
+
+static void report(const char *what, long long bytes, double seconds)
+{
+    printf("%s: %lld bytes in %.2f s, %.1f Mbit/s\n", what, bytes, seconds,
+           bytes * 8 / seconds / 1e6);
+    fflush(stdout);
+}
+
+/* The client sends a one byte command first: 's' if it is going to send,
+ * otherwise it wants to receive and the next four bytes are the duration.
+ */
+static void server(int port)
+{
+    struct sockaddr_in addr;
+    int lfd, fd, one = 1;
+
+    lfd = socket(AF_INET, SOCK_STREAM, 0);
+    if (lfd < 0) {
+        die("socket");
+    }
+    setsockopt(lfd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (bind(lfd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        die("bind");
+    }
+    if (listen(lfd, 1) < 0) {
+        die("listen");
+    }
+
+    for (;;) {
+        unsigned char cmd[5];
+        double start;
+        long long bytes;
+
+        fd = accept(lfd, NULL, NULL);
+        if (fd < 0) {
+            die("accept");
+        }
+        if (read(fd, cmd, 1) != 1) {
+            close(fd);
+            continue;
+        }
+        start = now();
+        if (cmd[0] == 's') {
+            bytes = transfer(fd, 0, 0);
+            report("received", bytes, now() - start);
+        } else {
+            if (read(fd, cmd + 1, 4) != 4) {
+                close(fd);
+                continue;
+            }
+            bytes = transfer(fd, 1, cmd[1] << 24 | cmd[2] << 16 |
+                                    cmd[3] << 8 | cmd[4]);
+            report("sent", bytes, now() - start);
+        }
+        close(fd);
+    }
+}
+
+static void client(const char *host, int port, int sending, int seconds)
+{
+    struct sockaddr_in addr;
+    unsigned char cmd[5];
+    double start;
+    long long bytes;
+    int fd;
+
+    fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0) {
+        die("socket");
+    }
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    if (!inet_aton(host, &addr.sin_addr)) {
+        fprintf(stderr, "invalid address %s\n", host);
+        exit(1);
+    }
+    if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        die("connect");
+    }
+
+    cmd[0] = sending ? 's' : 'r';
+    cmd[1] = seconds >> 24;
+    cmd[2] = seconds >> 16;
+    cmd[3] = seconds >> 8;
+    cmd[4] = seconds;
+    if (write(fd, cmd, sending ? 1 : 5) != (sending ? 1 : 5)) {
+        die("write");
+    }
+
+    start = now();
+    bytes = transfer(fd, sending, seconds);
+    report(sending ? "sent" : "received", bytes, now() - start);
+    close(fd);
+}
+
+int main(int argc, char **argv)
+{
+    signal(SIGPIPE, SIG_IGN);
+
+    if (argc == 3 && !strcmp(argv[1], "server")) {
+        server(atoi(argv[2]));
+    } else if (argc == 5 && (!strcmp(argv[1], "send") ||
+                             !strcmp(argv[1], "recv"))) {
+        client(argv[2], atoi(argv[3]), argv[1][0] == 's', atoi(argv[4]));
+    } else {
+        fprintf(stderr, "usage: %s server PORT\n"
+                        "       %s send|recv HOST PORT SECONDS\n",
+                argv[0], argv[0]);
+        return 1;
+    }
+    return 0;
+}
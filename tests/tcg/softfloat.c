@@ -0,0 +1,181 @@
+/*
+ * SSE float32/float64 arithmetic check and benchmark
+ *
+ * Without arguments, runs a few million add/sub/mul/div/sqrt operations
+ * on pseudo-random operands (normals, denormals, values close to
+ * overflow, infinities and NaNs) in every rounding mode and prints the
+ * resulting bit patterns and exception flags.  The output must be the
+ * same natively and under QEMU, which checks that the softfloat host
+ * FPU fast path is bit-exact.
+ *
+ * With "bench" as the first argument, times a tight loop of operations
+ * that stay on the fast path instead.
+ */
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fenv.h>
+#include <math.h>
+
+#define ITERATIONS 1000000
+#define BENCH_ITERATIONS 20000000
+
+static const int rounding_modes[] = {
+    FE_TONEAREST, FE_DOWNWARD, FE_UPWARD, FE_TOWARDZERO
+};
+
+static uint64_t seed = 88172645463325252ULL;
+
+static uint64_t rnd(void)
+{
+    seed ^= seed << 13;
+    seed ^= seed >> 7;
+    seed ^= seed << 17;
+    return seed;
+}
+
+static float rnd_f32(void)
+{
+    uint64_t r = rnd();
+    uint32_t i = r >> 32;
+    float f;
+
+    switch (r & 7) {
+    case 0:
+        /* any bit pattern */
+        break;
+    case 1:
+        /* denormals and the smallest normals */
+        i = (i & 0x807fffff) | ((uint32_t)((r >> 8) & 3) << 23);
+        break;
+    case 2:
+        /* close to overflow */
+        i = (i & 0x80ffffff) | 0x7f000000;
+        break;
+    default:
+        /* ordinary numbers around 1.0 */
+        i = (i & 0x807fffff) | ((uint32_t)(0x70 + ((r >> 8) & 31)) << 23);
+        break;
+    }
+    memcpy(&f, &i, sizeof(f));
+    return f;
+}
+
+static double rnd_f64(void)
+{
+    uint64_t r = rnd();
+    uint64_t i = rnd();
+    double d;
+
+    switch (r & 7) {
+    case 0:
+        break;
+    case 1:
+        i = (i & 0x800fffffffffffffULL) | (((r >> 8) & 3) << 52);
+        break;
+    case 2:
+        i = (i & 0x801fffffffffffffULL) | 0x7fe0000000000000ULL;
+        break;
+    default:
+        i = (i & 0x800fffffffffffffULL) | ((0x3f0 + ((r >> 8) & 31)) << 52);
+        break;
+    }
+    memcpy(&d, &i, sizeof(d));
+    return d;
+}
+
+static uint32_t f32_bits(float f)
+{
+    uint32_t i;
+    memcpy(&i, &f, sizeof(i));
+    return i;
+}
+
+static uint64_t f64_bits(double d)
+{
+    uint64_t i;
+    memcpy(&i, &d, sizeof(i));
+    return i;
+}
+
+static void check(void)
+{
+    volatile float fa, fb, fr;
+    volatile double da, db, dr;
+    uint64_t sum = 0, bits;
+    int i, op, flags;
+
+    for (i = 0; i < ITERATIONS; i++) {
+        fesetround(rounding_modes[(i >> 4) & 3]);
+        feclearexcept(FE_ALL_EXCEPT);
+        op = rnd() % 10;
+        if (op < 5) {
+            fa = rnd_f32();
+            fb = rnd_f32();
+            switch (op) {
+            case 0: fr = fa + fb; break;
+            case 1: fr = fa - fb; break;
+            case 2: fr = fa * fb; break;
+            case 3: fr = fa / fb; break;
+            default: fr = sqrtf(fa); break;
+            }
+            bits = f32_bits(fr);
+            if (isnan(fr)) {
+                bits = 0x7fc00000;
+            }
+        } else {
+            da = rnd_f64();
+            db = rnd_f64();
+            switch (op) {
+            case 5: dr = da + db; break;
+            case 6: dr = da - db; break;
+            case 7: dr = da * db; break;
+            case 8: dr = da / db; break;
+            default: dr = sqrt(da); break;
+            }
+            bits = f64_bits(dr);
+            if (isnan(dr)) {
+                bits = 0x7ff8000000000000ULL;
+            }
+        }
+        flags = fetestexcept(FE_ALL_EXCEPT);
+        sum = (sum ^ bits ^ flags) * 0x100000001b3ULL;
+        if ((i & 0xffff) == 0xffff) {
+            printf("%08d: %016llx\n", i + 1, (unsigned long long)sum);
+        }
+    }
+    fesetround(FE_TONEAREST);
+    printf("checksum: %016llx\n", (unsigned long long)sum);
+}
+
+static void bench(long n)
+{
+    volatile float fx = 1.0f;
+    volatile double dx = 1.0;
+    float f = 1.0f;
+    double d = 1.0;
+    long i;
+
+    for (i = 0; i < n; i++) {
+        f = f * 1.0000001f + 0.5f;
+        f = f / 1.0000002f - 0.25f;
+        f = sqrtf(f * f);
+        d = d * 1.0000000001 + 0.5;
+        d = d / 1.0000000002 - 0.25;
+        d = sqrt(d * d);
+    }
+    fx = f;
+    dx = d;
+    printf("%g %g\n", (double)fx, dx);
+}
+
+int main(int argc, char **argv)
+{
+    if (argc > 1 && !strcmp(argv[1], "bench")) {
+        bench(argc > 2 ? atol(argv[2]) : BENCH_ITERATIONS);
+    } else {
+        check();
+    }
+    return 0;
+}
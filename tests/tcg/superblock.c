@@ -0,0 +1,46 @@
+/*
+ * Superblock formation test for the i386 frontend
+ *
+ * The hot loop is a chain of basic blocks connected by forward direct
+ * jumps, written in assembly so that the compiler cannot merge them.
+ * With -tb-hot-threshold the head of the loop is retranslated as one
+ * superblock through the whole chain; the checksum must be the same
+ * with and without it.  An optional argument gives the iteration count
+ * for timing runs.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+
+static unsigned int chain(unsigned int x, long n)
+{
+    asm volatile(".p2align 8\n"
+                 "1:\n\t"
+                 "imul $1103515245, %0, %0\n\t"
+                 "jmp 2f\n\t"
+                 "ud2\n"
+                 "2:\n\t"
+                 "add $12345, %0\n\t"
+                 "jmp 3f\n\t"
+                 "ud2\n"
+                 "3:\n\t"
+                 "rol $7, %0\n\t"
+                 "jmp 4f\n\t"
+                 "ud2\n"
+                 "4:\n\t"
+                 "xor $0x5a5a5a5a, %0\n\t"
+                 "dec %1\n\t"
+                 "jnz 1b\n\t"
+                 : "+r" (x), "+r" (n));
+    return x;
+}
+
+int main(int argc, char **argv)
+{
+    long n = 1000000;
+
+    if (argc > 1) {
+        n = atol(argv[1]);
+    }
+    printf("checksum %08x\n", chain(1, n));
+    return 0;
+}
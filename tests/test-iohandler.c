@@ -0,0 +1,299 @@
+/*
+ * fd handler dispatch tests
+ *
+ * Copyright (c) 2012 agent <agent@local>
+ *
+ * This work is licensed under the terms of the GNU LGPL, version 2 or later.
+ * See the COPYING.LIB file in the top-level directory.
+ *
+ */
+
+#include <glib.h>
+#include <sys/resource.h>
+#include "qemu-common.h"
+#include "qemu-timer.h"
+#include "main-loop.h"
+
+typedef struct {
+    int fds[2];
+    int reads;
+    int writes;
+    bool can_read;
+    int *other_fd;
+} TestPipe;
+
+static void test_pipe_init(TestPipe *p)
+{
+    memset(p, 0, sizeof(*p));
+    g_assert(qemu_pipe(p->fds) == 0);
+    g_assert(fcntl_setfl(p->fds[0], O_NONBLOCK) == 0);
+    g_assert(fcntl_setfl(p->fds[1], O_NONBLOCK) == 0);
+}
+
+static void test_pipe_cleanup(TestPipe *p)
+{
+    qemu_set_fd_handler(p->fds[0], NULL, NULL, NULL);
+    close(p->fds[0]);
+    close(p->fds[1]);
+}
+
+static void test_pipe_kick(TestPipe *p)
+{
+    char c = 0;
+    g_assert(write(p->fds[1], &c, 1) == 1);
+}
+
+static void pipe_read(void *opaque)
+{
+    TestPipe *p = opaque;
+    char buf[64];
+
+    while (read(p->fds[0], buf, sizeof(buf)) > 0) {
+        /* drain */
+    }
+    p->reads++;
+}
+
+static void pipe_read_and_delete(void *opaque)
+{
+    TestPipe *p = opaque;
+
+    pipe_read(opaque);
+    qemu_set_fd_handler(*p->other_fd, NULL, NULL, NULL);
+}
+
+static int pipe_can_read(void *opaque)
+{
+    TestPipe *p = opaque;
+    return p->can_read;
+}
+
+static void pipe_write(void *opaque)
+{
+    TestPipe *p = opaque;
+
+    p->writes++;
+    qemu_set_fd_handler(p->fds[1], NULL, NULL, NULL);
+}
+
+/* Run the main loop until nothing is ready any more */
+static void drain(void)
+{
+    while (main_loop_wait(true) > 0) {
+        /* nothing */
+    }
+}
+
+static void test_read(void)
+{
+    TestPipe p;
+
+    test_pipe_init(&p);
+    qemu_set_fd_handler(p.fds[0], pipe_read, NULL, &p);
+    drain();
+    g_assert_cmpint(p.reads, ==, 0);
+
+    test_pipe_kick(&p);
+    drain();
+    g_assert_cmpint(p.reads, ==, 1);
+
+    /* A removed handler must not run */
+    qemu_set_fd_handler(p.fds[0], NULL, NULL, NULL);
+    test_pipe_kick(&p);
+    drain();
+    g_assert_cmpint(p.reads, ==, 1);
+
+    test_pipe_cleanup(&p);
+}
+
+static void test_write(void)
+{
+    TestPipe p;
+
+    test_pipe_init(&p);
+    qemu_set_fd_handler(p.fds[1], NULL, pipe_write, &p);
+    drain();
+    g_assert_cmpint(p.writes, ==, 1);
+    test_pipe_cleanup(&p);
+}
+
+static void test_read_poll(void)
+{
+    TestPipe p;
+
+    test_pipe_init(&p);
+    qemu_set_fd_handler2(p.fds[0], pipe_can_read, pipe_read, NULL, &p);
+    test_pipe_kick(&p);
+    drain();
+    g_assert_cmpint(p.reads, ==, 0);
+
+    p.can_read = true;
+    drain();
+    g_assert_cmpint(p.reads, ==, 1);
+
+    /* The pipe was drained, but the write end going away must still be
+     * seen as a read event once reading is allowed again. */
+    p.can_read = false;
+    close(p.fds[1]);
+    p.fds[1] = -1;
+    main_loop_wait(true);
+    g_assert_cmpint(p.reads, ==, 1);
+    p.can_read = true;
+    main_loop_wait(true);
+    g_assert_cmpint(p.reads, ==, 2);
+
+    qemu_set_fd_handler(p.fds[0], NULL, NULL, NULL);
+    close(p.fds[0]);
+}
+
+static void test_delete_other(void)
+{
+    TestPipe a, b;
+
+    test_pipe_init(&a);
+    test_pipe_init(&b);
+    a.other_fd = &b.fds[0];
+    b.other_fd = &a.fds[0];
+    qemu_set_fd_handler(a.fds[0], pipe_read_and_delete, NULL, &a);
+    qemu_set_fd_handler(b.fds[0], pipe_read_and_delete, NULL, &b);
+
+    /* Whichever runs first removes the other one */
+    test_pipe_kick(&a);
+    test_pipe_kick(&b);
+    drain();
+    g_assert_cmpint(a.reads + b.reads, ==, 1);
+
+    test_pipe_cleanup(&a);
+    test_pipe_cleanup(&b);
+}
+
+static void test_regular_file(void)
+{
+    char name[] = "/tmp/test-iohandler.XXXXXX";
+    TestPipe p;
+
+    /* Regular files cannot be watched with epoll, but are always readable */
+    memset(&p, 0, sizeof(p));
+    p.fds[0] = mkstemp(name);
+    g_assert(p.fds[0] >= 0);
+    unlink(name);
+
+    qemu_set_fd_handler(p.fds[0], pipe_read, NULL, &p);
+    main_loop_wait(true);
+    g_assert_cmpint(p.reads, ==, 1);
+
+    qemu_set_fd_handler(p.fds[0], NULL, NULL, NULL);
+    close(p.fds[0]);
+}
+
+/* Open enough pipes that the interesting one is above FD_SETSIZE, which
+ * select() could not handle. */
+static void test_many_fds(void)
+{
+    struct rlimit rlim;
+    int n = FD_SETSIZE / 2 + 16;
+    int *fds = g_new(int, 2 * n);
+    TestPipe p;
+    int i;
+
+    getrlimit(RLIMIT_NOFILE, &rlim);
+    if (rlim.rlim_cur < 2 * n + 64) {
+        rlim.rlim_cur = MIN(rlim.rlim_max, 2 * n + 64);
+        setrlimit(RLIMIT_NOFILE, &rlim);
+    }
+    if (rlim.rlim_cur < 2 * n + 64) {
+        g_test_message("RLIMIT_NOFILE too low, skipping\n");
+        g_free(fds);
+        return;
+    }
+
+    for (i = 0; i < n; i++) {
+        g_assert(qemu_pipe(&fds[2 * i]) == 0);
+        qemu_set_fd_handler(fds[2 * i], pipe_read, NULL, NULL);
+    }
+
+    test_pipe_init(&p);
+    g_assert_cmpint(p.fds[0], >=, FD_SETSIZE);
+    qemu_set_fd_handler(p.fds[0], pipe_read, NULL, &p);
+    test_pipe_kick(&p);
+    drain();
+    g_assert_cmpint(p.reads, ==, 1);
+    test_pipe_cleanup(&p);
+
+    for (i = 0; i < n; i++) {
+        qemu_set_fd_handler(fds[2 * i], NULL, NULL, NULL);
+        close(fds[2 * i]);
+        close(fds[2 * i + 1]);
+    }
+    g_free(fds);
+}
+
+/* Wakeup latency: time a write to one pipe until its handler has run,
+ * with a growing number of idle fds registered next to it. */
+static void perf_wakeup(void)
+{
+    static const int counts[] = { 0, 16, 128, 512, 1000 };
+    const int iterations = 20000;
+    struct rlimit rlim;
+    int *fds;
+    TestPipe p;
+    int c, i, n = 0;
+
+    getrlimit(RLIMIT_NOFILE, &rlim);
+    rlim.rlim_cur = rlim.rlim_max;
+    setrlimit(RLIMIT_NOFILE, &rlim);
+
+    fds = g_new(int, 2 * counts[ARRAY_SIZE(counts) - 1]);
+    test_pipe_init(&p);
+    qemu_set_fd_handler(p.fds[0], pipe_read, NULL, &p);
+
+    for (c = 0; c < ARRAY_SIZE(counts); c++) {
+        int64_t start, duration;
+
+        for (; n < counts[c]; n++) {
+            if (qemu_pipe(&fds[2 * n]) < 0) {
+                g_test_message("out of fds at %d\n", n);
+                goto out;
+            }
+            qemu_set_fd_handler(fds[2 * n], pipe_read, NULL, NULL);
+        }
+
+        p.reads = 0;
+        start = get_clock();
+        for (i = 0; i < iterations; i++) {
+            test_pipe_kick(&p);
+            main_loop_wait(false);
+        }
+        duration = get_clock() - start;
+        g_assert_cmpint(p.reads, ==, iterations);
+
+        g_test_message("%4d idle fds: %" PRId64 " ns per wakeup\n",
+                       n, duration / iterations);
+    }
+
+out:
+    while (n-- > 0) {
+        qemu_set_fd_handler(fds[2 * n], NULL, NULL, NULL);
+        close(fds[2 * n]);
+        close(fds[2 * n + 1]);
+    }
+    test_pipe_cleanup(&p);
+    g_free(fds);
+}
+
+int main(int argc, char **argv)
+{
+    qemu_init_main_loop();
+
+    g_test_init(&argc, &argv, NULL);
+    g_test_add_func("/iohandler/read", test_read);
+    g_test_add_func("/iohandler/write", test_write);
+    g_test_add_func("/iohandler/read_poll", test_read_poll);
+    g_test_add_func("/iohandler/delete_other", test_delete_other);
+    g_test_add_func("/iohandler/regular_file", test_regular_file);
+    g_test_add_func("/iohandler/many_fds", test_many_fds);
+    if (g_test_perf()) {
+        g_test_add_func("/perf/wakeup", perf_wakeup);
+    }
+    return g_test_run();
+}
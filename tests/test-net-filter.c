@@ -0,0 +1,180 @@
+/*
+ * Packet filter expression tests
+ *
+ * Copyright (c) 2012 agent <agent@local>
+ *
+ * This work is licensed under the terms of the GNU LGPL, version 2 or later.
+ * See the COPYING.LIB file in the top-level directory.
+ *
+ */
+
+#include <glib.h>
+#include "qemu-common.h"
+#include "net/filter.h"
+
+/* 10.0.2.15:1234 -> 10.0.2.2:80 */
+static size_t build_tcp(uint8_t *buf, bool vlan)
+{
+    uint8_t *p = buf;
+
+    memset(buf, 0, 128);
+    memcpy(p, "\x52\x54\x00\x12\x34\x56\x52\x54\x00\x12\x34\x57", 12);
+    p += 12;
+    if (vlan) {
+        memcpy(p, "\x81\x00\x00\x05", 4);
+        p += 4;
+    }
+    memcpy(p, "\x08\x00", 2);
+    p += 2;
+    p[0] = 0x45;
+    p[9] = 6;
+    memcpy(p + 12, "\x0a\x00\x02\x0f\x0a\x00\x02\x02", 8);
+    memcpy(p + 20, "\x04\xd2\x00\x50", 4);
+    return p + 40 - buf;
+}
+
+static bool match(const char *expr, const uint8_t *buf, size_t size)
+{
+    const char *err = NULL;
+    NetFilter *f = net_filter_new(expr, &err);
+    bool ret;
+
+    g_assert(f);
+    ret = net_filter_match(f, buf, size, size);
+    net_filter_free(f);
+    return ret;
+}
+
+static void test_primitives(void)
+{
+    uint8_t buf[128];
+    size_t size = build_tcp(buf, false);
+
+    g_assert(match("ip", buf, size));
+    g_assert(match("tcp", buf, size));
+    g_assert(!match("udp", buf, size));
+    g_assert(!match("arp", buf, size));
+    g_assert(!match("ip6", buf, size));
+    g_assert(!match("vlan", buf, size));
+    g_assert(!match("broadcast", buf, size));
+    g_assert(!match("multicast", buf, size));
+    g_assert(match("host 10.0.2.2", buf, size));
+    g_assert(match("src host 10.0.2.15", buf, size));
+    g_assert(!match("src host 10.0.2.2", buf, size));
+    g_assert(match("dst host 10.0.2.2", buf, size));
+    g_assert(match("port 80", buf, size));
+    g_assert(match("port 1234", buf, size));
+    g_assert(!match("src port 80", buf, size));
+    g_assert(match("dst port 80", buf, size));
+    g_assert(match("less 54", buf, size));
+    g_assert(!match("less 53", buf, size));
+    g_assert(match("greater 54", buf, size));
+    g_assert(!match("greater 55", buf, size));
+
+    memset(buf, 0xff, 6);
+    g_assert(match("broadcast", buf, size));
+    g_assert(!match("multicast", buf, size));
+    buf[0] = 0x01;
+    g_assert(match("multicast", buf, size));
+}
+
+static void test_vlan(void)
+{
+    uint8_t buf[128];
+    size_t size = build_tcp(buf, true);
+
+    g_assert(match("vlan", buf, size));
+    g_assert(match("tcp and dst port 80", buf, size));
+    g_assert(match("host 10.0.2.15", buf, size));
+}
+
+static void test_fragment(void)
+{
+    uint8_t buf[128];
+    size_t size = build_tcp(buf, false);
+
+    /* A later fragment has no ports */
+    buf[14 + 7] = 0x10;
+    g_assert(match("tcp", buf, size));
+    g_assert(!match("port 80", buf, size));
+    g_assert(!match("not port 80 and port 1234", buf, size));
+}
+
+static void test_truncated(void)
+{
+    uint8_t buf[128];
+    const char *err = NULL;
+    NetFilter *f;
+
+    build_tcp(buf, false);
+    f = net_filter_new("port 80", &err);
+    g_assert(f);
+    g_assert(!net_filter_match(f, buf, 14 + 20 + 2, 1500));
+    g_assert(!net_filter_match(f, buf, 10, 1500));
+    net_filter_free(f);
+
+    f = net_filter_new("greater 1000", &err);
+    g_assert(net_filter_match(f, buf, 14 + 20, 1500));
+    net_filter_free(f);
+}
+
+static void test_operators(void)
+{
+    uint8_t buf[128];
+    size_t size = build_tcp(buf, false);
+
+    g_assert(match("tcp and port 80", buf, size));
+    g_assert(match("tcp && port 80", buf, size));
+    g_assert(!match("udp and port 80", buf, size));
+    g_assert(match("udp or port 80", buf, size));
+    g_assert(match("udp || tcp", buf, size));
+    g_assert(match("not udp", buf, size));
+    g_assert(match("!udp", buf, size));
+    g_assert(match("!!tcp", buf, size));
+    /* and binds tighter than or */
+    g_assert(match("tcp or udp and arp", buf, size));
+    g_assert(!match("(tcp or udp) and arp", buf, size));
+    g_assert(match("not (udp or arp) and (port 22 or port 80)", buf, size));
+}
+
+static void test_errors(void)
+{
+    static const struct {
+        const char *expr;
+        const char *err;
+    } bad[] = {
+        { "", "" },
+        { "foo", "foo" },
+        { "tcp and", "" },
+        { "tcp udp", "udp" },
+        { "(tcp", "" },
+        { "tcp)", ")" },
+        { "port", "" },
+        { "port 65536", "65536" },
+        { "port x", "x" },
+        { "host 10.0.2", "10.0.2" },
+        { "host 10.0.2.256", "10.0.2.256" },
+        { "src tcp", "tcp" },
+        { "tcp & udp", "& udp" },
+    };
+    const char *err;
+    int i;
+
+    for (i = 0; i < ARRAY_SIZE(bad); i++) {
+        err = NULL;
+        g_assert(net_filter_new(bad[i].expr, &err) == NULL);
+        g_assert_cmpstr(err, ==, bad[i].err);
+    }
+}
+
+int main(int argc, char **argv)
+{
+    g_test_init(&argc, &argv, NULL);
+    g_test_add_func("/net/filter/primitives", test_primitives);
+    g_test_add_func("/net/filter/vlan", test_vlan);
+    g_test_add_func("/net/filter/fragment", test_fragment);
+    g_test_add_func("/net/filter/truncated", test_truncated);
+    g_test_add_func("/net/filter/operators", test_operators);
+    g_test_add_func("/net/filter/errors", test_errors);
+    return g_test_run();
+}
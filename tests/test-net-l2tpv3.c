@@ -0,0 +1,92 @@
+/*
+ * L2TPv3 encapsulation tests
+ *
+ * Copyright (c) 2012 agent <agent@local>
+ *
+ * This work is licensed under the terms of the GNU LGPL, version 2 or later.
+ * See the COPYING.LIB file in the top-level directory.
+ *
+ */
+
+#include <glib.h>
+#include "qemu-common.h"
+#include "net/l2tpv3.h"
+
+static void test_plain(void)
+{
+    L2TPv3 l = { .tx_session = 0x01020304, .rx_session = 0x01020304 };
+    uint8_t buf[L2TPV3_HEADER_MAX];
+
+    g_assert_cmpint(l2tpv3_header_size(&l), ==, 8);
+    l2tpv3_write_header(&l, buf);
+    g_assert(!memcmp(buf, "\x00\x03\x00\x00\x01\x02\x03\x04", 8));
+    g_assert_cmpint(l2tpv3_check_header(&l, buf, 8), ==, 8);
+    g_assert_cmpint(l2tpv3_check_header(&l, buf, 7), ==, -1);
+
+    /* Another session */
+    l.rx_session = 0x01020305;
+    g_assert_cmpint(l2tpv3_check_header(&l, buf, 8), ==, -1);
+    l.rx_session = 0x01020304;
+
+    /* Control messages and other versions */
+    buf[0] = 0x80;
+    g_assert_cmpint(l2tpv3_check_header(&l, buf, 8), ==, -1);
+    buf[0] = 0;
+    buf[1] = 2;
+    g_assert_cmpint(l2tpv3_check_header(&l, buf, 8), ==, -1);
+}
+
+static void test_cookie(void)
+{
+    L2TPv3 tx = {
+        .tx_session = 7, .tx_cookie = 0x1122334455667788ULL,
+        .cookie_size = 8,
+    };
+    L2TPv3 rx = {
+        .rx_session = 7, .rx_cookie = 0x1122334455667788ULL,
+        .cookie_size = 8,
+    };
+    uint8_t buf[L2TPV3_HEADER_MAX];
+
+    g_assert_cmpint(l2tpv3_header_size(&tx), ==, 16);
+    l2tpv3_write_header(&tx, buf);
+    g_assert(!memcmp(buf + 8, "\x11\x22\x33\x44\x55\x66\x77\x88", 8));
+    g_assert_cmpint(l2tpv3_check_header(&rx, buf, 16), ==, 16);
+    rx.rx_cookie++;
+    g_assert_cmpint(l2tpv3_check_header(&rx, buf, 16), ==, -1);
+
+    /* 32-bit cookies are the low half of the value */
+    tx.cookie_size = rx.cookie_size = 4;
+    l2tpv3_write_header(&tx, buf);
+    g_assert(!memcmp(buf + 8, "\x55\x66\x77\x88", 4));
+    g_assert_cmpint(l2tpv3_check_header(&rx, buf, 12), ==, -1);
+    rx.rx_cookie = 0x55667788;
+    g_assert_cmpint(l2tpv3_check_header(&rx, buf, 12), ==, 12);
+}
+
+static void test_counter(void)
+{
+    L2TPv3 l = {
+        .tx_session = 1, .rx_session = 1, .cookie_size = 4,
+        .counter = true, .tx_seq = 0xffffff,
+    };
+    uint8_t buf[L2TPV3_HEADER_MAX];
+
+    g_assert_cmpint(l2tpv3_header_size(&l), ==, 16);
+    l2tpv3_write_header(&l, buf);
+    g_assert(!memcmp(buf + 12, "\x40\xff\xff\xff", 4));
+    l2tpv3_write_header(&l, buf);
+    g_assert(!memcmp(buf + 12, "\x40\x00\x00\x00", 4));
+    l2tpv3_write_header(&l, buf);
+    g_assert(!memcmp(buf + 12, "\x40\x00\x00\x01", 4));
+    g_assert_cmpint(l2tpv3_check_header(&l, buf, 16), ==, 16);
+}
+
+int main(int argc, char **argv)
+{
+    g_test_init(&argc, &argv, NULL);
+    g_test_add_func("/net/l2tpv3/plain", test_plain);
+    g_test_add_func("/net/l2tpv3/cookie", test_cookie);
+    g_test_add_func("/net/l2tpv3/counter", test_counter);
+    return g_test_run();
+}
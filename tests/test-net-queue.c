@@ -0,0 +1,378 @@
+/*
+ * Network packet queue tests
+ *
+ * Copyright (c) 2012 agent <agent@local>
+ *
+ * This work is licensed under the terms of the GNU LGPL, version 2 or later.
+ * See the COPYING.LIB file in the top-level directory.
+ *
+ */
+
+#include <glib.h>
+#include "qemu-common.h"
+#include "qemu-thread.h"
+#include "net/queue.h"
+#include "net/ring.h"
+
+#define MAX_PACKETS 16
+
+typedef struct {
+    bool stalled;
+    int delivered;
+    const uint8_t *data[MAX_PACKETS];
+    uint8_t first[MAX_PACKETS];
+    size_t size[MAX_PACKETS];
+    int sent;
+    ssize_t sent_ret;
+} TestReceiver;
+
+static TestReceiver rx;
+static VLANClientState *sender = (VLANClientState *)&rx;
+
+static ssize_t test_deliver(VLANClientState *sender, unsigned flags,
+                            const uint8_t *buf, size_t size, void *opaque)
+{
+    TestReceiver *r = opaque;
+
+    if (r->stalled) {
+        return 0;
+    }
+    if (r->delivered < MAX_PACKETS) {
+        r->data[r->delivered] = buf;
+        r->first[r->delivered] = buf[0];
+        r->size[r->delivered] = size;
+    }
+    r->delivered++;
+    return size;
+}
+
+static ssize_t test_deliver_iov(VLANClientState *sender, unsigned flags,
+                                const struct iovec *iov, int iovcnt,
+                                void *opaque)
+{
+    TestReceiver *r = opaque;
+    size_t size = 0;
+    int i;
+
+    if (r->stalled) {
+        return 0;
+    }
+    for (i = 0; i < iovcnt; i++) {
+        size += iov[i].iov_len;
+    }
+    if (r->delivered < MAX_PACKETS) {
+        r->data[r->delivered] = iov[0].iov_base;
+        r->first[r->delivered] = *(uint8_t *)iov[0].iov_base;
+        r->size[r->delivered] = size;
+    }
+    r->delivered++;
+    return size;
+}
+
+static void test_sent(VLANClientState *sender, ssize_t ret)
+{
+    rx.sent++;
+    rx.sent_ret = ret;
+}
+
+static NetQueue *test_queue_new(void)
+{
+    memset(&rx, 0, sizeof(rx));
+    return qemu_new_net_queue(test_deliver, test_deliver_iov, &rx);
+}
+
+static void test_direct(void)
+{
+    NetQueue *queue = test_queue_new();
+    uint8_t buf[64] = { 1 };
+
+    g_assert_cmpint(qemu_net_queue_send(queue, sender, 0, buf, sizeof(buf),
+                                        test_sent), ==, sizeof(buf));
+    g_assert_cmpint(rx.delivered, ==, 1);
+    g_assert(rx.data[0] == buf);
+    g_assert_cmpint(rx.sent, ==, 0);
+    qemu_del_net_queue(queue);
+}
+
+/* A packet queued with a sent callback is delivered from the sender's
+ * own buffer once the receiver is ready again. */
+static void test_stall_borrows(void)
+{
+    NetQueue *queue = test_queue_new();
+    uint8_t buf[64] = { 1 };
+
+    rx.stalled = true;
+    g_assert_cmpint(qemu_net_queue_send(queue, sender, 0, buf, sizeof(buf),
+                                        test_sent), ==, 0);
+    g_assert_cmpint(rx.delivered, ==, 0);
+
+    rx.stalled = false;
+    qemu_net_queue_flush(queue);
+    g_assert_cmpint(rx.delivered, ==, 1);
+    g_assert(rx.data[0] == buf);
+    g_assert_cmpint(rx.size[0], ==, sizeof(buf));
+    g_assert_cmpint(rx.sent, ==, 1);
+    g_assert_cmpint(rx.sent_ret, ==, sizeof(buf));
+    qemu_del_net_queue(queue);
+}
+
+static void test_stall_borrows_iov(void)
+{
+    NetQueue *queue = test_queue_new();
+    uint8_t a[16] = { 2 }, b[48];
+    struct iovec iov[2] = {
+        { .iov_base = a, .iov_len = sizeof(a) },
+        { .iov_base = b, .iov_len = sizeof(b) },
+    };
+
+    rx.stalled = true;
+    g_assert_cmpint(qemu_net_queue_send_iov(queue, sender, 0, iov, 2,
+                                            test_sent), ==, 0);
+
+    /* The iovec array itself may go away, the data may not */
+    memset(iov, 0, sizeof(iov));
+
+    rx.stalled = false;
+    qemu_net_queue_flush(queue);
+    g_assert_cmpint(rx.delivered, ==, 1);
+    g_assert(rx.data[0] == a);
+    g_assert_cmpint(rx.size[0], ==, sizeof(a) + sizeof(b));
+    g_assert_cmpint(rx.sent, ==, 1);
+    qemu_del_net_queue(queue);
+}
+
+static ssize_t test_deliver_reenter(VLANClientState *s, unsigned flags,
+                                    const uint8_t *buf, size_t size,
+                                    void *opaque)
+{
+    NetQueue **queue = opaque;
+    uint8_t inner[32];
+
+    /* Sending from within delivery queues a copy, since the sender gets
+     * no callback and may reuse its buffer right away. */
+    if (buf[0] == 1) {
+        memset(inner, 3, sizeof(inner));
+        g_assert_cmpint(qemu_net_queue_send(*queue, sender, 0, inner,
+                                            sizeof(inner), NULL),
+                        ==, sizeof(inner));
+        memset(inner, 4, sizeof(inner));
+    } else {
+        g_assert_cmpint(buf[0], ==, 3);
+        g_assert_cmpint(buf[sizeof(inner) - 1], ==, 3);
+    }
+    rx.delivered++;
+    return size;
+}
+
+static void test_reentrant_copies(void)
+{
+    NetQueue *queue;
+    uint8_t buf[64] = { 1 };
+
+    memset(&rx, 0, sizeof(rx));
+    queue = qemu_new_net_queue(test_deliver_reenter, test_deliver_iov, &queue);
+    qemu_net_queue_send(queue, sender, 0, buf, sizeof(buf), NULL);
+    g_assert_cmpint(rx.delivered, ==, 2);
+    qemu_del_net_queue(queue);
+}
+
+static void test_order_and_purge(void)
+{
+    NetQueue *queue = test_queue_new();
+    VLANClientState *other = (VLANClientState *)&queue;
+    uint8_t bufs[4][64];
+    int i;
+
+    rx.stalled = true;
+    for (i = 0; i < 4; i++) {
+        bufs[i][0] = i;
+        qemu_net_queue_send(queue, i == 2 ? other : sender, 0,
+                            bufs[i], sizeof(bufs[i]), test_sent);
+    }
+    qemu_net_queue_purge(queue, other);
+
+    rx.stalled = false;
+    qemu_net_queue_flush(queue);
+    g_assert_cmpint(rx.delivered, ==, 3);
+    g_assert_cmpint(rx.first[0], ==, 0);
+    g_assert_cmpint(rx.first[1], ==, 1);
+    g_assert_cmpint(rx.first[2], ==, 3);
+    g_assert_cmpint(rx.sent, ==, 3);
+    qemu_del_net_queue(queue);
+}
+
+/* Recycled packets must be grown when a bigger one comes along */
+static void test_recycle_grow(void)
+{
+    NetQueue *queue = test_queue_new();
+    static uint8_t big[65536];
+    uint8_t small[60] = { 1 };
+
+    rx.stalled = true;
+    qemu_net_queue_send(queue, sender, 0, small, sizeof(small), NULL);
+    rx.stalled = false;
+    qemu_net_queue_flush(queue);
+
+    memset(big, 5, sizeof(big));
+    rx.stalled = true;
+    g_assert_cmpint(qemu_net_queue_send(queue, sender, 0, big, sizeof(big),
+                                        NULL), ==, 0);
+    memset(big, 6, sizeof(big));
+    rx.stalled = false;
+    qemu_net_queue_flush(queue);
+    g_assert_cmpint(rx.delivered, ==, 2);
+    g_assert(rx.data[1] != big);
+    g_assert_cmpint(rx.first[1], ==, 5);
+    g_assert_cmpint(rx.size[1], ==, sizeof(big));
+    qemu_del_net_queue(queue);
+}
+
+/* A receiver that never drains must not make the queue grow without end;
+ * senders whose packet is dropped must not be left waiting. */
+static void test_overflow(void)
+{
+    NetQueue *queue = test_queue_new();
+    uint8_t buf[64] = { 1 };
+    int i, queued = 0;
+
+    rx.stalled = true;
+    for (i = 0; i < 1000; i++) {
+        if (qemu_net_queue_send(queue, sender, 0, buf, sizeof(buf),
+                                test_sent) == 0) {
+            queued++;
+        }
+    }
+    g_assert_cmpint(queued, >, 0);
+    g_assert_cmpint(queued, <, 1000);
+
+    rx.stalled = false;
+    qemu_net_queue_flush(queue);
+    g_assert_cmpint(rx.sent, ==, queued);
+    qemu_del_net_queue(queue);
+}
+
+#define RING_ITEMS 100000
+
+static void *ring_producer(void *opaque)
+{
+    NetRing *ring = opaque;
+    uintptr_t i;
+
+    for (i = 1; i <= RING_ITEMS; i++) {
+        while (!net_ring_push(ring, (void *)i)) {
+            g_thread_yield();
+        }
+    }
+    return NULL;
+}
+
+static void test_ring_threads(void)
+{
+    NetRing *ring = net_ring_new(64);
+    QemuThread thread;
+    uintptr_t expect = 1;
+    void *entry;
+
+    qemu_thread_create(&thread, ring_producer, ring, QEMU_THREAD_JOINABLE);
+    while (expect <= RING_ITEMS) {
+        entry = net_ring_peek(ring);
+        if (entry) {
+            g_assert(entry == (void *)expect);
+            net_ring_pop(ring);
+            expect++;
+        } else {
+            g_thread_yield();
+        }
+    }
+    qemu_thread_join(&thread);
+    g_assert(net_ring_peek(ring) == NULL);
+    net_ring_free(ring);
+}
+
+/* A network I/O thread pushes while the main thread flushes */
+#define PUSH_PACKETS 20000
+
+typedef struct {
+    NetQueue *queue;
+    int notified;
+    int delivered;
+} PushState;
+
+static ssize_t push_deliver(VLANClientState *sender, unsigned flags,
+                            const uint8_t *buf, size_t size, void *opaque)
+{
+    PushState *s = opaque;
+    uint32_t seq;
+
+    memcpy(&seq, buf, sizeof(seq));
+    g_assert_cmpint(seq, ==, s->delivered);
+    g_assert_cmpint(size, ==, 60 + seq % 4000);
+    g_assert_cmpint(buf[size - 1], ==, (uint8_t)seq);
+    s->delivered++;
+    return size;
+}
+
+static ssize_t push_deliver_iov(VLANClientState *sender, unsigned flags,
+                                const struct iovec *iov, int iovcnt,
+                                void *opaque)
+{
+    g_assert_not_reached();
+    return -1;
+}
+
+static void push_notify(void *opaque)
+{
+    PushState *s = opaque;
+
+    s->notified++;
+}
+
+static void *push_producer(void *opaque)
+{
+    PushState *s = opaque;
+    static uint8_t buf[4096];
+    uint32_t seq;
+    size_t size;
+
+    for (seq = 0; seq < PUSH_PACKETS; seq++) {
+        size = 60 + seq % 4000;
+        memcpy(buf, &seq, sizeof(seq));
+        buf[size - 1] = seq;
+        while (!qemu_net_queue_push(s->queue, sender, 0, buf, size)) {
+            g_thread_yield();
+        }
+    }
+    return NULL;
+}
+
+static void test_push_thread(void)
+{
+    PushState s = { 0 };
+    QemuThread thread;
+
+    s.queue = qemu_new_net_queue(push_deliver, push_deliver_iov, &s);
+    qemu_net_queue_set_notify(s.queue, push_notify, &s);
+    qemu_thread_create(&thread, push_producer, &s, QEMU_THREAD_JOINABLE);
+    while (s.delivered < PUSH_PACKETS) {
+        qemu_net_queue_flush(s.queue);
+        g_thread_yield();
+    }
+    qemu_thread_join(&thread);
+    g_assert_cmpint(s.notified, ==, PUSH_PACKETS);
+    qemu_del_net_queue(s.queue);
+}
+
+int main(int argc, char **argv)
+{
+    g_test_init(&argc, &argv, NULL);
+    g_test_add_func("/net/queue/direct", test_direct);
+    g_test_add_func("/net/queue/stall_borrows", test_stall_borrows);
+    g_test_add_func("/net/queue/stall_borrows_iov", test_stall_borrows_iov);
+    g_test_add_func("/net/queue/reentrant_copies", test_reentrant_copies);
+    g_test_add_func("/net/queue/order_and_purge", test_order_and_purge);
+    g_test_add_func("/net/queue/recycle_grow", test_recycle_grow);
+    g_test_add_func("/net/queue/overflow", test_overflow);
+    g_test_add_func("/net/queue/push_thread", test_push_thread);
+    g_test_add_func("/net/ring/threads", test_ring_threads);
+    return g_test_run();
+}
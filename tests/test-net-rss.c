@@ -0,0 +1,223 @@
+/*
+ * Receive side scaling hash tests
+ *
+ * Copyright (c) 2012 agent <agent@local>
+ *
+ * This work is licensed under the terms of the GNU LGPL, version 2 or later.
+ * See the COPYING.LIB file in the top-level directory.
+ *
+ */
+
+#include <glib.h>
+#include "qemu-common.h"
+#include "net/rss.h"
+
+/* The verification suite of the Microsoft RSS specification, which uses
+ * the default key.  Addresses and ports are those of the received packet.
+ */
+static const struct {
+    uint8_t src[4], dst[4];
+    uint16_t sport, dport;
+    uint32_t hash_ip, hash_tcp;
+} ipv4_vectors[] = {
+    { { 66, 9, 149, 187 }, { 161, 142, 100, 80 }, 2794, 1766,
+      0x323e8fc2, 0x51ccc178 },
+    { { 199, 92, 111, 2 }, { 65, 69, 140, 83 }, 14230, 4739,
+      0xd718262a, 0xc626b0ea },
+    { { 24, 19, 198, 95 }, { 12, 22, 207, 184 }, 12898, 38024,
+      0xd2d0a5de, 0x5c2b394a },
+    { { 38, 27, 205, 30 }, { 209, 142, 163, 6 }, 48228, 2217,
+      0x82989176, 0xafc7327f },
+    { { 153, 39, 163, 191 }, { 202, 188, 127, 2 }, 44251, 1303,
+      0x5d1809c5, 0x10e828a2 },
+};
+
+static size_t build_ipv4(uint8_t *buf, const uint8_t *src, const uint8_t *dst,
+                         uint16_t sport, uint16_t dport, int proto)
+{
+    uint8_t *ip = buf + 14;
+
+    memset(buf, 0, 14 + 20 + 20);
+    buf[12] = 0x08;
+    ip[0] = 0x45;
+    ip[9] = proto;
+    memcpy(ip + 12, src, 4);
+    memcpy(ip + 16, dst, 4);
+    ip[20] = sport >> 8;
+    ip[21] = sport;
+    ip[22] = dport >> 8;
+    ip[23] = dport;
+    return 14 + 20 + 20;
+}
+
+static void test_toeplitz(void)
+{
+    NetRSS *rss = g_new0(NetRSS, 1);
+    uint8_t input[12];
+    int i;
+
+    net_rss_init(rss, 1);
+    for (i = 0; i < ARRAY_SIZE(ipv4_vectors); i++) {
+        memcpy(input, ipv4_vectors[i].src, 4);
+        memcpy(input + 4, ipv4_vectors[i].dst, 4);
+        input[8] = ipv4_vectors[i].sport >> 8;
+        input[9] = ipv4_vectors[i].sport;
+        input[10] = ipv4_vectors[i].dport >> 8;
+        input[11] = ipv4_vectors[i].dport;
+        g_assert_cmphex(net_rss_toeplitz(rss->key, input, 8), ==,
+                        ipv4_vectors[i].hash_ip);
+        g_assert_cmphex(net_rss_toeplitz(rss->key, input, 12), ==,
+                        ipv4_vectors[i].hash_tcp);
+    }
+    g_free(rss);
+}
+
+static void test_ipv4(void)
+{
+    NetRSS *rss = g_new0(NetRSS, 1);
+    uint8_t buf[64];
+    uint32_t hash;
+    size_t size;
+    int i;
+
+    net_rss_init(rss, 1);
+    for (i = 0; i < ARRAY_SIZE(ipv4_vectors); i++) {
+        size = build_ipv4(buf, ipv4_vectors[i].src, ipv4_vectors[i].dst,
+                          ipv4_vectors[i].sport, ipv4_vectors[i].dport, 6);
+
+        rss->types = NET_RSS_HASH_ALL;
+        g_assert(net_rss_hash(rss, buf, size, &hash));
+        g_assert_cmphex(hash, ==, ipv4_vectors[i].hash_tcp);
+
+        /* TCP hashing disabled: addresses only */
+        rss->types = NET_RSS_HASH_IPV4;
+        g_assert(net_rss_hash(rss, buf, size, &hash));
+        g_assert_cmphex(hash, ==, ipv4_vectors[i].hash_ip);
+
+        rss->types = NET_RSS_HASH_TCP_IPV4;
+        g_assert(net_rss_hash(rss, buf, size, &hash));
+        g_assert_cmphex(hash, ==, ipv4_vectors[i].hash_tcp);
+
+        /* Fragments are hashed without the ports */
+        rss->types = NET_RSS_HASH_ALL;
+        buf[14 + 6] = 0x20;
+        g_assert(net_rss_hash(rss, buf, size, &hash));
+        g_assert_cmphex(hash, ==, ipv4_vectors[i].hash_ip);
+    }
+
+    /* Neither IPv4 nor TCP hashing: not hashed */
+    rss->types = NET_RSS_HASH_IPV6 | NET_RSS_HASH_UDP_IPV4;
+    size = build_ipv4(buf, ipv4_vectors[0].src, ipv4_vectors[0].dst,
+                      ipv4_vectors[0].sport, ipv4_vectors[0].dport, 6);
+    g_assert(!net_rss_hash(rss, buf, size, &hash));
+    g_free(rss);
+}
+
+static void test_vlan(void)
+{
+    NetRSS *rss = g_new0(NetRSS, 1);
+    uint8_t buf[68], plain[64];
+    uint32_t hash;
+    size_t size;
+
+    net_rss_init(rss, 1);
+    size = build_ipv4(plain, ipv4_vectors[1].src, ipv4_vectors[1].dst,
+                      ipv4_vectors[1].sport, ipv4_vectors[1].dport, 17);
+    memcpy(buf, plain, 12);
+    buf[12] = 0x81;
+    buf[13] = 0x00;
+    buf[14] = 0;
+    buf[15] = 5;
+    memcpy(buf + 16, plain + 12, size - 12);
+
+    g_assert(net_rss_hash(rss, buf, size + 4, &hash));
+    g_assert_cmphex(hash, ==, ipv4_vectors[1].hash_tcp);
+    g_free(rss);
+}
+
+static void test_not_ip(void)
+{
+    NetRSS *rss = g_new0(NetRSS, 1);
+    uint8_t buf[64];
+    uint32_t hash;
+
+    net_rss_init(rss, 4);
+    memset(buf, 0, sizeof(buf));
+    buf[12] = 0x08;
+    buf[13] = 0x06;
+    g_assert(!net_rss_hash(rss, buf, sizeof(buf), &hash));
+    g_assert_cmpint(net_rss_queue(rss, buf, sizeof(buf)), ==, 0);
+
+    /* Truncated headers */
+    build_ipv4(buf, ipv4_vectors[0].src, ipv4_vectors[0].dst, 1, 2, 6);
+    g_assert(!net_rss_hash(rss, buf, 14 + 19, &hash));
+    g_free(rss);
+}
+
+static void test_ipv6(void)
+{
+    NetRSS *rss = g_new0(NetRSS, 1);
+    uint8_t buf[14 + 40 + 20], input[36];
+    uint32_t hash;
+    int i;
+
+    net_rss_init(rss, 1);
+    memset(buf, 0, sizeof(buf));
+    buf[12] = 0x86;
+    buf[13] = 0xdd;
+    buf[14] = 0x60;
+    buf[14 + 6] = 6;
+    for (i = 0; i < 32 + 4; i++) {
+        buf[14 + 8 + i] = input[i] = i * 7 + 1;
+    }
+
+    g_assert(net_rss_hash(rss, buf, sizeof(buf), &hash));
+    g_assert_cmphex(hash, ==, net_rss_toeplitz(rss->key, input, 36));
+
+    rss->types = NET_RSS_HASH_IPV6;
+    g_assert(net_rss_hash(rss, buf, sizeof(buf), &hash));
+    g_assert_cmphex(hash, ==, net_rss_toeplitz(rss->key, input, 32));
+    g_free(rss);
+}
+
+/* The same flow always goes to the same queue, and all queues are used */
+static void test_queue(void)
+{
+    NetRSS *rss = g_new0(NetRSS, 1);
+    uint8_t buf[64], src[4] = { 10, 0, 0, 1 }, dst[4] = { 10, 0, 0, 2 };
+    unsigned int used = 0, q;
+    size_t size;
+    int port;
+
+    net_rss_init(rss, 4);
+    for (port = 1024; port < 1024 + 256; port++) {
+        size = build_ipv4(buf, src, dst, port, 80, 6);
+        q = net_rss_queue(rss, buf, size);
+        g_assert_cmpint(q, <, 4);
+        g_assert_cmpint(net_rss_queue(rss, buf, size), ==, q);
+        used |= 1 << q;
+    }
+    g_assert_cmpint(used, ==, 0xf);
+
+    /* Fewer queues: the flows are spread over those only */
+    net_rss_set_queues(rss, 2);
+    used = 0;
+    for (port = 1024; port < 1024 + 256; port++) {
+        size = build_ipv4(buf, src, dst, port, 80, 6);
+        used |= 1 << net_rss_queue(rss, buf, size);
+    }
+    g_assert_cmpint(used, ==, 0x3);
+    g_free(rss);
+}
+
+int main(int argc, char **argv)
+{
+    g_test_init(&argc, &argv, NULL);
+    g_test_add_func("/net/rss/toeplitz", test_toeplitz);
+    g_test_add_func("/net/rss/ipv4", test_ipv4);
+    g_test_add_func("/net/rss/vlan", test_vlan);
+    g_test_add_func("/net/rss/not_ip", test_not_ip);
+    g_test_add_func("/net/rss/ipv6", test_ipv6);
+    g_test_add_func("/net/rss/queue", test_queue);
+    return g_test_run();
+}
@@ -0,0 +1,264 @@
+/*
+ * vhost-user tests, against the loopback backend
+ *
+ * Copyright (c) 2012 agent <agent@local>
+ *
+ * This work is licensed under the terms of the GNU LGPL, version 2 or later.
+ * See the COPYING.LIB file in the top-level directory.
+ *
+ */
+
+#include <glib.h>
+#include <signal.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <sys/eventfd.h>
+#include "qemu-common.h"
+#include "hw/vhost.h"
+#include "hw/vhost-user.h"
+
+/* Guest RAM, one file shared with the backend as with -mem-path.  Guest
+ * physical addresses are offsets into it.  */
+#define TEST_RAM_SIZE   (1024 * 1024)
+#define TEST_RING_NUM   4
+#define TEST_RING(i)    (0x1000 + (i) * 0x3000)
+#define TEST_TX_BUF     0x10000
+#define TEST_RX_BUF     0x20000
+
+enum {
+    TEST_RX,
+    TEST_TX,
+};
+
+static const char *backend_path;
+
+typedef struct TestBackend {
+    char dir[64];
+    char *sock_path;
+    pid_t pid;
+    struct vhost_dev dev;
+    int ram_fd;
+    uint8_t *ram;
+} TestBackend;
+
+static TestBackend *current;
+
+/* What exec.c does for -mem-path RAM */
+int qemu_ram_get_fd(void *ptr, ram_addr_t *offset, ram_addr_t *length)
+{
+    uint8_t *p = ptr;
+
+    if (!current || p < current->ram || p >= current->ram + TEST_RAM_SIZE) {
+        return -1;
+    }
+    *offset = p - current->ram;
+    *length = TEST_RAM_SIZE - *offset;
+    return current->ram_fd;
+}
+
+static void test_backend_start(TestBackend *b)
+{
+    struct sockaddr_un un = { .sun_family = AF_UNIX };
+    char *ram_path;
+    int fd, i;
+
+    memset(b, 0, sizeof(*b));
+    pstrcpy(b->dir, sizeof(b->dir), "/tmp/test-vhost-user-XXXXXX");
+    g_assert(mkdtemp(b->dir));
+    b->sock_path = g_strdup_printf("%s/vu.sock", b->dir);
+
+    b->pid = fork();
+    g_assert(b->pid >= 0);
+    if (!b->pid) {
+        /* Keep the disconnect message out of the test log */
+        fd = open("/dev/null", O_WRONLY);
+        dup2(fd, 1);
+        execl(backend_path, backend_path, b->sock_path, NULL);
+        _exit(1);
+    }
+
+    b->dev.backend_type = VHOST_BACKEND_TYPE_USER;
+    b->dev.control = socket(AF_UNIX, SOCK_STREAM, 0);
+    g_assert(b->dev.control >= 0);
+    pstrcpy(un.sun_path, sizeof(un.sun_path), b->sock_path);
+    for (i = 0; connect(b->dev.control, (struct sockaddr *)&un,
+                        sizeof(un)) < 0; i++) {
+        g_assert(i < 500);
+        g_usleep(10 * 1000);
+    }
+
+    ram_path = g_strdup_printf("%s/ram", b->dir);
+    b->ram_fd = open(ram_path, O_RDWR | O_CREAT, 0600);
+    g_assert(b->ram_fd >= 0);
+    unlink(ram_path);
+    g_free(ram_path);
+    g_assert(ftruncate(b->ram_fd, TEST_RAM_SIZE) == 0);
+    b->ram = mmap(NULL, TEST_RAM_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED,
+                  b->ram_fd, 0);
+    g_assert(b->ram != MAP_FAILED);
+    current = b;
+}
+
+static void test_backend_stop(TestBackend *b)
+{
+    int status;
+
+    current = NULL;
+    close(b->dev.control);
+    kill(b->pid, SIGTERM);
+    g_assert(waitpid(b->pid, &status, 0) == b->pid);
+    munmap(b->ram, TEST_RAM_SIZE);
+    close(b->ram_fd);
+    unlink(b->sock_path);
+    rmdir(b->dir);
+    g_free(b->sock_path);
+}
+
+static int test_call(TestBackend *b, unsigned long request, void *arg)
+{
+    return vhost_user_call(&b->dev, request, arg);
+}
+
+/* SET_OWNER, GET_FEATURES and SET_MEM_TABLE, as vhost_dev_init and
+ * vhost_dev_start send them */
+static void test_handshake(TestBackend *b)
+{
+    struct vhost_memory *mem;
+    uint64_t features = ~0ULL;
+
+    g_assert_cmpint(test_call(b, VHOST_SET_OWNER, NULL), ==, 0);
+    g_assert_cmpint(test_call(b, VHOST_GET_FEATURES, &features), ==, 0);
+    /* The loopback backend only knows the basic split ring */
+    g_assert_cmpint(features, ==, 0);
+
+    mem = g_malloc0(offsetof(struct vhost_memory, regions) +
+                    sizeof(mem->regions[0]));
+    mem->nregions = 1;
+    mem->regions[0].guest_phys_addr = 0;
+    mem->regions[0].memory_size = TEST_RAM_SIZE;
+    mem->regions[0].userspace_addr = (uintptr_t)b->ram;
+    g_assert_cmpint(test_call(b, VHOST_SET_MEM_TABLE, mem), ==, 0);
+    g_free(mem);
+}
+
+static void test_messages(void)
+{
+    TestBackend b;
+    struct vhost_vring_state state = { .index = TEST_TX, .num = 42 };
+
+    test_backend_start(&b);
+    test_handshake(&b);
+
+    /* The backend drops the connection if it could not map the table, so
+     * a request with a reply shows that it got this far */
+    g_assert_cmpint(test_call(&b, VHOST_SET_VRING_BASE, &state), ==, 0);
+    state.num = 0;
+    g_assert_cmpint(test_call(&b, VHOST_GET_VRING_BASE, &state), ==, 0);
+    g_assert_cmpint(state.index, ==, TEST_TX);
+    g_assert_cmpint(state.num, ==, 42);
+
+    test_backend_stop(&b);
+}
+
+static void test_ring_setup(TestBackend *b, unsigned int index, int kick,
+                            int call)
+{
+    uint8_t *ring = b->ram + TEST_RING(index);
+    struct vhost_vring_state state = { .index = index };
+    struct vhost_vring_addr addr = {
+        .index = index,
+        .desc_user_addr = (uintptr_t)ring,
+        .avail_user_addr = (uintptr_t)ring + 0x1000,
+        .used_user_addr = (uintptr_t)ring + 0x2000,
+    };
+    struct vhost_vring_file file = { .index = index };
+
+    state.num = TEST_RING_NUM;
+    g_assert_cmpint(test_call(b, VHOST_SET_VRING_NUM, &state), ==, 0);
+    state.num = 0;
+    g_assert_cmpint(test_call(b, VHOST_SET_VRING_BASE, &state), ==, 0);
+    g_assert_cmpint(test_call(b, VHOST_SET_VRING_ADDR, &addr), ==, 0);
+    file.fd = kick;
+    g_assert_cmpint(test_call(b, VHOST_SET_VRING_KICK, &file), ==, 0);
+    file.fd = call;
+    g_assert_cmpint(test_call(b, VHOST_SET_VRING_CALL, &file), ==, 0);
+    file.fd = b->dev.control;
+    g_assert_cmpint(test_call(b, VHOST_NET_SET_BACKEND, &file), ==, 0);
+}
+
+static void test_ring_add(TestBackend *b, unsigned int index, uint64_t gpa,
+                          uint32_t len, uint16_t flags)
+{
+    uint8_t *ring = b->ram + TEST_RING(index);
+    struct vring_desc *desc = (struct vring_desc *)ring;
+    struct vring_avail *avail = (struct vring_avail *)(ring + 0x1000);
+
+    desc[0].addr = gpa;
+    desc[0].len = len;
+    desc[0].flags = flags;
+    avail->ring[avail->idx % TEST_RING_NUM] = 0;
+    __sync_synchronize();
+    avail->idx++;
+}
+
+static struct vring_used *test_ring_used(TestBackend *b, unsigned int index)
+{
+    return (struct vring_used *)(b->ram + TEST_RING(index) + 0x2000);
+}
+
+static void test_loopback(void)
+{
+    TestBackend b;
+    struct pollfd pfd;
+    struct vring_used *used;
+    uint64_t one = 1;
+    int kick, call, i;
+
+    test_backend_start(&b);
+    test_handshake(&b);
+
+    kick = eventfd(0, 0);
+    call = eventfd(0, 0);
+    g_assert(kick >= 0 && call >= 0);
+    test_ring_setup(&b, TEST_RX, -1, call);
+    test_ring_setup(&b, TEST_TX, kick, -1);
+
+    for (i = 0; i < 64; i++) {
+        b.ram[TEST_TX_BUF + i] = i;
+    }
+    test_ring_add(&b, TEST_RX, TEST_RX_BUF, 2048, VRING_DESC_F_WRITE);
+    test_ring_add(&b, TEST_TX, TEST_TX_BUF, 64, 0);
+    g_assert(write(kick, &one, sizeof(one)) == sizeof(one));
+
+    pfd.fd = call;
+    pfd.events = POLLIN;
+    g_assert_cmpint(poll(&pfd, 1, 5000), ==, 1);
+
+    used = test_ring_used(&b, TEST_RX);
+    g_assert_cmpint(used->idx, ==, 1);
+    g_assert_cmpint(used->ring[0].id, ==, 0);
+    g_assert_cmpint(used->ring[0].len, ==, 64);
+    g_assert(!memcmp(b.ram + TEST_RX_BUF, b.ram + TEST_TX_BUF, 64));
+    g_assert_cmpint(test_ring_used(&b, TEST_TX)->idx, ==, 1);
+
+    close(kick);
+    close(call);
+    test_backend_stop(&b);
+}
+
+int main(int argc, char **argv)
+{
+    char *dir = g_path_get_dirname(argv[0]);
+
+    g_test_init(&argc, &argv, NULL);
+    backend_path = g_strdup_printf("%s/vhost-user-loopback", dir);
+    g_free(dir);
+    signal(SIGPIPE, SIG_IGN);
+
+    g_test_add_func("/vhost-user/messages", test_messages);
+    g_test_add_func("/vhost-user/loopback", test_loopback);
+    return g_test_run();
+}
@@ -0,0 +1,497 @@
+/*
+ * vhost-user loopback backend
+ *
+ * Copyright (c) 2012 agent <agent@local>
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ *
+ * A minimal process at the other end of -netdev vhost-user: every packet
+ * that the guest sends is copied into the next receive buffer of the same
+ * guest.  It shows what a backend has to do, and measures the cost of the
+ * virtqueue handling alone without any host networking in the way:
+ *
+ *     host$  tests/vhost-user-loopback /tmp/vu.sock
+ *     host$  qemu-system-x86_64 -enable-kvm -mem-path /dev/hugepages \
+ *                -mem-prealloc -netdev vhost-user,id=vu0,path=/tmp/vu.sock \
+ *                -device virtio-net-pci,netdev=vu0 ...
+ *
+ * It is built by "make check-unit", and tests/test-vhost-user.c checks
+ * hw/vhost-user.c against it.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "hw/vhost-user.h"
+
+#define MIN(a, b) ((a) < (b) ? (a) : (b))
+
+/* Queue 0 receives, queue 1 transmits */
+enum {
+    VU_RX,
+    VU_TX,
+    VU_QUEUES,
+};
+
+typedef struct VuRegion {
+    uint64_t guest_phys_addr;
+    uint64_t memory_size;
+    uint64_t userspace_addr;
+    uint8_t *mmap_addr;
+    uint64_t mmap_size;
+    uint8_t *host;
+} VuRegion;
+
+typedef struct VuRing {
+    unsigned int num;
+    struct vhost_vring_addr addr;
+    struct vring_desc *desc;
+    struct vring_avail *avail;
+    struct vring_used *used;
+    uint16_t last_avail;
+    int kick;
+    int call;
+    bool enabled;
+} VuRing;
+
+static VuRegion regions[VHOST_USER_MEMORY_MAX_NREGIONS];
+static int nregions;
+static VuRing rings[VU_QUEUES];
+static uint8_t packet[65536 + 12];
+static unsigned long long packets;
+
+static void *qva_to_va(uint64_t qva)
+{
+    int i;
+
+    for (i = 0; i < nregions; i++) {
+        if (qva - regions[i].userspace_addr < regions[i].memory_size) {
+            return regions[i].host + (qva - regions[i].userspace_addr);
+        }
+    }
+    return NULL;
+}
+
+static void *gpa_to_va(uint64_t gpa, uint32_t len)
+{
+    int i;
+
+    for (i = 0; i < nregions; i++) {
+        VuRegion *r = &regions[i];
+
+        if (gpa - r->guest_phys_addr < r->memory_size &&
+            len <= r->memory_size - (gpa - r->guest_phys_addr)) {
+            return r->host + (gpa - r->guest_phys_addr);
+        }
+    }
+    return NULL;
+}
+
+static void ring_map(VuRing *r)
+{
+    r->desc = qva_to_va(r->addr.desc_user_addr);
+    r->avail = qva_to_va(r->addr.avail_user_addr);
+    r->used = qva_to_va(r->addr.used_user_addr);
+}
+
+static void ring_reset(VuRing *r)
+{
+    if (r->kick >= 0) {
+        close(r->kick);
+    }
+    if (r->call >= 0) {
+        close(r->call);
+    }
+    memset(r, 0, sizeof(*r));
+    r->kick = r->call = -1;
+}
+
+static void unmap_regions(void)
+{
+    int i;
+
+    for (i = 0; i < nregions; i++) {
+        munmap(regions[i].mmap_addr, regions[i].mmap_size);
+    }
+    nregions = 0;
+}
+
+static int set_mem_table(VhostUserMemory *memory, int *fds, int fd_num)
+{
+    int i;
+
+    unmap_regions();
+    if (memory->nregions != fd_num ||
+        memory->nregions > VHOST_USER_MEMORY_MAX_NREGIONS) {
+        fprintf(stderr, "%u regions with %d fds\n", memory->nregions, fd_num);
+        return -1;
+    }
+    for (i = 0; i < fd_num; i++) {
+        VhostUserMemoryRegion *m = &memory->regions[i];
+        VuRegion *r = &regions[i];
+
+        /* Map from the start of the file, so that the offset need not be
+         * aligned to the (huge) pages */
+        r->mmap_size = m->mmap_offset + m->memory_size;
+        r->mmap_addr = mmap(NULL, r->mmap_size, PROT_READ | PROT_WRITE,
+                            MAP_SHARED, fds[i], 0);
+        close(fds[i]);
+        if (r->mmap_addr == MAP_FAILED) {
+            perror("mmap");
+            return -1;
+        }
+        r->guest_phys_addr = m->guest_phys_addr;
+        r->memory_size = m->memory_size;
+        r->userspace_addr = m->userspace_addr;
+        r->host = r->mmap_addr + m->mmap_offset;
+        nregions++;
+    }
+    for (i = 0; i < VU_QUEUES; i++) {
+        ring_map(&rings[i]);
+    }
+    return 0;
+}
+
+/* Copy between @buf and the buffers of the chain at @head that the device
+ * reads (@to_guest false) or writes (@to_guest true).  */
+static size_t ring_copy(VuRing *r, uint16_t head, uint8_t *buf, size_t size,
+                        bool to_guest)
+{
+    unsigned int i = head, count = 0;
+    size_t done = 0, n;
+    struct vring_desc *d;
+    void *p;
+
+    while (i < r->num && count++ < r->num) {
+        d = &r->desc[i];
+        p = gpa_to_va(d->addr, d->len);
+        if (!p) {
+            fprintf(stderr, "bad descriptor address 0x%llx\n",
+                    (unsigned long long)d->addr);
+            break;
+        }
+        if (!!(d->flags & VRING_DESC_F_WRITE) == to_guest) {
+            n = MIN(d->len, size - done);
+            if (to_guest) {
+                memcpy(p, buf + done, n);
+            } else {
+                memcpy(buf + done, p, n);
+            }
+            done += n;
+        }
+        if (!(d->flags & VRING_DESC_F_NEXT)) {
+            break;
+        }
+        i = d->next;
+    }
+    return done;
+}
+
+static void ring_push(VuRing *r, uint16_t head, uint32_t len)
+{
+    struct vring_used_elem *e = &r->used->ring[r->used->idx % r->num];
+
+    e->id = head;
+    e->len = len;
+    __sync_synchronize();
+    r->used->idx++;
+}
+
+static void ring_notify(VuRing *r)
+{
+    uint64_t one = 1;
+
+    __sync_synchronize();
+    if (r->call >= 0 && !(r->avail->flags & VRING_AVAIL_F_NO_INTERRUPT)) {
+        if (write(r->call, &one, sizeof(one)) < 0) {
+            perror("write call");
+        }
+    }
+}
+
+static bool ring_ready(VuRing *r)
+{
+    return r->enabled && r->num && r->desc && r->avail && r->used;
+}
+
+/* Move what the guest sent into its receive buffers.  Packets wait in the
+ * transmit queue while there are no receive buffers; the guest kicks the
+ * receive queue when it adds some.
+ */
+static void loopback(void)
+{
+    VuRing *rx = &rings[VU_RX], *tx = &rings[VU_TX];
+    uint16_t rx_head, tx_head;
+    size_t len;
+    int n = 0;
+
+    if (!ring_ready(rx) || !ring_ready(tx)) {
+        return;
+    }
+    while (tx->last_avail != tx->avail->idx &&
+           rx->last_avail != rx->avail->idx) {
+        __sync_synchronize();
+        tx_head = tx->avail->ring[tx->last_avail++ % tx->num];
+        rx_head = rx->avail->ring[rx->last_avail++ % rx->num];
+        len = ring_copy(tx, tx_head, packet, sizeof(packet), false);
+        len = ring_copy(rx, rx_head, packet, len, true);
+        ring_push(tx, tx_head, 0);
+        ring_push(rx, rx_head, len);
+        n++;
+    }
+    if (n) {
+        packets += n;
+        ring_notify(tx);
+        ring_notify(rx);
+    }
+}
+
+static int read_msg(int sock, VhostUserMsg *msg, int *fds, int *fd_num)
+{
+    char control[CMSG_SPACE(VHOST_USER_MEMORY_MAX_NREGIONS * sizeof(int))];
+    struct iovec iov = { .iov_base = msg, .iov_len = VHOST_USER_HDR_SIZE };
+    struct msghdr msgh = {
+        .msg_iov = &iov,
+        .msg_iovlen = 1,
+        .msg_control = control,
+        .msg_controllen = sizeof(control),
+    };
+    struct cmsghdr *cmsg;
+    ssize_t r;
+
+    *fd_num = 0;
+    r = recvmsg(sock, &msgh, MSG_WAITALL);
+    if (r != VHOST_USER_HDR_SIZE) {
+        return -1;
+    }
+    for (cmsg = CMSG_FIRSTHDR(&msgh); cmsg; cmsg = CMSG_NXTHDR(&msgh, cmsg)) {
+        if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS) {
+            *fd_num = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+            memcpy(fds, CMSG_DATA(cmsg), *fd_num * sizeof(int));
+        }
+    }
+    if (msg->size > sizeof(msg->payload)) {
+        return -1;
+    }
+    if (msg->size &&
+        recv(sock, &msg->payload, msg->size, MSG_WAITALL) != msg->size) {
+        return -1;
+    }
+    return 0;
+}
+
+static int reply(int sock, VhostUserMsg *msg, uint32_t size)
+{
+    msg->flags = VHOST_USER_VERSION | VHOST_USER_REPLY;
+    msg->size = size;
+    if (write(sock, msg, VHOST_USER_HDR_SIZE + size) !=
+        VHOST_USER_HDR_SIZE + size) {
+        return -1;
+    }
+    return 0;
+}
+
+static VuRing *msg_ring(VhostUserMsg *msg, unsigned int index)
+{
+    if (index >= VU_QUEUES) {
+        fprintf(stderr, "request %u for queue %u\n", msg->request, index);
+        return NULL;
+    }
+    return &rings[index];
+}
+
+static int handle_msg(int sock)
+{
+    VhostUserMsg msg;
+    VhostUserMemory memory;
+    int fds[VHOST_USER_MEMORY_MAX_NREGIONS], fd_num, fd, i;
+    VuRing *r;
+
+    if (read_msg(sock, &msg, fds, &fd_num) < 0) {
+        return -1;
+    }
+
+    /* Only the ring requests that carry an eventfd take one */
+    fd = -1;
+    if (msg.request == VHOST_USER_SET_VRING_KICK ||
+        msg.request == VHOST_USER_SET_VRING_CALL) {
+        if (!(msg.payload.u64 & VHOST_USER_VRING_NOFD) && fd_num == 1) {
+            fd = fds[0];
+            fd_num = 0;
+        }
+    }
+    if (msg.request != VHOST_USER_SET_MEM_TABLE) {
+        for (i = 0; i < fd_num; i++) {
+            close(fds[i]);
+        }
+    }
+
+    switch (msg.request) {
+    case VHOST_USER_GET_FEATURES:
+        /* Nothing but the basic split ring */
+        msg.payload.u64 = 0;
+        return reply(sock, &msg, sizeof(msg.payload.u64));
+    case VHOST_USER_SET_FEATURES:
+    case VHOST_USER_SET_OWNER:
+        return 0;
+    case VHOST_USER_RESET_OWNER:
+        for (i = 0; i < VU_QUEUES; i++) {
+            ring_reset(&rings[i]);
+        }
+        return 0;
+    case VHOST_USER_SET_MEM_TABLE:
+        memory = msg.payload.memory;
+        return set_mem_table(&memory, fds, fd_num);
+    case VHOST_USER_SET_VRING_NUM:
+        r = msg_ring(&msg, msg.payload.state.index);
+        if (r) {
+            r->num = msg.payload.state.num;
+        }
+        return r ? 0 : -1;
+    case VHOST_USER_SET_VRING_BASE:
+        r = msg_ring(&msg, msg.payload.state.index);
+        if (r) {
+            r->last_avail = msg.payload.state.num;
+        }
+        return r ? 0 : -1;
+    case VHOST_USER_GET_VRING_BASE:
+        r = msg_ring(&msg, msg.payload.state.index);
+        if (!r) {
+            return -1;
+        }
+        r->enabled = false;
+        msg.payload.state.num = r->last_avail;
+        return reply(sock, &msg, sizeof(msg.payload.state));
+    case VHOST_USER_SET_VRING_ADDR:
+        r = msg_ring(&msg, msg.payload.addr.index);
+        if (!r) {
+            return -1;
+        }
+        r->addr = msg.payload.addr;
+        ring_map(r);
+        return 0;
+    case VHOST_USER_SET_VRING_KICK:
+    case VHOST_USER_SET_VRING_CALL:
+        r = msg_ring(&msg, msg.payload.u64 & VHOST_USER_VRING_IDX_MASK);
+        if (!r) {
+            if (fd >= 0) {
+                close(fd);
+            }
+            return -1;
+        }
+        if (msg.request == VHOST_USER_SET_VRING_KICK) {
+            if (r->kick >= 0) {
+                close(r->kick);
+            }
+            r->kick = fd;
+        } else {
+            if (r->call >= 0) {
+                close(r->call);
+            }
+            r->call = fd;
+        }
+        return 0;
+    case VHOST_USER_NET_SET_BACKEND:
+        r = msg_ring(&msg, msg.payload.u64 & VHOST_USER_VRING_IDX_MASK);
+        if (!r) {
+            return -1;
+        }
+        r->enabled = !(msg.payload.u64 & VHOST_USER_VRING_NOFD);
+        /* The guest may have queued packets before we were started */
+        loopback();
+        return 0;
+    default:
+        fprintf(stderr, "unknown request %u\n", msg.request);
+        return -1;
+    }
+}
+
+static void serve(int sock)
+{
+    struct pollfd pfd[1 + VU_QUEUES];
+    uint64_t count;
+    int i, n;
+
+    for (;;) {
+        pfd[0].fd = sock;
+        pfd[0].events = POLLIN;
+        n = 1;
+        for (i = 0; i < VU_QUEUES; i++) {
+            if (rings[i].enabled && rings[i].kick >= 0) {
+                pfd[n].fd = rings[i].kick;
+                pfd[n].events = POLLIN;
+                n++;
+            }
+        }
+        if (poll(pfd, n, -1) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("poll");
+            return;
+        }
+        for (i = 1; i < n; i++) {
+            if (pfd[i].revents & POLLIN) {
+                if (read(pfd[i].fd, &count, sizeof(count)) < 0) {
+                    perror("read kick");
+                }
+            }
+        }
+        loopback();
+        if (pfd[0].revents & (POLLIN | POLLHUP)) {
+            if (handle_msg(sock) < 0) {
+                return;
+            }
+        }
+    }
+}
+
+int main(int argc, char **argv)
+{
+    struct sockaddr_un un = { .sun_family = AF_UNIX };
+    int listener, sock, i;
+
+    if (argc != 2 || strlen(argv[1]) >= sizeof(un.sun_path)) {
+        fprintf(stderr, "usage: %s socket-path\n", argv[0]);
+        return 1;
+    }
+    strcpy(un.sun_path, argv[1]);
+    unlink(un.sun_path);
+
+    listener = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listener < 0 ||
+        bind(listener, (struct sockaddr *)&un, sizeof(un)) < 0 ||
+        listen(listener, 1) < 0) {
+        perror(argv[1]);
+        return 1;
+    }
+    for (i = 0; i < VU_QUEUES; i++) {
+        rings[i].kick = rings[i].call = -1;
+    }
+
+    for (;;) {
+        sock = accept(listener, NULL, NULL);
+        if (sock < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("accept");
+            return 1;
+        }
+        serve(sock);
+        close(sock);
+        for (i = 0; i < VU_QUEUES; i++) {
+            ring_reset(&rings[i]);
+        }
+        unmap_regions();
+        printf("disconnected after %llu packets\n", packets);
+        packets = 0;
+    }
+}
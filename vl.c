@@ -183,9 +183,7 @@ int display_remote = 0;
 const char* keyboard_layout = NULL;
 ram_addr_t ram_size;
 const char *mem_path = NULL;
-#ifdef MAP_POPULATE
 int mem_prealloc = 0; /* force preallocation of physical target memory */
-#endif
 int nb_nics;
 NICInfo nd_table[MAX_NICS];
 int autostart;
@@ -204,6 +202,9 @@ CharDriverState *virtcon_hds[MAX_VIRTIO_CONSOLES];
 int win2k_install_hack = 0;
 int usb_enabled = 0;
 int singlestep = 0;
+unsigned int tb_hot_threshold = 0;
+int64_t halt_poll_max_ns = 200000;
+const char *tb_cache_path = NULL;
 int smp_cpus = 1;
 int max_cpus = 0;
 int smp_cores = 1;
@@ -247,6 +248,9 @@ QTAILQ_HEAD(, FWBootEntry) fw_boot_order = QTAILQ_HEAD_INITIALIZER(fw_boot_order
 int nb_numa_nodes;
 uint64_t node_mem[MAX_NODES];
 uint64_t node_cpumask[MAX_NODES];
+uint64_t node_host_nodes[MAX_NODES];
+NumaMemPolicy node_mem_policy[MAX_NODES];
+const char *node_mem_path[MAX_NODES];
 
 uint8_t qemu_uuid[16];
 
@@ -953,6 +957,7 @@ char *get_boot_devices_list(uint32_t *size)
 static void numa_add(const char *optarg)
 {
     char option[128];
+    char path[1024];
     char *endptr;
     unsigned long long value, endvalue;
     int nodenr;
@@ -998,6 +1003,41 @@ static void numa_add(const char *optarg)
             }
             node_cpumask[nodenr] = value;
         }
+        if (get_param_value(option, 128, "hostnodes", optarg) != 0) {
+            value = strtoull(option, &endptr, 10);
+            endvalue = value;
+            if (*endptr == '-') {
+                endvalue = strtoull(endptr + 1, &endptr, 10);
+            }
+            if (*endptr || value > endvalue || endvalue >= 64) {
+                fprintf(stderr, "qemu: invalid numa host nodes: %s\n", option);
+                exit(1);
+            }
+            node_host_nodes[nodenr] = (2ULL << endvalue) - (1ULL << value);
+            node_mem_policy[nodenr] = NUMA_MEM_POLICY_BIND;
+        }
+        if (get_param_value(option, 128, "policy", optarg) != 0) {
+            int i;
+
+            for (i = 0; i < NUMA_MEM_POLICY_MAX; i++) {
+                if (!strcmp(option, NumaMemPolicy_lookup[i])) {
+                    break;
+                }
+            }
+            if (i == NUMA_MEM_POLICY_MAX) {
+                fprintf(stderr, "qemu: invalid numa policy: %s\n", option);
+                exit(1);
+            }
+            if (i != NUMA_MEM_POLICY_DEFAULT && !node_host_nodes[nodenr]) {
+                fprintf(stderr, "qemu: numa policy %s needs hostnodes\n",
+                        option);
+                exit(1);
+            }
+            node_mem_policy[nodenr] = i;
+        }
+        if (get_param_value(path, sizeof(path), "mem-path", optarg) != 0) {
+            node_mem_path[nodenr] = g_strdup(path);
+        }
         nb_numa_nodes++;
     }
     return;
@@ -2338,6 +2378,9 @@ int main(int argc, char **argv, char **envp)
     for (i = 0; i < MAX_NODES; i++) {
         node_mem[i] = 0;
         node_cpumask[i] = 0;
+        node_host_nodes[i] = 0;
+        node_mem_policy[i] = NUMA_MEM_POLICY_DEFAULT;
+        node_mem_path[i] = NULL;
     }
 
     nb_numa_nodes = 0;
@@ -2677,11 +2720,9 @@ int main(int argc, char **argv, char **envp)
             case QEMU_OPTION_mempath:
                 mem_path = optarg;
                 break;
-#ifdef MAP_POPULATE
             case QEMU_OPTION_mem_prealloc:
                 mem_prealloc = 1;
                 break;
-#endif
             case QEMU_OPTION_d:
                 log_mask = optarg;
                 break;
@@ -2703,6 +2744,24 @@ int main(int argc, char **argv, char **envp)
             case QEMU_OPTION_singlestep:
                 singlestep = 1;
                 break;
+            case QEMU_OPTION_tb_hot_threshold:
+                tb_hot_threshold = strtoul(optarg, NULL, 0);
+                break;
+            case QEMU_OPTION_tb_cache:
+                tb_cache_path = optarg;
+                break;
+            case QEMU_OPTION_halt_poll_ns:
+                {
+                    char *end;
+
+                    halt_poll_max_ns = strtoll(optarg, &end, 0);
+                    if (*end || halt_poll_max_ns < 0) {
+                        fprintf(stderr, "Invalid -halt-poll-ns value: %s\n",
+                                optarg);
+                        exit(1);
+                    }
+                }
+                break;
             case QEMU_OPTION_S:
                 autostart = 0;
                 break;